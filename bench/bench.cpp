@@ -0,0 +1,422 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <vsyncalter.h>
+#include <debug.h>
+#include <clocks.h>
+#include "version.h"
+#include "mmio.h"
+#include "combo.h"
+#include "dkl.h"
+#include "c10.h"
+#include "c20.h"
+#include "dp_m_n.h"
+#include "interval.h"
+#include "message.h"
+
+#define BENCH_DEFAULT_MIN_MS  200   // Time each case runs for after calibration
+#define BENCH_MAX_ITERATIONS  1000000000L
+
+#define TGL_PLATFORM    0   // platform_table entries used for the PHYs
+#define MTL_PLATFORM    3
+#define TGL_COMBO_DDI   0   // DDI_A
+#define TGL_DKL_DDI     3   // DDI_TC1
+#define MTL_C10_DDI     0   // DDI_A
+#define MTL_C20_DDI     2   // DDI_TC1
+
+typedef struct _bench_case {
+	std::string name;
+	std::function<void(void)> run;
+} bench_case;
+
+typedef struct _bench_result {
+	std::string name;
+	long iterations;
+	double real_ns;
+	double cpu_ns;
+} bench_result;
+
+/**
+* @brief
+* Keeps the compiler from optimizing away a value computed by a benchmark.
+* @param value - The value to keep
+* @return void
+*/
+template <class T>
+static inline void keep(const T &value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+* @brief
+* Runs a case for a number of iterations.
+* @param &bc - The case to run
+* @param iterations - Number of times to call the case
+* @param *real_ns - Receives the elapsed wall clock time
+* @param *cpu_ns - Receives the elapsed CPU time of this thread
+* @return void
+*/
+static void run_iterations(const bench_case &bc, long iterations, double *real_ns, double *cpu_ns)
+{
+	uint64_t real = monotonic_ns();
+	uint64_t cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+	for (long i = 0; i < iterations; i++) {
+		bc.run();
+	}
+	*real_ns = monotonic_ns() - real;
+	*cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu;
+}
+
+/**
+* @brief
+* Runs a case long enough to get a stable time per iteration. The iteration
+* count grows until a run takes a tenth of the target time and is then
+* scaled to fill it.
+* @param &bc - The case to run
+* @param min_ms - Target duration of the measured run in milliseconds
+* @return The result of the measured run
+*/
+static bench_result measure(const bench_case &bc, int min_ms)
+{
+	double target_ns = min_ms * 1e6, real_ns, cpu_ns;
+	long iterations = 1;
+
+	for (;;) {
+		run_iterations(bc, iterations, &real_ns, &cpu_ns);
+		if (real_ns >= target_ns / 10 || iterations >= BENCH_MAX_ITERATIONS) {
+			break;
+		}
+		iterations *= 10;
+	}
+
+	long scaled = (long) (iterations * target_ns / (real_ns > 0 ? real_ns : 1));
+	if (scaled > iterations) {
+		iterations = scaled < BENCH_MAX_ITERATIONS ? scaled : BENCH_MAX_ITERATIONS;
+		run_iterations(bc, iterations, &real_ns, &cpu_ns);
+	}
+
+	return { bc.name, iterations, real_ns / iterations, cpu_ns / iterations };
+}
+
+/**
+* @brief
+* Seeds the simulated registers of every PHY with a DP HBR2 or UHBR10 link
+* configuration so that the PLL math works on realistic values.
+* @param None
+* @return void
+*/
+static void seed_registers(void)
+{
+	ddi_sel *c10_ds = &platform_table[MTL_PLATFORM].ds[MTL_C10_DDI];
+	ddi_sel *c20_ds = &platform_table[MTL_PLATFORM].ds[MTL_C20_DDI];
+	int c10_port = c10_ds->dpll_num - 1;
+	int c20_port = c20_ds->de_clk - 1;
+
+	// Combo: 8.1 GHz DCO = 19.2 MHz * (421 + 0x3800 * 2 / 0x8000)
+	WRITE_OFFSET_DWORD(combo_table[0].cfgcr0.addr, 0x1A5 | 0x3800 << 10);
+	// DKL: 8.1 GHz = 38.4 MHz * 2 * (105 + 0x1E0000 / 2^22)
+	WRITE_OFFSET_DWORD(dkl_table[0].dkl_pll_div0.addr, 2 << 8 | 0x69);
+	WRITE_OFFSET_DWORD(dkl_table[0].dkl_bias.addr, 0x1E0000 << 8);
+	// DP M/N for a 148.5 MHz stream on a 270 MHz link
+	WRITE_OFFSET_DWORD(dp_m_n_table[0].mreg.addr, 0x46666);
+	WRITE_OFFSET_DWORD(dp_m_n_table[0].nreg.addr, 0x80000);
+
+	// C10: 540 MHz = 38.4 MHz * (140 + 0xA000 / 2^16) / 10
+	sim_phy_write(c10_port, 0, PHY_C10_VDR_PLL(2), (140 - 16) * 2);
+	sim_phy_write(c10_port, 0, PHY_C10_VDR_PLL(C10_PLL_REG_QUOT_HIGH), 0xA0);
+	sim_phy_write(c10_port, 0, PHY_C10_VDR_PLL(C10_PLL_REG_DEN_LOW), 1);
+
+	// C20 MPLLB: 1 GHz = 76.8 MHz * (260 / 4 + (13653 + 1 / 3) / 2^17) / 10 * 2
+	sim_sram_write(c20_port, PHY_C20_A_TX_CNTX_CFG(0), C20_PHY_USE_MPLLB);
+	sim_sram_write(c20_port, PHY_C20_A_MPLLB_CNTX_CFG(0), 260);
+	sim_sram_write(c20_port, PHY_C20_A_MPLLB_CNTX_CFG(6), C20_MPLLB_FRACEN);
+	sim_sram_write(c20_port, PHY_C20_A_MPLLB_CNTX_CFG(7), 3);
+	sim_sram_write(c20_port, RAWCMN_DIG_MPLLB_CNTX_CFG_8, 13653);
+	sim_sram_write(c20_port, RAWCMN_DIG_MPLLB_CNTX_CFG_9, 1);
+}
+
+/**
+* @brief
+* Creates the PHYs on the simulated backend and builds the list of cases.
+* @param &phys_list - Receives the PHYs, which the caller deletes
+* @param &cases - Receives the cases
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+static int make_cases(std::vector<std::pair<std::string, phys *>> &phys_list,
+	std::vector<bench_case> &cases)
+{
+	platform &tgl = platform_table[TGL_PLATFORM];
+	platform &mtl = platform_table[MTL_PLATFORM];
+
+	phys_list.push_back({"combo", new combo(&tgl.ds[TGL_COMBO_DDI], 0)});
+	phys_list.push_back({"dkl", new dkl(&tgl.ds[TGL_DKL_DDI], tgl.first_dkl_phy_loc, 0)});
+	phys_list.push_back({"c10", new c10(&mtl.ds[MTL_C10_DDI], 0)});
+	phys_list.push_back({"c20", new c20(&mtl.ds[MTL_C20_DDI], 0)});
+	phys_list.push_back({"dp_m_n", new dp_m_n(&mtl.ds[MTL_C10_DDI], 0)});
+
+	for (auto &p : phys_list) {
+		phys *ph = p.second;
+		if (!ph->is_init()) {
+			ERR("Failed to create the %s PHY\n", p.first.c_str());
+			return 1;
+		}
+		ph->read_registers();
+		double pll_clock = ph->calculate_pll_clock();
+		if (pll_clock <= 0) {
+			ERR("The %s PHY has no PLL clock\n", p.first.c_str());
+			return 1;
+		}
+		INFO("%s PLL clock: %lf\n", p.first.c_str(), pll_clock);
+
+		cases.push_back({"calculate_pll_clock/" + p.first, [ph]() {
+			keep(ph->calculate_pll_clock());
+		}});
+		cases.push_back({"calculate_feedback_dividers/" + p.first, [ph, pll_clock]() {
+			keep(ph->calculate_feedback_dividers(pll_clock * 1.0001));
+		}});
+		// A 0.1% change with a 0.01% shift is planned as 10 steps
+		cases.push_back({"set_pll_clock_steps/" + p.first, [ph, pll_clock]() {
+			keep(ph->set_pll_clock(pll_clock, pll_clock * 1.001, 0.01, 0, false));
+		}});
+	}
+
+	int c10_port = mtl.ds[MTL_C10_DDI].dpll_num - 1;
+	int c20_port = mtl.ds[MTL_C20_DDI].de_clk - 1;
+	phys *c10_phy = phys_list[2].second;
+
+	cases.push_back({"cx0_read", [c10_port]() {
+		keep(intel_cx0_read(c10_port, INTEL_CX0_LANE0, PHY_C10_VDR_PLL(C10_PLL_REG_QUOT_HIGH)));
+	}});
+	cases.push_back({"cx0_write_committed", [c10_port]() {
+		intel_cx0_write(c10_port, INTEL_CX0_LANE0, PHY_C10_VDR_PLL(C10_PLL_REG_QUOT_HIGH), 0xA0,
+			MB_WRITE_COMMITTED);
+	}});
+	cases.push_back({"c20_sram_read", [c20_port]() {
+		keep(intel_c20_sram_read(c20_port, INTEL_CX0_LANE0, RAWCMN_DIG_MPLLB_CNTX_CFG_8));
+	}});
+	cases.push_back({"program_mmio/c10", [c10_phy]() {
+		keep(c10_phy->program_mmio(0));
+	}});
+
+	// A 60 Hz window of vblanks with a little jitter
+	static vsync_sample samples[VSYNC_MAX_TIMESTAMPS];
+	static uint64_t stamps[VSYNC_MAX_TIMESTAMPS];
+	for (int i = 0; i < VSYNC_MAX_TIMESTAMPS; i++) {
+		stamps[i] = 1000000 + i * 16667 + (i * 7919) % 13;
+		samples[i].timestamp_ns = stamps[i] * 1000;
+		samples[i].sequence = i;
+		samples[i].flags = 0;
+	}
+	cases.push_back({"find_avg", []() {
+		keep(find_avg(stamps, VSYNC_MAX_TIMESTAMPS));
+	}});
+	cases.push_back({"check_vsync_samples", []() {
+		keep(check_vsync_samples(samples, VSYNC_MAX_TIMESTAMPS));
+	}});
+
+	// The message is sent as is, so serialization is a copy in each direction
+	cases.push_back({"message_roundtrip", []() {
+		static msg m, r;
+		static char wire[sizeof(msg)];
+		m.add_vsync();
+		m.add_time();
+		memcpy(m.get_va(), stamps, sizeof(stamps));
+		m.set_vblank_count(VSYNC_MAX_TIMESTAMPS);
+		m.set_quality(0);
+		memcpy(wire, &m, sizeof(m));
+		keep(wire);
+		memcpy(&r, wire, sizeof(r));
+		keep(find_avg(r.get_va(), r.get_vblank_count()));
+	}});
+
+	return 0;
+}
+
+/**
+* @brief
+* Writes the results in the JSON format of google-benchmark so that the
+* usual comparison tools can track them across releases.
+* @param *fp - The file to write to
+* @param &results - The results
+* @return void
+*/
+static void write_json(FILE *fp, const std::vector<bench_result> &results)
+{
+	char host[256] = "";
+	char date[64] = "";
+	time_t t = time(NULL);
+
+	gethostname(host, sizeof(host) - 1);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&t));
+
+	fprintf(fp, "{\n  \"context\": {\n");
+	fprintf(fp, "    \"date\": \"%s\",\n", date);
+	fprintf(fp, "    \"host_name\": \"%s\",\n", host);
+	fprintf(fp, "    \"executable\": \"swgenlock_bench\",\n");
+	fprintf(fp, "    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+	fprintf(fp, "    \"library_version\": \"%s\",\n", get_version().c_str());
+	fprintf(fp, "    \"library_build_type\": \"%s\"\n", "release");
+	fprintf(fp, "  },\n  \"benchmarks\": [\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		const bench_result &r = results[i];
+		fprintf(fp, "    {\n");
+		fprintf(fp, "      \"name\": \"%s\",\n", r.name.c_str());
+		fprintf(fp, "      \"run_name\": \"%s\",\n", r.name.c_str());
+		fprintf(fp, "      \"run_type\": \"iteration\",\n");
+		fprintf(fp, "      \"repetitions\": 1,\n");
+		fprintf(fp, "      \"threads\": 1,\n");
+		fprintf(fp, "      \"iterations\": %ld,\n", r.iterations);
+		fprintf(fp, "      \"real_time\": %.3f,\n", r.real_ns);
+		fprintf(fp, "      \"cpu_time\": %.3f,\n", r.cpu_ns);
+		fprintf(fp, "      \"time_unit\": \"ns\"\n");
+		fprintf(fp, "    }%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+}
+
+/**
+ * @brief
+ * Print help message
+ *
+ * @param program_name - Name of the program
+ * @return void
+ */
+void print_help(const char *program_name)
+{
+	printf("Usage: %s [-f filter] [-t ms] [-o file] [-l] [-v loglevel] [-h]\n"
+		"Options:\n"
+		"  -f filter      Only run the cases whose name contains filter\n"
+		"  -t ms          Time to run each case for (default: %d)\n"
+		"  -o file        Write the JSON results to file (default: stdout)\n"
+		"  -l             List the cases and exit\n"
+		"  -v loglevel    Log level: error, warning, info, debug or trace (default: error)\n"
+		"  -h             Display this help message\n",
+		program_name, BENCH_DEFAULT_MIN_MS);
+}
+
+/**
+* @brief
+* This is the main function
+* @param argc - The number of command line arguments
+* @param *argv[] - Each command line argument in an array
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int main(int argc, char *argv[])
+{
+	std::vector<std::pair<std::string, phys *>> phys_list;
+	std::vector<bench_case> cases;
+	std::vector<bench_result> results;
+	std::string filter, out_file, log_level = "error";
+	int min_ms = BENCH_DEFAULT_MIN_MS;
+	bool list = false;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "f:t:o:lv:h")) != -1) {
+		switch (opt) {
+			case 'f':
+				filter = optarg;
+				break;
+			case 't':
+				min_ms = atoi(optarg);
+				if (min_ms <= 0) {
+					ERR("Invalid time: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'o':
+				out_file = optarg;
+				break;
+			case 'l':
+				list = true;
+				break;
+			case 'v':
+				log_level = optarg;
+				break;
+			case 'h':
+			case '?':
+				print_help(argv[0]);
+				exit(EXIT_SUCCESS);
+		}
+	}
+
+	set_log_level_str(log_level.c_str());
+	if (sim_mmio_init()) {
+		return 1;
+	}
+	seed_registers();
+
+	if (make_cases(phys_list, cases)) {
+		ret = 1;
+		goto end;
+	}
+
+	for (auto &bc : cases) {
+		if (!filter.empty() && bc.name.find(filter) == std::string::npos) {
+			continue;
+		}
+		if (list) {
+			printf("%s\n", bc.name.c_str());
+			continue;
+		}
+		bench_result r = measure(bc, min_ms);
+		fprintf(stderr, "%-40s %12.1f ns %12.1f ns %12ld\n", r.name.c_str(),
+			r.real_ns, r.cpu_ns, r.iterations);
+		results.push_back(r);
+	}
+
+	if (!list) {
+		FILE *fp = out_file.empty() ? stdout : fopen(out_file.c_str(), "w");
+		if (!fp) {
+			ERR("Failed to open %s\n", out_file.c_str());
+			ret = 1;
+			goto end;
+		}
+		write_json(fp, results);
+		if (fp != stdout) {
+			fclose(fp);
+		}
+	}
+
+end:
+	for (auto &p : phys_list) {
+		delete p.second;
+	}
+	sim_mmio_uninit();
+	log_flush();
+	return ret;
+}
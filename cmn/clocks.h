@@ -0,0 +1,80 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef _CLOCKS_H
+#define _CLOCKS_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Converts a time of clock_gettime to nanoseconds.
+ *
+ * @param ts - The time
+ * @return The time in nanoseconds
+ */
+static inline uint64_t timespec_ns(const struct timespec *ts)
+{
+	return (uint64_t) ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+/**
+ * @brief Returns the current time of a clock. It is safe to call from a
+ * signal handler.
+ *
+ * @param clock - The clock to read
+ * @return The time in nanoseconds
+ */
+static inline uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return timespec_ns(&ts);
+}
+
+/**
+ * @brief Returns the current time of the monotonic clock, the one the kernel
+ * stamps vblanks with before they are converted to the timescale.
+ *
+ * @return The time in nanoseconds
+ */
+static inline uint64_t monotonic_ns(void)
+{
+	return clock_ns(CLOCK_MONOTONIC);
+}
+
+/**
+ * @brief Returns the current time of the raw monotonic clock, which NTP and
+ * PTP do not slew, for measuring durations.
+ *
+ * @return The time in nanoseconds
+ */
+static inline uint64_t monotonic_raw_ns(void)
+{
+	return clock_ns(CLOCK_MONOTONIC_RAW);
+}
+
+#endif
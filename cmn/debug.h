@@ -62,46 +62,61 @@ void log_message(log_level level, const char* format, ...);
 The existing trace object initialization code used __FUNCTION__,
 which provides only the function name without the class name.
 
-This macro extracts both the function and class names for use in TRACE logging.
+This function extracts both the function and class names for use in TRACE logging.
 Including the class name is necessary to distinguish functions with the same name
 in different classes.
 
 Example:
     combo::program_phy
     dkl::program_phy
+
+It is evaluated at compile time, so a traced function only carries a view into
+its own __PRETTY_FUNCTION__. The view is not null terminated and has to be
+printed with "%.*s".
 */
-#define FUNCTION_NAME ([]() -> const char* { \
-	static char buffer[128]; /* Buffer to store extracted function name */ \
-	const char *func = __PRETTY_FUNCTION__; \
-	const char *start = strstr(func, "::"); /* Locate "::" which separates class and function */ \
-	if (!start) return func; /* If "::" not found, return full function signature */ \
-	while (start > func && *(start - 1) != ' ') --start; /* Move back to the first character of class name */ \
-	const char *end = strchr(start, '('); /* Locate '(' at the end of function name */ \
-	if (!end) return func; /* Edge case: If '(' not found, return original */ \
-	int len = (int)(end - start); \
-	if (len < 0 || len >= (int)sizeof(buffer)) return func; /* Prevent buffer overflow */ \
-	strncpy(buffer, start, len); \
-	buffer[len] = '\0'; /* Null-terminate */ \
-	return buffer; \
-}())
+#ifdef __cplusplus
+#include <string_view>
 
+constexpr std::string_view trace_function_name(std::string_view func)
+{
+	size_t end = func.find('('); /* '(' ends the function name */
+	if (end == std::string_view::npos) {
+		return func;
+	}
+	size_t start = func.rfind(' ', end); /* The return type ends before the name */
+	start = (start == std::string_view::npos) ? 0 : start + 1;
+	return func.substr(start, end - start);
+}
+
+#define FUNCTION_NAME trace_function_name(__PRETTY_FUNCTION__)
 
-#ifdef __cplusplus
 class tracer {
 private:
-	const char *m_func_name;
+	std::string_view m_func_name;
+	bool m_on;
 public:
-	tracer(const char *func_name) : m_func_name(func_name) {
-		TRACE(">>> %s\n", m_func_name);
+	tracer(std::string_view func_name) : m_func_name(func_name),
+		m_on(dbg_lvl >= LOG_LEVEL_TRACE) {
+		if (m_on) {
+			TRACE(">>> %.*s\n", (int) m_func_name.size(), m_func_name.data());
+		}
 	}
 	~tracer() {
-		TRACE("<<< %s\n", m_func_name);
+		if (m_on) {
+			TRACE("<<< %.*s\n", (int) m_func_name.size(), m_func_name.data());
+		}
 	}
 };
 #endif
 
-#ifdef __cplusplus
-#define TRACING()  tracer trace(FUNCTION_NAME ? FUNCTION_NAME : "UnknownFunction");
+/*
+Building with -DNO_TRACING (make NO_TRACING=1) removes the tracers altogether.
+Otherwise a traced function only pays for a level check while trace is off.
+*/
+#if defined(__cplusplus) && !defined(NO_TRACING)
+#define TRACING() \
+	static constexpr std::string_view trace_func_name = FUNCTION_NAME; \
+	tracer trace(trace_func_name);
 #else
 #define TRACING()
 #endif
@@ -32,6 +32,13 @@
 #define VSYNC_ONE_VSYNC_PERIOD_IN_MS        16.666
 #define VSYNC_MAX_TIMESTAMPS                100
 #define VSYNC_ALL_PIPES                     4
+#define VSYNC_STREAM_BATCH                  32   // Most vsyncs handed to a stream handler at once
+
+// Flags of a vsync sample. A batch of samples is described by the OR of the
+// flags of its samples, 0 meaning that it can be trusted.
+#define VSYNC_FLAG_MISSED                   0x1  // Frames were missed before this vsync
+#define VSYNC_FLAG_TIMEOUT                  0x2  // Capture timed out before this vsync
+#define VSYNC_FLAG_OUTLIER                  0x4  // Interval to the previous vsync is out of line
 #define VSYNC_DEFAULT_DEVICE                "/dev/dri/card0"
 #define VSYNC_DEFAULT_PIPE                  0
 #define VSYNC_DEFAULT_SHIFT                 0.01
@@ -45,16 +52,89 @@
 extern "C" {
 #endif
 
+// Histograms kept by the metrics of the library
+typedef enum {
+	VSYNC_METRIC_DELTA_US,          // Drift delta between primary and secondary
+	VSYNC_METRIC_CORRECTION_US,     // Time spent applying a correction
+	VSYNC_METRIC_PLL_OFFSET_PPB,    // PLL frequency offset from its initial value
+	VSYNC_METRIC_CAPTURE_US,        // Time to capture a window of vsyncs
+	VSYNC_METRIC_RTT_US,            // Round trip of a vsync request to the primary
+	VSYNC_METRIC_MMIO_NS,           // MMIO register access
+	VSYNC_METRIC_MSGBUS_NS,         // PHY message bus transaction
+	VSYNC_METRIC_HISTOGRAMS,
+} vsync_histogram;
+
+// Counters and gauges kept by the metrics of the library
+typedef enum {
+	VSYNC_COUNTER_SYNC,             // Corrections applied
+	VSYNC_COUNTER_OUT_OF_SYNC,      // Windows found beyond the allowed drift
+	VSYNC_COUNTER_SUCCESS_ITER,     // Windows in sync since the last correction (gauge)
+	VSYNC_COUNTER_SKIPPED,          // Windows skipped for their quality flags
+	VSYNC_COUNTER_REQUESTS,         // vsync requests served by the primary
+	VSYNC_COUNTERS,
+} vsync_counter;
+
+typedef struct _vsync_sample {
+	uint64_t timestamp_ns;  // Time of the vblank on the timescale in nanoseconds
+	uint64_t sequence;      // Frame sequence number of the vblank on its pipe
+	uint32_t flags;         // VSYNC_FLAG_*
+} vsync_sample;
+
+// Clock the vsync timestamps are given in. The timestamps of two systems
+// are comparable when their clocks of this kind are synchronized.
+typedef enum {
+	VSYNC_TIMESCALE_REALTIME,       // CLOCK_REALTIME, kept by phc2sys or chrony
+	VSYNC_TIMESCALE_TAI,            // CLOCK_TAI, realtime without leap seconds
+	VSYNC_TIMESCALE_PHC,            // A PTP hardware clock, e.g. /dev/ptp0
+} vsync_timescale;
+
+// Phases of the last synchronize_vsync call on a pipe in CLOCK_MONOTONIC_RAW
+// nanoseconds. Phases that did not run are 0.
+typedef struct _vsync_sync_timing {
+	uint64_t ramp_up_ns;    // Stepping the PLL to the shifted frequency
+	uint64_t hold_ns;       // Running at the shifted frequency
+	uint64_t ramp_down_ns;  // Stepping the PLL back to the original frequency
+	uint64_t reset_ns;      // Restoring the original register values
+} vsync_sync_timing;
+
+// Identity of the display driven by a pipe: the graphics device and the
+// timing of the mode it is scanning out
+typedef struct _vsync_pipe_mode {
+	char pci_slot[16];      // PCI domain:bus:device.function of the device
+	uint16_t device_id;     // PCI device id
+	uint32_t clock_khz;     // Pixel clock of the mode
+	uint16_t hdisplay, vdisplay;
+	uint16_t htotal, vtotal;
+} vsync_pipe_mode;
+
+// Called by stream_vsync with the vsyncs of a pipe as they arrive, usually
+// one per call and never more than VSYNC_STREAM_BATCH. Returning non-zero
+// stops the stream on that pipe.
+typedef int (*vsync_stream_handler)(int pipe, const vsync_sample *samples, int count,
+						void *user_data);
+
 int vsync_lib_init(const char *device_str, bool dp_m_n);
 int vsync_lib_uninit();
 int synchronize_vsync(double time_diff, int pipe, double shift, double shift2,
 						int step_threshold, int wait_between_steps, bool reset,
 						bool commit);
 int get_vsync(const char *device_str, uint64_t *vsync_array, int size, int pipe);
+int get_vsync_multi(const char *device_str, uint64_t **vsync_arrays, int size,
+						const int *pipes, int num_pipes);
+int get_vsync_samples(const char *device_str, vsync_sample **sample_arrays, int size,
+						const int *pipes, int num_pipes);
+int stream_vsync(const char *device_str, const int *pipes, int num_pipes, int count,
+						vsync_stream_handler handler, void *user_data);
+uint32_t check_vsync_samples(vsync_sample *samples, int count);
+int set_vsync_timescale(vsync_timescale scale, const char *phc_device);
+int set_vsync_timescale_str(const char *spec);
+uint64_t get_vsync_time_ns(void);
 double get_vblank_interval(const char *device_str, int pipe, int size);
 int set_pll_clock(double pll_clock, int pipe, double shift,
 						uint32_t wait_between_steps);
 double get_pll_clock(int pipe);
+int get_sync_timing(int pipe, vsync_sync_timing *timing);
+int get_pipe_mode(const char *device_str, int pipe, vsync_pipe_mode *mode);
 bool get_phy_name(int pipe, char* out_name, size_t out_size);
 int print_drm_info(const char *device_str);
 void shutdown_lib(void);
@@ -62,6 +142,13 @@ const char* find_first_dri_card(void);
 int set_log_mode(const char* mode);
 int set_log_level(log_level level);
 int set_log_level_str(const char* log_level);
+void log_flush(void);
+int metrics_start(const char *path);
+void metrics_stop(void);
+int metrics_write(const char *path);
+void metrics_record(vsync_histogram h, int64_t value);
+void metrics_add(vsync_counter c, int64_t value);
+void metrics_set(vsync_counter c, int64_t value);
 
 #ifdef __cplusplus
 }
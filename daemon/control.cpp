@@ -0,0 +1,334 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <debug.h>
+#include "control.h"
+
+/**
+* @brief
+* Creates the socket of the control API and starts serving it.
+* @param *socket_path - Path of the UNIX socket
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int control_server::start(const char *socket_path)
+{
+	struct sockaddr_un addr;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		ERR("Control socket path too long: %s\n", socket_path);
+		return 1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		ERR("Failed to create the control socket: %s\n", strerror(errno));
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+	// A socket left behind by a daemon that didn't exit cleanly
+	unlink(socket_path);
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) || listen(fd, 4)) {
+		ERR("Failed to listen on %s: %s\n", socket_path, strerror(errno));
+		close(fd);
+		fd = -1;
+		return 1;
+	}
+	// Owner and group only, the API changes the display timing
+	chmod(socket_path, 0660);
+	path = socket_path;
+
+	if (pipe(pipe_fd) || pthread_create(&tid, NULL, run, this)) {
+		ERR("Failed to start the control API\n");
+		stop();
+		return 1;
+	}
+	running = true;
+	INFO("Control API on %s\n", socket_path);
+	return 0;
+}
+
+/**
+* @brief
+* Stops serving the control API and removes its socket.
+* @param None
+* @return void
+*/
+void control_server::stop()
+{
+	if (running) {
+		if (write(pipe_fd[1], "q", 1) != 1) {
+			ERR("Failed to stop the control API\n");
+		}
+		pthread_join(tid, NULL);
+		running = false;
+	}
+	for (int i = 0; i < 2; i++) {
+		if (pipe_fd[i] >= 0) {
+			close(pipe_fd[i]);
+			pipe_fd[i] = -1;
+		}
+	}
+	if (fd >= 0) {
+		close(fd);
+		fd = -1;
+		unlink(path.c_str());
+	}
+}
+
+/**
+* @brief
+* Thread entry of the control API.
+* @param *arg - The control_server
+* @return NULL
+*/
+void *control_server::run(void *arg)
+{
+	((control_server *) arg)->loop();
+	return NULL;
+}
+
+/**
+* @brief
+* Accepts clients until stop() is called.
+* @param None
+* @return void
+*/
+void control_server::loop()
+{
+	struct pollfd fds[2] = {
+		{ fd, POLLIN, 0 },
+		{ pipe_fd[0], POLLIN, 0 },
+	};
+
+	while (1) {
+		if (::poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ERR("Control API failed: %s\n", strerror(errno));
+			return;
+		}
+		if (fds[1].revents) {
+			return;
+		}
+		if (fds[0].revents & POLLIN) {
+			int client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+			if (client >= 0) {
+				serve(client);
+				close(client);
+			}
+		}
+	}
+}
+
+/**
+* @brief
+* Answers the requests of a client until it disconnects or goes idle.
+* @param client - Socket of the client
+* @return void
+*/
+void control_server::serve(int client)
+{
+	char buffer[CONTROL_MAX_LINE];
+	size_t used = 0;
+	struct timeval tv = { CONTROL_TIMEOUT_SEC, 0 };
+
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	while (1) {
+		ssize_t n = recv(client, buffer + used, sizeof(buffer) - 1 - used, 0);
+		if (n <= 0) {
+			return;
+		}
+		used += n;
+		buffer[used] = 0;
+
+		char *line = buffer, *nl;
+		while ((nl = strchr(line, '\n'))) {
+			*nl = 0;
+			std::string reply = handle(line) + "\n";
+			if (send(client, reply.c_str(), reply.size(), MSG_NOSIGNAL) < 0) {
+				return;
+			}
+			line = nl + 1;
+		}
+
+		used = strlen(line);
+		if (used == sizeof(buffer) - 1) {
+			const char *reply = "{\"ok\":false,\"error\":\"request too long\"}\n";
+			send(client, reply, strlen(reply), MSG_NOSIGNAL);
+			return;
+		}
+		memmove(buffer, line, used);
+	}
+}
+
+/**
+* @brief
+* Finds the pipes a request applies to.
+* @param *arg - A pipe number, or NULL for all pipes
+* @param &out - Receives the pipes
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int control_server::select_pipes(const char *arg, std::vector<pipe_sync *> &out)
+{
+	char *end;
+
+	out.clear();
+	if (!arg) {
+		out = pipes;
+		return 0;
+	}
+	long pipe = strtol(arg, &end, 10);
+	if (end == arg || *end) {
+		return 1;
+	}
+	for (size_t i = 0; i < pipes.size(); i++) {
+		if (pipes[i]->get_pipe() == pipe) {
+			out.push_back(pipes[i]);
+		}
+	}
+	return out.empty();
+}
+
+/**
+* @brief
+* Describes the state of a pipe.
+* @param *p - The pipe
+* @return The state as a JSON object
+*/
+std::string control_server::status_json(pipe_sync *p)
+{
+	sync_status s;
+	char json[512];
+
+	p->get_status(&s);
+	snprintf(json, sizeof(json),
+		"{\"pipe\":%d,\"state\":\"%s\",\"delta_us\":%ld,\"pll_clock\":%.6f,"
+		"\"drift_rate\":%.3f,\"polls\":%u,\"corrections\":%u,\"skipped\":%u,"
+		"\"errors\":%u,\"since_correction\":%.3f}",
+		s.pipe, pipe_sync::state_name(s.state), s.delta_us, s.pll_clock,
+		s.drift_rate, s.polls, s.corrections, s.skipped, s.errors, s.since_correction);
+	return json;
+}
+
+/**
+* @brief
+* Describes the parameters of a pipe.
+* @param *p - The pipe
+* @return The parameters as a JSON object
+*/
+std::string control_server::params_json(pipe_sync *p)
+{
+	sync_params s;
+	char json[512];
+
+	p->get_params(&s);
+	snprintf(json, sizeof(json),
+		"{\"pipe\":%d,\"threshold\":%d,\"shift\":%g,\"shift2\":%g,"
+		"\"step_threshold\":%d,\"step_wait\":%d,\"overshoot\":%g,"
+		"\"min_period\":%d,\"max_period\":%d}",
+		p->get_pipe(), s.threshold_us, s.shift, s.shift2, s.step_threshold_us,
+		s.step_wait_ms, s.overshoot, s.min_period_ms, s.max_period_ms);
+	return json;
+}
+
+/**
+* @brief
+* Runs a request of the control API:
+* - status [pipe]: state, delta and PLL frequency
+* - params [pipe]: parameters of the sync loop
+* - pause [pipe], resume [pipe]: stop and restart polling the primary
+* - resync [pipe]: poll now and correct whatever delta is found
+* - set name value [pipe]: change a parameter without a restart
+* @param *line - The request
+* @return The reply as a JSON object
+*/
+std::string control_server::handle(char *line)
+{
+	char *save, *args[4] = { NULL };
+	int count = 0;
+	std::vector<pipe_sync *> sel;
+	std::string reply;
+
+	for (char *tok = strtok_r(line, " \t\r", &save); tok && count < 4;
+		tok = strtok_r(NULL, " \t\r", &save)) {
+		args[count++] = tok;
+	}
+	if (!count) {
+		return "{\"ok\":false,\"error\":\"empty request\"}";
+	}
+	DBG("Control request: %s\n", args[0]);
+
+	const char *cmd = args[0];
+	bool is_set = !strcmp(cmd, "set");
+	if ((is_set && count < 3) || select_pipes(args[is_set ? 3 : 1], sel)) {
+		return "{\"ok\":false,\"error\":\"invalid arguments\"}";
+	}
+
+	if (!strcmp(cmd, "status") || !strcmp(cmd, "params")) {
+		reply = std::string("{\"ok\":true,\"pipes\":[");
+		for (size_t i = 0; i < sel.size(); i++) {
+			reply += (i ? "," : "") + (cmd[0] == 's' ? status_json(sel[i]) : params_json(sel[i]));
+		}
+		return reply + "]}";
+	}
+
+	for (size_t i = 0; i < sel.size(); i++) {
+		if (!strcmp(cmd, "pause")) {
+			sel[i]->pause();
+		} else if (!strcmp(cmd, "resume")) {
+			sel[i]->resume();
+		} else if (!strcmp(cmd, "resync")) {
+			sel[i]->resync();
+		} else if (is_set) {
+			if (sel[i]->set_param(args[1], args[2])) {
+				return "{\"ok\":false,\"error\":\"invalid parameter\"}";
+			}
+		} else {
+			return "{\"ok\":false,\"error\":\"unknown command\"}";
+		}
+	}
+	return "{\"ok\":true}";
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#ifndef _CONTROL_H
+#define _CONTROL_H
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "pipe_sync.h"
+
+#define CONTROL_DEFAULT_SOCKET  "/run/genlockd.sock"
+#define CONTROL_MAX_LINE        256
+#define CONTROL_TIMEOUT_SEC     5    // A client idle for longer is dropped
+
+/*
+ * Serves the control API of the daemon on a UNIX stream socket. Each
+ * request is a line of text, a command and its arguments, and each reply is
+ * a line holding a JSON object with "ok" and either the result or "error".
+ * Clients are served one at a time.
+ */
+class control_server {
+private:
+	int fd;
+	int pipe_fd[2];         // Wakes the thread up to stop
+	std::string path;
+	std::vector<pipe_sync *> &pipes;
+	pthread_t tid;
+	bool running;
+	static void *run(void *arg);
+	void loop();
+	void serve(int client);
+	std::string handle(char *line);
+	int select_pipes(const char *arg, std::vector<pipe_sync *> &out);
+	std::string status_json(pipe_sync *p);
+	std::string params_json(pipe_sync *p);
+public:
+	control_server(std::vector<pipe_sync *> &pipes) : fd(-1), pipes(pipes), running(false) {
+		pipe_fd[0] = pipe_fd[1] = -1;
+	}
+	int start(const char *socket_path);
+	void stop();
+};
+
+#endif
@@ -0,0 +1,467 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string>
+#include <vector>
+#include <vsyncalter.h>
+#include <debug.h>
+#include "pipe_sync.h"
+#include "control.h"
+#include "config.h"
+#include "calibration.h"
+#include "version.h"
+
+#define PIPE_CONFIG_ITEMS  8    // Settings of a pipe in the configuration file
+
+// Checked by the connection code to give up on a peer
+int client_done = 0;
+volatile sig_atomic_t g_stop = 0;
+volatile sig_atomic_t g_reload = 0;
+config_file g_config;
+
+// Codes of the options that only have a long name
+enum {
+	OPT_MIN_PERIOD = 256,
+	OPT_MAX_PERIOD,
+	OPT_CLOCK_SOURCE,
+	OPT_CLOCK_MAX_OFFSET,
+	OPT_CLOCK_MARGIN,
+	OPT_TIMESCALE,
+	OPT_PROFILE,
+};
+
+/**
+* @brief
+* This function asks the daemon to exit.
+* @param sig - The signal that was received
+* @return void
+*/
+void stop_signal(int sig)
+{
+	// Inform vsync lib so that a correction in progress ends early
+	shutdown_lib();
+	client_done = 1;
+	g_stop = 1;
+}
+
+/**
+* @brief
+* This function asks the daemon to read the configuration file again.
+* @param sig - The signal that was received
+* @return void
+*/
+void reload_signal(int sig)
+{
+	g_reload = 1;
+}
+
+/**
+* @brief
+* This function lists the settings of a pipe that can be configured.
+* @param *p - The parameters the settings are read into
+* @param *items - Receives PIPE_CONFIG_ITEMS settings
+* @return void
+*/
+static void pipe_items(sync_params *p, config_item *items)
+{
+	const config_item list[PIPE_CONFIG_ITEMS] = {
+		{"delta", CONFIG_INT, &p->threshold_us, 0, 1000000, false},
+		{"shift", CONFIG_DOUBLE, &p->shift, 0, 1, false},
+		{"shift2", CONFIG_DOUBLE, &p->shift2, 0, 1, false},
+		{"step_threshold", CONFIG_INT, &p->step_threshold_us, 0, 1000000, false},
+		{"step_wait", CONFIG_INT, &p->step_wait_ms, 0, 10000, false},
+		{"overshoot", CONFIG_DOUBLE, &p->overshoot, 0, 1, false},
+		{"min_period", CONFIG_INT, &p->min_period_ms, 1, 3600000, false},
+		{"max_period", CONFIG_INT, &p->max_period_ms, 1, 3600000, false},
+	};
+
+	for (int i = 0; i < PIPE_CONFIG_ITEMS; i++) {
+		items[i] = list[i];
+	}
+}
+
+/**
+* @brief
+* This function sets the parameters of a pipe from the configuration file
+* or the profile, the [pipe N] and [display key] sections overriding [global].
+* @param &cfg - The configuration file or the profile
+* @param pipe - The pipe
+* @param *p - The parameters to update
+* @param *base - The parameters the settings missing from cfg take, NULL to
+* leave them as they are
+* @param reload - Whether the daemon is running already
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int configure_pipe(config_file &cfg, int pipe, sync_params *p, const sync_params *base,
+	bool reload)
+{
+	config_item items[PIPE_CONFIG_ITEMS];
+	config_values values;
+
+	if (base) {
+		sync_params b = *base;
+		pipe_items(&b, items);
+		values.save(items, PIPE_CONFIG_ITEMS);
+	}
+	pipe_items(p, items);
+	return cfg.apply(items, PIPE_CONFIG_ITEMS, pipe, reload, base ? &values : NULL);
+}
+
+/**
+* @brief
+* This function reads the configuration file again and hands each pipe its
+* new parameters, those of the file on top of the ones the pipe started
+* with before the file. A pipe keeps its parameters if the file is invalid.
+* @param &pipes - The sync loops
+* @param &bases - The parameters of each pipe from the options and the profile
+* @return void
+*/
+void reload_config(std::vector<pipe_sync *> &pipes, const std::vector<sync_params> &bases)
+{
+	std::string path = g_config.get_path();
+
+	INFO("Reading %s again\n", path.c_str());
+	if (g_config.load(path.c_str())) {
+		ERR("Keeping the current configuration\n");
+		return;
+	}
+	for (size_t i = 0; i < pipes.size(); i++) {
+		sync_params p;
+		pipes[i]->get_params(&p);
+		if (configure_pipe(g_config, pipes[i]->get_pipe(), &p, &bases[i], true) ||
+			pipes[i]->set_params(&p)) {
+			ERR("Pipe %d keeps its configuration\n", pipes[i]->get_pipe());
+		}
+	}
+}
+
+/**
+* @brief
+* This function parses a comma separated list of pipes.
+* @param *str - The list, e.g. 0,2
+* @param &pipes - Receives the pipes
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int parse_pipes(const char *str, std::vector<int> &pipes)
+{
+	char *end;
+
+	pipes.clear();
+	while (*str) {
+		long pipe = strtol(str, &end, 10);
+		if (end == str || pipe < 0 || pipe >= VSYNC_ALL_PIPES || (*end && *end != ',')) {
+			return 1;
+		}
+		pipes.push_back((int) pipe);
+		str = *end ? end + 1 : end;
+	}
+	return pipes.empty();
+}
+
+/**
+ * @brief
+ * Print help message
+ *
+ * @param program_name - Name of the program
+ * @return void
+ */
+void print_help(const char *program_name)
+{
+	printf("Usage: %s -i interface [-c mac_address] [-p pipes] [-S socket] ... [-h]\n"
+		"Options:\n"
+		"  -i interface       Network interface (PTP) or IP address of the primary (default: 127.0.0.1)\n"
+		"  -c mac_address     MAC address of the primary. Applicable to ethernet interface mode only.\n"
+		"  -p pipes           Comma separated pipes to keep in sync (default: 0)\n"
+		"  -d delta           Drift in microseconds to allow before pll reprogramming (default: 100 us)\n"
+		"  -s shift           PLL frequency change fraction (default: 0.01)\n"
+		"  -x shift2          PLL frequency change fraction for large drift (default: 0.0; Disabled)\n"
+		"  -t step_threshold  Delta threshold in microseconds to trigger stepping mode (default: 1000 us)\n"
+		"  -w step_wait       Wait in milliseconds between steps (default: 50 ms)\n"
+		"  -o overshoot_ratio Allow the clock to go beyond zero alignment by a ratio of the delta (default: 0.0)\n"
+		"  -e device          Device string (default: first card in /dev/dri)\n"
+		"  -n                 Use DP M & N Path. (default: no)\n"
+		"  -S socket          Path of the control socket (default: %s)\n"
+		"  -C file            Read the settings from an INI file, overriding the options. It is\n"
+		"                     applied again when it changes or on SIGHUP\n"
+		"  -b                 Run in the background\n"
+		"  -v loglevel        Log level: error, warning, info, debug or trace (default: info)\n"
+		"  --min-period ms    Shortest wait between two polls (default: %d ms)\n"
+		"  --max-period ms    Longest wait between two polls (default: %d ms)\n"
+		"  --clock-source src Clock daemon whose lock gates the corrections: pmc[:socket] for\n"
+		"                     ptp4l and the system clock phc2sys keeps on its PHC (only the PHC\n"
+		"                     with --timescale phc:), chrony, file:path for a local stand-in or\n"
+		"                     none (default: none)\n"
+		"  --clock-max-offset us Clock offset beyond which corrections are suspended (default: %d us)\n"
+		"  --clock-margin us  Offset between the clocks of the two systems tolerated when checking\n"
+		"                     the primary's vsyncs are from the exchange (default: twice\n"
+		"                     --clock-max-offset with a clock source, else %d us)\n"
+		"  --timescale clock  Clock of the vsync timestamps, the same as on the primary: realtime,\n"
+		"                     tai or phc:device, e.g. phc:/dev/ptp0 (default: realtime)\n"
+		"  --profile file     Sync parameters per display written by synctest --calibrate,\n"
+		"                     overridden by -C (default: none)\n"
+		"  -h                 Display this help message\n",
+		program_name, CONTROL_DEFAULT_SOCKET, SCHED_DEFAULT_MIN_MS, SCHED_DEFAULT_MAX_MS,
+		CLOCK_DEFAULT_MAX_OFFSET_US, CLOCK_DEFAULT_MARGIN_US);
+}
+
+/**
+* @brief
+* This is the main function
+* @param argc - The number of command line arguments
+* @param *argv[] - Each command line argument in an array
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int main(int argc, char *argv[])
+{
+	int ret = 0;
+	std::string server = "127.0.0.1";
+	std::string mac_address = "";
+	std::string device_str = find_first_dri_card();
+	std::string socket_path = CONTROL_DEFAULT_SOCKET;
+	std::string config_path = "";
+	std::string clock_spec = "none";
+	std::string timescale = "realtime";
+	std::string profile_path = "";
+	config_file profile;
+	double clock_max_offset = CLOCK_DEFAULT_MAX_OFFSET_US;
+	double clock_margin = 0;
+	clock_gate clock;
+	std::vector<int> pipe_ids(1, 0);
+	std::vector<pipe_sync *> pipes;
+	std::vector<sync_params> bases;    // Parameters of each pipe under the file
+	bool m_n = false, background = false;
+	sync_params params = {
+		100,                        // threshold_us
+		0.01,                       // shift
+		0.0,                        // shift2
+		VSYNC_TIME_DELTA_FOR_STEP,  // step_threshold_us
+		VSYNC_DEFAULT_WAIT_IN_MS,   // step_wait_ms
+		0.0,                        // overshoot
+		SCHED_DEFAULT_MIN_MS,       // min_period_ms
+		SCHED_DEFAULT_MAX_MS,       // max_period_ms
+	};
+	static struct option long_options[] = {
+		{"min-period", required_argument, NULL, OPT_MIN_PERIOD},
+		{"max-period", required_argument, NULL, OPT_MAX_PERIOD},
+		{"clock-source", required_argument, NULL, OPT_CLOCK_SOURCE},
+		{"clock-max-offset", required_argument, NULL, OPT_CLOCK_MAX_OFFSET},
+		{"clock-margin", required_argument, NULL, OPT_CLOCK_MARGIN},
+		{"timescale", required_argument, NULL, OPT_TIMESCALE},
+		{"profile", required_argument, NULL, OPT_PROFILE},
+		{0, 0, 0, 0}
+	};
+	int opt, option_index = 0;
+
+	INFO("Genlockd Version: %s\n", get_version().c_str());
+
+	while ((opt = getopt_long(argc, argv, "i:c:p:d:s:x:t:w:o:e:nS:C:bv:h", long_options, &option_index)) != -1) {
+		switch (opt) {
+			case 'i':
+				server = optarg;
+				break;
+			case 'c':
+				mac_address = optarg;
+				break;
+			case 'p':
+				if (parse_pipes(optarg, pipe_ids)) {
+					ERR("Invalid pipes: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'd':
+				params.threshold_us = std::stoi(optarg);
+				break;
+			case 's':
+				params.shift = std::stod(optarg);
+				break;
+			case 'x':
+				params.shift2 = std::stod(optarg);
+				break;
+			case 't':
+				params.step_threshold_us = std::stoi(optarg);
+				break;
+			case 'w':
+				params.step_wait_ms = std::stoi(optarg);
+				break;
+			case 'o':
+				params.overshoot = std::stod(optarg);
+				break;
+			case 'e':
+				device_str = optarg;
+				break;
+			case 'n':
+				m_n = true;
+				break;
+			case 'S':
+				socket_path = optarg;
+				break;
+			case 'C':
+				config_path = optarg;
+				break;
+			case 'b':
+				background = true;
+				break;
+			case 'v':
+				set_log_level_str(optarg);
+				break;
+			case OPT_MIN_PERIOD:
+				params.min_period_ms = std::stoi(optarg);
+				break;
+			case OPT_MAX_PERIOD:
+				params.max_period_ms = std::stoi(optarg);
+				break;
+			case OPT_CLOCK_SOURCE:
+				clock_spec = optarg;
+				break;
+			case OPT_CLOCK_MAX_OFFSET:
+				clock_max_offset = std::stod(optarg);
+				break;
+			case OPT_CLOCK_MARGIN:
+				clock_margin = std::stod(optarg);
+				break;
+			case OPT_TIMESCALE:
+				timescale = optarg;
+				break;
+			case OPT_PROFILE:
+				profile_path = optarg;
+				break;
+			case 'h':
+				print_help(argv[0]);
+				exit(EXIT_SUCCESS);
+			case '?':
+				print_help(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	set_log_mode("[ GENLOCKD ]");
+
+	if (!config_path.empty() && g_config.load(config_path.c_str())) {
+		return 1;
+	}
+	if (!profile_path.empty() && profile.load(profile_path.c_str())) {
+		return 1;
+	}
+
+	if (clock.init(clock_spec.c_str(), clock_max_offset, clock_margin,
+		timescale.compare(0, 4, "phc:") != 0)) {
+		return 1;
+	}
+	pipe_sync::set_clock_gate(&clock);
+
+	if (set_vsync_timescale_str(timescale.c_str())) {
+		return 1;
+	}
+
+	if (background && daemon(1, 1)) {
+		ERR("Failed to run in the background\n");
+		return 1;
+	}
+
+	if (vsync_lib_init(device_str.c_str(), m_n)) {
+		ERR("Failed to initialize vsync library with device: %s\n", device_str.c_str());
+		return 1;
+	}
+
+	signal(SIGINT, stop_signal);
+	signal(SIGTERM, stop_signal);
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGHUP, reload_signal);
+
+	for (size_t i = 0; i < pipe_ids.size(); i++) {
+		char name[32];
+		if (!get_phy_name(pipe_ids[i], name, sizeof(name))) {
+			ERR("No PHY found for pipe %d\n", pipe_ids[i]);
+			ret = 1;
+			goto cleanup;
+		}
+		sync_params p = params;
+		// The profile of the display, then the configuration file
+		vsync_pipe_mode mode;
+		if (!get_pipe_mode(device_str.c_str(), pipe_ids[i], &mode)) {
+			std::string key = calibration_store::make_key(&mode, pipe_ids[i], name);
+			profile.set_display(pipe_ids[i], key);
+			g_config.set_display(pipe_ids[i], key);
+		}
+		if (!profile_path.empty() && configure_pipe(profile, pipe_ids[i], &p, NULL, false)) {
+			ret = 1;
+			goto cleanup;
+		}
+		bases.push_back(p);
+		if (!config_path.empty() && configure_pipe(g_config, pipe_ids[i], &p, NULL, false)) {
+			ret = 1;
+			goto cleanup;
+		}
+		INFO("Keeping pipe %d (%s) in sync with %s\n", pipe_ids[i], name, server.c_str());
+		pipes.push_back(new pipe_sync(device_str.c_str(), pipe_ids[i], server.c_str(),
+			mac_address.empty() ? NULL : mac_address.c_str(), &p));
+	}
+
+	{
+		control_server control(pipes);
+		if (control.start(socket_path.c_str())) {
+			ret = 1;
+			goto cleanup;
+		}
+
+		for (size_t i = 0; i < pipes.size() && !ret; i++) {
+			ret = pipes[i]->start();
+		}
+		if (!config_path.empty()) {
+			g_config.watch();
+		}
+
+		// The signal may be taken by any thread, so check for it
+		while (!g_stop && !ret) {
+			usleep(200 * 1000);
+			if (g_reload || g_config.changed()) {
+				g_reload = 0;
+				reload_config(pipes, bases);
+			}
+		}
+		control.stop();
+	}
+
+cleanup:
+	for (size_t i = 0; i < pipes.size(); i++) {
+		pipes[i]->stop();
+		delete pipes[i];
+	}
+	vsync_lib_uninit();
+	return ret;
+}
@@ -0,0 +1,540 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <chrono>
+#include <vector>
+#include <debug.h>
+#include <vsyncalter.h>
+#include <clocks.h>
+#include "connection.h"
+#include "message.h"
+#include "interval.h"
+#include "pipe_sync.h"
+
+// One exchange with the primary at a time, it serves its clients in turn
+std::mutex pipe_sync::net_lock;
+// The library programs the PHYs of all pipes through the same registers
+std::mutex pipe_sync::lib_lock;
+// Health of the system clock shared by all pipes, NULL if not checked
+clock_gate *pipe_sync::clock = NULL;
+
+/**
+* @brief
+* Constructor of the sync loop of a pipe. The loop starts with start().
+* @param *device - The DRM device of the pipe
+* @param pipe - The pipe to keep in sync
+* @param *server - IP address of the primary, or the local interface for PTP
+* @param *mac - MAC address of the primary for PTP, NULL for TCP
+* @param *p - The initial parameters
+*/
+pipe_sync::pipe_sync(const char *device, int pipe, const char *server, const char *mac,
+	const sync_params *p) :
+	device(device), pipe(pipe), server(server), mac(mac ? mac : ""), params(*p),
+	timestamps(MSG_MAX_TIMESTAMPS), out_of_sync(0), paused(false), force(false),
+	stopping(false), running(false), last_correction_ns(0)
+{
+	memset(&status, 0, sizeof(status));
+	status.pipe = pipe;
+	status.state = SYNC_STARTING;
+	status.since_correction = -1;
+}
+
+/**
+* @brief
+* Starts the thread of the sync loop.
+* @param None
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int pipe_sync::start()
+{
+	if (scheduler.configure(params.min_period_ms, params.max_period_ms, params.threshold_us)) {
+		return 1;
+	}
+	if (pthread_create(&tid, NULL, run, this)) {
+		ERR("Failed to start the sync loop of pipe %d\n", pipe);
+		return 1;
+	}
+	running = true;
+	return 0;
+}
+
+/**
+* @brief
+* Stops the sync loop and waits for its thread. A correction in progress
+* is finished first so the PLL is left at its original frequency.
+* @param None
+* @return void
+*/
+void pipe_sync::stop()
+{
+	if (!running) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	pthread_join(tid, NULL);
+	running = false;
+}
+
+/**
+* @brief
+* Stops polling the primary until resume() is called.
+* @param None
+* @return void
+*/
+void pipe_sync::pause()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	paused = true;
+	status.state = SYNC_PAUSED;
+}
+
+/**
+* @brief
+* Resumes polling the primary right away.
+* @param None
+* @return void
+*/
+void pipe_sync::resume()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (!paused) {
+			return;
+		}
+		paused = false;
+		status.state = SYNC_STARTING;
+		scheduler.corrected();
+	}
+	wake.notify_all();
+}
+
+/**
+* @brief
+* Polls the primary right away and corrects whatever delta is found, even
+* within the threshold.
+* @param None
+* @return void
+*/
+void pipe_sync::resync()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		force = true;
+	}
+	wake.notify_all();
+}
+
+/**
+* @brief
+* Changes a parameter of the loop. It applies from the next poll.
+* @param *name - Name of the parameter, as listed by get_params
+* @param *value - The new value
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int pipe_sync::set_param(const char *name, const char *value)
+{
+	char *end;
+	double v = strtod(value, &end);
+
+	if (end == value || *end) {
+		ERR("Invalid value for %s: %s\n", name, value);
+		return 1;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	sync_params p = params;
+	if (!strcmp(name, "threshold")) {
+		p.threshold_us = (int) v;
+	} else if (!strcmp(name, "shift")) {
+		p.shift = v;
+	} else if (!strcmp(name, "shift2")) {
+		p.shift2 = v;
+	} else if (!strcmp(name, "step_threshold")) {
+		p.step_threshold_us = (int) v;
+	} else if (!strcmp(name, "step_wait")) {
+		p.step_wait_ms = (int) v;
+	} else if (!strcmp(name, "overshoot")) {
+		p.overshoot = v;
+	} else if (!strcmp(name, "min_period")) {
+		p.min_period_ms = (int) v;
+	} else if (!strcmp(name, "max_period")) {
+		p.max_period_ms = (int) v;
+	} else {
+		ERR("Unknown parameter: %s\n", name);
+		return 1;
+	}
+
+	if (apply_params(p)) {
+		return 1;
+	}
+	INFO("Pipe %d: %s set to %s\n", pipe, name, value);
+	return 0;
+}
+
+/**
+* @brief
+* Replaces all the parameters of the loop at once. They apply from the next
+* poll, a correction in progress completes with the ones it started with.
+* @param *p - The new parameters
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int pipe_sync::set_params(const sync_params *p)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return apply_params(*p);
+}
+
+/**
+* @brief
+* Checks and takes new parameters. The lock must be held.
+* @param &p - The new parameters
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int pipe_sync::apply_params(const sync_params &p)
+{
+	if (p.threshold_us < 0 || p.shift <= 0 || p.shift2 < 0 || p.step_threshold_us < 0 ||
+		p.step_wait_ms < 0 || p.overshoot < 0 || p.overshoot > 1) {
+		ERR("Pipe %d: invalid parameters\n", pipe);
+		return 1;
+	}
+	if (scheduler.configure(p.min_period_ms, p.max_period_ms, p.threshold_us)) {
+		return 1;
+	}
+	params = p;
+	return 0;
+}
+
+/**
+* @brief
+* Returns the current parameters of the loop.
+* @param *p - Receives the parameters
+* @return void
+*/
+void pipe_sync::get_params(sync_params *p)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	*p = params;
+}
+
+/**
+* @brief
+* Returns the state of the loop. A poll or correction running when the loop
+* was paused still sets its state when it ends, so paused takes precedence.
+* @param *s - Receives the state
+* @return void
+*/
+void pipe_sync::get_status(sync_status *s)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	*s = status;
+	if (paused) {
+		s->state = SYNC_PAUSED;
+	}
+	s->drift_rate = scheduler.drift_rate();
+	if (last_correction_ns) {
+		s->since_correction = (monotonic_ns() - last_correction_ns) / 1e9;
+	}
+}
+
+/**
+* @brief
+* Returns the name of a state for the control API.
+* @param state - The state
+* @return The name
+*/
+const char *pipe_sync::state_name(sync_state state)
+{
+	switch (state) {
+		case SYNC_STARTING:   return "starting";
+		case SYNC_LOCKED:     return "locked";
+		case SYNC_DRIFTING:   return "drifting";
+		case SYNC_CORRECTING: return "correcting";
+		case SYNC_PAUSED:     return "paused";
+		case SYNC_HOLDOVER:   return "holdover";
+		case SYNC_ERROR:      return "error";
+	}
+	return "unknown";
+}
+
+/**
+* @brief
+* Thread entry of the sync loop.
+* @param *arg - The pipe_sync
+* @return NULL
+*/
+void *pipe_sync::run(void *arg)
+{
+	((pipe_sync *) arg)->loop();
+	return NULL;
+}
+
+/**
+* @brief
+* Polls the primary until the loop is stopped, waiting as long as the
+* scheduler allows in between. Control requests cut the wait short.
+* @param None
+* @return void
+*/
+void pipe_sync::loop()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	while (!stopping) {
+		if (paused) {
+			wake.wait(guard);
+			continue;
+		}
+
+		guard.unlock();
+		int wait_ms = poll() ? SYNC_ERROR_WAIT_MS : scheduler.next_ms();
+		guard.lock();
+
+		if (!force && !stopping && !paused) {
+			wake.wait_for(guard, std::chrono::milliseconds(wait_ms));
+		}
+	}
+}
+
+/**
+* @brief
+* Asks the primary for its last vsyncs. They must fall within the exchange,
+* otherwise the clocks of the two systems are not synchronized.
+* @param *primary - Receives the vsyncs of the primary in us
+* @param *hops - Receives the relays between the primary and the root
+* @param *offset - Receives the offset of a relay from the root in us
+* @param *quality - Receives the flags of the primary's vsyncs
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int pipe_sync::fetch(uint64_t *primary, int *hops, int *offset, uint32_t *quality)
+{
+	std::lock_guard<std::mutex> guard(net_lock);
+	msg m, r;
+	int ret = 1;
+	uint64_t request_us = 0, reply_us = 0;
+
+	connection *client = mac.empty() ? new connection(server.c_str())
+						: new ptp_connection(server.c_str(), mac.c_str());
+
+	if (!client->init_client(server.c_str())) {
+		memset(&m, 0, sizeof(m));
+		r.ack();
+		r.set_vblank_count(timestamps);
+		r.set_request(MSG_REQ_LAST, 0);
+		request_us = get_vsync_time_ns() / 1000;
+		ret = client->send_msg(&r, sizeof(r)) || client->recv_msg(&m, sizeof(m));
+		reply_us = get_vsync_time_ns() / 1000;
+	}
+	client->close_client();
+	delete client;
+
+	if (!ret) {
+		if (m.get_type() != VSYNC_MSG) {
+			ERR("Pipe %d: no vsyncs from the primary\n", pipe);
+			return 1;
+		}
+		if (check_exchange_window(m.get_va(), timestamps, request_us, reply_us,
+			clock ? clock->margin() : CLOCK_DEFAULT_MARGIN_US)) {
+			ERR("Pipe %d: primary and secondary clocks are not synchronized\n", pipe);
+			return 1;
+		}
+		memcpy(primary, m.get_va(), timestamps * sizeof(uint64_t));
+		*hops = m.get_hops();
+		*offset = m.get_offset();
+		*quality = m.get_quality();
+	}
+	return ret;
+}
+
+/**
+* @brief
+* Runs one poll: compares the vsyncs of the pipe with the primary's and
+* corrects the PLL when needed.
+* @param None
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int pipe_sync::poll()
+{
+	uint64_t primary[MSG_MAX_TIMESTAMPS];
+	std::vector<uint64_t> local(timestamps);
+	std::vector<vsync_sample> samples(timestamps);
+	vsync_sample *sample_array = samples.data();
+	uint32_t quality, local_quality;
+	int hops, offset;
+	bool forced;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		forced = force;
+		force = false;
+	}
+
+	if (fetch(primary, &hops, &offset, &quality) ||
+		get_vsync_samples(device.c_str(), &sample_array, timestamps, &pipe, 1)) {
+		std::lock_guard<std::mutex> guard(lock);
+		status.state = SYNC_ERROR;
+		status.errors++;
+		force = force || forced;
+		return 1;
+	}
+
+	local_quality = check_vsync_samples(sample_array, timestamps);
+	for (int i = 0; i < timestamps; i++) {
+		local[i] = samples[i].timestamp_ns / 1000;
+	}
+
+	// Outside the lock, the clock daemon may take a moment to answer
+	double clock_error = 0;
+	bool holdover = clock && clock->check(&clock_error);
+
+	std::unique_lock<std::mutex> guard(lock);
+	sync_params p = params;
+	status.polls++;
+
+	long delta = local[0] - primary[timestamps - 1];
+	if (quality || local_quality) {
+		WARNING("Pipe %d: skipping, vsyncs not reliable (primary 0x%x, secondary 0x%x)\n",
+			pipe, quality, local_quality);
+		status.skipped++;
+		scheduler.retry();
+		force = force || forced;
+		return 0;
+	}
+
+	// A delta measured while the clock is not locked is the clock error
+	if (holdover) {
+		status.state = SYNC_HOLDOVER;
+		status.skipped++;
+		scheduler.retry();
+		force = force || forced;
+		return 0;
+	}
+
+	phase_estimate phase;
+	if (!estimate_phase(primary, timestamps, local.data(), timestamps, &phase)) {
+		if (p.threshold_us && phase.error_us + clock_error > p.threshold_us / 2.0) {
+			WARNING("Pipe %d: skipping, phase uncertain (%.1f us +/- %.1f us, clock %.1f us)\n",
+				pipe, phase.offset_us, phase.error_us, clock_error);
+			status.skipped++;
+			scheduler.retry();
+			force = force || forced;
+			return 0;
+		}
+		delta = lround(phase.offset_us);
+	} else {
+		delta = nearest_delta(delta, find_avg(local.data(), timestamps));
+	}
+	if (hops) {
+		delta += offset;
+	}
+	timestamps = SYNC_POLL_VBLANKS;
+	status.delta_us = delta;
+	scheduler.observe(delta);
+	DBG("Pipe %d: delta %ld us\n", pipe, delta);
+
+	if (!forced && (!p.threshold_us || labs(delta) <= p.threshold_us)) {
+		out_of_sync = 0;
+		status.state = SYNC_LOCKED;
+		guard.unlock();
+		double pll_clock = read_pll();
+		guard.lock();
+		status.pll_clock = pll_clock;
+		return 0;
+	}
+
+	// Like the secondary of vsync_test, a drift seen once may be a glitch,
+	// so it is only corrected when the next poll confirms it
+	status.state = SYNC_DRIFTING;
+	if (!forced && ++out_of_sync < 2 && status.corrections) {
+		scheduler.retry();
+		return 0;
+	}
+	out_of_sync = 0;
+	status.state = SYNC_CORRECTING;
+	guard.unlock();
+
+	correct(delta, p);
+	double pll_clock = read_pll();
+
+	guard.lock();
+	status.pll_clock = pll_clock;
+	status.corrections++;
+	status.state = SYNC_LOCKED;
+	last_correction_ns = monotonic_ns();
+	scheduler.corrected();
+	return 0;
+}
+
+/**
+* @brief
+* Walks the vsyncs of the pipe back to the primary's. This returns once the
+* PLL is back to its original frequency.
+* @param delta - Delta from the primary in us
+* @param &p - The parameters to correct with
+* @return void
+*/
+void pipe_sync::correct(long delta, const sync_params &p)
+{
+	double delta_ms = -delta / 1000.0 * (1.0 + p.overshoot);
+
+	INFO("Pipe %d: correcting %ld us\n", pipe, delta);
+	std::lock_guard<std::mutex> lib(lib_lock);
+	if (synchronize_vsync(delta_ms, pipe, p.shift, p.shift2, p.step_threshold_us,
+		p.step_wait_ms, true, true)) {
+		ERR("Pipe %d: correction failed\n", pipe);
+	}
+}
+
+/**
+* @brief
+* Reads the current PLL frequency of the pipe.
+* @param None
+* @return The frequency
+*/
+double pipe_sync::read_pll()
+{
+	std::lock_guard<std::mutex> lib(lib_lock);
+	return get_pll_clock(pipe);
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#ifndef _PIPE_SYNC_H
+#define _PIPE_SYNC_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include "scheduler.h"
+#include "clock_health.h"
+
+#define SYNC_POLL_VBLANKS      2    // Vblanks compared in each poll after the first
+#define SYNC_ERROR_WAIT_MS     1000 // Wait before polling again after an error
+
+// Parameters of the sync loop of a pipe, all can be changed while it runs
+typedef struct _sync_params {
+	int threshold_us;       // Drift that triggers a correction
+	double shift;           // PLL frequency change fraction
+	double shift2;          // PLL frequency change fraction for large drift, 0 = disabled
+	int step_threshold_us;  // Drift from which shift2 is used
+	int step_wait_ms;       // Wait between steps
+	double overshoot;       // Ratio of the drift to go beyond zero alignment
+	int min_period_ms;      // Shortest wait between two polls
+	int max_period_ms;      // Longest wait between two polls
+} sync_params;
+
+typedef enum {
+	SYNC_STARTING,          // No delta measured yet
+	SYNC_LOCKED,            // Within the threshold
+	SYNC_DRIFTING,          // Beyond the threshold, correction pending
+	SYNC_CORRECTING,        // Correction in progress
+	SYNC_PAUSED,            // Paused through the control API
+	SYNC_HOLDOVER,          // Corrections suspended until the clock is locked
+	SYNC_ERROR,             // Last poll failed
+} sync_state;
+
+typedef struct _sync_status {
+	int pipe;
+	sync_state state;
+	long delta_us;          // Last delta from the primary
+	double pll_clock;       // Current PLL frequency
+	double drift_rate;      // Estimated drift in us per second
+	uint32_t polls;         // Polls done
+	uint32_t corrections;   // Corrections applied
+	uint32_t skipped;       // Polls skipped for unreliable vsyncs
+	uint32_t errors;        // Polls that failed
+	double since_correction; // Seconds since the last correction, -1 = none
+} sync_status;
+
+/*
+ * Keeps the vsyncs of one pipe in sync with the primary from a thread of
+ * its own. The loop polls the primary for its vsyncs, compares them with the
+ * pipe's and corrects the PLL when the drift goes beyond the threshold, like
+ * the secondary mode of vsync_test. It can be paused, resynchronized and
+ * reconfigured while it runs.
+ */
+class pipe_sync {
+private:
+	std::string device;
+	int pipe;
+	std::string server;     // IP address, or interface for PTP
+	std::string mac;        // MAC address of the primary for PTP, empty for TCP
+	sync_params params;
+	sync_status status;
+	loop_scheduler scheduler;
+	int timestamps;
+	int out_of_sync;
+	bool paused, force, stopping, running;
+	uint64_t last_correction_ns;
+	pthread_t tid;
+	std::mutex lock;
+	std::condition_variable wake;
+	static std::mutex net_lock;
+	static std::mutex lib_lock;
+	static clock_gate *clock;
+	static void *run(void *arg);
+	void loop();
+	int poll();
+	int fetch(uint64_t *primary, int *hops, int *offset, uint32_t *quality);
+	void correct(long delta, const sync_params &p);
+	double read_pll();
+	int apply_params(const sync_params &p);
+public:
+	pipe_sync(const char *device, int pipe, const char *server, const char *mac,
+		const sync_params *p);
+	int start();
+	void stop();
+	void pause();
+	void resume();
+	void resync();
+	int set_param(const char *name, const char *value);
+	int set_params(const sync_params *p);
+	void get_params(sync_params *p);
+	void get_status(sync_status *s);
+	int get_pipe() { return pipe; }
+	static const char *state_name(sync_state state);
+	static void set_clock_gate(clock_gate *gate) { clock = gate; }
+};
+
+#endif
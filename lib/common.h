@@ -26,6 +26,8 @@
 #define _COMMON_H
 
 #include <list>
+#include <signal.h>
+#include <vsyncalter.h>
 #include "utils.h"
 
 using namespace std;
@@ -94,11 +96,26 @@ class user_info {
 	void *get_reg() { return phy_reg; }
 };
 
+enum {
+	VBLANK_BACKEND_LEGACY,          // drmWaitVBlank, microsecond timestamps
+	VBLANK_BACKEND_CRTC_SEQUENCE,   // drmCrtcQueueSequence, nanosecond timestamps
+	VBLANK_BACKEND_SIM,             // Simulated display, see vblank_sim.h
+};
+
 typedef struct _vbl_info {
-	uint64_t *vsync_array;
-	int size;
-	int counter;
+	vsync_sample *samples;          // Buffer receiving the vblanks
+	int size;                       // Capacity of samples
+	int counter;                    // Entries of samples in use
+	int total;                      // vblanks needed, 0 = until stopped
+	int captured;                   // vblanks captured so far
+	bool done;
+	uint64_t last_sequence;         // Sequence of the previous vblank captured
+	uint32_t pending_flags;         // Flags for the next vblank captured
 	int pipe;
+	uint32_t crtc_id;
+	int backend;
+	vsync_stream_handler handler;   // Receives samples each time it fills up
+	void *user_data;
 } vbl_info;
 
 typedef void (*reset_func)(int sig, siginfo_t *si, void *uc);
@@ -131,5 +148,7 @@ extern int lib_client_done;
 void timer_handler(int sig, siginfo_t *si, void *uc);
 unsigned int pipe_to_wait_for(int pipe);
 int cleanup_phy_list();
+int open_device(const char *device_str);
+void close_device(int fd);
 
 #endif
@@ -374,6 +374,7 @@ int __intel_cx0_read_once(u32 port, int lane, u16 addr)
 u8 __intel_cx0_read(u32 port, int lane, u16 addr)
 {
 	int i, status;
+	metrics_timer t(VSYNC_METRIC_MSGBUS_NS);
 
 	/* 3 tries is assumed to be enough to read successfully */
 	for (i = 0; i < 3; i++) {
@@ -457,6 +458,7 @@ int __intel_cx0_write_once(u32 port, int lane, u16 addr, u8 data, bool committed
 void __intel_cx0_write(u32 port, int lane, u16 addr, u8 data, bool committed)
 {
 	int i, status;
+	metrics_timer t(VSYNC_METRIC_MSGBUS_NS);
 
 	 /* 3 tries is assumed to be enough to write successfully */
 	for (i = 0; i < 3; i++) {
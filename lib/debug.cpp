@@ -24,18 +24,80 @@
 
 #include <cstdarg>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <vsyncalter.h>
 #include "debug.h"
 
+#define LOG_QUEUE_SLOTS        1024   // Messages queued at most, must be a power of 2
+#define LOG_ARG_BYTES          240    // Space for the arguments of a message
+#define LOG_LINE_LENGTH        1024   // Longest line written
+#define LOG_FLUSH_TIMEOUT_MS   1000   // Longest time log_flush waits for the writer
 
 log_level dbg_lvl = LOG_LEVEL_INFO;
 std::string mode_str = "";
 bool time_init = false;
 struct timespec base_time;
 
+/*
+ * Messages are not formatted by the caller. log_message only stores the
+ * format pointer, a timestamp and the raw arguments (strings are copied) in
+ * a slot of a bounded lock-free queue and a background thread formats and
+ * writes them. Each slot has a sequence number telling whether it is free
+ * for the producer of a given position or filled for the consumer, so
+ * producers only need a CAS on the enqueue position and never block. When
+ * the queue is full the message is counted as dropped instead.
+ */
+typedef struct _log_record {
+	std::atomic<size_t> seq;
+	uint64_t ts_ns;
+	const char *fmt;
+	log_level level;
+	uint16_t len;
+	bool truncated;
+	unsigned char args[LOG_ARG_BYTES];
+} log_record;
+
+static log_record log_queue[LOG_QUEUE_SLOTS];
+static std::atomic<size_t> enqueue_pos(0);
+static size_t dequeue_pos = 0;
+static std::atomic<size_t> written_pos(0);
+static std::atomic<unsigned long> dropped(0);
+static std::atomic<int> writer_state(0);    // 0 = not started, 1 = starting, 2 = running
+static std::atomic_flag consumer_busy = ATOMIC_FLAG_INIT;
+static sem_t log_sem;
+
+// Argument types as they are stored in a record
+enum {
+	ARG_INT,
+	ARG_UINT,
+	ARG_DOUBLE,
+	ARG_LONG_DOUBLE,
+	ARG_POINTER,
+	ARG_STRING,
+	ARG_NONE,
+};
+
+typedef struct _fmt_spec {
+	const char *start;      // The '%'
+	const char *end;        // One past the conversion character
+	char length[3];         // Length modifier, e.g. "ll"
+	char conv;              // Conversion character
+	bool star_width;
+	bool star_prec;
+	int prec;               // Literal precision, -1 if none
+	int type;               // ARG_*
+} fmt_spec;
+
 /**
 * @brief
 * This function sets the logging level for the application.
@@ -109,44 +171,247 @@ int set_log_mode(const char* mode)
 
 /**
 * @brief
-* This function logs a message at the specified logging level.
-* It supports formatted output similar to printf-style formatting.
-*
-* @param level - The logging level of the message, specified as a LogLevel enum value.
-* @param format - A format string that specifies how to format the message.
-* @param ... - Additional arguments to be formatted according to the format string.
-* @return void
+* This function finds the next conversion of a printf format string.
+* @param *p - Where to start looking
+* @param *spec - Receives the conversion found
+* @return true if a conversion was found, false at the end of the string
 */
-void log_message(log_level level, const char* format, ...)
+static bool next_spec(const char *p, fmt_spec *spec)
 {
-	struct timespec now, diff;
+	while ((p = strchr(p, '%')) != NULL) {
+		if (p[1] == '%') {
+			p += 2;
+			continue;
+		}
+		memset(spec, 0, sizeof(*spec));
+		spec->prec = -1;
+		spec->start = p++;
+		while (*p && strchr("-+ #0'", *p)) {
+			p++;
+		}
+		if (*p == '*') {
+			spec->star_width = true;
+			p++;
+		}
+		while (*p >= '0' && *p <= '9') {
+			p++;
+		}
+		if (*p == '.') {
+			p++;
+			if (*p == '*') {
+				spec->star_prec = true;
+				p++;
+			} else {
+				spec->prec = 0;
+			}
+			while (*p >= '0' && *p <= '9') {
+				spec->prec = spec->prec * 10 + (*p - '0');
+				p++;
+			}
+		}
+		for (int i = 0; i < 2 && *p && strchr("hlqLjzt", *p); i++) {
+			spec->length[i] = *p++;
+		}
+		spec->conv = *p;
+		if (!*p) {
+			return false;
+		}
+		spec->end = p + 1;
 
-	if (level > dbg_lvl) {
-		return;
+		switch (spec->conv) {
+			case 'd': case 'i': case 'c':
+				spec->type = ARG_INT;
+				break;
+			case 'o': case 'u': case 'x': case 'X':
+				spec->type = ARG_UINT;
+				break;
+			case 'f': case 'F': case 'e': case 'E':
+			case 'g': case 'G': case 'a': case 'A':
+				spec->type = spec->length[0] == 'L' ? ARG_LONG_DOUBLE : ARG_DOUBLE;
+				break;
+			case 's':
+				spec->type = spec->length[0] ? ARG_POINTER : ARG_STRING;
+				break;
+			case 'p': case 'n':
+				spec->type = ARG_POINTER;
+				break;
+			default:
+				spec->type = ARG_NONE;
+				break;
+		}
+		return true;
 	}
+	return false;
+}
 
-	// If this is the first time then initialize the base time
-	if (time_init == false) {
-		clock_gettime(CLOCK_MONOTONIC, &base_time);
-		time_init = true;
+/**
+* @brief
+* Appends a value to the arguments of a record.
+* @param *rec - The record
+* @param *value - The value
+* @param size - Size of the value in bytes
+* @return true if it fit, false if the record is full
+*/
+static bool put_arg(log_record *rec, const void *value, size_t size)
+{
+	if (rec->len + size > LOG_ARG_BYTES) {
+		rec->truncated = true;
+		return false;
 	}
+	memcpy(rec->args + rec->len, value, size);
+	rec->len += size;
+	return true;
+}
 
-	clock_gettime(CLOCK_MONOTONIC, &now);
+/**
+* @brief
+* This function copies the arguments of a message into a record. Integers
+* are read with the type given by their length modifier and widened to 64
+* bits, strings are copied since they may be gone by the time the message
+* is formatted.
+* @param *rec - The record
+* @param *format - The format string of the message
+* @param args - The arguments of the message
+* @return void
+*/
+static void store_args(log_record *rec, const char *format, va_list args)
+{
+	fmt_spec spec;
+	const char *p = format;
+
+	while (!rec->truncated && next_spec(p, &spec)) {
+		int pr = spec.prec;
+		p = spec.end;
+		if (spec.star_width) {
+			int w = va_arg(args, int);
+			if (!put_arg(rec, &w, sizeof(w))) {
+				break;
+			}
+		}
+		if (spec.star_prec) {
+			pr = va_arg(args, int);
+			if (!put_arg(rec, &pr, sizeof(pr))) {
+				break;
+			}
+		}
+
+		const char *len = spec.length;
+		switch (spec.type) {
+			case ARG_INT:
+			case ARG_UINT: {
+				int64_t v;
+				if (!strcmp(len, "l")) {
+					v = va_arg(args, long);
+				} else if (!strcmp(len, "ll") || !strcmp(len, "q") || !strcmp(len, "L")) {
+					v = va_arg(args, long long);
+				} else if (!strcmp(len, "j")) {
+					v = va_arg(args, intmax_t);
+				} else if (!strcmp(len, "z")) {
+					v = va_arg(args, ssize_t);
+				} else if (!strcmp(len, "t")) {
+					v = va_arg(args, ptrdiff_t);
+				} else {
+					v = spec.type == ARG_INT ? va_arg(args, int) : va_arg(args, unsigned int);
+				}
+				put_arg(rec, &v, sizeof(v));
+				break;
+			}
+			case ARG_DOUBLE: {
+				double v = va_arg(args, double);
+				put_arg(rec, &v, sizeof(v));
+				break;
+			}
+			case ARG_LONG_DOUBLE: {
+				long double v = va_arg(args, long double);
+				put_arg(rec, &v, sizeof(v));
+				break;
+			}
+			case ARG_POINTER: {
+				void *v = va_arg(args, void *);
+				put_arg(rec, &v, sizeof(v));
+				break;
+			}
+			case ARG_STRING: {
+				const char *s = va_arg(args, const char *);
+				if (!s) {
+					s = "(null)";
+				}
+				// Only the part within the precision is printed
+				size_t room = LOG_ARG_BYTES - rec->len;
+				size_t n = strnlen(s, (pr >= 0 && (size_t) pr < room) ? pr : room);
+				if (n == room) {
+					// Keep what fits, the rest of the message is lost
+					if (room == 0) {
+						rec->truncated = true;
+						break;
+					}
+					n = room - 1;
+					rec->truncated = true;
+				}
+				memcpy(rec->args + rec->len, s, n);
+				rec->args[rec->len + n] = '\0';
+				rec->len += n + 1;
+				break;
+			}
+			default:
+				break;
+		}
+	}
+}
 
-	// Calculate the time difference from base_time
-	if ((now.tv_nsec - base_time.tv_nsec) < 0) {
-		diff.tv_sec = now.tv_sec - base_time.tv_sec - 1;
-		diff.tv_nsec = now.tv_nsec - base_time.tv_nsec + 1000000000;
-	} else {
-		diff.tv_sec = now.tv_sec - base_time.tv_sec;
-		diff.tv_nsec = now.tv_nsec - base_time.tv_nsec;
+/**
+* @brief
+* Reads a value from the arguments of a record.
+* @param *rec - The record
+* @param *off - Offset of the value, advanced past it
+* @param *value - Receives the value
+* @param size - Size of the value in bytes
+* @return true if the value was stored, false if it was lost
+*/
+static bool get_arg(const log_record *rec, size_t *off, void *value, size_t size)
+{
+	if (*off + size > rec->len) {
+		return false;
 	}
+	memcpy(value, rec->args + *off, size);
+	*off += size;
+	return true;
+}
 
-	// Convert nanoseconds to milliseconds
-	int msec = diff.tv_nsec / 1000000;
+/**
+* @brief
+* Appends the literal text of a format string to a line.
+* @param *line - The line
+* @param size - Size of line
+* @param pos - Length of the text in line
+* @param *from - Start of the text
+* @param *to - End of the text
+* @return The new length of the text in line
+*/
+static size_t append_text(char *line, size_t size, size_t pos, const char *from, const char *to)
+{
+	while (from < to && pos + 1 < size) {
+		line[pos++] = *from;
+		// "%%" stands for a single '%'
+		from += (from[0] == '%' && from + 1 < to && from[1] == '%') ? 2 : 1;
+	}
+	line[pos] = '\0';
+	return pos;
+}
 
-	const char* level_str = nullptr;
-	switch (level) {
+/**
+* @brief
+* This function formats a record into a line, one conversion at a time
+* from the values stored by store_args.
+* @param *rec - The record
+* @param *line - Buffer receiving the text
+* @param size - Size of line
+* @return Length of the text in line
+*/
+static size_t format_record(const log_record *rec, char *line, size_t size)
+{
+	const char *level_str = nullptr;
+	switch (rec->level) {
 		case LOG_LEVEL_NONE:
 			level_str = "[PRNT]";
 			break;
@@ -170,10 +435,322 @@ void log_message(log_level level, const char* format, ...)
 			break;
 	}
 
-	printf("%s%s[%4ld.%03d] ", mode_str.c_str(),level_str, diff.tv_sec, msec);
+	uint64_t base_ns = (uint64_t) base_time.tv_sec * 1000000000 + base_time.tv_nsec;
+	uint64_t diff_ns = rec->ts_ns > base_ns ? rec->ts_ns - base_ns : 0;
+	int ret = snprintf(line, size, "%s%s[%4ld.%03d] ", mode_str.c_str(), level_str,
+		(long) (diff_ns / 1000000000), (int) (diff_ns % 1000000000 / 1000000));
+	size_t pos = ret < 0 ? 0 : std::min((size_t) ret, size - 1);
+
+	fmt_spec spec;
+	const char *p = rec->fmt;
+	size_t off = 0;
+	bool lost = false;
+	while (next_spec(p, &spec)) {
+		char sub[64];
+		int width = 0, prec = 0;
+
+		pos = append_text(line, size, pos, p, spec.start);
+		p = spec.end;
+		if (pos + 1 >= size) {
+			break;
+		}
+
+		size_t spec_len = spec.end - spec.start;
+		if (spec.conv == 'n') {
+			// Nothing is written back, only skip the pointer
+			void *v;
+			get_arg(rec, &off, &v, sizeof(v));
+			continue;
+		}
+		if (spec_len >= sizeof(sub) || spec.type == ARG_NONE) {
+			continue;
+		}
+		memcpy(sub, spec.start, spec_len);
+		sub[spec_len] = '\0';
+
+		if ((spec.star_width && !get_arg(rec, &off, &width, sizeof(width))) ||
+			(spec.star_prec && !get_arg(rec, &off, &prec, sizeof(prec)))) {
+			lost = true;
+			break;
+		}
+
+#define FORMAT_ARG(value) \
+		do { \
+			if (spec.star_width && spec.star_prec) { \
+				ret = snprintf(line + pos, size - pos, sub, width, prec, value); \
+			} else if (spec.star_width) { \
+				ret = snprintf(line + pos, size - pos, sub, width, value); \
+			} else if (spec.star_prec) { \
+				ret = snprintf(line + pos, size - pos, sub, prec, value); \
+			} else { \
+				ret = snprintf(line + pos, size - pos, sub, value); \
+			} \
+		} while (0)
+
+		const char *len = spec.length;
+		ret = 0;
+		switch (spec.type) {
+			case ARG_INT:
+			case ARG_UINT: {
+				int64_t v;
+				if (!get_arg(rec, &off, &v, sizeof(v))) {
+					lost = true;
+					break;
+				}
+				if (!strcmp(len, "l")) {
+					FORMAT_ARG((long) v);
+				} else if (!strcmp(len, "ll") || !strcmp(len, "q") || !strcmp(len, "L")) {
+					FORMAT_ARG((long long) v);
+				} else if (!strcmp(len, "j")) {
+					FORMAT_ARG((intmax_t) v);
+				} else if (!strcmp(len, "z")) {
+					FORMAT_ARG((ssize_t) v);
+				} else if (!strcmp(len, "t")) {
+					FORMAT_ARG((ptrdiff_t) v);
+				} else {
+					FORMAT_ARG((int) v);
+				}
+				break;
+			}
+			case ARG_DOUBLE: {
+				double v;
+				if (!get_arg(rec, &off, &v, sizeof(v))) {
+					lost = true;
+					break;
+				}
+				FORMAT_ARG(v);
+				break;
+			}
+			case ARG_LONG_DOUBLE: {
+				long double v;
+				if (!get_arg(rec, &off, &v, sizeof(v))) {
+					lost = true;
+					break;
+				}
+				FORMAT_ARG(v);
+				break;
+			}
+			case ARG_POINTER: {
+				void *v;
+				if (!get_arg(rec, &off, &v, sizeof(v))) {
+					lost = true;
+					break;
+				}
+				FORMAT_ARG(v);
+				break;
+			}
+			case ARG_STRING: {
+				if (off >= rec->len) {
+					lost = true;
+					break;
+				}
+				const char *v = (const char *) rec->args + off;
+				off += strlen(v) + 1;
+				FORMAT_ARG(v);
+				break;
+			}
+		}
+#undef FORMAT_ARG
+		if (lost) {
+			break;
+		}
+		pos = ret < 0 ? pos : std::min(pos + ret, size - 1);
+	}
+
+	if (!lost) {
+		pos = append_text(line, size, pos, p, p + strlen(p));
+	}
+	if (lost || rec->truncated) {
+		// Make the cut visible and keep the line break of the message
+		const char cut[] = "...\n";
+		if (pos + sizeof(cut) > size) {
+			pos = size - sizeof(cut);
+		}
+		memcpy(line + pos, cut, sizeof(cut));
+		pos += sizeof(cut) - 1;
+	}
+	return pos;
+}
+
+/**
+* @brief
+* This function writes every queued message to stdout. Only one thread
+* drains the queue at a time.
+* @return true if the queue could be drained, false if another thread is
+* already draining it
+*/
+static bool drain_queue(void)
+{
+	char line[LOG_LINE_LENGTH];
+	bool wrote = false;
+
+	if (consumer_busy.test_and_set(std::memory_order_acquire)) {
+		return false;
+	}
+
+	unsigned long lost = dropped.exchange(0, std::memory_order_relaxed);
+	if (lost) {
+		printf("%s[WARN][log] %lu message(s) dropped, log queue full\n", mode_str.c_str(), lost);
+		wrote = true;
+	}
+
+	while (1) {
+		log_record *rec = &log_queue[dequeue_pos & (LOG_QUEUE_SLOTS - 1)];
+		if (rec->seq.load(std::memory_order_acquire) != dequeue_pos + 1) {
+			break;
+		}
+		size_t n = format_record(rec, line, sizeof(line));
+		fwrite(line, 1, n, stdout);
+		wrote = true;
+		rec->seq.store(dequeue_pos + LOG_QUEUE_SLOTS, std::memory_order_release);
+		dequeue_pos++;
+		written_pos.store(dequeue_pos, std::memory_order_release);
+	}
+
+	if (wrote) {
+		fflush(stdout);
+	}
+	consumer_busy.clear(std::memory_order_release);
+	return true;
+}
+
+/**
+* @brief
+* The background thread writing the queued messages.
+* @param *arg - Unused
+* @return NULL
+*/
+static void *log_writer(void *arg)
+{
+	while (1) {
+		while (sem_wait(&log_sem) && errno == EINTR) {
+		}
+		drain_queue();
+	}
+	return NULL;
+}
+
+/**
+* @brief
+* This function writes out every message logged so far. It is also called
+* when the process exits.
+* @return void
+*/
+void log_flush(void)
+{
+	if (writer_state.load(std::memory_order_acquire) != 2) {
+		return;
+	}
+
+	size_t target = enqueue_pos.load(std::memory_order_acquire);
+	for (int waited = 0; waited < LOG_FLUSH_TIMEOUT_MS; waited++) {
+		// Drain here if the writer is idle, otherwise wait for it
+		drain_queue();
+		if (written_pos.load(std::memory_order_acquire) >= target) {
+			return;
+		}
+		usleep(1000);
+	}
+}
+
+/**
+* @brief
+* This function starts the writer thread the first time a message is
+* logged. Messages logged while it starts are queued.
+* @return true if the writer runs, false otherwise
+*/
+static bool start_writer(void)
+{
+	int state = 0;
+	if (writer_state.compare_exchange_strong(state, 1)) {
+		for (size_t i = 0; i < LOG_QUEUE_SLOTS; i++) {
+			log_queue[i].seq.store(i, std::memory_order_relaxed);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &base_time);
+		time_init = true;
+		sem_init(&log_sem, 0, 0);
+
+		pthread_t tid;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&tid, &attr, log_writer, NULL)) {
+			pthread_attr_destroy(&attr);
+			writer_state.store(0);
+			return false;
+		}
+		pthread_attr_destroy(&attr);
+		atexit(log_flush);
+		writer_state.store(2, std::memory_order_release);
+		return true;
+	}
+	return state == 2 || writer_state.load(std::memory_order_acquire) == 2;
+}
+
+/**
+* @brief
+* This function logs a message at the specified logging level.
+* It supports formatted output similar to printf-style formatting.
+* The message is only queued here and formatted and written by a background
+* thread, so it takes no locks, makes no blocking call and is safe to call
+* from the signal handler of the reset timer. The format must be a string
+* literal. If the queue is full, the message is dropped and counted.
+*
+* @param level - The logging level of the message, specified as a LogLevel enum value.
+* @param format - A format string that specifies how to format the message.
+* @param ... - Additional arguments to be formatted according to the format string.
+* @return void
+*/
+void log_message(log_level level, const char* format, ...)
+{
+	struct timespec now;
+
+	if (level > dbg_lvl) {
+		return;
+	}
+
+	if (!start_writer()) {
+		// Fall back to writing directly
+		va_list args;
+		va_start(args, format);
+		vprintf(format, args);
+		va_end(args);
+		fflush(stdout);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	// Claim a slot
+	log_record *rec;
+	size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+	while (1) {
+		rec = &log_queue[pos & (LOG_QUEUE_SLOTS - 1)];
+		size_t seq = rec->seq.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+		if (diff == 0) {
+			if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			pos = enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	rec->ts_ns = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+	rec->fmt = format;
+	rec->level = level;
+	rec->len = 0;
+	rec->truncated = false;
 	va_list args;
 	va_start(args, format);
-	vprintf(format, args);
+	store_args(rec, format, args);
 	va_end(args);
-	fflush(stdout);
+
+	// Publish the slot and wake up the writer
+	rec->seq.store(pos + 1, std::memory_order_release);
+	sem_post(&log_sem);
 }
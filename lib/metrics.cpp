@@ -0,0 +1,369 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <limits.h>
+#include <string>
+#include <debug.h>
+#include "metrics.h"
+
+#define METRICS_SUB_BITS       3                            // 8 buckets per power of 2, ~12% resolution
+#define METRICS_SUB_BUCKETS    (1 << METRICS_SUB_BITS)
+#define METRICS_BUCKETS        (METRICS_SUB_BUCKETS * (64 - METRICS_SUB_BITS + 1))
+#define METRICS_PERIOD_MS      1000                         // Refresh period of the metrics file
+#define METRICS_PREFIX         "swgenlock_"
+
+/*
+ * Histograms are log-linear: values below METRICS_SUB_BUCKETS have a bucket
+ * each and every power of 2 above is split into METRICS_SUB_BUCKETS buckets,
+ * which bounds the relative error of a quantile while covering the whole
+ * 64 bit range in a fixed array. Negative values use a mirrored set of
+ * buckets. Every update is a handful of relaxed atomic operations, so the
+ * metrics can be updated from any thread, including the reset signal handler.
+ */
+typedef struct _metrics_hist {
+	std::atomic<uint64_t> neg[METRICS_BUCKETS];
+	std::atomic<uint64_t> pos[METRICS_BUCKETS];
+	std::atomic<uint64_t> count;
+	std::atomic<int64_t> sum;
+	std::atomic<int64_t> min;
+	std::atomic<int64_t> max;
+} metrics_hist;
+
+typedef struct _metrics_info {
+	const char *name;
+	const char *help;
+	const char *type;
+} metrics_info;
+
+static const metrics_info hist_info[VSYNC_METRIC_HISTOGRAMS] = {
+	{ "delta_us", "Drift delta between primary and secondary vblanks in us", "summary" },
+	{ "correction_us", "Time spent applying a correction in us", "summary" },
+	{ "pll_offset_ppb", "PLL frequency offset from its initial value in ppb", "summary" },
+	{ "capture_us", "Time to capture a window of vsyncs in us", "summary" },
+	{ "rtt_us", "Round trip of a vsync request to the primary in us", "summary" },
+	{ "mmio_ns", "MMIO register access time in ns", "summary" },
+	{ "msgbus_ns", "PHY message bus transaction time in ns", "summary" },
+};
+
+static const metrics_info counter_info[VSYNC_COUNTERS] = {
+	{ "sync_total", "Corrections applied", "counter" },
+	{ "out_of_sync_total", "Windows found beyond the allowed drift", "counter" },
+	{ "success_iter", "Windows in sync since the last correction", "gauge" },
+	{ "skipped_total", "Windows skipped for their quality flags", "counter" },
+	{ "requests_total", "vsync requests served by the primary", "counter" },
+};
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+static metrics_hist hists[VSYNC_METRIC_HISTOGRAMS];
+static std::atomic<int64_t> counters[VSYNC_COUNTERS];
+std::atomic<bool> g_metrics_on(false);
+
+static pthread_t metrics_tid;
+static std::atomic<bool> metrics_running(false);
+static std::string metrics_path;
+
+/**
+* @brief
+* Returns the bucket of a magnitude.
+* @param v - The magnitude
+* @return The bucket index
+*/
+static int bucket_of(uint64_t v)
+{
+	if (v < METRICS_SUB_BUCKETS) {
+		return (int) v;
+	}
+	int e = 63 - __builtin_clzll(v);
+	int sub = (int) (v >> (e - METRICS_SUB_BITS)) & (METRICS_SUB_BUCKETS - 1);
+	return METRICS_SUB_BUCKETS + (e - METRICS_SUB_BITS) * METRICS_SUB_BUCKETS + sub;
+}
+
+/**
+* @brief
+* Returns the middle of the range of magnitudes of a bucket.
+* @param idx - The bucket index
+* @return The magnitude
+*/
+static double bucket_value(int idx)
+{
+	if (idx < METRICS_SUB_BUCKETS) {
+		return idx;
+	}
+	int e = (idx - METRICS_SUB_BUCKETS) / METRICS_SUB_BUCKETS + METRICS_SUB_BITS;
+	int sub = (idx - METRICS_SUB_BUCKETS) % METRICS_SUB_BUCKETS;
+	double low = (double) (METRICS_SUB_BUCKETS + sub) * (double) (1ULL << (e - METRICS_SUB_BITS));
+	return low + (double) (1ULL << (e - METRICS_SUB_BITS)) / 2;
+}
+
+/**
+* @brief
+* This function clears all metrics.
+* @return void
+*/
+static void metrics_reset(void)
+{
+	for (int h = 0; h < VSYNC_METRIC_HISTOGRAMS; h++) {
+		for (int i = 0; i < METRICS_BUCKETS; i++) {
+			hists[h].neg[i].store(0, std::memory_order_relaxed);
+			hists[h].pos[i].store(0, std::memory_order_relaxed);
+		}
+		hists[h].count.store(0, std::memory_order_relaxed);
+		hists[h].sum.store(0, std::memory_order_relaxed);
+		hists[h].min.store(INT64_MAX, std::memory_order_relaxed);
+		hists[h].max.store(INT64_MIN, std::memory_order_relaxed);
+	}
+	for (int c = 0; c < VSYNC_COUNTERS; c++) {
+		counters[c].store(0, std::memory_order_relaxed);
+	}
+}
+
+/**
+* @brief
+* This function adds a value to a histogram. It does nothing unless the
+* metrics were started.
+* @param h - The histogram
+* @param value - The value
+* @return void
+*/
+void metrics_record(vsync_histogram h, int64_t value)
+{
+	if (!g_metrics_on.load(std::memory_order_relaxed) || h < 0 || h >= VSYNC_METRIC_HISTOGRAMS) {
+		return;
+	}
+
+	metrics_hist *hist = &hists[h];
+	if (value < 0) {
+		hist->neg[bucket_of(-(uint64_t) value)].fetch_add(1, std::memory_order_relaxed);
+	} else {
+		hist->pos[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+	}
+	hist->count.fetch_add(1, std::memory_order_relaxed);
+	hist->sum.fetch_add(value, std::memory_order_relaxed);
+
+	int64_t cur = hist->min.load(std::memory_order_relaxed);
+	while (value < cur && !hist->min.compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+	}
+	cur = hist->max.load(std::memory_order_relaxed);
+	while (value > cur && !hist->max.compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+	}
+}
+
+/**
+* @brief
+* This function adds to a counter.
+* @param c - The counter
+* @param value - The amount to add
+* @return void
+*/
+void metrics_add(vsync_counter c, int64_t value)
+{
+	if (!g_metrics_on.load(std::memory_order_relaxed) || c < 0 || c >= VSYNC_COUNTERS) {
+		return;
+	}
+	counters[c].fetch_add(value, std::memory_order_relaxed);
+}
+
+/**
+* @brief
+* This function sets a gauge.
+* @param c - The gauge
+* @param value - The new value
+* @return void
+*/
+void metrics_set(vsync_counter c, int64_t value)
+{
+	if (!g_metrics_on.load(std::memory_order_relaxed) || c < 0 || c >= VSYNC_COUNTERS) {
+		return;
+	}
+	counters[c].store(value, std::memory_order_relaxed);
+}
+
+/**
+* @brief
+* This function finds a quantile of a histogram from a snapshot of its
+* buckets, ordered from the most negative to the most positive value.
+* @param *neg - Snapshot of the negative buckets
+* @param *pos - Snapshot of the positive buckets
+* @param total - Number of values in the snapshot
+* @param q - The quantile, between 0 and 1
+* @return The value at the quantile
+*/
+static double quantile(const uint64_t *neg, const uint64_t *pos, uint64_t total, double q)
+{
+	uint64_t rank = (uint64_t) (q * (total - 1)) + 1, seen = 0;
+
+	for (int i = METRICS_BUCKETS - 1; i >= 0; i--) {
+		seen += neg[i];
+		if (seen >= rank) {
+			return -bucket_value(i);
+		}
+	}
+	for (int i = 0; i < METRICS_BUCKETS; i++) {
+		seen += pos[i];
+		if (seen >= rank) {
+			return bucket_value(i);
+		}
+	}
+	return 0;
+}
+
+/**
+* @brief
+* This function writes all metrics in the Prometheus text format. The file
+* is written next to its final name and renamed over it, so a reader never
+* sees a partial file.
+* @param *path - The file to write
+* @return
+* - 0 == SUCCESS
+* - 1 = ERROR
+*/
+int metrics_write(const char *path)
+{
+	static uint64_t neg[METRICS_BUCKETS], pos[METRICS_BUCKETS];
+	char tmp[PATH_MAX];
+
+	if (path == NULL || strlen(path) == 0) {
+		ERR("Invalid metrics path (NULL or empty)\n");
+		return 1;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	FILE *fp = fopen(tmp, "w");
+	if (!fp) {
+		ERR("Failed to open %s: %s\n", tmp, strerror(errno));
+		return 1;
+	}
+
+	for (int c = 0; c < VSYNC_COUNTERS; c++) {
+		fprintf(fp, "# HELP " METRICS_PREFIX "%s %s\n", counter_info[c].name, counter_info[c].help);
+		fprintf(fp, "# TYPE " METRICS_PREFIX "%s %s\n", counter_info[c].name, counter_info[c].type);
+		fprintf(fp, METRICS_PREFIX "%s %ld\n", counter_info[c].name,
+			(long) counters[c].load(std::memory_order_relaxed));
+	}
+
+	for (int h = 0; h < VSYNC_METRIC_HISTOGRAMS; h++) {
+		const char *name = hist_info[h].name;
+		uint64_t total = 0;
+
+		// Quantiles come from a snapshot so that they are consistent with each other
+		for (int i = 0; i < METRICS_BUCKETS; i++) {
+			neg[i] = hists[h].neg[i].load(std::memory_order_relaxed);
+			pos[i] = hists[h].pos[i].load(std::memory_order_relaxed);
+			total += neg[i] + pos[i];
+		}
+
+		fprintf(fp, "# HELP " METRICS_PREFIX "%s %s\n", name, hist_info[h].help);
+		fprintf(fp, "# TYPE " METRICS_PREFIX "%s %s\n", name, hist_info[h].type);
+		for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+			fprintf(fp, METRICS_PREFIX "%s{quantile=\"%g\"} %.0f\n", name, quantiles[q],
+				total ? quantile(neg, pos, total, quantiles[q]) : 0.0);
+		}
+		fprintf(fp, METRICS_PREFIX "%s_sum %ld\n", name, (long) hists[h].sum.load(std::memory_order_relaxed));
+		fprintf(fp, METRICS_PREFIX "%s_count %lu\n", name, (unsigned long) total);
+		if (total) {
+			fprintf(fp, "# TYPE " METRICS_PREFIX "%s_min gauge\n", name);
+			fprintf(fp, METRICS_PREFIX "%s_min %ld\n", name, (long) hists[h].min.load(std::memory_order_relaxed));
+			fprintf(fp, "# TYPE " METRICS_PREFIX "%s_max gauge\n", name);
+			fprintf(fp, METRICS_PREFIX "%s_max %ld\n", name, (long) hists[h].max.load(std::memory_order_relaxed));
+		}
+	}
+
+	if (fclose(fp) || rename(tmp, path)) {
+		ERR("Failed to write %s: %s\n", path, strerror(errno));
+		unlink(tmp);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+* @brief
+* The background thread refreshing the metrics file.
+* @param *arg - Unused
+* @return NULL
+*/
+static void *metrics_writer(void *arg)
+{
+	while (metrics_running.load()) {
+		metrics_write(metrics_path.c_str());
+		for (int i = 0; i < METRICS_PERIOD_MS / 100 && metrics_running.load(); i++) {
+			usleep(100 * 1000);
+		}
+	}
+	return NULL;
+}
+
+/**
+* @brief
+* This function clears the metrics and starts collecting them. They are
+* written to a file in the Prometheus text format every second, e.g. for the
+* textfile collector of node_exporter.
+* @param *path - The file to write
+* @return
+* - 0 == SUCCESS
+* - 1 = ERROR
+*/
+int metrics_start(const char *path)
+{
+	if (path == NULL || strlen(path) == 0) {
+		ERR("Invalid metrics path (NULL or empty)\n");
+		return 1;
+	}
+
+	metrics_stop();
+	metrics_reset();
+	metrics_path = path;
+	g_metrics_on.store(true);
+	metrics_running.store(true);
+	if (pthread_create(&metrics_tid, NULL, metrics_writer, NULL)) {
+		ERR("Failed to start the metrics thread\n");
+		metrics_running.store(false);
+		g_metrics_on.store(false);
+		return 1;
+	}
+	INFO("Writing metrics to %s\n", path);
+	return 0;
+}
+
+/**
+* @brief
+* This function stops collecting metrics after writing them out one last time.
+* @return void
+*/
+void metrics_stop(void)
+{
+	if (!metrics_running.exchange(false)) {
+		return;
+	}
+	pthread_join(metrics_tid, NULL);
+	metrics_write(metrics_path.c_str());
+	g_metrics_on.store(false);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <vsyncalter.h>
+#include <clocks.h>
+
+extern std::atomic<bool> g_metrics_on;
+
+/*
+ * Records the time spent in a scope into a histogram. Nothing but a flag
+ * check is done while metrics are off.
+ */
+class metrics_timer {
+private:
+	vsync_histogram m_hist;
+	uint64_t m_start;
+	int64_t m_scale;
+public:
+	metrics_timer(vsync_histogram hist, int64_t scale = 1) : m_hist(hist),
+		m_start(g_metrics_on.load(std::memory_order_relaxed) ? monotonic_ns() : 0),
+		m_scale(scale) {}
+	~metrics_timer() {
+		if (m_start) {
+			metrics_record(m_hist, (monotonic_ns() - m_start) / m_scale);
+		}
+	}
+};
+
+#endif
@@ -26,6 +26,7 @@
 #define _MMIO_H
 
 #include <pciaccess.h>
+#include "metrics.h"
 
 typedef struct _gfx_pci_device {
     unsigned short vendor_id, device_id;    // Identity of the device
@@ -40,8 +41,8 @@ typedef struct _gfx_pci_device {
 
 #define MMIO_SIZE 2*1024*1024
 #define MMIO_BAR  0
-#define READ_OFFSET_DWORD(x) (*((volatile uint32_t *) (g_mmio + x + cpu_offset)))
-#define WRITE_OFFSET_DWORD(x, y) ((*((volatile uint32_t *) (g_mmio + x + cpu_offset))) = y)
+#define READ_OFFSET_DWORD(x) read_offset_dword(x)
+#define WRITE_OFFSET_DWORD(x, y) write_offset_dword(x, y)
 #define IS_INIT() g_init
 #define INIT()    g_init = 1;
 #define UNINIT()    g_init = 0;
@@ -56,9 +57,46 @@ extern int g_mem_size;
 extern int g_fd;
 extern int g_drm_fd;
 extern int g_init;
+extern bool g_mmio_sim;
+extern struct pci_device *pci_dev;
 
 int map_mmio(const char *device_str);
 int close_mmio_handle();
 int get_device_id(const char *device_str);
+int sim_mmio_init(void);
+void sim_mmio_uninit(void);
+void sim_mmio_write(uint32_t offset, uint32_t value);
+void sim_phy_write(int port, int lane, uint16_t addr, uint8_t data);
+void sim_sram_write(int port, uint16_t addr, uint16_t data);
+
+/**
+* @brief
+* Reads an MMIO register, timing the access while metrics are collected.
+* @param offset - Offset of the register
+* @return The value of the register
+*/
+static inline uint32_t read_offset_dword(uint32_t offset)
+{
+	metrics_timer t(VSYNC_METRIC_MMIO_NS);
+	return *((volatile uint32_t *) (g_mmio + offset + cpu_offset));
+}
+
+/**
+* @brief
+* Writes an MMIO register, timing the access while metrics are collected.
+* With the simulated backend the write goes through the PHY model instead.
+* @param offset - Offset of the register
+* @param value - The value to write
+* @return void
+*/
+static inline void write_offset_dword(uint32_t offset, uint32_t value)
+{
+	metrics_timer t(VSYNC_METRIC_MMIO_NS);
+	if (__builtin_expect(g_mmio_sim, 0)) {
+		sim_mmio_write(offset, value);
+		return;
+	}
+	*((volatile uint32_t *) (g_mmio + offset + cpu_offset)) = value;
+}
 
 #endif
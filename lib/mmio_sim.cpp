@@ -0,0 +1,245 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "cx0_helper.h"
+#include "mmio.h"
+#include "debug.h"
+#include "common.h"
+
+using namespace cx0;
+
+// Ports A through TC6 and the two lanes of each port reachable over the
+// message bus
+#define SIM_PORTS          (PORT_TC6 + 1)
+#define SIM_LANES          2
+#define SIM_PHY_REGS       4096
+#define SIM_SRAM_WORDS     65536
+
+bool g_mmio_sim = false;
+
+static unsigned char *sim_range;
+static u8 (*sim_phy_regs)[SIM_LANES][SIM_PHY_REGS];
+static u16 (*sim_sram)[SIM_SRAM_WORDS];
+
+/**
+* @brief
+* Finds the port and lane whose message bus control register is at the
+* given offset.
+* @param offset - Offset of the register
+* @param *port - Receives the port
+* @param *lane - Receives the lane
+* @return true if the offset is a message bus control register
+*/
+static bool sim_msgbus_lookup(uint32_t offset, int *port, int *lane)
+{
+	for (int p = 0; p < SIM_PORTS; p++) {
+		for (int l = 0; l < SIM_LANES; l++) {
+			if ((uint32_t) XELPDP_PORT_M2P_MSGBUS_CTL(p, l) == offset) {
+				*port = p;
+				*lane = l;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/**
+* @brief
+* Writes a register in the memory backing the simulated MMIO range.
+* @param offset - Offset of the register
+* @param value - The value to write
+* @return void
+*/
+static inline void sim_store(uint32_t offset, uint32_t value)
+{
+	*((uint32_t *) (g_mmio + offset)) = value;
+}
+
+/**
+* @brief
+* Executes a message bus transaction the way the PHY would: reads and writes
+* go to the PHY register file, C20 SRAM accesses go through the address and
+* data registers, and the status register reports the acknowledgement.
+* @param port - The port of the PHY
+* @param lane - The lane of the PHY
+* @param value - The value written to the message bus control register
+* @return void
+*/
+static void sim_msgbus_transaction(int port, int lane, uint32_t value)
+{
+	u8 *regs = sim_phy_regs[port][lane];
+	uint32_t status_reg = XELPDP_PORT_P2M_MSGBUS_STATUS(port, lane);
+	u16 addr = REG_FIELD_GET(XELPDP_PORT_M2P_ADDRESS_MASK, value);
+	u8 data = REG_FIELD_GET(XELPDP_PORT_M2P_DATA_MASK, value);
+	uint32_t command = value & XELPDP_PORT_M2P_COMMAND_TYPE_MASK;
+	uint32_t status = 0;
+
+	if (command == XELPDP_PORT_M2P_COMMAND_READ) {
+		status = XELPDP_PORT_P2M_RESPONSE_READY |
+			REG_FIELD_PREP(XELPDP_PORT_P2M_COMMAND_TYPE_MASK, XELPDP_PORT_P2M_COMMAND_READ_ACK) |
+			REG_FIELD_PREP(XELPDP_PORT_P2M_DATA_MASK, regs[addr]);
+	} else {
+		regs[addr] = data;
+		if (addr == PHY_C20_RD_ADDRESS_L) {
+			u16 word = sim_sram[port][regs[PHY_C20_RD_ADDRESS_H] << 8 | data];
+			regs[PHY_C20_RD_DATA_H] = word >> 8;
+			regs[PHY_C20_RD_DATA_L] = word & 0xff;
+		} else if (addr == PHY_C20_WR_DATA_L) {
+			sim_sram[port][regs[PHY_C20_WR_ADDRESS_H] << 8 | regs[PHY_C20_WR_ADDRESS_L]] =
+				regs[PHY_C20_WR_DATA_H] << 8 | data;
+		}
+
+		if (command == XELPDP_PORT_M2P_COMMAND_WRITE_COMMITTED) {
+			status = XELPDP_PORT_P2M_RESPONSE_READY |
+				REG_FIELD_PREP(XELPDP_PORT_P2M_COMMAND_TYPE_MASK, XELPDP_PORT_P2M_COMMAND_WRITE_ACK);
+		}
+	}
+
+	sim_store(status_reg, status);
+}
+
+/**
+* @brief
+* Handles a register write while the simulated backend is active. Plain
+* registers keep the written value. Message bus control registers complete
+* the transaction immediately and status registers are write-1-to-clear.
+* @param offset - Offset of the register
+* @param value - The value to write
+* @return void
+*/
+void sim_mmio_write(uint32_t offset, uint32_t value)
+{
+	int port, lane;
+
+	if (sim_msgbus_lookup(offset, &port, &lane)) {
+		if (value & XELPDP_PORT_M2P_TRANSACTION_RESET) {
+			sim_store(XELPDP_PORT_P2M_MSGBUS_STATUS(port, lane), 0);
+		} else if (value & XELPDP_PORT_M2P_TRANSACTION_PENDING) {
+			sim_msgbus_transaction(port, lane, value);
+		}
+		sim_store(offset, value & ~(XELPDP_PORT_M2P_TRANSACTION_PENDING | XELPDP_PORT_M2P_TRANSACTION_RESET));
+		return;
+	}
+
+	if (offset >= 8 && sim_msgbus_lookup(offset - 8, &port, &lane)) {
+		sim_store(offset, *((uint32_t *) (g_mmio + offset)) & ~value);
+		return;
+	}
+
+	sim_store(offset, value);
+}
+
+/**
+* @brief
+* Replaces the PCI BAR with a zeroed memory range and a simulated PHY
+* message bus so that the PHY code can run on machines without the
+* hardware. Registers are seeded with WRITE_OFFSET_DWORD, sim_phy_write and
+* sim_sram_write.
+* @param None
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int sim_mmio_init(void)
+{
+	if (g_mmio_sim) {
+		return 0;
+	}
+
+	if (g_mmio) {
+		ERR("MMIO is already mapped to a device\n");
+		return 1;
+	}
+
+	sim_range = (unsigned char *) calloc(1, MMIO_SIZE);
+	sim_phy_regs = (u8 (*)[SIM_LANES][SIM_PHY_REGS]) calloc(SIM_PORTS, sizeof(*sim_phy_regs));
+	sim_sram = (u16 (*)[SIM_SRAM_WORDS]) calloc(SIM_PORTS, sizeof(*sim_sram));
+	if (!sim_range || !sim_phy_regs || !sim_sram) {
+		ERR("Failed to allocate the simulated MMIO range\n");
+		sim_mmio_uninit();
+		return 1;
+	}
+
+	g_mmio = sim_range;
+	cpu_offset = 0;
+	g_mmio_size = MMIO_SIZE;
+	g_mmio_sim = true;
+	return 0;
+}
+
+/**
+* @brief
+* Releases the simulated MMIO range.
+* @param None
+* @return void
+*/
+void sim_mmio_uninit(void)
+{
+	if (g_mmio && g_mmio == sim_range) {
+		g_mmio = NULL;
+		g_mmio_size = 0;
+	}
+	free(sim_range);
+	free(sim_phy_regs);
+	free(sim_sram);
+	sim_range = NULL;
+	sim_phy_regs = NULL;
+	sim_sram = NULL;
+	g_mmio_sim = false;
+}
+
+/**
+* @brief
+* Seeds a register of a simulated PHY behind the message bus.
+* @param port - The port of the PHY
+* @param lane - The lane of the PHY
+* @param addr - The address of the PHY register
+* @param data - The value of the register
+* @return void
+*/
+void sim_phy_write(int port, int lane, uint16_t addr, uint8_t data)
+{
+	if (g_mmio_sim && port >= 0 && port < SIM_PORTS && lane >= 0 && lane < SIM_LANES &&
+		addr < SIM_PHY_REGS) {
+		sim_phy_regs[port][lane][addr] = data;
+	}
+}
+
+/**
+* @brief
+* Seeds a word of the SRAM of a simulated C20 PHY.
+* @param port - The port of the PHY
+* @param addr - The SRAM address
+* @param data - The value of the word
+* @return void
+*/
+void sim_sram_write(int port, uint16_t addr, uint16_t data)
+{
+	if (g_mmio_sim && port >= 0 && port < SIM_PORTS) {
+		sim_sram[port][addr] = data;
+	}
+}
@@ -1,11 +1,14 @@
 
 #include <math.h>
 #include <debug.h>
+#include <clocks.h>
 #include <signal.h>
 #include <unistd.h>
 #include <memory.h>
 #include <time.h>
 #include "phy.h"
+#include "mmio.h"
+#include "vblank_sim.h"
 
 /**
 * @brief
@@ -50,12 +53,22 @@ void phys::reset_phy_regs()
 	// Without deleting the timer, it might expire and trigger again during this delay.
 	timer_delete(get_timer());
 
+	uint64_t start = monotonic_raw_ns();
+	if (hold_start) {
+		timing.hold_ns = start - hold_start;
+	}
 	set_pll_clock(pll_freq_mod, pll_freq_orig, used_shift, _wait_between_steps);
+	uint64_t ramp_down_end = monotonic_raw_ns();
+	timing.ramp_down_ns = ramp_down_end - start;
 
 	// set_pll_clock is expected to restore the original value using pll_freq_orig (double).
 	// However, due to precision loss when converting from double to divider factors,
 	// we explicitly set the registers back to the original value as a safeguard.
 	program_mmio(0);
+	if (g_mmio_sim) {
+		sim_vblank_pll(get_pipe(), calculate_pll_clock());
+	}
+	timing.reset_ns = monotonic_raw_ns() - ramp_down_end;
 
 	done = 1;
 }
@@ -105,6 +118,8 @@ int phys::program_phy(double time_diff, double shift, double shift2, int step_th
 
 	// Use larger shift for desired frequency calculation if time_diff is greater than 1 ms
 	double _shift = ((shift2 && (fabs(time_diff) * 1000) >= step_threshold) ? shift2 : shift);
+	timing = {};
+	hold_start = 0;
 
 	int steps = CALC_STEPS_TO_SYNC(time_diff, _shift);
 	DBG("steps are %d - (Step threshold = %d us)\n", steps, step_threshold);
@@ -135,10 +150,13 @@ int phys::program_phy(double time_diff, double shift, double shift2, int step_th
 		return 0;
 	}
 
+	uint64_t start = monotonic_raw_ns();
 	if (set_pll_clock(pll_clock, new_pll_clock, shift, wait_between_steps, commit) != 0) {
 		ERR("Failed to set PLL clock.\n");
 		return 1;
 	}
+	hold_start = monotonic_raw_ns();
+	timing.ramp_up_ns = hold_start - start;
 
 	if (!commit || dbg_lvl >= LOG_LEVEL_DEBUG) {
 		print_registers();
@@ -280,10 +298,14 @@ int phys::set_pll_clock(double current_pll_clock, double target_pll_clock, doubl
 			ERR("Failed to program MMIO during PLL adjustment step %d\n", i + 1);
 			return 1;
 		}
+		// The simulated display follows the PLL like a real one would
+		if (commit && g_mmio_sim) {
+			sim_vblank_pll(get_pipe(), calculate_pll_clock());
+		}
 
 		// Wait is needed otherwise changing registers quickly will create trearing on screen.
 		// Wait only if stepping multiple times
-		if (steps > 1) {
+		if (steps > 1 && wait_between_steps) {
 			usleep(wait_between_steps * 1000); // Convert to microseconds
 		}
 	}
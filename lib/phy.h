@@ -16,10 +16,12 @@ class phys {
 		double pll_freq_mod;
 		double used_shift;
 		int _wait_between_steps;
+		vsync_sync_timing timing;
+		uint64_t hold_start;
 	public:
 		phys(int _pipe) : done(0), phy_type(-1), init(false), pipe(_pipe), timer_id(0),
 					m_ds(NULL), pll_freq_orig(0.0), pll_freq_mod(0.0), used_shift(0.0),
-					_wait_between_steps(0) {}
+					_wait_between_steps(0), timing(), hold_start(0) {}
 		virtual ~phys() { }
 		bool is_init() { return init; }
 		void set_init(bool i) { init = i; }
@@ -39,6 +41,7 @@ class phys {
 		int set_pll_clock(double current_pll_clock, double target_pll_clock, double shift,
 				uint32_t wait_between_steps, bool commit = true);
 		double get_pll_clock(void);
+		const vsync_sync_timing &get_timing() { return timing; }
 		virtual int program_mmio(int mod)= 0;
 		virtual double calculate_pll_clock() = 0;
 		virtual int calculate_feedback_dividers(double pll_freq) = 0;
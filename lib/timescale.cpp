@@ -0,0 +1,318 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/ptp_clock.h>
+#include <mutex>
+#include <vsyncalter.h>
+#include <debug.h>
+#include <clocks.h>
+#include "timescale.h"
+
+#define FD_TO_CLOCKID(fd)   ((clockid_t) ((((unsigned int) ~fd) << 3) | 3))
+
+// Offset of the timescale from the monotonic clock at a point in time
+typedef struct _offset_sample {
+	uint64_t mono_ns;
+	int64_t offset_ns;
+} offset_sample;
+
+static std::mutex ts_lock;
+static vsync_timescale ts_scale = VSYNC_TIMESCALE_REALTIME;
+static int ts_phc_fd = -1;
+static offset_sample ts_prev, ts_last;
+static int ts_count;         // Valid samples in ts_prev and ts_last
+
+/**
+* @brief
+* Measures the offset of a clock from the monotonic clock by reading it
+* between two readings of the monotonic clock. Of several tries, the one
+* with the shortest window is kept, which is preempted the least.
+* @param clock - The clock to compare
+* @param *s - Receives the offset, at the middle of the window
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+static int read_clock_offset(clockid_t clock, offset_sample *s)
+{
+	struct timespec before, t, after;
+	int64_t best = INT64_MAX;
+
+	for (int i = 0; i < TIMESCALE_READS; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &before);
+		if (clock_gettime(clock, &t)) {
+			ERR("Failed to read clock %d: %s\n", (int) clock, strerror(errno));
+			return 1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &after);
+		int64_t window = (int64_t) (timespec_ns(&after) - timespec_ns(&before));
+		if (window < best) {
+			best = window;
+			s->mono_ns = timespec_ns(&before) + window / 2;
+			s->offset_ns = (int64_t) timespec_ns(&t) - (int64_t) s->mono_ns;
+		}
+	}
+	return 0;
+}
+
+/**
+* @brief
+* Measures the offset of the PHC from the monotonic clock. The PHC is read
+* against the realtime clock by the driver, precisely when the hardware
+* supports cross timestamps, and the realtime clock against the monotonic
+* one. Without driver support the PHC is read like any other clock.
+* @param *s - Receives the offset
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+static int read_phc_offset(offset_sample *s)
+{
+	struct ptp_sys_offset_precise precise;
+	struct ptp_sys_offset_extended ext;
+	offset_sample real;
+	int64_t phc_real = 0;
+
+	if (read_clock_offset(CLOCK_REALTIME, &real)) {
+		return 1;
+	}
+
+	memset(&precise, 0, sizeof(precise));
+	if (!ioctl(ts_phc_fd, PTP_SYS_OFFSET_PRECISE, &precise)) {
+		phc_real = ((int64_t) precise.device.sec * 1000000000 + precise.device.nsec) -
+			((int64_t) precise.sys_realtime.sec * 1000000000 + precise.sys_realtime.nsec);
+	} else {
+		memset(&ext, 0, sizeof(ext));
+		ext.n_samples = TIMESCALE_READS;
+		if (ioctl(ts_phc_fd, PTP_SYS_OFFSET_EXTENDED, &ext) || !ext.n_samples) {
+			return read_clock_offset(FD_TO_CLOCKID(ts_phc_fd), s);
+		}
+		int64_t best = INT64_MAX;
+		for (unsigned int i = 0; i < ext.n_samples; i++) {
+			int64_t before = (int64_t) ext.ts[i][0].sec * 1000000000 + ext.ts[i][0].nsec;
+			int64_t phc = (int64_t) ext.ts[i][1].sec * 1000000000 + ext.ts[i][1].nsec;
+			int64_t after = (int64_t) ext.ts[i][2].sec * 1000000000 + ext.ts[i][2].nsec;
+			if (after - before < best) {
+				best = after - before;
+				phc_real = phc - (before + (after - before) / 2);
+			}
+		}
+	}
+
+	s->mono_ns = real.mono_ns;
+	s->offset_ns = real.offset_ns + phc_real;
+	return 0;
+}
+
+/**
+* @brief
+* Measures the offset of the timescale from the monotonic clock.
+* @param *s - Receives the offset
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+static int read_offset(offset_sample *s)
+{
+	switch (ts_scale) {
+		case VSYNC_TIMESCALE_TAI:
+			return read_clock_offset(CLOCK_TAI, s);
+		case VSYNC_TIMESCALE_PHC:
+			return read_phc_offset(s);
+		default:
+			return read_clock_offset(CLOCK_REALTIME, s);
+	}
+}
+
+/**
+* @brief
+* Keeps the offset model current. The lock must be held.
+* @param mono_ns - The current monotonic time
+* @return void
+*/
+static void refresh_offset(uint64_t mono_ns)
+{
+	offset_sample s;
+
+	if (ts_count && mono_ns < ts_last.mono_ns + TIMESCALE_REFRESH_MS * 1000000ULL) {
+		return;
+	}
+	if (read_offset(&s)) {
+		return;
+	}
+
+	if (ts_count) {
+		// A step of the clock would turn into a steep slope, start over from it
+		double rate = (double) (s.offset_ns - ts_last.offset_ns) / (s.mono_ns - ts_last.mono_ns);
+		if (rate > TIMESCALE_MAX_RATE_PPM / 1e6 || rate < -TIMESCALE_MAX_RATE_PPM / 1e6) {
+			DBG("Timescale stepped by %ld ns\n", (long) (s.offset_ns - ts_last.offset_ns));
+			ts_count = 0;
+		}
+	}
+	ts_prev = ts_last;
+	ts_last = s;
+	ts_count = ts_count ? 2 : 1;
+}
+
+/**
+* @brief
+* Gives the offset of the timescale at a monotonic time, interpolated
+* between the last two measurements so that the slewing of the clock
+* between them is followed. The lock must be held.
+* @param mono_ns - The monotonic time
+* @return The offset in nanoseconds
+*/
+static int64_t offset_at(uint64_t mono_ns)
+{
+	if (ts_count < 2 || ts_last.mono_ns == ts_prev.mono_ns) {
+		return ts_last.offset_ns;
+	}
+	double rate = (double) (ts_last.offset_ns - ts_prev.offset_ns) /
+		(ts_last.mono_ns - ts_prev.mono_ns);
+	return ts_last.offset_ns + (int64_t) (rate * ((int64_t) mono_ns - (int64_t) ts_last.mono_ns));
+}
+
+/**
+* @brief
+* Converts a vblank timestamp of the kernel to the timescale. The kernel
+* stamps vblanks with the monotonic clock, or with the realtime clock when
+* the timestamp patch is applied and drm.timestamp_monotonic=0 is set.
+* @param kernel_ns - The timestamp in nanoseconds
+* @return The timestamp on the timescale in nanoseconds
+*/
+uint64_t timescale_convert(uint64_t kernel_ns)
+{
+	uint64_t mono_ns = kernel_ns;
+
+	std::lock_guard<std::mutex> guard(ts_lock);
+	refresh_offset(monotonic_ns());
+	if (!ts_count) {
+		return kernel_ns;
+	}
+
+	if (kernel_ns >= TIMESCALE_REALTIME_MIN_NS) {
+		// Realtime already, which the realtime timescale takes as it is
+		if (ts_scale == VSYNC_TIMESCALE_REALTIME) {
+			return kernel_ns;
+		}
+		offset_sample real;
+		if (read_clock_offset(CLOCK_REALTIME, &real)) {
+			return kernel_ns;
+		}
+		mono_ns = kernel_ns - real.offset_ns;
+	}
+	return mono_ns + offset_at(mono_ns);
+}
+
+/**
+* @brief
+* This function selects the timescale of the vsync timestamps given by the
+* library. The kernel stamps vblanks with the monotonic clock, which is not
+* comparable between systems. The library converts them with the offset of
+* the timescale from it, measured every TIMESCALE_REFRESH_MS and
+* interpolated in between, so no kernel patch is needed.
+* @param scale - VSYNC_TIMESCALE_REALTIME (default), VSYNC_TIMESCALE_TAI or
+* VSYNC_TIMESCALE_PHC
+* @param *phc_device - The PTP hardware clock for VSYNC_TIMESCALE_PHC, e.g.
+* /dev/ptp0. Ignored otherwise.
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int set_vsync_timescale(vsync_timescale scale, const char *phc_device)
+{
+	int fd = -1;
+
+	if (scale != VSYNC_TIMESCALE_REALTIME && scale != VSYNC_TIMESCALE_TAI &&
+		scale != VSYNC_TIMESCALE_PHC) {
+		ERR("Invalid timescale: %d\n", scale);
+		return 1;
+	}
+	if (scale == VSYNC_TIMESCALE_PHC) {
+		if (phc_device == NULL) {
+			ERR("NULL PTP clock device provided\n");
+			return 1;
+		}
+		fd = open(phc_device, O_RDWR);
+		if (fd < 0) {
+			ERR("Failed to open %s: %s\n", phc_device, strerror(errno));
+			return 1;
+		}
+	}
+
+	std::lock_guard<std::mutex> guard(ts_lock);
+	if (ts_phc_fd >= 0) {
+		close(ts_phc_fd);
+	}
+	ts_phc_fd = fd;
+	ts_scale = scale;
+	ts_count = 0;
+	return 0;
+}
+
+/**
+* @brief
+* This function gives the current time on the timescale of the vsync
+* timestamps, to compare them with.
+* @param None
+* @return Time in nanoseconds
+*/
+uint64_t get_vsync_time_ns(void)
+{
+	return timescale_convert(monotonic_ns());
+}
+
+/**
+* @brief
+* This function selects the timescale of the vsync timestamps via string
+* parameter.
+* @param *spec - realtime, tai or phc:device, e.g. phc:/dev/ptp0
+* @return 0 - success, non zero - failure
+*/
+int set_vsync_timescale_str(const char *spec)
+{
+	if (spec == NULL) {
+		return 1;
+	}
+
+	if (strcasecmp(spec, "realtime") == 0) {
+		return set_vsync_timescale(VSYNC_TIMESCALE_REALTIME, NULL);
+	} else if (strcasecmp(spec, "tai") == 0) {
+		return set_vsync_timescale(VSYNC_TIMESCALE_TAI, NULL);
+	} else if (strncasecmp(spec, "phc:", 4) == 0) {
+		return set_vsync_timescale(VSYNC_TIMESCALE_PHC, spec + 4);
+	}
+
+	ERR("Invalid timescale: %s\n", spec);
+	return 1;
+}
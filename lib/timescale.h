@@ -0,0 +1,40 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#ifndef _TIMESCALE_H
+#define _TIMESCALE_H
+
+#include <stdint.h>
+
+#define TIMESCALE_REFRESH_MS      500    // Age at which the offset is measured again
+#define TIMESCALE_READS           5      // Readings per measurement, the tightest is kept
+#define TIMESCALE_MAX_RATE_PPM    1000   // Faster offset changes are steps of the clock
+// Kernel timestamps before this are monotonic, after it realtime (year 2001)
+#define TIMESCALE_REALTIME_MIN_NS 1000000000000000000ULL
+
+uint64_t timescale_convert(uint64_t kernel_ns);
+
+#endif
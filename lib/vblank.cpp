@@ -0,0 +1,922 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdio.h>
+#include <errno.h>
+#include <vsyncalter.h>
+#include <debug.h>
+#include <clocks.h>
+#include <memory.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include "common.h"
+#include "metrics.h"
+#include "timescale.h"
+#include "vblank_sim.h"
+
+#define VBLANK_MAX_TIMEOUTS          3      // Consecutive wait timeouts before giving up
+#define VBLANK_WAIT_PERIODS          4      // Frame periods to wait for a vblank
+#define VBLANK_MIN_WAIT_MS           50     // Shortest wait for a vblank
+#define VBLANK_DEADLINE_SLACK        8      // Extra frame periods allowed for a capture
+#define VBLANK_OUTLIER_MIN_PERIODS   3      // Periods needed to judge outliers
+#define VBLANK_OUTLIER_MADS          5.0    // Scaled MADs from the median to be an outlier
+#define VBLANK_OUTLIER_MIN_RATIO     0.005  // Smallest deviation treated as an outlier
+
+/**
+* @brief
+* Stores a vblank in the buffer of the pipe it belongs to. If the pipe is
+* being streamed, the buffer is handed to the stream handler each time it
+* fills up and then reused for the next batch.
+* @param *info - The capture state of the pipe
+* @param timestamp_ns - Time of the vblank in nanoseconds
+* @param sequence - Frame sequence number of the vblank
+* @return true if the pipe needs more vblanks, false if it is done
+*/
+static bool record_vblank(vbl_info *info, uint64_t timestamp_ns, uint64_t sequence)
+{
+	if(info->done) {
+		return false;
+	}
+
+	// A jump in the sequence means the frames in between were never reported
+	if(info->captured && sequence > info->last_sequence + 1) {
+		DBG("Pipe %d missed %lu vblank(s)\n", info->pipe,
+			(unsigned long) (sequence - info->last_sequence - 1));
+		info->pending_flags |= VSYNC_FLAG_MISSED;
+	}
+	info->last_sequence = sequence;
+
+	info->samples[info->counter].timestamp_ns = timestamp_ns;
+	info->samples[info->counter].sequence = sequence;
+	info->samples[info->counter].flags = info->pending_flags;
+	info->pending_flags = 0;
+	info->counter++;
+	info->captured++;
+
+	if(info->total && info->captured >= info->total) {
+		info->done = true;
+	}
+
+	if(info->handler && (info->counter == info->size || info->done)) {
+		if(info->handler(info->pipe, info->samples, info->counter, info->user_data)) {
+			info->done = true;
+		}
+		info->counter = 0;
+	} else if(info->counter == info->size) {
+		info->done = true;
+	}
+
+	return !info->done;
+}
+
+/**
+* @brief
+* The function which will be called whenever a VBLANK occurs. Each pipe being
+* captured has its own vbl_info which is passed as the request's signal, so the
+* event is routed to the buffer of the pipe that generated it.
+* @param fd - The device file descriptor
+* @param frame - Frame number
+* @param sec - second when the vblank occured
+* @param usec - micro second when the vblank occured
+* @param *data - a private data structure pointing to the vbl_info
+* @return void
+*/
+static void vblank_handler(int fd, unsigned int frame, unsigned int sec,
+			   unsigned int usec, void *data)
+{
+	drmVBlank vbl;
+	vbl_info *info = (vbl_info *)data;
+
+	// No need to re-arm a pipe which already has all of its timestamps
+	if(!record_vblank(info, timescale_convert(TIME_IN_USEC(sec, usec) * 1000), frame)) {
+		return;
+	}
+
+	memset(&vbl, 0, sizeof(drmVBlank));
+	vbl.request.type = (drmVBlankSeqType) (DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT |
+		pipe_to_wait_for(info->pipe));
+	vbl.request.sequence = 1;
+	vbl.request.signal = (unsigned long)data;
+
+	drmWaitVBlank(fd, &vbl);
+}
+
+/**
+* @brief
+* The function which will be called whenever a CRTC sequence event occurs.
+* The next event is queued for the absolute sequence following this one, so
+* if we are late in handling it the kernel delivers the next vblank after
+* that and the gap is visible in the sequence numbers.
+* @param fd - The device file descriptor
+* @param sequence - 64 bit frame sequence number
+* @param ns - nano second when the vblank occured
+* @param user_data - a private data pointing to the vbl_info
+* @return void
+*/
+static void sequence_handler(int fd, uint64_t sequence, uint64_t ns, uint64_t user_data)
+{
+	vbl_info *info = (vbl_info *)(uintptr_t)user_data;
+
+	if(!record_vblank(info, timescale_convert(ns), sequence)) {
+		return;
+	}
+
+	drmCrtcQueueSequence(fd, info->crtc_id, DRM_CRTC_SEQUENCE_NEXT_ON_MISS,
+		sequence + 1, NULL, user_data);
+}
+
+/**
+* @brief
+* This function determines the type of vblank synchronization to
+* use for the output.
+* @param pipe - Indicates which CRTC to get vblank for.  Knowing this, we
+* can determine which vblank sequence type to use for it.  Traditional
+* cards had only two CRTCs, with CRTC 0 using no special flags, and
+* CRTC 1 using DRM_VBLANK_SECONDARY.  The first bit of the pipe
+* Bits 1-5 of the pipe parameter are 5 bit wide pipe number between
+* 0-31.  If this is non-zero it indicates we're dealing with a
+* multi-gpu situation and we need to calculate the vblank sync
+* using DRM_BLANK_HIGH_CRTC_MASK.
+* @return The flag to OR in for drmWaitVBlank API
+*/
+unsigned int pipe_to_wait_for(int pipe)
+{
+	int ret = 0;
+	if (pipe > 1) {
+		ret = (pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+	} else if (pipe > 0) {
+		ret = DRM_VBLANK_SECONDARY;
+	}
+	return ret;
+}
+
+/**
+* @brief
+* This function looks up the CRTC ids of the pipes being captured. CRTC
+* sequence events are keyed by CRTC id rather than by pipe index.
+* @param fd - The device file descriptor
+* @param *info - Capture state of each pipe. crtc_id is filled in.
+* @param num_pipes - Number of entries in info
+* @return
+* - 0 == SUCCESS
+* - 1 = FAILURE
+*/
+static int find_crtc_ids(int fd, vbl_info *info, int num_pipes)
+{
+	drmModeRes *resources = drmModeGetResources(fd);
+	if (!resources) {
+		DBG("drmModeGetResources failed: %s\n", strerror(errno));
+		return 1;
+	}
+
+	int ret = 0;
+	for (int p = 0; p < num_pipes; p++) {
+		if (info[p].pipe >= resources->count_crtcs) {
+			DBG("No CRTC for pipe %d\n", info[p].pipe);
+			ret = 1;
+			break;
+		}
+		info[p].crtc_id = resources->crtcs[info[p].pipe];
+	}
+
+	drmModeFreeResources(resources);
+	return ret;
+}
+
+/**
+* @brief
+* This function finds the longest frame period among the pipes of a capture
+* from the modes programmed on their CRTCs, so that waits can be sized to the
+* actual refresh rate. Pipes without a known mode count as 60 Hz.
+* @param fd - The device file descriptor
+* @param *info - Capture state of each pipe
+* @param num_pipes - Number of entries in info
+* @return The frame period in nanoseconds
+*/
+static uint64_t longest_frame_period(int fd, vbl_info *info, int num_pipes)
+{
+	uint64_t longest = 0;
+
+	for (int p = 0; p < num_pipes; p++) {
+		uint64_t period = (uint64_t) (VSYNC_ONE_VSYNC_PERIOD_IN_MS * 1000000);
+		drmModeCrtc *crtc = info[p].crtc_id ? drmModeGetCrtc(fd, info[p].crtc_id) : NULL;
+		if (crtc) {
+			if (crtc->mode_valid && crtc->mode.clock) {
+				// clock is in kHz
+				period = (uint64_t) crtc->mode.htotal * crtc->mode.vtotal * 1000000 /
+					crtc->mode.clock;
+			}
+			drmModeFreeCrtc(crtc);
+		}
+		DBG("Pipe %d frame period %.3f ms\n", info[p].pipe, period / 1000000.0);
+		longest = std::max(longest, period);
+	}
+	return longest;
+}
+
+/**
+* @brief
+* This function queues the first vblank event of a pipe using the backend
+* selected in its vbl_info.
+* @param fd - The device file descriptor
+* @param *info - The capture state of the pipe
+* @return 0 on success, otherwise the error of the DRM call
+*/
+static int queue_first_vblank(int fd, vbl_info *info)
+{
+	if (info->backend == VBLANK_BACKEND_CRTC_SEQUENCE) {
+		uint64_t queued = 0;
+		return drmCrtcQueueSequence(fd, info->crtc_id, DRM_CRTC_SEQUENCE_RELATIVE, 1,
+			&queued, (uint64_t)(uintptr_t)info);
+	}
+
+	drmVBlank vbl;
+	memset(&vbl, 0, sizeof(drmVBlank));
+	vbl.request.type = (drmVBlankSeqType)
+		(DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT | pipe_to_wait_for(info->pipe));
+	DBG("Pipe %d: vbl.request.type = 0x%X\n", info->pipe, vbl.request.type);
+	vbl.request.sequence = 1;
+	vbl.request.signal = (unsigned long)info;
+	return drmWaitVBlank(fd, &vbl);
+}
+
+/**
+* @brief
+* This function validates the pipes requested by a caller.
+* @param *pipes - The pipes whose vblanks are needed
+* @param num_pipes - Number of entries in pipes
+* @return
+* - 0 == SUCCESS
+* - 1 = ERROR
+*/
+static int check_pipes(const int *pipes, int num_pipes)
+{
+	if (pipes == NULL) {
+		ERR("NULL pipes pointer provided\n");
+		return 1;
+	}
+
+	if (num_pipes <= 0 || num_pipes > VSYNC_ALL_PIPES) {
+		ERR("Invalid number of pipes (must be 1 - %d): %d\n", VSYNC_ALL_PIPES, num_pipes);
+		return 1;
+	}
+
+	for (int p = 0; p < num_pipes; p++) {
+		if (pipes[p] < 0 || pipes[p] >= VSYNC_ALL_PIPES) {
+			ERR("Invalid pipe: %d\n", pipes[p]);
+			return 1;
+		}
+		for (int q = 0; q < p; q++) {
+			if (pipes[q] == pipes[p]) {
+				ERR("Pipe %d requested more than once\n", pipes[p]);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+* @brief
+* Hands the vblanks captured so far to the stream handlers. Streams get
+* their vblanks as soon as they arrive rather than a batch later, which
+* keeps a live consumer current.
+* @param *info - Capture state of each pipe
+* @param num_pipes - Number of entries in info
+* @return void
+*/
+static void flush_streams(vbl_info *info, int num_pipes)
+{
+	for (int p = 0; p < num_pipes; p++) {
+		if (info[p].handler && !info[p].done && info[p].counter) {
+			if (info[p].handler(info[p].pipe, info[p].samples, info[p].counter,
+				info[p].user_data)) {
+				info[p].done = true;
+			}
+			info[p].counter = 0;
+		}
+	}
+}
+
+/**
+* @brief
+* This function runs the capture loop on the simulated display. Instead of
+* waiting on the DRM fd it sleeps until the next frame of the pipes, which
+* the model places by the PLL clock programmed last. A frame is delivered
+* once its time has passed, with the timestamp converted to the timescale
+* like a kernel one, so everything above the capture runs unchanged.
+* @param *device_str - The simulated device, e.g. sim:ppm=20
+* @param *info - Capture state of each pipe
+* @param num_pipes - Number of entries in info
+* @return
+* - 0 == SUCCESS
+* - 1 = ERROR
+*/
+static int capture_sim_vblanks(const char *device_str, vbl_info *info, int num_pipes)
+{
+	int64_t next[VSYNC_ALL_PIPES];
+
+	if (sim_vblank_open(device_str)) {
+		return 1;
+	}
+
+	uint64_t now_ns = monotonic_ns();
+	for (int p = 0; p < num_pipes; p++) {
+		if (info[p].pipe >= sim_vblank_pipes()) {
+			ERR("Pipe %d is not simulated\n", info[p].pipe);
+			return 1;
+		}
+		info[p].backend = VBLANK_BACKEND_SIM;
+		next[p] = sim_vblank_next(info[p].pipe, now_ns);
+	}
+
+	while (!lib_client_done) {
+		// Find the earliest frame among the pipes still capturing
+		int first = -1;
+		uint64_t due_ns = 0;
+		for (int p = 0; p < num_pipes; p++) {
+			if (info[p].done) {
+				continue;
+			}
+			uint64_t t = sim_vblank_time(info[p].pipe, next[p]);
+			if (first < 0 || t < due_ns) {
+				first = p;
+				due_ns = t;
+			}
+		}
+		if (first < 0) {
+			break;
+		}
+
+		// Sleep in short steps, a PLL change may move the frame meanwhile
+		now_ns = monotonic_ns();
+		if (due_ns > now_ns) {
+			uint64_t sleep_ns = std::min(due_ns - now_ns, (uint64_t) SIM_MAX_SLEEP_NS);
+			struct timespec ts = { .tv_sec = 0, .tv_nsec = (long) sleep_ns };
+			nanosleep(&ts, NULL);
+			continue;
+		}
+
+		int64_t k = next[first]++;
+		if (sim_vblank_missed(info[first].pipe, k)) {
+			continue;
+		}
+		record_vblank(&info[first], timescale_convert(due_ns), k);
+		flush_streams(info, num_pipes);
+	}
+
+	// Hand over any partial batch of a stream that was cut short
+	flush_streams(info, num_pipes);
+	return 0;
+}
+
+/**
+* @brief
+* This function runs the capture loop for several pipes at the same time. A
+* vblank event is queued for every pipe on a single file descriptor and the
+* events are demultiplexed into the per-pipe vbl_info as they arrive, so the
+* timestamps of all pipes belong to the same frames and are collected within
+* the time it takes to capture a single pipe.
+* Events are requested through the CRTC sequence interface, which reports 64
+* bit frame sequence numbers and nanosecond timestamps. Kernels without it
+* fall back to drmWaitVBlank which has microsecond resolution. A simulated
+* device is captured by capture_sim_vblanks instead.
+* @param *device_str - The device to capture on, e.g. /dev/dri/card0
+* @param *info - Capture state of each pipe
+* @param num_pipes - Number of entries in info
+* @return
+* - 0 == SUCCESS
+* - 1 = ERROR
+*/
+static int capture_vblanks(const char *device_str, vbl_info *info, int num_pipes)
+{
+	metrics_timer t(VSYNC_METRIC_CAPTURE_US, 1000);
+	int ret;
+	drmEventContext evctx;
+
+	if (device_str == NULL || strlen(device_str) == 0) {
+		ERR("Invalid device string (NULL or empty)\n");
+		return 1;
+	}
+
+	if (is_sim_device(device_str)) {
+		return capture_sim_vblanks(device_str, info, num_pipes);
+	}
+
+	int fd = open_device(device_str);
+	if(fd < 0) {
+		ERR("Couldn't open %s. Is i915 installed?\n", device_str);
+		return 1;
+	}
+
+	// Use CRTC sequence events if the CRTCs can be resolved and the kernel
+	// accepts the first request, otherwise fall back to the legacy interface
+	if (find_crtc_ids(fd, info, num_pipes) || queue_first_vblank(fd, &info[0])) {
+		DBG("CRTC sequence events unavailable, using drmWaitVBlank\n");
+		for (int p = 0; p < num_pipes; p++) {
+			info[p].backend = VBLANK_BACKEND_LEGACY;
+		}
+		if ((ret = queue_first_vblank(fd, &info[0]))) {
+			ERR("drmWaitVBlank (relative, event) failed on pipe %d ret: %i\n", info[0].pipe, ret);
+			close_device(fd);
+			return 1;
+		}
+	}
+
+	// Queue an event for frame + 1 on the remaining pipes before waiting on any of them
+	for (int p = 1; p < num_pipes; p++) {
+		ret = queue_first_vblank(fd, &info[p]);
+		if (ret) {
+			ERR("Failed to queue vblank event on pipe %d ret: %i\n", info[p].pipe, ret);
+			close_device(fd);
+			return 1;
+		}
+	}
+
+	// Set up our event handler
+	memset(&evctx, 0, sizeof evctx);
+	evctx.version = DRM_EVENT_CONTEXT_VERSION;
+	evctx.vblank_handler = vblank_handler;
+	evctx.page_flip_handler = NULL;
+	evctx.sequence_handler = sequence_handler;
+
+	// Wait for events on the DRM fd until every pipe is done. Each wait is
+	// bounded by a few frame periods, after which the next vblank is flagged
+	// as late, and a bounded capture additionally has to finish within the
+	// time its frames take plus some slack. An unbounded stream runs until
+	// its handler stops it or the client shuts the library down.
+	uint64_t period_ns = longest_frame_period(fd, info, num_pipes);
+	uint64_t wait_ns = std::max((uint64_t) VBLANK_WAIT_PERIODS * period_ns,
+		(uint64_t) VBLANK_MIN_WAIT_MS * 1000000);
+	uint64_t deadline_ns = 0;
+	int frames = 0, timeouts = 0;
+	for (int p = 0; p < num_pipes; p++) {
+		if (!info[p].total) {
+			frames = 0;
+			break;
+		}
+		frames = std::max(frames, info[p].total);
+	}
+	if (frames) {
+		deadline_ns = monotonic_ns() + wait_ns +
+			(uint64_t) (frames + VBLANK_DEADLINE_SLACK) * period_ns;
+	}
+
+	struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+
+	ret = 0;
+	while(1) {
+		bool pending = false;
+		for (int p = 0; p < num_pipes; p++) {
+			if (!info[p].done) {
+				pending = true;
+				break;
+			}
+		}
+		if (!pending || lib_client_done) {
+			break;
+		}
+
+		uint64_t timeout_ns = wait_ns;
+		if (deadline_ns) {
+			uint64_t now_ns = monotonic_ns();
+			if (now_ns >= deadline_ns) {
+				ERR("Capture did not complete in %.3f ms\n",
+					(frames + VBLANK_DEADLINE_SLACK) * period_ns / 1000000.0);
+				ret = 1;
+				break;
+			}
+			timeout_ns = std::min(timeout_ns, deadline_ns - now_ns);
+		}
+
+		struct timespec timeout = { .tv_sec = (time_t) (timeout_ns / 1000000000),
+			.tv_nsec = (long) (timeout_ns % 1000000000) };
+		ret = ppoll(&pfd, 1, &timeout, NULL);
+
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ERR("ppoll failed: %s\n", strerror(errno));
+			ret = 1;
+			break;
+		}
+
+		if (ret == 0) {
+			DBG("No vblank within %.3f ms\n", timeout_ns / 1000000.0);
+			if (++timeouts >= VBLANK_MAX_TIMEOUTS) {
+				ERR("No vblank received after %d attempts\n", timeouts);
+				ret = 1;
+				break;
+			}
+			for (int p = 0; p < num_pipes; p++) {
+				info[p].pending_flags |= VSYNC_FLAG_TIMEOUT;
+			}
+			continue;
+		}
+		timeouts = 0;
+
+		if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			ERR("Error on DRM fd (revents 0x%x)\n", pfd.revents);
+			ret = 1;
+			break;
+		}
+
+		ret = drmHandleEvent(fd, &evctx);
+		if (ret) {
+			ERR("drmHandleEvent failed: %i\n", ret);
+			ret = 1;
+			break;
+		}
+
+		flush_streams(info, num_pipes);
+	}
+
+	// Hand over any partial batch of a stream that was cut short
+	flush_streams(info, num_pipes);
+
+	close_device(fd);
+	return ret;
+}
+
+/**
+* @brief
+* This function initializes the capture state of a pipe.
+* @param *info - The capture state to initialize
+* @param pipe - The pipe whose vblanks are needed
+* @param *samples - Buffer receiving the vblanks
+* @param size - Capacity of samples
+* @param total - Number of vblanks needed, 0 = until stopped
+* @param handler - Stream handler receiving full buffers, NULL if none
+* @param *user_data - Private data passed to the handler
+* @return void
+*/
+static void init_vbl_info(vbl_info *info, int pipe, vsync_sample *samples, int size,
+						int total, vsync_stream_handler handler, void *user_data)
+{
+	info->samples = samples;
+	info->size = size;
+	info->counter = 0;
+	info->total = total;
+	info->captured = 0;
+	info->done = false;
+	info->last_sequence = 0;
+	info->pending_flags = 0;
+	info->pipe = pipe;
+	info->crtc_id = 0;
+	info->backend = VBLANK_BACKEND_CRTC_SEQUENCE;
+	info->handler = handler;
+	info->user_data = user_data;
+}
+
+/**
+* @brief
+* This function gets a list of vsyncs for several pipes at the same time,
+* with a nanosecond timestamp and frame sequence number for each of them.
+* The arrays are owned by the caller and may have any size.
+* @param *device_str - The device to capture on, e.g. /dev/dri/card0
+* @param **sample_arrays - One array per pipe in which vsyncs need to be
+* given. sample_arrays[i] receives the vsyncs of pipes[i].
+* @param size - The size of each array. This is also the number of times that
+* we need to get the next few vsync timestamps on every pipe.
+* @param *pipes - The pipes whose vblanks are needed
+* @param num_pipes - Number of entries in pipes and sample_arrays
+* @return
+* - 0 == SUCCESS
+* - 1 = ERROR
+*/
+int get_vsync_samples(const char *device_str, vsync_sample **sample_arrays, int size,
+						const int *pipes, int num_pipes)
+{
+	vbl_info info[VSYNC_ALL_PIPES];
+
+	if (sample_arrays == NULL) {
+		ERR("NULL sample_arrays pointer provided\n");
+		return 1;
+	}
+
+	if (check_pipes(pipes, num_pipes)) {
+		return 1;
+	}
+
+	if (size <= 0) {
+		ERR("Invalid size (must be > 0): %d\n", size);
+		return 1;
+	}
+
+	for (int p = 0; p < num_pipes; p++) {
+		if (sample_arrays[p] == NULL) {
+			ERR("NULL sample array pointer provided for pipe %d\n", pipes[p]);
+			return 1;
+		}
+		init_vbl_info(&info[p], pipes[p], sample_arrays[p], size, size, NULL, NULL);
+	}
+
+	return capture_vblanks(device_str, info, num_pipes);
+}
+
+/**
+* @brief
+* This function streams vsyncs of several pipes to a handler. vsyncs are
+* collected in a fixed buffer of VSYNC_STREAM_BATCH entries per pipe, so a
+* capture of any length runs without allocating memory. The buffer is
+* handed to the handler as soon as the pending events have been handled,
+* which delivers each vblank as it arrives, usually one per call. Only a
+* backlog of events fills it up and delivers up to VSYNC_STREAM_BATCH.
+* @param *device_str - The device to capture on, e.g. /dev/dri/card0
+* @param *pipes - The pipes whose vblanks are needed
+* @param num_pipes - Number of entries in pipes
+* @param count - Number of vsyncs to stream per pipe. 0 streams until the
+* handler returns non-zero for every pipe or the client calls shutdown_lib.
+* @param handler - Called with the vsyncs of a pipe as they arrive. Returning
+* non-zero stops the stream on that pipe. The samples are only valid during
+* the call.
+* @param *user_data - Private data passed to the handler
+* @return
+* - 0 == SUCCESS
+* - 1 = ERROR
+*/
+int stream_vsync(const char *device_str, const int *pipes, int num_pipes, int count,
+						vsync_stream_handler handler, void *user_data)
+{
+	vbl_info info[VSYNC_ALL_PIPES];
+	vsync_sample batch[VSYNC_ALL_PIPES][VSYNC_STREAM_BATCH];
+
+	if (handler == NULL) {
+		ERR("NULL stream handler provided\n");
+		return 1;
+	}
+
+	if (check_pipes(pipes, num_pipes)) {
+		return 1;
+	}
+
+	if (count < 0) {
+		ERR("Invalid count (must be >= 0): %d\n", count);
+		return 1;
+	}
+
+	for (int p = 0; p < num_pipes; p++) {
+		init_vbl_info(&info[p], pipes[p], batch[p], VSYNC_STREAM_BATCH, count,
+			handler, user_data);
+	}
+
+	return capture_vblanks(device_str, info, num_pipes);
+}
+
+typedef struct _usec_sink {
+	uint64_t **vsync_arrays;
+	const int *pipes;
+	int num_pipes;
+	int filled[VSYNC_ALL_PIPES];
+} usec_sink;
+
+/**
+* @brief
+* Stream handler which stores the timestamps of a batch in microseconds in
+* the caller's array of the pipe.
+* @param pipe - The pipe the batch belongs to
+* @param *samples - The batch
+* @param count - Number of entries in samples
+* @param *user_data - Pointer to a usec_sink
+* @return 0 to keep streaming
+*/
+static int store_usec(int pipe, const vsync_sample *samples, int count, void *user_data)
+{
+	usec_sink *sink = (usec_sink *) user_data;
+
+	for (int p = 0; p < sink->num_pipes; p++) {
+		if (sink->pipes[p] != pipe) {
+			continue;
+		}
+		for (int i = 0; i < count; i++) {
+			sink->vsync_arrays[p][sink->filled[p]++] = samples[i].timestamp_ns / 1000;
+		}
+		break;
+	}
+	return 0;
+}
+
+/**
+* @brief
+* This function gets a list of vsyncs for several pipes at the same time and
+* provides their timestamps in microseconds. See get_vsync_samples.
+* @param *device_str - The device to capture on, e.g. /dev/dri/card0
+* @param **vsync_arrays - One array per pipe in which vsync timestamps need to
+* be given. vsync_arrays[i] receives the timestamps of pipes[i].
+* @param size - The size of each array. This is also the number of times that
+* we need to get the next few vsync timestamps on every pipe.
+* @param *pipes - The pipes whose vblanks are needed
+* @param num_pipes - Number of entries in pipes and vsync_arrays
+* @return
+* - 0 == SUCCESS
+* - 1 = ERROR
+*/
+int get_vsync_multi(const char *device_str, uint64_t **vsync_arrays, int size,
+						const int *pipes, int num_pipes)
+{
+	usec_sink sink;
+
+	if (vsync_arrays == NULL) {
+		ERR("NULL vsync_arrays pointer provided\n");
+		return 1;
+	}
+
+	if (check_pipes(pipes, num_pipes)) {
+		return 1;
+	}
+
+	if (size <= 0) {
+		ERR("Invalid size (must be > 0): %d\n", size);
+		return 1;
+	}
+
+	for (int p = 0; p < num_pipes; p++) {
+		if (vsync_arrays[p] == NULL) {
+			ERR("NULL vsync_array pointer provided for pipe %d\n", pipes[p]);
+			return 1;
+		}
+		sink.filled[p] = 0;
+	}
+	sink.vsync_arrays = vsync_arrays;
+	sink.pipes = pipes;
+	sink.num_pipes = num_pipes;
+
+	return stream_vsync(device_str, pipes, num_pipes, size, store_usec, &sink);
+}
+
+/**
+* @brief
+* This function gets a list of vsyncs for the number of times
+* indicated by the caller and provide their timestamps in the array provided
+* @param *vsync_array - The array in which vsync timestamps need to be given
+* @param size - The size of this array. This is also the number of times that we
+* need to get the next few vsync timestamps.
+* @param pipe - This is the pipe whose vblank is needed. Defaults to 0 if not
+* provided.
+* @return
+* - 0 == SUCCESS
+* - 1 = ERROR
+*/
+int get_vsync(const char *device_str, uint64_t *vsync_array, int size, int pipe)
+{
+	return get_vsync_multi(device_str, &vsync_array, size, &pipe, 1);
+}
+
+typedef struct _interval_sink {
+	uint64_t first_ns;
+	uint64_t last_ns;
+	int count;
+} interval_sink;
+
+/**
+* @brief
+* Stream handler which only keeps the first and last timestamp of a pipe.
+* @param pipe - The pipe the batch belongs to
+* @param *samples - The batch
+* @param count - Number of entries in samples
+* @param *user_data - Pointer to an interval_sink
+* @return 0 to keep streaming
+*/
+static int track_interval(int pipe, const vsync_sample *samples, int count, void *user_data)
+{
+	interval_sink *sink = (interval_sink *) user_data;
+
+	if (count <= 0) {
+		return 0;
+	}
+	if (!sink->count) {
+		sink->first_ns = samples[0].timestamp_ns;
+	}
+	sink->last_ns = samples[count - 1].timestamp_ns;
+	sink->count += count;
+	return 0;
+}
+
+/**
+* @brief
+* Returns the median of a list of values. The list is reordered.
+* @param &values - The values, must not be empty
+* @return The median
+*/
+static double median(std::vector<double> &values)
+{
+	size_t mid = values.size() / 2;
+	std::nth_element(values.begin(), values.begin() + mid, values.end());
+	double m = values[mid];
+	if (values.size() % 2 == 0) {
+		m = (m + *std::max_element(values.begin(), values.begin() + mid)) / 2;
+	}
+	return m;
+}
+
+/**
+* @brief
+* This function checks a batch of vsyncs before it is used for any
+* calculation. Sequence gaps are flagged as missed frames. The frame period
+* ending at each vsync is then compared against the median period of the
+* batch and vsyncs deviating by more than VBLANK_OUTLIER_MADS scaled median
+* absolute deviations are flagged as outliers, which catches the late or
+* early vblanks seen around PSR and DC state transitions. Flags already set
+* by the capture are kept.
+* @param *samples - The vsyncs to check
+* @param count - Number of entries in samples
+* @return The OR of the flags of all samples, 0 if the batch can be trusted
+*/
+uint32_t check_vsync_samples(vsync_sample *samples, int count)
+{
+	uint32_t quality = 0;
+	std::vector<double> periods, deviations;
+
+	if (samples == NULL || count <= 0) {
+		return 0;
+	}
+
+	for (int i = 1; i < count; i++) {
+		uint64_t frames = 1;
+		if (samples[i].sequence > samples[i-1].sequence) {
+			frames = samples[i].sequence - samples[i-1].sequence;
+		}
+		if (frames > 1) {
+			samples[i].flags |= VSYNC_FLAG_MISSED;
+		}
+		periods.push_back(((double) samples[i].timestamp_ns -
+			(double) samples[i-1].timestamp_ns) / frames);
+	}
+
+	if (periods.size() >= VBLANK_OUTLIER_MIN_PERIODS) {
+		std::vector<double> sorted(periods);
+		double med = median(sorted);
+		for (size_t i = 0; i < periods.size(); i++) {
+			deviations.push_back(fabs(periods[i] - med));
+		}
+		// 1.4826 scales the MAD to a standard deviation for normal jitter
+		double limit = std::max(VBLANK_OUTLIER_MADS * 1.4826 * median(deviations),
+			VBLANK_OUTLIER_MIN_RATIO * med);
+		for (size_t i = 0; i < periods.size(); i++) {
+			if (periods[i] <= 0 || fabs(periods[i] - med) > limit) {
+				samples[i+1].flags |= VSYNC_FLAG_OUTLIER;
+			}
+		}
+	}
+
+	for (int i = 0; i < count; i++) {
+		quality |= samples[i].flags;
+	}
+	return quality;
+}
+
+/**
+ * @brief
+ * This function collects vblank timestamps and prints average interval between them
+ *
+ * @param device_str - The device string, e.g. "/dev/dri/card0"
+ * @param pipe - The pipe number
+ * @param size - The number of timestamps to collect
+ * @return double - The average vblank interval in milliseconds, or 0.0 on error
+ */
+double get_vblank_interval(const char *device_str, int pipe, int size)
+{
+	interval_sink sink = { 0, 0, 0 };
+
+	if (size < 2) {
+		ERR("Requested size is not sufficient: size=%d\n", size);
+		return 0.0;
+	}
+
+	if (stream_vsync(device_str, &pipe, 1, size, track_interval, &sink) == 0 && sink.count == size) {
+		// Intervals telescope, so their average only needs the first and last vblank
+		return (sink.last_ns - sink.first_ns) / 1000.0 / (size - 1) / 1000.0; // Convert to milliseconds
+	}
+	return 0.0;
+}
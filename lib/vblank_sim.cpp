@@ -0,0 +1,512 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <debug.h>
+#include <clocks.h>
+#include "mmio.h"
+#include "combo.h"
+#include "vblank_sim.h"
+
+typedef struct _sim_config {
+	char spec[128];         // Options of the device string the clock was set up with
+	double period_us;       // Nominal frame period
+	double ppm;             // Rate error of the display clock, positive is fast
+	double jitter_us;       // Sigma of normal, half width of uniform jitter
+	int dist;               // SIM_JITTER_*
+	double miss;            // Probability of a vblank not being reported
+	double phase_us;        // Offset of the frame grid from the monotonic epoch
+	int pipes;              // Simulated pipes
+	uint64_t seed;          // Seed of the jitter and the missed frames
+} sim_config;
+
+// The frame grid of a pipe since its last PLL change. It is a seqlock
+// rather than a mutex because PLL resets are written from the timer
+// signal, which may interrupt a capture reading the grid.
+typedef struct _sim_pipe {
+	std::atomic<uint32_t> seq;
+	std::atomic<int64_t> base_k;    // Frame the grid starts at
+	std::atomic<double> base_ns;    // Time of that frame since sim_epoch_ns
+	std::atomic<double> period_ns;  // Frame period of the current PLL clock
+	std::atomic<double> ref_pll;    // PLL clock of the nominal period, 0 = not known
+	std::atomic<double> pll;        // PLL clock programmed last, 0 = not known
+} sim_pipe;
+
+static sim_config sim_cfg;
+static sim_pipe sim_pipes[SIM_MAX_PIPES];
+static int64_t sim_epoch_ns;
+static bool sim_open = false;
+
+/**
+* @brief
+* Hashes a frame of a pipe into a uniform number, so that the jitter and the
+* missed frames do not depend on when or how often a frame is looked at.
+* @param pipe - The pipe of the frame
+* @param k - The frame
+* @param stream - Selects one of several independent numbers of the frame
+* @return A number in (0, 1]
+*/
+static double sim_uniform(int pipe, int64_t k, int stream)
+{
+	uint64_t z = sim_cfg.seed + ((uint64_t) k * 4 + stream) * 0x9E3779B97F4A7C15ULL +
+		(uint64_t) pipe * 0xD1B54A32D192ED03ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+	return ((z >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/**
+* @brief
+* Returns the jitter of the timestamp of a frame.
+* @param pipe - The pipe of the frame
+* @param k - The frame
+* @return Jitter in nanoseconds
+*/
+static double sim_jitter_ns(int pipe, int64_t k)
+{
+	if (sim_cfg.jitter_us <= 0) {
+		return 0;
+	}
+
+	double u1 = sim_uniform(pipe, k, 0);
+	if (sim_cfg.dist == SIM_JITTER_UNIFORM) {
+		return (2 * u1 - 1) * sim_cfg.jitter_us * 1000;
+	}
+	// Box-Muller
+	double u2 = sim_uniform(pipe, k, 1);
+	return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2) * sim_cfg.jitter_us * 1000;
+}
+
+/**
+* @brief
+* Returns the frame period of a pipe at the PLL clock programmed last. A
+* faster PLL clock gives a shorter period.
+* @param pipe - The pipe
+* @return The frame period in nanoseconds
+*/
+static double sim_period_ns(int pipe)
+{
+	double ref = sim_pipes[pipe].ref_pll.load();
+	double pll = sim_pipes[pipe].pll.load();
+	double period = sim_cfg.period_us * 1000 / (1 + sim_cfg.ppm / 1e6);
+
+	return ref > 0 && pll > 0 ? period * ref / pll : period;
+}
+
+/**
+* @brief
+* Reads a consistent copy of the frame grid of a pipe.
+* @param pipe - The pipe
+* @param *base_k - Receives the frame the grid starts at
+* @param *base_ns - Receives the time of that frame since sim_epoch_ns
+* @param *period_ns - Receives the frame period
+* @return void
+*/
+static void sim_load(int pipe, int64_t *base_k, double *base_ns, double *period_ns)
+{
+	sim_pipe *sp = &sim_pipes[pipe];
+	uint32_t seq;
+
+	do {
+		seq = sp->seq.load(std::memory_order_acquire);
+		*base_k = sp->base_k.load(std::memory_order_relaxed);
+		*base_ns = sp->base_ns.load(std::memory_order_relaxed);
+		*period_ns = sp->period_ns.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((seq & 1) || seq != sp->seq.load(std::memory_order_relaxed));
+}
+
+/**
+* @brief
+* Replaces the frame grid of a pipe.
+* @param pipe - The pipe
+* @param base_k - The frame the grid starts at
+* @param base_ns - The time of that frame since sim_epoch_ns
+* @param period_ns - The frame period
+* @return void
+*/
+static void sim_store(int pipe, int64_t base_k, double base_ns, double period_ns)
+{
+	sim_pipe *sp = &sim_pipes[pipe];
+	uint32_t seq = sp->seq.load(std::memory_order_relaxed);
+
+	sp->seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	sp->base_k.store(base_k, std::memory_order_relaxed);
+	sp->base_ns.store(base_ns, std::memory_order_relaxed);
+	sp->period_ns.store(period_ns, std::memory_order_relaxed);
+	sp->seq.store(seq + 2, std::memory_order_release);
+}
+
+/**
+* @brief
+* Parses the options of a simulated device string.
+* @param *options - Comma separated key=value pairs
+* @param *cfg - Receives the configuration
+* @return
+* - 0 == SUCCESS
+* - 1 = FAILURE
+*/
+static int sim_parse(const char *options, sim_config *cfg)
+{
+	char buf[sizeof(cfg->spec)], *save = NULL;
+
+	cfg->period_us = SIM_PERIOD_US;
+	cfg->ppm = 0;
+	cfg->jitter_us = 0;
+	cfg->dist = SIM_JITTER_NORMAL;
+	cfg->miss = 0;
+	cfg->phase_us = 0;
+	cfg->pipes = 1;
+	cfg->seed = getpid();
+
+	if (strlen(options) >= sizeof(buf)) {
+		ERR("Simulated device options too long: %s\n", options);
+		return 1;
+	}
+	strcpy(buf, options);
+
+	for (char *opt = strtok_r(buf, ",", &save); opt; opt = strtok_r(NULL, ",", &save)) {
+		char *val = strchr(opt, '=');
+		char *end = NULL;
+		double num = 0;
+
+		if (!val) {
+			ERR("Simulated device option without a value: %s\n", opt);
+			return 1;
+		}
+		*val++ = '\0';
+
+		if (!strcmp(opt, "dist")) {
+			if (!strcmp(val, "normal")) {
+				cfg->dist = SIM_JITTER_NORMAL;
+			} else if (!strcmp(val, "uniform")) {
+				cfg->dist = SIM_JITTER_UNIFORM;
+			} else {
+				ERR("Unknown jitter distribution: %s\n", val);
+				return 1;
+			}
+			continue;
+		}
+
+		num = strtod(val, &end);
+		if (end == val || *end) {
+			ERR("Invalid value of simulated device option %s: %s\n", opt, val);
+			return 1;
+		}
+
+		if (!strcmp(opt, "period") && num > 0) {
+			cfg->period_us = num;
+		} else if (!strcmp(opt, "ppm") && fabs(num) < 1000000) {
+			cfg->ppm = num;
+		} else if (!strcmp(opt, "jitter") && num >= 0) {
+			cfg->jitter_us = num;
+		} else if (!strcmp(opt, "miss") && num >= 0 && num < 1) {
+			cfg->miss = num;
+		} else if (!strcmp(opt, "phase")) {
+			cfg->phase_us = num;
+		} else if (!strcmp(opt, "pipes") && num >= 1 && num <= SIM_MAX_PIPES) {
+			cfg->pipes = (int) num;
+		} else if (!strcmp(opt, "seed") && num >= 0) {
+			cfg->seed = (uint64_t) num;
+		} else {
+			ERR("Invalid simulated device option %s=%s\n", opt, val);
+			return 1;
+		}
+	}
+
+	strcpy(cfg->spec, options);
+	return 0;
+}
+
+/**
+* @brief
+* Tells whether a device string selects the simulated display, i.e. it is
+* "sim" or "sim:" followed by options.
+* @param *device_str - The device string
+* @return true for the simulated display
+*/
+bool is_sim_device(const char *device_str)
+{
+	size_t len = strlen(SIM_DEVICE);
+
+	return device_str && !strncmp(device_str, SIM_DEVICE, len) &&
+		(device_str[len] == '\0' || device_str[len] == ':');
+}
+
+/**
+* @brief
+* Sets up the clock of the simulated display from a device string of the
+* form sim[:key=value,...]. The frames of every pipe start on a grid of the
+* nominal period and the given phase from the monotonic epoch, so displays
+* simulated by several processes on one host start with a known offset,
+* and drift by the given rate error from there. A device string with the
+* options already in use leaves the clock running.
+* @param *device_str - The device string
+* @return
+* - 0 == SUCCESS
+* - 1 = FAILURE
+*/
+int sim_vblank_open(const char *device_str)
+{
+	const char *options = "";
+	sim_config cfg;
+
+	if (!is_sim_device(device_str)) {
+		ERR("Not a simulated device: %s\n", device_str ? device_str : "(null)");
+		return 1;
+	}
+	if (device_str[strlen(SIM_DEVICE)] == ':') {
+		options = device_str + strlen(SIM_DEVICE) + 1;
+	}
+	if (sim_open && !strcmp(options, sim_cfg.spec)) {
+		return 0;
+	}
+	if (sim_parse(options, &cfg)) {
+		return 1;
+	}
+
+	sim_cfg = cfg;
+	sim_epoch_ns = (int64_t) monotonic_ns();
+
+	long double nominal_ns = (long double) sim_cfg.period_us * 1000;
+	long double phase_ns = (long double) sim_cfg.phase_us * 1000;
+	int64_t k = (int64_t) floorl((sim_epoch_ns - phase_ns) / nominal_ns);
+	double base_ns = (double) (phase_ns + k * nominal_ns - sim_epoch_ns);
+	for (int pipe = 0; pipe < SIM_MAX_PIPES; pipe++) {
+		sim_store(pipe, k, base_ns, sim_period_ns(pipe));
+	}
+	sim_open = true;
+
+	INFO("Simulated display: %d pipe(s), period %.3f us, %+.3f ppm, %s jitter %.3f us, miss %g\n",
+		sim_cfg.pipes, sim_cfg.period_us, sim_cfg.ppm,
+		sim_cfg.dist == SIM_JITTER_UNIFORM ? "uniform" : "normal", sim_cfg.jitter_us,
+		sim_cfg.miss);
+	return 0;
+}
+
+/**
+* @brief
+* Starts the frame grid of a pipe over at its last frame, so that the frames
+* after it follow the PLL clock programmed last.
+* @param pipe - The pipe
+* @return void
+*/
+static void sim_rebase(int pipe)
+{
+	int64_t base_k;
+	double base_ns, period_ns;
+
+	sim_load(pipe, &base_k, &base_ns, &period_ns);
+	double now_ns = (double) ((int64_t) monotonic_ns() - sim_epoch_ns);
+	int64_t n = (int64_t) floor((now_ns - base_ns) / period_ns);
+	if (n < 0) {
+		n = 0;
+	}
+	sim_store(pipe, base_k + n, base_ns + n * period_ns, sim_period_ns(pipe));
+}
+
+/**
+* @brief
+* Tells the simulated display that the PLL of a pipe has been programmed.
+* The first clock told for a pipe is the one of its nominal period, later
+* ones change the frame period in inverse proportion from the next frame on.
+* It only touches atomics so that it is safe in the timer signal.
+* @param pipe - The pipe
+* @param pll_clock - The PLL clock read back from the registers
+* @return void
+*/
+void sim_vblank_pll(int pipe, double pll_clock)
+{
+	if (pipe < 0 || pipe >= SIM_MAX_PIPES || pll_clock <= 0) {
+		return;
+	}
+
+	sim_pipe *sp = &sim_pipes[pipe];
+	if (sp->ref_pll.load() <= 0) {
+		sp->ref_pll.store(pll_clock);
+	}
+	sp->pll.store(pll_clock);
+	if (sim_open) {
+		sim_rebase(pipe);
+	}
+}
+
+/**
+* @brief
+* Forgets the PLL clocks of the pipes when the library lets go of the
+* simulated registers. The display keeps running at its nominal period.
+* @param None
+* @return void
+*/
+void sim_vblank_release(void)
+{
+	for (int pipe = 0; pipe < SIM_MAX_PIPES; pipe++) {
+		sim_pipes[pipe].ref_pll.store(0);
+		sim_pipes[pipe].pll.store(0);
+		if (sim_open) {
+			sim_rebase(pipe);
+		}
+	}
+}
+
+/**
+* @brief
+* Seeds the simulated MMIO range with the registers of the display: the
+* transcoders of the simulated pipes enabled on DDI A and B of TGL, driven
+* by combo PLLs at the nominal clock.
+* @param None
+* @return void
+*/
+void sim_vblank_seed(void)
+{
+	reg trans_ddi_func_ctl[SIM_MAX_PIPES] = {
+		REG(TRANS_DDI_FUNC_CTL_A),
+		REG(TRANS_DDI_FUNC_CTL_B),
+	};
+
+	// DDI A runs from DPLL0 and DDI B from DPLL1, the clocks of both are on
+	WRITE_OFFSET_DWORD(DPCLKA_CFGCR0, 1 << 2);
+	for (int pipe = 0; pipe < sim_cfg.pipes; pipe++) {
+		WRITE_OFFSET_DWORD(combo_table[pipe].cfgcr0.addr, SIM_COMBO_CFGCR0);
+		// Enabled in HDMI mode, so that the combo PHY rather than M & N is used
+		WRITE_OFFSET_DWORD(trans_ddi_func_ctl[pipe].addr, BIT(31) | (pipe + 1) << 27);
+	}
+}
+
+/**
+* @brief
+* Returns the number of simulated pipes.
+* @param None
+* @return The number of pipes, 0 if the display is not set up
+*/
+int sim_vblank_pipes(void)
+{
+	return sim_open ? sim_cfg.pipes : 0;
+}
+
+/**
+* @brief
+* Finds the first frame of a pipe after a point in time.
+* @param pipe - The pipe
+* @param now_ns - The time on the monotonic clock
+* @return The frame
+*/
+int64_t sim_vblank_next(int pipe, uint64_t now_ns)
+{
+	int64_t base_k;
+	double base_ns, period_ns;
+
+	sim_load(pipe, &base_k, &base_ns, &period_ns);
+	double t = (double) ((int64_t) now_ns - sim_epoch_ns);
+	return base_k + (int64_t) floor((t - base_ns) / period_ns) + 1;
+}
+
+/**
+* @brief
+* Returns the time of a frame of a pipe, jitter included. Frames before the
+* last PLL change are placed on the current grid too, so the caller should
+* only ask for frames from sim_vblank_next on.
+* @param pipe - The pipe
+* @param k - The frame
+* @return Time of the frame on the monotonic clock in nanoseconds
+*/
+uint64_t sim_vblank_time(int pipe, int64_t k)
+{
+	int64_t base_k;
+	double base_ns, period_ns;
+
+	sim_load(pipe, &base_k, &base_ns, &period_ns);
+	double t = base_ns + (k - base_k) * period_ns + sim_jitter_ns(pipe, k);
+	return (uint64_t) (sim_epoch_ns + llround(t));
+}
+
+/**
+* @brief
+* Tells whether a frame of a pipe is missed, i.e. never reported.
+* @param pipe - The pipe
+* @param k - The frame
+* @return true if the frame is missed
+*/
+bool sim_vblank_missed(int pipe, int64_t k)
+{
+	return sim_cfg.miss > 0 && sim_uniform(pipe, k, 2) < sim_cfg.miss;
+}
+
+/**
+* @brief
+* Describes the display of a simulated pipe.
+* @param pipe - The pipe
+* @param *mode - Receives the device and the mode timing of the pipe
+* @return
+* - 0 == SUCCESS
+* - 1 = FAILURE
+*/
+int sim_pipe_mode(int pipe, vsync_pipe_mode *mode)
+{
+	if (pipe < 0 || pipe >= sim_vblank_pipes() || !mode) {
+		ERR("Pipe %d is not simulated\n", pipe);
+		return 1;
+	}
+
+	memset(mode, 0, sizeof(*mode));
+	snprintf(mode->pci_slot, sizeof(mode->pci_slot), "%s", SIM_PCI_SLOT);
+	mode->device_id = SIM_DEVICE_ID;
+	mode->clock_khz = (uint32_t) lround((double) SIM_HTOTAL * SIM_VTOTAL * 1000 /
+		sim_cfg.period_us);
+	mode->hdisplay = SIM_HDISPLAY;
+	mode->vdisplay = SIM_VDISPLAY;
+	mode->htotal = SIM_HTOTAL;
+	mode->vtotal = SIM_VTOTAL;
+	return 0;
+}
+
+/**
+* @brief
+* Prints the pipes of the simulated display the way print_drm_info prints
+* the CRTCs of a DRM device.
+* @param None
+* @return void
+*/
+void sim_print_info(void)
+{
+	INFO("DRM Info (simulated):\n");
+	INFO("  CRTCs found: %d\n", sim_vblank_pipes());
+	for (int pipe = 0; pipe < sim_vblank_pipes(); pipe++) {
+		INFO("  \tPipe: %2d, CRTC ID: %4d, Mode Valid: %3s, Mode Name: %dx%d, Position: (%4d, %4d), Resolution: %4dx%-4d, Refresh Rate: %.2f Hz\n",
+			pipe, pipe + 1, "Yes", SIM_HDISPLAY, SIM_VDISPLAY, 0, 0, SIM_HDISPLAY,
+			SIM_VDISPLAY, 1000000.0 / sim_cfg.period_us);
+	}
+	INFO("  Clock: %+.3f ppm, %s jitter %.3f us, missed frames %g\n", sim_cfg.ppm,
+		sim_cfg.dist == SIM_JITTER_UNIFORM ? "uniform" : "normal", sim_cfg.jitter_us,
+		sim_cfg.miss);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef _VBLANK_SIM_H
+#define _VBLANK_SIM_H
+
+#include <stdint.h>
+#include <vsyncalter.h>
+
+#define SIM_DEVICE              "sim"      // Device string prefix of the simulated display
+#define SIM_MAX_PIPES           2          // DDI A and B, the combo PHYs of TGL
+#define SIM_PLATFORM            "TGL"      // Platform whose registers are simulated
+#define SIM_PERIOD_US           16666.667  // Default frame period
+#define SIM_HDISPLAY            1920       // Mode of the simulated display
+#define SIM_VDISPLAY            1080
+#define SIM_HTOTAL              2200
+#define SIM_VTOTAL              1125
+#define SIM_PCI_SLOT            "sim"
+#define SIM_DEVICE_ID           0x9A49     // A TGL device id
+// Combo PLL of the simulated pipes: 8.1 GHz DCO = 19.2 MHz * (421 + 0x3800 * 2 / 0x8000)
+#define SIM_COMBO_CFGCR0        (0x1A5 | 0x3800 << 10)
+#define SIM_MAX_SLEEP_NS        2000000    // Longest sleep before the clock is looked at again
+
+enum {
+	SIM_JITTER_NORMAL,
+	SIM_JITTER_UNIFORM,
+};
+
+bool is_sim_device(const char *device_str);
+int sim_vblank_open(const char *device_str);
+void sim_vblank_release(void);
+void sim_vblank_seed(void);
+int sim_vblank_pipes(void);
+int64_t sim_vblank_next(int pipe, uint64_t now_ns);
+uint64_t sim_vblank_time(int pipe, int64_t k);
+bool sim_vblank_missed(int pipe, int64_t k);
+void sim_vblank_pll(int pipe, double pll_clock);
+int sim_pipe_mode(int pipe, vsync_pipe_mode *mode);
+void sim_print_info(void);
+
+#endif
@@ -49,6 +49,7 @@
 #include "c10.h"
 #include "c20.h"
 #include "dp_m_n.h"
+#include "vblank_sim.h"
 #include "i915_pciids.h"
 
 platform platform_table[] = {
@@ -313,6 +314,14 @@ int print_drm_info(const char *device_str)
 		"USB"           // 20
 	};
 
+	if (is_sim_device(device_str)) {
+		if (sim_vblank_open(device_str)) {
+			return 1;
+		}
+		sim_print_info();
+		return 0;
+	}
+
 	int fd = open_device(device_str);
 	if (fd < 0) {
 		ERR("Failed to open DRM device: %s (%s)\n", device_str, strerror(errno));
@@ -383,6 +392,51 @@ int print_drm_info(const char *device_str)
 	return 0;
 }
 
+/**
+* @brief
+* This function sets the library up on the simulated display. The PCI BAR
+* is replaced by the simulated MMIO range, seeded with the registers of the
+* simulated pipes, so that the PHYs are found and programmed as on TGL. The
+* clock of each PHY is told to the simulated display as its nominal one.
+* @param *device_str - The simulated device, e.g. sim:ppm=20
+* @param dp_m_n - Whether to use the M & N path on DP panels
+* @return
+* - 0 == SUCCESS
+* - 1 == FAILURE
+*/
+static int sim_lib_init(const char *device_str, bool dp_m_n)
+{
+	int i;
+
+	for(i = 0; i < ARRAY_SIZE(platform_table); i++) {
+		if(!strcmp(platform_table[i].name, SIM_PLATFORM)) {
+			break;
+		}
+	}
+	if(i == ARRAY_SIZE(platform_table)) {
+		ERR("Platform %s is not supported\n", SIM_PLATFORM);
+		return 1;
+	}
+	supported_platform = i;
+
+	if(sim_vblank_open(device_str) || sim_mmio_init()) {
+		return 1;
+	}
+	sim_vblank_seed();
+
+	if(find_enabled_phys(dp_m_n)) {
+		vsync_lib_uninit();
+		return 1;
+	}
+
+	for(list<phys *>::iterator it = phy_enabled_list->begin();
+		it != phy_enabled_list->end(); it++) {
+			sim_vblank_pll((*it)->get_pipe(), (*it)->calculate_pll_clock());
+	}
+
+	return 0;
+}
+
 /**
 * @brief
 * This function initializes the library. It must be called
@@ -403,6 +457,14 @@ int vsync_lib_init(const char *device_str, bool dp_m_n)
 			return 1;
 		}
 
+		if (is_sim_device(device_str)) {
+			if(sim_lib_init(device_str, dp_m_n)) {
+				return 1;
+			}
+			INIT();
+			return 0;
+		}
+
 		// Check if device string is valid
 		int fd = open_device(device_str);
 		if (fd < 0) {
@@ -465,7 +527,10 @@ int vsync_lib_uninit()
 		status = 1;
 	}
 
-	if (close_mmio_handle() != 0) {
+	if (g_mmio_sim) {
+		sim_vblank_release();
+		sim_mmio_uninit();
+	} else if (close_mmio_handle() != 0) {
 		ERR("Failed to close MMIO handle.\n");
 		status = 1;
 	}
@@ -552,196 +617,6 @@ int synchronize_vsync(double time_diff, int pipe, double shift, double shift2, i
 	return status;
 }
 
-/**
-* @brief
-* The function which will be called whenever a VBLANK occurs
-* @param fd - The device file descriptor
-* @param frame - Frame number
-* @param sec - second when the vblank occured
-* @param usec - micro second when the vblank occured
-* @param *data - a private data structure pointing to the vbl_info
-* @return void
-*/
-static void vblank_handler(int fd, unsigned int frame, unsigned int sec,
-			   unsigned int usec, void *data)
-{
-	drmVBlank vbl;
-	vbl_info *info = (vbl_info *)data;
-	memset(&vbl, 0, sizeof(drmVBlank));
-	if(info->counter < info->size) {
-		info->vsync_array[info->counter++] = TIME_IN_USEC(sec, usec);
-	}
-
-	vbl.request.type = (drmVBlankSeqType) (DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT |
-		pipe_to_wait_for(info->pipe));
-	vbl.request.sequence = 1;
-	vbl.request.signal = (unsigned long)data;
-
-	drmWaitVBlank(fd, &vbl);
-}
-
-/**
-* @brief
-* This function determines the type of vblank synchronization to
-* use for the output.
-* @param pipe - Indicates which CRTC to get vblank for.  Knowing this, we
-* can determine which vblank sequence type to use for it.  Traditional
-* cards had only two CRTCs, with CRTC 0 using no special flags, and
-* CRTC 1 using DRM_VBLANK_SECONDARY.  The first bit of the pipe
-* Bits 1-5 of the pipe parameter are 5 bit wide pipe number between
-* 0-31.  If this is non-zero it indicates we're dealing with a
-* multi-gpu situation and we need to calculate the vblank sync
-* using DRM_BLANK_HIGH_CRTC_MASK.
-* @return The flag to OR in for drmWaitVBlank API
-*/
-unsigned int pipe_to_wait_for(int pipe)
-{
-	int ret = 0;
-	if (pipe > 1) {
-		ret = (pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
-	} else if (pipe > 0) {
-		ret = DRM_VBLANK_SECONDARY;
-	}
-	return ret;
-}
-
-/**
-* @brief
-* This function gets a list of vsyncs for the number of times
-* indicated by the caller and provide their timestamps in the array provided
-* @param *vsync_array - The array in which vsync timestamps need to be given
-* @param size - The size of this array. This is also the number of times that we
-* need to get the next few vsync timestamps.
-* @param pipe - This is the pipe whose vblank is needed. Defaults to 0 if not
-* provided.
-* @return
-* - 0 == SUCCESS
-* - 1 = ERROR
-*/
-int get_vsync(const char *device_str, uint64_t *vsync_array, int size, int pipe)
-{
-	drmVBlank vbl;
-	int ret;
-	drmEventContext evctx;
-	vbl_info handler_info;
-
-	// Validate parameters
-	if (device_str == NULL || strlen(device_str) == 0) {
-		ERR("Invalid device string (NULL or empty)\n");
-		return 1;
-	}
-
-	if (vsync_array == NULL) {
-		ERR("NULL vsync_array pointer provided\n");
-		return 1;
-	}
-
-	if (size <= 0) {
-		ERR("Invalid size (must be > 0): %d\n", size);
-		return 1;
-	}
-
-	if (size > VSYNC_MAX_TIMESTAMPS) {
-		ERR("Requested size (%d) exceeds VSYNC_MAX_TIMESTAMPS (%d)\n", size, VSYNC_MAX_TIMESTAMPS);
-		return 1;
-	}
-
-	int fd = open_device(device_str);
-	if(fd < 0) {
-		ERR("Couldn't open %s. Is i915 installed?\n", device_str);
-		return 1;
-	}
-
-	memset(&vbl, 0, sizeof(drmVBlank));
-
-	handler_info.vsync_array = vsync_array;
-	handler_info.size = size;
-	handler_info.counter = 0;
-	handler_info.pipe = pipe;
-
-	// Queue an event for frame + 1
-	vbl.request.type = (drmVBlankSeqType)
-		(DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT | pipe_to_wait_for(pipe));
-	DBG("vbl.request.type = 0x%X\n", vbl.request.type);
-	vbl.request.sequence = 1;
-	vbl.request.signal = (unsigned long)&handler_info;
-	ret = drmWaitVBlank(fd, &vbl);
-	if (ret) {
-		ERR("drmWaitVBlank (relative, event) failed ret: %i\n", ret);
-		close_device(fd);
-		return 1;
-	}
-
-	// Set up our event handler
-	memset(&evctx, 0, sizeof evctx);
-	evctx.version = DRM_EVENT_CONTEXT_VERSION;
-	evctx.vblank_handler = vblank_handler;
-	evctx.page_flip_handler = NULL;
-
-	// Poll for events
-	for(int i = 0; i < size; i++) {
-		struct timeval timeout = { .tv_sec = 3, .tv_usec = 0 };
-		fd_set fds;
-
-		FD_ZERO(&fds);
-		FD_SET(0, &fds);
-		FD_SET(fd, &fds);
-		ret = select(fd + 1, &fds, NULL, NULL, &timeout);
-
-		if (ret <= 0) {
-			ERR("select timed out or error (ret %d)\n", ret);
-			continue;
-		}
-
-		ret = drmHandleEvent(fd, &evctx);
-		if (ret) {
-			ERR("drmHandleEvent failed: %i\n", ret);
-			close_device(fd);
-			return 1;
-		}
-	}
-
-	close_device(fd);
-	return 0;
-}
-
-
-/**
- * @brief
- * This function collects vblank timestamps and prints average interval between them
- *
- * @param device_str - The device string, e.g. "/dev/dri/card0"
- * @param pipe - The pipe number
- * @param size - The number of timestamps to collect
- * @return double - The average vblank interval in milliseconds, or 0.0 on error
- */
-double get_vblank_interval(const char *device_str, int pipe, int size)
-{
-
-	uint64_t timestamps[VSYNC_MAX_TIMESTAMPS];  // Allocate enough buffer
-
-	if (size > VSYNC_MAX_TIMESTAMPS) {
-		ERR("Requested size exceeding maximum\n");
-		return 0.0;
-	}
-
-	if (size < 2) {
-		ERR("Requested size is not sufficient: size=%d\n", size);
-		return 0.0;
-	}
-
-	if (get_vsync(device_str, timestamps, size, pipe) == 0) {
-			long total_interval = 0;
-			for (int i = 0; i < size - 1; ++i) {
-					total_interval += (timestamps[i+1] - timestamps[i]);
-			}
-
-			double avg_interval =  total_interval / (size - 1) / 1000.0; // Convert to milliseconds
-			return avg_interval;
-	}
-	return 0.0;
-}
-
 /**
  * @brief
  * This function sets the PLL clock for the given pipe
@@ -812,6 +687,107 @@ double get_pll_clock(int pipe)
 	return 0.0;
 }
 
+/**
+ * @brief
+ * This function returns how long the phases of the last synchronize_vsync
+ * call on the given pipe took.
+ * @param pipe - The pipe whose PHY was programmed
+ * @param *timing - Receives the duration of each phase
+ * @return int - 0 on success, non-zero on failure
+ */
+int get_sync_timing(int pipe, vsync_sync_timing *timing)
+{
+	if(!IS_INIT()) {
+		ERR("Uninitialized lib, please call lib init first\n");
+		return 1;
+	}
+	if (pipe == VSYNC_ALL_PIPES || !timing) {
+		ERR("Invalid pipe or timing\n");
+		return 1;
+	}
+
+	if(phy_enabled_list) {
+		for(list<phys *>::iterator it = phy_enabled_list->begin();
+			it != phy_enabled_list->end(); it++) {
+				if(pipe == (*it)->get_pipe()) {
+					*timing = (*it)->get_timing();
+					return 0;
+				}
+			}
+	}
+
+	return 1;
+}
+
+/**
+ * @brief
+ * This function describes the display driven by the given pipe, so that
+ * values learned for it can be told apart from those of another display or
+ * mode.
+ * @param device_str - The DRM device of the pipe
+ * @param pipe - The pipe to describe
+ * @param *mode - Receives the device and the mode timing of the pipe
+ * @return int - 0 on success, non-zero on failure
+ */
+int get_pipe_mode(const char *device_str, int pipe, vsync_pipe_mode *mode)
+{
+	int ret = 1;
+
+	if(!IS_INIT()) {
+		ERR("Uninitialized lib, please call lib init first\n");
+		return 1;
+	}
+	if (is_sim_device(device_str)) {
+		return sim_pipe_mode(pipe, mode);
+	}
+	if (pipe == VSYNC_ALL_PIPES || !mode || !pci_dev) {
+		ERR("Invalid pipe or mode\n");
+		return 1;
+	}
+
+	memset(mode, 0, sizeof(*mode));
+	snprintf(mode->pci_slot, sizeof(mode->pci_slot), "%04x:%02x:%02x.%x",
+		pci_dev->domain, pci_dev->bus, pci_dev->dev, pci_dev->func);
+	mode->device_id = pci_dev->device_id;
+
+	int fd = open_device(device_str);
+	if (fd < 0) {
+		ERR("Failed to open DRM device: %s (%s)\n", device_str, strerror(errno));
+		return 1;
+	}
+
+	// CRTCs are listed in pipe order, as print_drm_info shows them
+	drmModeRes *resources = drmModeGetResources(fd);
+	if (!resources) {
+		ERR("drmModeGetResources failed: %s\n", strerror(errno));
+	} else if (pipe >= resources->count_crtcs) {
+		ERR("Pipe %d has no CRTC\n", pipe);
+	} else {
+		drmModeCrtc *crtc = drmModeGetCrtc(fd, resources->crtcs[pipe]);
+		if (!crtc) {
+			ERR("drmModeGetCrtc failed: %s\n", strerror(errno));
+		} else {
+			if (crtc->mode_valid) {
+				mode->clock_khz = crtc->mode.clock;
+				mode->hdisplay = crtc->mode.hdisplay;
+				mode->vdisplay = crtc->mode.vdisplay;
+				mode->htotal = crtc->mode.htotal;
+				mode->vtotal = crtc->mode.vtotal;
+				ret = 0;
+			} else {
+				ERR("Pipe %d has no mode set\n", pipe);
+			}
+			drmModeFreeCrtc(crtc);
+		}
+	}
+
+	if (resources) {
+		drmModeFreeResources(resources);
+	}
+	close_device(fd);
+	return ret;
+}
+
 /**
 * @brief
 *	Utility function to return first available card.
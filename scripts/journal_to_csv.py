@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+# *
+# * Copyright © 2024 Intel Corporation
+# *
+# * Permission is hereby granted, free of charge, to any person obtaining a
+# * copy of this software and associated documentation files (the "Software"),
+# * to deal in the Software without restriction, including without limitation
+# * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# * and/or sell copies of the Software, and to permit persons to whom the
+# * Software is furnished to do so, subject to the following conditions:
+# *
+# * The above copyright notice and this permission notice (including the next
+# * paragraph) shall be included in all copies or substantial portions of the
+# * Software.
+# *
+# * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# * IN THE SOFTWARE.
+#
+"""
+journal_to_csv.py
+
+This script converts a binary Software GenLock journal (vsync_test -j bin)
+into the CSV format written by vsync_test -j csv, which plot_sync_interval.py
+reads.
+
+Usage:
+    python journal_to_csv.py path/to/journal.sgj > journal.csv
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b'SGJ\0'
+HEADER = struct.Struct('<4sHH')
+COMMENT = struct.Struct('<BBH')
+ENTRY = struct.Struct('<BBHIqdddd')
+
+JOURNAL_COMMENT = 0
+JOURNAL_SYNC = 1
+JOURNAL_SKIP = 2
+JOURNAL_TRIM = 3
+
+def convert(data, out):
+    magic, version, entry_size = HEADER.unpack_from(data, 0)
+    if magic != MAGIC:
+        raise ValueError('Not a journal file')
+    if version != 1 or entry_size != ENTRY.size:
+        raise ValueError(f'Unsupported journal version {version}')
+
+    pos = HEADER.size
+    while pos < len(data):
+        kind = data[pos]
+        if kind == JOURNAL_COMMENT:
+            if pos + COMMENT.size > len(data):
+                break
+            _, _, length = COMMENT.unpack_from(data, pos)
+            pos += COMMENT.size
+            text = data[pos:pos + length].decode('utf-8', errors='replace')
+            pos += length
+            out.write(f'#{text}\n')
+        elif kind in (JOURNAL_SYNC, JOURNAL_SKIP, JOURNAL_TRIM):
+            if pos + ENTRY.size > len(data):
+                break
+            (_, _, steps, flags, delta, time, duration,
+             pll_clock, correction_ms) = ENTRY.unpack_from(data, pos)
+            pos += ENTRY.size
+            if kind == JOURNAL_SKIP:
+                out.write(f'#[+{time:.3f}s] Skipped window, delta {delta} us, flags 0x{flags:x}\n')
+            elif kind == JOURNAL_TRIM:
+                out.write(f'#[+{time:.3f}s] Trimmed PLL to {pll_clock:.3f}, delta {delta} us\n')
+            else:
+                out.write(f'[+{time:.3f}s] ,{duration:7.3f},{delta:3d},{pll_clock:.3f},'
+                          f'{correction_ms:.3f},{steps},0x{flags:x}\n')
+        else:
+            raise ValueError(f'Corrupted journal at offset {pos}')
+
+def main():
+    parser = argparse.ArgumentParser(description='Convert a binary journal to CSV.')
+    parser.add_argument('journal_file', help='Path to the binary journal')
+    args = parser.parse_args()
+
+    with open(args.journal_file, 'rb') as file:
+        data = file.read()
+
+    try:
+        convert(data, sys.stdout)
+    except (ValueError, struct.error) as e:
+        print(f'Error: {e}', file=sys.stderr)
+        sys.exit(1)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,651 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <math.h>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <vsyncalter.h>
+#include <debug.h>
+#include "version.h"
+#include "connection.h"
+#include "message.h"
+#include "history.h"
+#include "interval.h"
+
+#define SKEW_DEFAULT_PORT      5002    // Next to the one of vsync_test, so both can run
+#define SKEW_DEFAULT_COUNT     30      // vblanks per node and round
+#define SKEW_DEFAULT_ROUNDS    60
+#define SKEW_DEFAULT_INTERVAL  1000    // ms between rounds
+
+// A node of the wall as seen by the collector
+typedef struct _skew_node {
+	std::string host;
+	int port;
+	connection *conn;
+	uint64_t va[MSG_MAX_TIMESTAMPS];
+	bool valid;             // The node answered this round with reliable vblanks
+} skew_node;
+
+// Skew of the second node of a pair from the first one over all rounds
+typedef struct _skew_pair {
+	int a, b;
+	std::vector<double> skews;
+	int unreliable;         // Rounds without a measurement
+} skew_pair;
+
+int client_done = 0;  // Stops the connection classes waiting for a message
+connection *server = NULL;
+vblank_history g_history;
+
+/**
+* @brief
+* This function closes the agent's socket and exits.
+* @param sig - The signal that was received
+* @return void
+*/
+void agent_close_signal(int sig)
+{
+	DBG("Closing agent's socket\n");
+	if (server) {
+		server->close_server();
+	}
+	exit(0);
+}
+
+/**
+* @brief
+* This function stops the collector after the current round, which still
+* gets summarized.
+* @param sig - The signal that was received
+* @return void
+*/
+void collector_close_signal(int sig)
+{
+	client_done = 1;
+}
+
+/**
+* @brief
+* This function turns the clock of --synthetic into the device string of
+* the simulated display, whose phase is the offset of the clock.
+* @param *spec - period_us[,offset_us[,ppm[,jitter_us]]], e.g. 16666.667,120,5,2
+* @param &device_str - Receives the device string
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int synthetic_device(const char *spec, std::string &device_str)
+{
+	double period = 0, offset = 0, ppm = 0, jitter = 0;
+	char buf[128];
+
+	if (sscanf(spec, "%lf,%lf,%lf,%lf", &period, &offset, &ppm, &jitter) < 1) {
+		ERR("Invalid synthetic clock: %s\n", spec);
+		return 1;
+	}
+	snprintf(buf, sizeof(buf), "sim:period=%.9g,phase=%.9g,ppm=%.9g,jitter=%.9g", period,
+		offset, ppm, jitter);
+	device_str = buf;
+	return 0;
+}
+
+/**
+* @brief
+* This function finds the vblanks a collector asks for in the history of
+* the pipe.
+* @param &r - The request
+* @param *va - Receives the vblanks in us
+* @param *quality - Receives the VSYNC_FLAG_* of the vblanks
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int find_window(msg &r, uint64_t *va, uint32_t *quality)
+{
+	int count = r.get_vblank_count();
+	bool nearest = r.get_request() == MSG_REQ_NEAREST;
+	uint64_t time_us = nearest ? r.get_request_time() : get_vsync_time_ns() / 1000;
+
+	return nearest ? g_history.nearest(time_us, count, va, quality) :
+		g_history.last(count, va, quality);
+}
+
+/**
+* @brief
+* This function answers the requests of a collector until it sends an ACK,
+* its last request, or goes away.
+* @param sockfd - The socket of the collector
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int serve_collector(int sockfd)
+{
+	int ret = 0;
+	msg m, r;
+	uint32_t quality;
+
+	do {
+		memset(&m, 0, sizeof(m));
+		if (server->recv_msg(&r, sizeof(r), sockfd)) {
+			ret = 1;
+			break;
+		}
+
+		// The count comes from the peer and must fit in the reply
+		if (r.get_vblank_count() <= 0 || r.get_vblank_count() > m.get_size()) {
+			ERR("Invalid vblank count requested: %d\n", r.get_vblank_count());
+			ret = 1;
+			break;
+		}
+
+		if (find_window(r, m.get_va(), &quality)) {
+			WARNING("No vblanks for the request\n");
+			m.nack();
+		} else {
+			m.add_vsync();
+			m.set_quality(quality);
+			m.set_vblank_count(r.get_vblank_count());
+		}
+		m.add_time();
+		if (server->send_msg(&m, sizeof(m), sockfd)) {
+			ret = 1;
+			break;
+		}
+	} while (r.get_type() != ACK);
+
+	close(sockfd);
+	return ret;
+}
+
+/**
+* @brief
+* This function runs an agent: it records the vblanks of its pipe and
+* serves them to collectors one after the other until Ctrl+C.
+* @param *ip - Address to serve on, empty for all
+* @param port - TCP port to serve on
+* @param *device_str - The device of the pipe
+* @param pipe - The pipe to record
+* @param history_size - Number of vblanks recorded
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int do_agent(const char *ip, int port, const char *device_str, int pipe, int history_size)
+{
+	if (g_history.start(device_str, pipe, history_size)) {
+		ERR("Failed to record the vblanks of pipe %d\n", pipe);
+		return 1;
+	}
+
+	server = new connection(ip);
+	server->set_port(port);
+	if (server->init_server()) {
+		ERR("Failed to init socket connection\n");
+		return 1;
+	}
+	signal(SIGINT, agent_close_signal);
+	signal(SIGTERM, agent_close_signal);
+
+	INFO("Serving vblanks on port %d\n", port);
+	while (1) {
+		int sockfd;
+		if (server->accept_client(&sockfd)) {
+			return 1;
+		}
+		if (serve_collector(sockfd)) {
+			WARNING("Collector went away\n");
+		}
+	}
+	return 0;
+}
+
+/**
+* @brief
+* This function parses a comma separated list of nodes, each host[:port].
+* @param *str - The string to parse
+* @param &nodes - Receives the nodes
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int parse_nodes(const char *str, std::vector<skew_node> &nodes)
+{
+	std::stringstream ss(str);
+	std::string item;
+
+	nodes.clear();
+	while (std::getline(ss, item, ',')) {
+		skew_node n = {};
+		size_t colon = item.find(':');
+		n.host = item.substr(0, colon);
+		n.port = SKEW_DEFAULT_PORT;
+		if (colon != std::string::npos) {
+			try {
+				n.port = std::stoi(item.substr(colon + 1));
+			} catch (...) {
+				return 1;
+			}
+		}
+		if (n.host.empty() || n.port <= 0 || n.port > 65535) {
+			return 1;
+		}
+		nodes.push_back(n);
+	}
+	return nodes.size() < 2;
+}
+
+/**
+* @brief
+* This function asks every node for its vblanks ending nearest to the same
+* time. The requests all go out before the first reply is read, so the
+* nodes look them up at once.
+* @param &nodes - The nodes
+* @param count - Number of vblanks per node
+* @param time_us - The time on the timescale in us
+* @param last - Whether this is the last round, after which the nodes close
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE, a node can't be reached any more
+*/
+int collect_round(std::vector<skew_node> &nodes, int count, uint64_t time_us, bool last)
+{
+	msg m, r;
+
+	memset(&r, 0, sizeof(r));
+	if (last) {
+		r.ack();
+	} else {
+		r.nack();
+	}
+	r.set_vblank_count(count);
+	r.set_request(MSG_REQ_NEAREST, time_us);
+	for (auto &n : nodes) {
+		if (n.conn->send_msg(&r, sizeof(r))) {
+			ERR("Failed to send the request to %s\n", n.host.c_str());
+			return 1;
+		}
+	}
+
+	for (auto &n : nodes) {
+		n.valid = false;
+		if (n.conn->recv_msg(&m, sizeof(m))) {
+			ERR("No reply from %s\n", n.host.c_str());
+			return 1;
+		}
+		if (client_done) {
+			return 0;
+		}
+		if (m.get_type() != VSYNC_MSG || m.get_vblank_count() != count) {
+			WARNING("%s has no vblanks for this round\n", n.host.c_str());
+			continue;
+		}
+		if (m.get_quality()) {
+			WARNING("vblanks of %s are not reliable (flags 0x%x)\n", n.host.c_str(),
+				m.get_quality());
+			continue;
+		}
+		memcpy(n.va, m.get_va(), count * sizeof(uint64_t));
+		n.valid = true;
+	}
+	return 0;
+}
+
+/**
+* @brief
+* This function prints the skew statistics of every pair of nodes.
+* @param &nodes - The nodes
+* @param &pairs - The skews of each pair
+* @param max_skew - Largest skew to pass in us, 0 = no verdict
+* @return
+* - 0 = SUCCESS, every pair within max_skew
+* - 1 = FAILURE
+*/
+int summarize(std::vector<skew_node> &nodes, std::vector<skew_pair> &pairs, double max_skew)
+{
+	int ret = 0;
+
+	INFO("Skew of each pair in us:\n");
+	INFO("%-24s %-24s %6s %5s %9s %8s %9s %9s %9s %9s\n", "node a", "node b", "rounds",
+		"lost", "mean", "stddev", "min", "max", "p95 |x|", "max |x|");
+	for (auto &p : pairs) {
+		std::string a = nodes[p.a].host + ":" + std::to_string(nodes[p.a].port);
+		std::string b = nodes[p.b].host + ":" + std::to_string(nodes[p.b].port);
+		size_t n = p.skews.size();
+		if (!n) {
+			INFO("%-24s %-24s %6d %5d no measurement\n", a.c_str(), b.c_str(), 0, p.unreliable);
+			ret = 1;
+			continue;
+		}
+
+		double mean = 0, m2 = 0;
+		std::vector<double> abs_skews;
+		for (size_t i = 0; i < n; i++) {
+			double d = p.skews[i] - mean;
+			mean += d / (i + 1);
+			m2 += d * (p.skews[i] - mean);
+			abs_skews.push_back(fabs(p.skews[i]));
+		}
+		std::sort(abs_skews.begin(), abs_skews.end());
+		double stddev = n > 1 ? sqrt(m2 / (n - 1)) : 0;
+		double p95 = abs_skews[(size_t) ceil(0.95 * n) - 1];
+		INFO("%-24s %-24s %6zu %5d %9.3f %8.3f %9.3f %9.3f %9.3f %9.3f\n", a.c_str(),
+			b.c_str(), n, p.unreliable, mean, stddev,
+			*std::min_element(p.skews.begin(), p.skews.end()),
+			*std::max_element(p.skews.begin(), p.skews.end()), p95, abs_skews.back());
+		if (max_skew > 0 && abs_skews.back() > max_skew) {
+			ret = 1;
+		}
+	}
+
+	if (max_skew > 0) {
+		if (ret) {
+			ERR("FAIL: skew beyond %.1f us or a pair not measured\n", max_skew);
+		} else {
+			INFO("PASS: every pair within %.1f us\n", max_skew);
+		}
+	}
+	return ret;
+}
+
+/**
+* @brief
+* This function runs the collector. Each round it gets the vblanks of every
+* node from the same time, estimates the skew of every pair from line fits
+* of their windows and writes it to the time series. The statistics of each
+* pair follow at the end.
+* @param &nodes - The nodes
+* @param count - Number of vblanks per node and round
+* @param rounds - Number of rounds
+* @param interval_ms - Time between rounds in ms
+* @param *out - The time series
+* @param max_skew - Largest skew to pass in us, 0 = no verdict
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int do_collect(std::vector<skew_node> &nodes, int count, int rounds, int interval_ms,
+	FILE *out, double max_skew)
+{
+	std::vector<skew_pair> pairs;
+	int ret = 0;
+
+	for (auto &n : nodes) {
+		n.conn = new connection(n.host.c_str());
+		n.conn->set_port(n.port);
+		if (n.conn->init_client(n.host.c_str())) {
+			ERR("Failed to connect to %s:%d\n", n.host.c_str(), n.port);
+			ret = 1;
+			goto cleanup;
+		}
+	}
+	for (int a = 0; a < (int) nodes.size(); a++) {
+		for (int b = a + 1; b < (int) nodes.size(); b++) {
+			pairs.push_back({a, b, {}, 0});
+		}
+	}
+
+	signal(SIGINT, collector_close_signal);
+	signal(SIGTERM, collector_close_signal);
+
+	fprintf(out, "round,time_us,node_a,node_b,skew_us,error_us,period_us\n");
+	for (int round = 0; round < rounds && !client_done; round++) {
+		uint64_t start_us = get_vsync_time_ns() / 1000;
+		if (collect_round(nodes, count, start_us, round == rounds - 1)) {
+			ret = 1;
+			break;
+		}
+		if (client_done) {
+			break;
+		}
+
+		for (auto &p : pairs) {
+			skew_node &a = nodes[p.a], &b = nodes[p.b];
+			phase_estimate est;
+			if (!a.valid || !b.valid || estimate_phase(a.va, count, b.va, count, &est)) {
+				p.unreliable++;
+				continue;
+			}
+			// Windows a period or more apart mean the clocks of the nodes
+			// are not synchronized
+			if (llabs((int64_t) (a.va[count - 1] - b.va[count - 1])) > est.period_us) {
+				WARNING("Clocks of %s and %s are not synchronized\n", a.host.c_str(),
+					b.host.c_str());
+				p.unreliable++;
+				continue;
+			}
+			p.skews.push_back(est.offset_us);
+			fprintf(out, "%d,%lu,%s:%d,%s:%d,%.3f,%.3f,%.3f\n", round,
+				(unsigned long) start_us, a.host.c_str(), a.port, b.host.c_str(), b.port,
+				est.offset_us, est.error_us, est.period_us);
+		}
+		fflush(out);
+
+		uint64_t next_us = start_us + interval_ms * 1000ULL;
+		uint64_t now_us = get_vsync_time_ns() / 1000;
+		if (round < rounds - 1 && next_us > now_us) {
+			usleep(next_us - now_us);
+		}
+	}
+
+	if (summarize(nodes, pairs, max_skew)) {
+		ret = 1;
+	}
+
+cleanup:
+	for (auto &n : nodes) {
+		if (n.conn) {
+			n.conn->close_client();
+			delete n.conn;
+			n.conn = NULL;
+		}
+	}
+	return ret;
+}
+
+/**
+ * @brief
+ * Print help message
+ *
+ * @param program_name - Name of the program
+ * @return void
+ */
+void print_help(const char *program_name)
+{
+	printf("Usage: %s -m agent [-i address] [-p pipe] [--synthetic clock] [-v loglevel] [-h]\n"
+		"       %s -m collect -n node,node[,...] [-c count] [-r rounds] [-o file] [-h]\n"
+		"Options:\n"
+		"  -m mode            agent serves the vblanks of a node, collect measures the skew\n"
+		"                     between the agents\n"
+		"  -P port            TCP port of the agent (default: %d)\n"
+		"  -v loglevel        Log level: error, warning, info, debug or trace (default: info)\n"
+		"  --timescale clock  Clock of the vsync timestamps, the same on all systems: realtime,\n"
+		"                     tai or phc:device, e.g. phc:/dev/ptp0 (default: realtime)\n"
+		"  -h                 Display this help message\n"
+		"Agent options:\n"
+		"  -i address         IP address to serve on (default: all)\n"
+		"  -p pipe            Pipe whose vblanks are served (default: 0)\n"
+		"  -e device          Device string (default: /dev/dri/card0)\n"
+		"  --history n        vblanks recorded to answer the requests (default: %d)\n"
+		"  --synthetic clock  Serve a simulated display instead, the same as -e sim:...:\n"
+		"                     period_us[,offset_us[,ppm[,jitter_us]]], e.g. 16666.667,100,5,2\n"
+		"Collector options:\n"
+		"  -n nodes           Agents to compare, host[:port] separated by commas\n"
+		"  -c count           vblanks per node and round (default: %d, max %d)\n"
+		"  -r rounds          Number of rounds (default: %d)\n"
+		"  -I interval        Time between rounds in ms (default: %d ms)\n"
+		"  -o file            Write the time series as CSV to this file (default: standard output)\n"
+		"  --max-skew us      Fail unless every pair stays within this skew (default: 0 = no verdict)\n",
+		program_name, program_name, SKEW_DEFAULT_PORT, HISTORY_DEFAULT_SIZE,
+		SKEW_DEFAULT_COUNT, MSG_MAX_TIMESTAMPS, SKEW_DEFAULT_ROUNDS, SKEW_DEFAULT_INTERVAL);
+}
+
+/**
+* @brief
+* This is the main function
+* @param argc - The number of command line arguments
+* @param *argv[] - Each command line argument in an array
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int main(int argc, char *argv[])
+{
+	int ret = 0;
+	std::string mode = "", ip = "", nodes_str = "", output_path = "";
+	std::string device_str = find_first_dri_card();
+	int port = SKEW_DEFAULT_PORT, pipe = 0, history_size = HISTORY_DEFAULT_SIZE;
+	int count = SKEW_DEFAULT_COUNT, rounds = SKEW_DEFAULT_ROUNDS;
+	int interval_ms = SKEW_DEFAULT_INTERVAL;
+	double max_skew = 0;
+	std::vector<skew_node> nodes;
+	FILE *out = stdout;
+	enum {
+		OPT_HISTORY = 1000,
+		OPT_SYNTHETIC,
+		OPT_TIMESCALE,
+		OPT_MAX_SKEW,
+	};
+	struct option long_options[] = {
+		{"history", required_argument, NULL, OPT_HISTORY},
+		{"synthetic", required_argument, NULL, OPT_SYNTHETIC},
+		{"timescale", required_argument, NULL, OPT_TIMESCALE},
+		{"max-skew", required_argument, NULL, OPT_MAX_SKEW},
+		{"help", no_argument, NULL, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	printf("Skewtest Version: %s\n", get_version().c_str());
+	int opt, option_index = 0;
+	while ((opt = getopt_long(argc, argv, "m:P:i:p:e:n:c:r:I:o:v:h", long_options,
+		&option_index)) != -1) {
+		switch (opt) {
+			case 'm':
+				mode = optarg;
+				break;
+			case 'P':
+				port = std::stoi(optarg);
+				break;
+			case 'i':
+				ip = optarg;
+				break;
+			case 'p':
+				pipe = std::stoi(optarg);
+				break;
+			case 'e':
+				device_str = optarg;
+				break;
+			case 'n':
+				nodes_str = optarg;
+				break;
+			case 'c':
+				count = std::stoi(optarg);
+				break;
+			case 'r':
+				rounds = std::stoi(optarg);
+				break;
+			case 'I':
+				interval_ms = std::stoi(optarg);
+				break;
+			case 'o':
+				output_path = optarg;
+				break;
+			case 'v':
+				set_log_level_str(optarg);
+				break;
+			case OPT_HISTORY:
+				history_size = std::stoi(optarg);
+				break;
+			case OPT_SYNTHETIC:
+				if (synthetic_device(optarg, device_str)) {
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_TIMESCALE:
+				if (set_vsync_timescale_str(optarg)) {
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_MAX_SKEW:
+				max_skew = std::stod(optarg);
+				break;
+			case 'h':
+				print_help(argv[0]);
+				exit(EXIT_SUCCESS);
+			case '?':
+				print_help(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (port <= 0 || port > 65535) {
+		ERR("Invalid port: %d\n", port);
+		exit(EXIT_FAILURE);
+	}
+
+	if (mode == "agent") {
+		if (history_size <= 0) {
+			ERR("Invalid history size: %d\n", history_size);
+			exit(EXIT_FAILURE);
+		}
+		return do_agent(ip.c_str(), port, device_str.c_str(), pipe, history_size);
+	}
+
+	if (mode != "collect") {
+		ERR("Mode must be agent or collect\n");
+		print_help(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (parse_nodes(nodes_str.c_str(), nodes)) {
+		ERR("Invalid node list, at least two nodes are needed: %s\n", nodes_str.c_str());
+		exit(EXIT_FAILURE);
+	}
+	if (count < 2 || count > MSG_MAX_TIMESTAMPS || rounds <= 0 || interval_ms < 0) {
+		ERR("Invalid count, rounds or interval\n");
+		exit(EXIT_FAILURE);
+	}
+	if (!output_path.empty()) {
+		out = fopen(output_path.c_str(), "w");
+		if (!out) {
+			ERR("Failed to open %s: %s\n", output_path.c_str(), strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	ret = do_collect(nodes, count, rounds, interval_ms, out, max_skew);
+	if (out != stdout) {
+		fclose(out);
+	}
+	return ret;
+}
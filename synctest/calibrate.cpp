@@ -0,0 +1,489 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <math.h>
+#include <algorithm>
+#include <mutex>
+#include <vsyncalter.h>
+#include <debug.h>
+#include "calibrate.h"
+
+typedef struct _recorder {
+	const char *device;
+	int pipe;
+	std::mutex lock;
+	std::vector<vsync_sample> samples;
+	bool stop;
+} recorder;
+
+/**
+* @brief
+* Stream handler keeping the vblanks of a measurement.
+* @param pipe - The pipe of the batch
+* @param *samples - The vblanks
+* @param count - Number of vblanks
+* @param *user_data - The recorder
+* @return Non-zero once the measurement is done
+*/
+static int record(int pipe, const vsync_sample *samples, int count, void *user_data)
+{
+	recorder *rec = (recorder *) user_data;
+
+	std::lock_guard<std::mutex> guard(rec->lock);
+	rec->samples.insert(rec->samples.end(), samples, samples + count);
+	return rec->stop;
+}
+
+/**
+* @brief
+* Thread streaming the vblanks of the pipe to the recorder.
+* @param arg - The recorder
+* @return NULL
+*/
+static void *capture(void *arg)
+{
+	recorder *rec = (recorder *) arg;
+
+	if (stream_vsync(rec->device, &rec->pipe, 1, 0, record, rec)) {
+		ERR("Capture of pipe %d failed\n", rec->pipe);
+	}
+	return NULL;
+}
+
+/**
+* @brief
+* Fits the timestamps of vblanks against their sequence numbers, which
+* counts any vblank missed between them.
+* @param &s - The vblanks
+* @param count - Number of vblanks from the start to use
+* @param *seq0 - Receives the sequence the line is relative to
+* @param *t0 - Receives the fitted time of seq0 in us
+* @param *period - Receives the period in us
+* @param *sigma - Receives the deviation of the vblanks from the line in us
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+static int fit_vblanks(const std::vector<vsync_sample> &s, size_t count, uint64_t *seq0,
+	double *t0, double *period, double *sigma)
+{
+	double mk = 0, mt = 0, sxx = 0, sxt = 0, ssr = 0;
+
+	if (count < 3) {
+		return 1;
+	}
+	*seq0 = s[0].sequence;
+	uint64_t origin = s[0].timestamp_ns;
+	for (size_t i = 0; i < count; i++) {
+		mk += s[i].sequence - *seq0;
+		mt += (s[i].timestamp_ns - origin) / 1000.0;
+	}
+	mk /= count;
+	mt /= count;
+	for (size_t i = 0; i < count; i++) {
+		double k = s[i].sequence - *seq0 - mk;
+		sxx += k * k;
+		sxt += k * ((s[i].timestamp_ns - origin) / 1000.0 - mt);
+	}
+	if (sxx <= 0) {
+		return 1;
+	}
+	*period = sxt / sxx;
+	*t0 = origin / 1000.0 + mt - *period * mk;
+	for (size_t i = 0; i < count; i++) {
+		double r = s[i].timestamp_ns / 1000.0 - (*t0 + *period * (s[i].sequence - *seq0));
+		ssr += r * r;
+	}
+	*sigma = sqrt(ssr / (count - 2));
+	return *period > 0 ? 0 : 1;
+}
+
+/**
+* @brief
+* Applies one setting and measures the response of the display.
+* @param &s - The setting
+* @param drift_us - Drift to correct in us, its sign gives the direction
+* @param *r - Receives the measurement
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int calibrator::measure(const cal_setting &s, int drift_us, cal_result *r)
+{
+	recorder rec;
+	pthread_t tid;
+	uint64_t seq0;
+	double t0, period, sigma;
+	size_t base = 0, first = 0, settled = 0;
+
+	rec.device = device.c_str();
+	rec.pipe = pipe;
+	rec.stop = false;
+	memset(r, 0, sizeof(*r));
+	r->setting = s;
+	r->drift_us = drift_us;
+	r->settle_ms = -1;
+
+	if (pthread_create(&tid, NULL, capture, &rec)) {
+		ERR("Failed to start the capture\n");
+		return 1;
+	}
+	usleep(CAL_BASELINE_MS * 1000);
+
+	uint64_t start_ns = get_vsync_time_ns();
+	int ret = synchronize_vsync(drift_us / 1000.0, pipe, s.shift, s.shift2,
+		step_threshold_us, s.step_wait_ms, true, true);
+	uint64_t end_ns = get_vsync_time_ns();
+	r->duration_ms = (end_ns - start_ns) / 1e6;
+
+	// Watch the period come back, with the tolerance given by the jitter
+	// seen before the correction
+	while (!ret) {
+		usleep(50000);
+		std::lock_guard<std::mutex> guard(rec.lock);
+		std::vector<vsync_sample> &v = rec.samples;
+		if (!base) {
+			while (base < v.size() && v[base].timestamp_ns < start_ns) {
+				base++;
+			}
+			if (fit_vblanks(v, base, &seq0, &t0, &period, &sigma)) {
+				ERR("Too few vblanks before the correction\n");
+				ret = 1;
+				break;
+			}
+			first = base;
+		}
+		double tol = std::max(CAL_MIN_TOLERANCE, 4 * sigma * sqrt(2));
+		size_t run = 0;
+		for (size_t i = first; i < v.size() && !settled; i++) {
+			double frames = v[i].sequence - v[i-1].sequence;
+			bool steady = v[i].timestamp_ns > end_ns &&
+				fabs((v[i].timestamp_ns - v[i-1].timestamp_ns) / 1000.0 / frames - period) <= tol;
+			run = steady ? run + 1 : 0;
+			if (run == CAL_SETTLE_FRAMES) {
+				settled = i + 1;
+			}
+		}
+		if (settled || get_vsync_time_ns() > end_ns + CAL_SETTLE_MAX_MS * 1000000ULL) {
+			break;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(rec.lock);
+		rec.stop = true;
+	}
+	pthread_join(tid, NULL);
+	if (ret) {
+		return 1;
+	}
+
+	std::vector<vsync_sample> &v = rec.samples;
+	size_t end = settled ? settled : v.size();
+	r->period_us = period;
+	for (size_t i = first; i < end; i++) {
+		uint64_t frames = v[i].sequence - v[i-1].sequence;
+		if (frames > 1 || (v[i].flags & VSYNC_FLAG_TIMEOUT)) {
+			r->missed += frames > 1 ? frames - 1 : 1;
+		}
+		double change = fabs((v[i].timestamp_ns - v[i-1].timestamp_ns) / 1000.0 / frames - period);
+		r->max_change_ppm = std::max(r->max_change_ppm, change / period * 1e6);
+	}
+
+	// The drift achieved is where the steady vblanks are against the line
+	// of the reference period
+	if (settled) {
+		size_t from = settled - CAL_SETTLE_FRAMES;
+		r->settle_ms = (v[from].timestamp_ns > end_ns ? v[from].timestamp_ns - end_ns : 0) / 1e6;
+		for (size_t i = from; i < settled; i++) {
+			r->achieved_us += v[i].timestamp_ns / 1000.0 - (t0 + period * (v[i].sequence - seq0));
+		}
+		r->achieved_us /= CAL_SETTLE_FRAMES;
+	}
+	r->error_us = r->achieved_us - drift_us;
+
+	double tol = std::max(CAL_MAX_ERROR * abs(drift_us), 4 * sigma);
+	r->safe = !r->missed && settled && fabs(r->error_us) <= tol;
+	return 0;
+}
+
+/**
+* @brief
+* Gives the drift shift is calibrated with, below the step threshold so
+* program_phy uses shift for it.
+* @param None
+* @return The drift in us
+*/
+int calibrator::shift_drift()
+{
+	return step_threshold_us > 0 && delta_us >= step_threshold_us ?
+		step_threshold_us / 2 : delta_us;
+}
+
+/**
+* @brief
+* Gives the drift shift2 is calibrated with, from the step threshold so
+* program_phy uses shift2 for it.
+* @param None
+* @return The drift in us
+*/
+int calibrator::shift2_drift()
+{
+	return std::max(delta_us, step_threshold_us);
+}
+
+/**
+* @brief
+* Adds a setting to a list unless it is there already.
+* @param &settings - The list
+* @param &s - The setting
+* @return void
+*/
+static void add_setting(std::vector<cal_setting> &settings, const cal_setting &s)
+{
+	for (size_t i = 0; i < settings.size(); i++) {
+		if (settings[i].shift == s.shift && settings[i].shift2 == s.shift2 &&
+			settings[i].step_wait_ms == s.step_wait_ms) {
+			return;
+		}
+	}
+	settings.push_back(s);
+}
+
+/**
+* @brief
+* Tries each setting of a stage in turn. The drift alternates in direction
+* so the display ends close to where it started.
+* @param stage - The stage, which gives the drift
+* @param &settings - The settings to try
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE, a setting could not be applied
+*/
+int calibrator::run_stage(cal_stage stage, const std::vector<cal_setting> &settings)
+{
+	int drift = stage == CAL_STAGE_SHIFT ? shift_drift() : shift2_drift();
+
+	for (size_t i = 0; i < settings.size(); i++) {
+		cal_result r;
+		INFO("[%zu/%zu] shift %g, shift2 %g, step_wait %d ms, drift %d us\n", i + 1,
+			settings.size(), settings[i].shift, settings[i].shift2,
+			settings[i].step_wait_ms, drift);
+		if (measure(settings[i], drift, &r)) {
+			return 1;
+		}
+		INFO("\tdrift %.1f us (error %.1f us), %.1f ppm, %.0f ms + settle %.0f ms, %d missed%s\n",
+			r.achieved_us, r.error_us, r.max_change_ppm, r.duration_ms, r.settle_ms,
+			r.missed, r.safe ? "" : ", unsafe");
+		r.stage = stage;
+		results.push_back(r);
+		drift = -drift;
+	}
+	return 0;
+}
+
+/**
+* @brief
+* Calibrates shift, then shift2 and the step wait. shift is tried alone,
+* correcting a drift below the step threshold in a single step where the
+* wait does not apply. shift2 is tried with each wait, stepping by the
+* shift chosen, on a drift from the threshold. shift2 = 0, which corrects
+* that drift with shift and no steps, is tried once.
+* @param &shifts, &shift2s, &waits - The values to sweep
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE, a setting could not be applied
+*/
+int calibrator::run(const std::vector<double> &shifts, const std::vector<double> &shift2s,
+	const std::vector<double> &waits)
+{
+	std::vector<cal_setting> settings;
+
+	results.clear();
+	for (size_t i = 0; i < shifts.size(); i++) {
+		cal_setting s = { shifts[i], 0, 0 };
+		add_setting(settings, s);
+	}
+	INFO("Calibrating shift with %zu settings on a %d us drift\n", settings.size(),
+		shift_drift());
+	if (run_stage(CAL_STAGE_SHIFT, settings)) {
+		return 1;
+	}
+
+	const cal_result *b = best(CAL_STAGE_SHIFT);
+	if (!b) {
+		WARNING("No shift was safe, shift2 is not calibrated\n");
+		return 0;
+	}
+	double shift = b->setting.shift;
+
+	settings.clear();
+	for (size_t i = 0; i < shift2s.size(); i++) {
+		for (size_t k = 0; k < waits.size(); k++) {
+			cal_setting s = { shift, shift2s[i], shift2s[i] ? (int) waits[k] : 0 };
+			add_setting(settings, s);
+		}
+	}
+	INFO("Calibrating shift2 with %zu settings on a %d us drift, shift %g\n",
+		settings.size(), shift2_drift(), shift);
+	return run_stage(CAL_STAGE_SHIFT2, settings);
+}
+
+/**
+* @brief
+* Picks the safe setting of a stage that completes a correction the fastest.
+* @param stage - The stage
+* @return The result of the setting, NULL if none was safe
+*/
+const cal_result *calibrator::best(cal_stage stage)
+{
+	const cal_result *b = NULL;
+
+	for (size_t i = 0; i < results.size(); i++) {
+		const cal_result &r = results[i];
+		if (r.stage == stage && r.safe &&
+			(!b || r.duration_ms + r.settle_ms < b->duration_ms + b->settle_ms)) {
+			b = &r;
+		}
+	}
+	return b;
+}
+
+/**
+* @brief
+* Prints the results as CSV.
+* @param None
+* @return void
+*/
+void calibrator::print()
+{
+	printf("shift,shift2,step_wait_ms,drift_us,period_us,max_change_ppm,achieved_us,error_us,"
+		"duration_ms,settle_ms,missed,safe\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		const cal_result &r = results[i];
+		printf("%g,%g,%d,%d,%.3f,%.1f,%.1f,%.1f,%.1f,%.1f,%d,%d\n", r.setting.shift,
+			r.setting.shift2, r.setting.step_wait_ms, r.drift_us, r.period_us,
+			r.max_change_ppm, r.achieved_us, r.error_us, r.duration_ms, r.settle_ms,
+			r.missed, r.safe);
+	}
+}
+
+/**
+* @brief
+* Writes the best shift and the best shift2 and step wait to the profile as
+* the [display key] section of the display, replacing the one from an
+* earlier calibration. Without a safe shift2, stepping is disabled. Sections
+* of other displays are kept, so one profile can serve a whole wall. The
+* file is written to a temporary file and renamed over the old one.
+* @param *path - The profile
+* @param &key - Identity of the display, see calibration_store::make_key
+* @param *phy - Name of the PHY of the pipe
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE, no safe shift or the file can't be written
+*/
+int calibrator::save(const char *path, const std::string &key, const char *phy)
+{
+	const cal_result *b = best(CAL_STAGE_SHIFT);
+	const cal_result *b2 = best(CAL_STAGE_SHIFT2);
+	double shift2 = b2 ? b2->setting.shift2 : 0;
+	std::string section = "[display " + key + "]";
+	std::vector<std::string> kept;
+	char line[512];
+	bool skip = false;
+
+	if (!b) {
+		ERR("No shift was safe, the profile is not written\n");
+		return 1;
+	}
+	if (!b2) {
+		WARNING("No shift2 was safe, stepping is disabled in the profile\n");
+	}
+
+	FILE *fp = fopen(path, "r");
+	if (fp) {
+		while (fgets(line, sizeof(line), fp)) {
+			std::string l(line);
+			l.erase(l.find_last_not_of("\r\n") + 1);
+			if (l.size() && l[0] == '[') {
+				skip = l == section;
+			}
+			if (!skip) {
+				kept.push_back(l);
+			}
+		}
+		fclose(fp);
+	} else if (errno != ENOENT) {
+		ERR("Failed to open %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	std::string tmp = std::string(path) + ".tmp";
+	fp = fopen(tmp.c_str(), "w");
+	if (!fp) {
+		ERR("Failed to write %s: %s\n", tmp.c_str(), strerror(errno));
+		return 1;
+	}
+	if (kept.empty()) {
+		fprintf(fp, "# Sync parameters per display, written by synctest --calibrate\n");
+	}
+	for (size_t i = 0; i < kept.size(); i++) {
+		fprintf(fp, "%s\n", kept[i].c_str());
+	}
+	fprintf(fp, "%s\n", section.c_str());
+	fprintf(fp, "# %s, shift on a %d us drift, shift2 on a %d us drift, period %.3f us\n", phy,
+		shift_drift(), shift2_drift(), b->period_us);
+	fprintf(fp, "# shift,shift2,step_wait,drift_us,max_change_ppm,error_us,duration_ms,settle_ms,"
+		"missed,safe\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		const cal_result &r = results[i];
+		fprintf(fp, "# %g,%g,%d,%d,%.1f,%.1f,%.1f,%.1f,%d,%d\n", r.setting.shift,
+			r.setting.shift2, r.setting.step_wait_ms, r.drift_us, r.max_change_ppm, r.error_us,
+			r.duration_ms, r.settle_ms, r.missed, r.safe);
+	}
+	fprintf(fp, "shift = %g\n", b->setting.shift);
+	fprintf(fp, "shift2 = %g\n", shift2);
+	// The wait only applies between the steps of shift2
+	if (shift2) {
+		fprintf(fp, "step_wait = %d\n", b2->setting.step_wait_ms);
+	}
+	fprintf(fp, "step_threshold = %d\n", step_threshold_us);
+
+	if (fclose(fp) || rename(tmp.c_str(), path)) {
+		ERR("Failed to write %s: %s\n", path, strerror(errno));
+		unlink(tmp.c_str());
+		return 1;
+	}
+	INFO("Profile of %s written to %s: shift %g, shift2 %g, step_wait %d ms\n", key.c_str(),
+		path, b->setting.shift, shift2, shift2 ? b2->setting.step_wait_ms : 0);
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#ifndef _CALIBRATE_H
+#define _CALIBRATE_H
+
+#include <string>
+#include <vector>
+
+#define CAL_BASELINE_MS     500     // Capture before each correction for the reference period
+#define CAL_SETTLE_MAX_MS   3000    // Longest wait for the period to settle after a correction
+#define CAL_SETTLE_FRAMES   10      // Consecutive intervals back at the reference to be settled
+#define CAL_MIN_TOLERANCE   2.0     // Smallest interval tolerance in us
+#define CAL_MAX_ERROR       0.1     // Largest error of the drift achieved, fraction of the drift
+
+// Which parameter a measurement calibrates. shift alone corrects the drifts
+// below the step threshold, shift2 and the wait between its steps take over
+// from there.
+typedef enum {
+	CAL_STAGE_SHIFT,
+	CAL_STAGE_SHIFT2,
+} cal_stage;
+
+// A combination of sync parameters to try
+typedef struct _cal_setting {
+	double shift;
+	double shift2;
+	int step_wait_ms;
+} cal_setting;
+
+// What a setting did to the display
+typedef struct _cal_result {
+	cal_setting setting;
+	cal_stage stage;
+	int drift_us;           // Drift asked for, its sign gives the direction
+	double period_us;       // Reference period before the correction
+	double max_change_ppm;  // Largest change of the period during the correction
+	double achieved_us;     // Drift the correction moved the vblanks by
+	double error_us;        // Achieved minus requested drift
+	double duration_ms;     // Time synchronize_vsync took
+	double settle_ms;       // Time from its end until the period was steady, -1 = never
+	int missed;             // vblanks lost or late during the correction
+	bool safe;              // Nothing lost, settled and accurate
+} cal_result;
+
+/*
+ * Characterizes the PLL step response of the display of a pipe. shift is
+ * calibrated first with a drift below the step threshold, then shift2 and
+ * the step wait with a drift from the threshold, stepping by the shift
+ * chosen. Each setting corrects the drift of its stage, alternating its
+ * direction so the phase of the display stays near where it was, while the
+ * vblanks are streamed to measure the change of the period, the drift
+ * achieved, the settle time and any vblank lost. The fastest safe value of
+ * each stage is written to a profile the sync loop loads for the display.
+ */
+class calibrator {
+private:
+	std::string device;
+	int pipe;
+	int delta_us;
+	int step_threshold_us;
+	std::vector<cal_result> results;
+	int measure(const cal_setting &s, int drift_us, cal_result *r);
+	int run_stage(cal_stage stage, const std::vector<cal_setting> &settings);
+public:
+	calibrator(const char *device_str, int p, int delta, int step_threshold) :
+		device(device_str), pipe(p), delta_us(delta), step_threshold_us(step_threshold) {}
+	int shift_drift();
+	int shift2_drift();
+	int run(const std::vector<double> &shifts, const std::vector<double> &shift2s,
+		const std::vector<double> &waits);
+	const cal_result *best(cal_stage stage);
+	void print();
+	int save(const char *path, const std::string &key, const char *phy);
+};
+
+#endif
@@ -29,7 +29,11 @@
 #include <debug.h>
 #include <math.h>
 #include <getopt.h>
+#include <sstream>
+#include <vector>
 #include "version.h"
+#include "calibrate.h"
+#include "calibration.h"
 
 using namespace std;
 volatile int thread_continue = 1;
@@ -37,6 +41,72 @@ volatile int thread_continue = 1;
 #define MAX_DEVICE_NAME_LENGTH 64
 char g_devicestr[MAX_DEVICE_NAME_LENGTH];
 
+// Codes of the options that only have a long name
+enum {
+	OPT_CALIBRATE = 256,
+	OPT_SHIFTS,
+	OPT_SHIFT2S,
+	OPT_WAITS,
+};
+
+/**
+* @brief
+* Parses a comma separated list of numbers.
+* @param *str - The list
+* @param &values - Receives the numbers
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int parse_list(const char *str, std::vector<double> &values)
+{
+	std::stringstream ss(str);
+	std::string item;
+
+	values.clear();
+	while (std::getline(ss, item, ',')) {
+		char *end;
+		double v = strtod(item.c_str(), &end);
+		if (item.empty() || *end || v < 0) {
+			return 1;
+		}
+		values.push_back(v);
+	}
+	return values.empty();
+}
+
+/**
+* @brief
+* Runs the calibration of the display of a pipe and writes its profile.
+* @param pipe - The pipe
+* @param delta - Drift to correct with each shift2 setting in us
+* @param step_threshold - Drift from which shift2 is used in us
+* @param &shifts, &shift2s, &waits - The values to sweep, see calibrator::run
+* @param *profile - The profile to write
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int do_calibration(int pipe, int delta, int step_threshold, const std::vector<double> &shifts,
+	const std::vector<double> &shift2s, const std::vector<double> &waits, const char *profile)
+{
+	vsync_pipe_mode mode;
+	char name[32];
+
+	if (!get_phy_name(pipe, name, sizeof(name)) || get_pipe_mode(g_devicestr, pipe, &mode)) {
+		ERR("No display found on pipe %d\n", pipe);
+		return 1;
+	}
+
+	calibrator cal(g_devicestr, pipe, delta, step_threshold);
+	INFO("Calibrating pipe %d (%s)\n", pipe, name);
+	if (cal.run(shifts, shift2s, waits)) {
+		return 1;
+	}
+	cal.print();
+	return cal.save(profile, calibration_store::make_key(&mode, pipe, name), name);
+}
+
 /**
 * @brief
 * This function informs vsynclib about termination.
@@ -107,6 +177,12 @@ void print_help(const char *program_name)
 		"  --no-reset         Do no reset to original values. Keep modified PLL frequency and exit (default: reset)\n"
 		"  --no-commit        Do no commit changes.  Just print (default: commit)\n"
 		"  -m                 Use DP M & N Path. (default: no)\n"
+		"  --calibrate file   Try the shifts on a drift below -t, then the shift2s with each wait\n"
+		"                     on a drift of -d us (at least -t), and write the fastest safe\n"
+		"                     values to a profile\n"
+		"  --shifts list      Shifts to try (default: 0.005,0.01,0.02,0.05)\n"
+		"  --shift2s list     Shift2 values to try, 0 = no stepping (default: 0,0.1)\n"
+		"  --waits list       Waits between shift2 steps to try in ms (default: 10,25,50)\n"
 		"  -h                 Display this help message\n",
 		program_name);
 }
@@ -139,10 +215,18 @@ int main(int argc, char *argv[])
 	double frequency = 0.0;
 	bool m_n = false;
 	int step_threshold = VSYNC_TIME_DELTA_FOR_STEP, wait_between_steps = VSYNC_DEFAULT_WAIT_IN_MS;
+	std::string profile = "";
+	std::vector<double> shifts = { 0.005, 0.01, 0.02, 0.05 };
+	std::vector<double> shift2s = { 0.0, 0.1 };
+	std::vector<double> waits = { 10, 25, 50 };
 	static struct option long_options[] = {
 		{"no-reset", no_argument, NULL, 'r'},
 		{"no-commit", no_argument, NULL, 'c'},
 		{"mn", no_argument, NULL, 'm'},
+		{"calibrate", required_argument, NULL, OPT_CALIBRATE},
+		{"shifts", required_argument, NULL, OPT_SHIFTS},
+		{"shift2s", required_argument, NULL, OPT_SHIFT2S},
+		{"waits", required_argument, NULL, OPT_WAITS},
 		{0, 0, 0, 0}
 	};
 	int opt, option_index = 0; // getopt_long stores the option index here
@@ -185,6 +269,18 @@ int main(int argc, char *argv[])
 			case 'f':
 				frequency = std::stod(optarg);
 				break;
+			case OPT_CALIBRATE:
+				profile = optarg;
+				break;
+			case OPT_SHIFTS:
+			case OPT_SHIFT2S:
+			case OPT_WAITS:
+				if (parse_list(optarg, opt == OPT_SHIFTS ? shifts :
+					opt == OPT_SHIFT2S ? shift2s : waits)) {
+					ERR("Invalid list: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 'h':
 				print_help(argv[0]);
 				exit(EXIT_SUCCESS);
@@ -221,6 +317,13 @@ int main(int argc, char *argv[])
 	sigaction(SIGINT, &sigIntHandler, NULL);
 	sigaction(SIGTERM, &sigIntHandler, NULL);
 
+	if (!profile.empty()) {
+		ret = do_calibration(pipe, delta, step_threshold, shifts, shift2s, waits,
+			profile.c_str());
+		vsync_lib_uninit();
+		return ret;
+	}
+
 	if (commit) {
 		// synchronize_vsync function is synchronous call and does not
 		// output any information. To enhance visibility, a thread is
@@ -0,0 +1,186 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <debug.h>
+#include "calibration.h"
+
+/**
+* @brief
+* Builds the key of a display from its device, pipe, PHY and mode timing.
+* @param *mode - The device and mode of the pipe
+* @param pipe - The pipe
+* @param *phy - Name of the PHY of the pipe
+* @return The key
+*/
+std::string calibration_store::make_key(const vsync_pipe_mode *mode, int pipe, const char *phy)
+{
+	char key[128];
+	snprintf(key, sizeof(key), "%s,0x%04x,%d,%s,%u,%ux%u,%ux%u",
+		mode->pci_slot, mode->device_id, pipe, phy, mode->clock_khz,
+		mode->hdisplay, mode->vdisplay, mode->htotal, mode->vtotal);
+	return key;
+}
+
+/**
+* @brief
+* Reads the stored frequencies. A missing file is an empty store.
+* @param *filename - The file of the store
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int calibration_store::load(const char *filename)
+{
+	char line[256];
+
+	path = filename;
+	entries.clear();
+
+	FILE *fp = fopen(filename, "r");
+	if (!fp) {
+		if (errno == ENOENT) {
+			return 0;
+		}
+		ERR("Failed to open calibration file %s: %s\n", filename, strerror(errno));
+		return 1;
+	}
+
+	// Each line is the key followed by the frequency after the last comma
+	while (fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\r\n")] = 0;
+		char *sep = strrchr(line, ',');
+		if (line[0] == '#' || !sep) {
+			continue;
+		}
+		*sep = 0;
+		entry e;
+		e.key = line;
+		e.pll_clock = atof(sep + 1);
+		if (e.pll_clock > 0) {
+			entries.push_back(e);
+		} else {
+			WARNING("Ignoring calibration of %s: %s\n", line, sep + 1);
+		}
+	}
+
+	fclose(fp);
+	DBG("Loaded %zu calibrations from %s\n", entries.size(), filename);
+	return 0;
+}
+
+/**
+* @brief
+* Writes the store out. The file is replaced in one step so that a crash
+* while saving leaves the previous calibrations in place.
+* @param None
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int calibration_store::save()
+{
+	std::string tmp = path + ".tmp";
+
+	if (path.empty()) {
+		return 1;
+	}
+
+	FILE *fp = fopen(tmp.c_str(), "w");
+	if (!fp) {
+		ERR("Failed to open calibration file %s: %s\n", tmp.c_str(), strerror(errno));
+		return 1;
+	}
+
+	fprintf(fp, "# pci slot,device id,pipe,phy,clock (kHz),active,total,PLL frequency\n");
+	for (size_t i = 0; i < entries.size(); i++) {
+		fprintf(fp, "%s,%.6f\n", entries[i].key.c_str(), entries[i].pll_clock);
+	}
+
+	if (fflush(fp) || fsync(fileno(fp))) {
+		ERR("Failed to write calibration file %s: %s\n", tmp.c_str(), strerror(errno));
+		fclose(fp);
+		unlink(tmp.c_str());
+		return 1;
+	}
+	fclose(fp);
+
+	if (rename(tmp.c_str(), path.c_str())) {
+		ERR("Failed to replace calibration file %s: %s\n", path.c_str(), strerror(errno));
+		unlink(tmp.c_str());
+		return 1;
+	}
+	return 0;
+}
+
+/**
+* @brief
+* Finds the frequency stored for a display.
+* @param &key - The key of the display
+* @param *pll_clock - Receives the frequency
+* @return true if the display has a calibration
+*/
+bool calibration_store::lookup(const std::string &key, double *pll_clock)
+{
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].key == key) {
+			*pll_clock = entries[i].pll_clock;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+* @brief
+* Sets the frequency of a display.
+* @param &key - The key of the display
+* @param pll_clock - The learned frequency
+* @return true if the store changed and needs saving
+*/
+bool calibration_store::update(const std::string &key, double pll_clock)
+{
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].key == key) {
+			if (fabs(entries[i].pll_clock - pll_clock) < 1e-6) {
+				return false;
+			}
+			entries[i].pll_clock = pll_clock;
+			return true;
+		}
+	}
+
+	entry e;
+	e.key = key;
+	e.pll_clock = pll_clock;
+	entries.push_back(e);
+	return true;
+}
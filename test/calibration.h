@@ -0,0 +1,59 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#ifndef _CALIBRATION_H
+#define _CALIBRATION_H
+
+#include <string>
+#include <vector>
+#include <vsyncalter.h>
+
+#define CALIBRATION_DEFAULT_FILE  "vsync_calibration.txt"
+#define CALIBRATION_MAX_OFFSET    0.01   // Largest trusted offset of a stored PLL frequency
+
+/*
+ * Stores the PLL frequency the secondary has learned for a display, so a
+ * restarted node can start from it instead of learning it again. Entries
+ * are keyed by the graphics device, pipe, PHY and mode timing, so a value
+ * is only reapplied to the display and mode it was learned on.
+ */
+class calibration_store {
+private:
+	struct entry {
+		std::string key;
+		double pll_clock;
+	};
+	std::string path;
+	std::vector<entry> entries;
+public:
+	int load(const char *filename);
+	int save();
+	bool lookup(const std::string &key, double *pll_clock);
+	bool update(const std::string &key, double pll_clock);
+	static std::string make_key(const vsync_pipe_mode *mode, int pipe, const char *phy);
+};
+
+#endif
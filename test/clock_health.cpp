@@ -0,0 +1,419 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <linux/ptp_clock.h>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <debug.h>
+#include <clocks.h>
+#include "clock_health.h"
+
+/**
+* @brief
+* Runs a command and collects its output.
+* @param &cmd - The command line
+* @param *out - Receives the output
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+static int run_command(const std::string &cmd, std::string *out)
+{
+	char buf[256];
+	FILE *f = popen(cmd.c_str(), "r");
+
+	if (!f) {
+		ERR("Failed to run %s\n", cmd.c_str());
+		return 1;
+	}
+	out->clear();
+	while (fgets(buf, sizeof(buf), f)) {
+		out->append(buf);
+	}
+	return pclose(f) == 0 ? 0 : 1;
+}
+
+/**
+* @brief
+* Finds the PTP hardware clock of a network interface.
+* @param &iface - The interface, e.g. eth0
+* @param *dev - Receives the device, e.g. /dev/ptp0
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE, the interface has no PHC
+*/
+static int find_phc(const std::string &iface, std::string *dev)
+{
+	std::string dir = "/sys/class/net/" + iface + "/device/ptp";
+	DIR *d = opendir(dir.c_str());
+	struct dirent *e;
+
+	if (!d) {
+		return 1;
+	}
+	dev->clear();
+	while ((e = readdir(d))) {
+		if (!strncmp(e->d_name, "ptp", 3)) {
+			*dev = std::string("/dev/") + e->d_name;
+			break;
+		}
+	}
+	closedir(d);
+	return dev->empty() ? 1 : 0;
+}
+
+/**
+* @brief
+* Measures how far the system clock is from a PHC, which is what phc2sys
+* keeps small. Uses the cross timestamp of the hardware when the driver has
+* one and the closest of several reads around the PHC otherwise.
+* @param &dev - The PHC, e.g. /dev/ptp0
+* @param utc_offset_s - Seconds the PHC is ahead of UTC, 0 unless it runs on TAI
+* @param *offset_us - Receives the offset of the system clock
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+static int read_phc_system_offset(const std::string &dev, int utc_offset_s, double *offset_us)
+{
+	struct ptp_sys_offset_precise precise;
+	struct ptp_sys_offset_extended ext;
+	int64_t phc_real = 0;
+	int fd = open(dev.c_str(), O_RDONLY);
+
+	if (fd < 0) {
+		ERR("Failed to open %s\n", dev.c_str());
+		return 1;
+	}
+	memset(&precise, 0, sizeof(precise));
+	if (!ioctl(fd, PTP_SYS_OFFSET_PRECISE, &precise)) {
+		phc_real = ((int64_t) precise.device.sec * 1000000000 + precise.device.nsec) -
+			((int64_t) precise.sys_realtime.sec * 1000000000 + precise.sys_realtime.nsec);
+	} else {
+		memset(&ext, 0, sizeof(ext));
+		ext.n_samples = PHC_SYSTEM_READS;
+		if (ioctl(fd, PTP_SYS_OFFSET_EXTENDED, &ext) || !ext.n_samples) {
+			ERR("Failed to read %s against the system clock\n", dev.c_str());
+			close(fd);
+			return 1;
+		}
+		int64_t best = INT64_MAX;
+		for (unsigned int i = 0; i < ext.n_samples; i++) {
+			int64_t before = (int64_t) ext.ts[i][0].sec * 1000000000 + ext.ts[i][0].nsec;
+			int64_t phc = (int64_t) ext.ts[i][1].sec * 1000000000 + ext.ts[i][1].nsec;
+			int64_t after = (int64_t) ext.ts[i][2].sec * 1000000000 + ext.ts[i][2].nsec;
+			if (after - before < best) {
+				best = after - before;
+				phc_real = phc - (before + (after - before) / 2);
+			}
+		}
+	}
+	close(fd);
+
+	*offset_us = (double) ((int64_t) utc_offset_s * 1000000000 - phc_real) / 1000;
+	return 0;
+}
+
+/**
+* @brief
+* Reads the state of ptp4l and, unless only the PHC is used, of the system
+* clock phc2sys keeps on it. With several ports, the one following the
+* grandmaster is taken, else a master port. The clock is locked when that
+* port follows a grandmaster or is itself the master, and the system clock
+* is within reach of the PHC. The offset is the one of ptp4l from the
+* grandmaster plus the one of the system clock from the PHC. Ports with
+* software timestamps have no PHC, ptp4l steers the system clock itself.
+* @param *st - Receives the state
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int pmc_source::query(clock_status *st)
+{
+	std::string out, line, key, value;
+	std::string cmd = "pmc -u -b 0";
+	bool gm_present = false, have_offset = false, ptp_timescale = false;
+	int utc_offset_s = 0;
+	std::vector<pmc_port> ports;
+	const pmc_port *port = NULL;
+
+	if (!uds.empty()) {
+		cmd += " -s " + uds;
+	}
+	cmd += " 'GET TIME_STATUS_NP' 'GET PORT_PROPERTIES_NP' 'GET TIME_PROPERTIES_DATA_SET'"
+		" 2>/dev/null";
+	if (run_command(cmd, &out)) {
+		return 1;
+	}
+
+	std::istringstream lines(out);
+	while (std::getline(lines, line)) {
+		std::istringstream fields(line);
+		if (!(fields >> key >> value)) {
+			continue;
+		}
+		if (key == "master_offset") {
+			st->offset_us = atof(value.c_str()) / 1000;
+			have_offset = true;
+		} else if (key == "gmPresent") {
+			gm_present = value == "true";
+		} else if (key == "currentUtcOffset") {
+			utc_offset_s = atoi(value.c_str());
+		} else if (key == "ptpTimescale") {
+			ptp_timescale = atoi(value.c_str()) != 0;
+		} else if (key == "portIdentity") {
+			ports.push_back(pmc_port());
+		} else if (ports.empty()) {
+			continue;
+		} else if (key == "portState") {
+			ports.back().state = value;
+		} else if (key == "timestamping") {
+			ports.back().timestamping = value;
+		} else if (key == "interface") {
+			ports.back().iface = value;
+		}
+	}
+
+	for (size_t i = 0; i < ports.size(); i++) {
+		if (ports[i].state == "SLAVE" || ports[i].state == "UNCALIBRATED") {
+			port = &ports[i];
+			break;
+		}
+		if (!port && (ports[i].state == "MASTER" || ports[i].state == "GRAND_MASTER")) {
+			port = &ports[i];
+		}
+	}
+	if (!port && !ports.empty()) {
+		port = &ports[0];
+	}
+	if (!port || !have_offset) {
+		return 1;
+	}
+	if (port->state == "MASTER" || port->state == "GRAND_MASTER") {
+		st->state = CLOCK_LOCKED;
+		st->offset_us = 0;
+	} else if (port->state == "SLAVE" && gm_present) {
+		st->state = CLOCK_LOCKED;
+	} else {
+		st->state = CLOCK_UNLOCKED;
+	}
+
+	if (system && st->state == CLOCK_LOCKED && port->timestamping != "SOFTWARE") {
+		std::string dev;
+		double sys_us;
+		if (find_phc(port->iface, &dev)) {
+			ERR("No PHC found for %s\n", port->iface.c_str());
+			return 1;
+		}
+		if (read_phc_system_offset(dev, ptp_timescale ? utc_offset_s : 0, &sys_us)) {
+			return 1;
+		}
+		DBG("System clock %.3f us off %s\n", sys_us, dev.c_str());
+		st->offset_us += sys_us;
+	}
+	return 0;
+}
+
+/**
+* @brief
+* Reads the state of chronyd from the CSV output of chronyc tracking. The
+* clock is locked unless chronyd reports it is not synchronised.
+* @param *st - Receives the state
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int chrony_source::query(clock_status *st)
+{
+	std::string out, field;
+	std::vector<std::string> fields;
+
+	if (run_command("chronyc -c tracking 2>/dev/null", &out)) {
+		return 1;
+	}
+
+	// Reference ID, name, stratum, reference time, system time offset in s,
+	// ..., leap status last
+	std::istringstream csv(out.substr(0, out.find('\n')));
+	while (std::getline(csv, field, ',')) {
+		fields.push_back(field);
+	}
+	if (fields.size() < 14) {
+		return 1;
+	}
+	st->offset_us = atof(fields[4].c_str()) * 1000000;
+	st->state = fields[13] == "Not synchronised" || atoi(fields[2].c_str()) >= 16 ?
+		CLOCK_UNLOCKED : CLOCK_LOCKED;
+	return 0;
+}
+
+/**
+* @brief
+* Reads the state written by a local stand-in for a clock daemon.
+* @param *st - Receives the state
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int file_source::query(clock_status *st)
+{
+	std::ifstream f(path);
+	std::string state;
+
+	if (!(f >> state >> st->offset_us)) {
+		return 1;
+	}
+	if (state == "locked") {
+		st->state = CLOCK_LOCKED;
+	} else if (state == "unlocked") {
+		st->state = CLOCK_UNLOCKED;
+	} else {
+		return 1;
+	}
+	return 0;
+}
+
+/**
+* @brief
+* Selects the clock source.
+* @param *spec - pmc[:socket], chrony, file:path or none
+* @param max_offset - Clock error in us beyond which corrections stop
+* @param margin - Offset in us tolerated between the clocks of two systems,
+* 0 to derive it from the source
+* @param system_clock - The vsyncs are stamped by the system clock, not a PHC,
+* so ptp4l alone does not tell its health
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int clock_gate::init(const char *spec, double max_offset, double margin, bool system_clock)
+{
+	std::string s(spec);
+
+	delete source;
+	source = NULL;
+	if (max_offset <= 0) {
+		ERR("Invalid clock offset limit: %f\n", max_offset);
+		return 1;
+	}
+	max_offset_us = max_offset;
+	if (margin < 0) {
+		ERR("Invalid clock margin: %f\n", margin);
+		return 1;
+	}
+	margin_us = margin;
+
+	if (s == "none") {
+		return 0;
+	} else if (s == "pmc") {
+		source = new pmc_source(NULL, system_clock);
+	} else if (s.compare(0, 4, "pmc:") == 0) {
+		source = new pmc_source(s.c_str() + 4, system_clock);
+	} else if (s == "chrony") {
+		source = new chrony_source();
+	} else if (s.compare(0, 5, "file:") == 0 && s.size() > 5) {
+		source = new file_source(s.c_str() + 5);
+	} else {
+		ERR("Unknown clock source: %s\n", spec);
+		return 1;
+	}
+	INFO("Checking the clock with %s\n", source->name());
+	return 0;
+}
+
+/**
+* @brief
+* Tells whether vsyncs can be compared now. The reading of the source is
+* reused for CLOCK_QUERY_INTERVAL_MS.
+* @param *error_us - Receives the clock error to allow for in the delta, 0
+* when no source is set
+* @return
+* - 0 = corrections allowed
+* - 1 = corrections suspended, the clock is not locked or too far off
+*/
+int clock_gate::check(double *error_us)
+{
+	*error_us = 0;
+	if (!source) {
+		return 0;
+	}
+
+	uint64_t now_ns = monotonic_ns();
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (!last_ns || now_ns - last_ns >= CLOCK_QUERY_INTERVAL_MS * 1000000ULL) {
+		clock_status st = { CLOCK_UNKNOWN, 0 };
+		if (source->query(&st)) {
+			st.state = CLOCK_UNKNOWN;
+		}
+		if (st.state != last.state || !last_ns) {
+			if (st.state == CLOCK_LOCKED) {
+				INFO("Clock locked by %s, offset %.3f us\n", source->name(), st.offset_us);
+			} else {
+				WARNING("Clock %s by %s, corrections suspended\n",
+					st.state == CLOCK_UNKNOWN ? "state unknown" : "unlocked", source->name());
+			}
+		}
+		last = st;
+		last_ns = now_ns;
+	}
+
+	if (last.state != CLOCK_LOCKED) {
+		return 1;
+	}
+	if (fabs(last.offset_us) > max_offset_us) {
+		DBG("Clock offset %.3f us beyond %.3f us\n", last.offset_us, max_offset_us);
+		return 1;
+	}
+	*error_us = fabs(last.offset_us);
+	return 0;
+}
+
+/**
+* @brief
+* Gives the offset tolerated between the clocks of two systems when
+* checking that vsyncs were taken during their exchange. Each system may be
+* off its reference by up to the limit of the source, otherwise the clocks
+* are only known to be roughly in sync.
+* @return The offset in us
+*/
+double clock_gate::margin()
+{
+	if (margin_us > 0) {
+		return margin_us;
+	}
+	return source ? 2 * max_offset_us : CLOCK_DEFAULT_MARGIN_US;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#ifndef _CLOCK_HEALTH_H
+#define _CLOCK_HEALTH_H
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+
+#define CLOCK_DEFAULT_MAX_OFFSET_US  50    // Clock error beyond which corrections stop
+// Offset tolerated between the clocks of two systems when no source checks them
+#define CLOCK_DEFAULT_MARGIN_US      50000
+#define CLOCK_QUERY_INTERVAL_MS      1000  // Reuse a reading for this long
+#define PHC_SYSTEM_READS             5     // Reads of the PHC against the system clock
+// Added to the quality of a window skipped because the clock is not locked
+#define CLOCK_FLAG_UNLOCKED          0x400
+
+typedef enum {
+	CLOCK_UNKNOWN,          // The source could not be read
+	CLOCK_LOCKED,           // Following its reference
+	CLOCK_UNLOCKED,         // Free running or still converging
+} clock_state;
+
+typedef struct _clock_status {
+	clock_state state;
+	double offset_us;       // Last offset from the reference reported by the source
+} clock_status;
+
+/*
+ * A daemon keeping the system clock in sync with the other nodes, which
+ * reports whether it is locked and by how much the clock is off.
+ */
+class clock_source {
+public:
+	virtual ~clock_source() {}
+	virtual int query(clock_status *st) = 0;
+	virtual const char *name() = 0;
+};
+
+// A port of ptp4l as reported by PORT_PROPERTIES_NP
+typedef struct _pmc_port {
+	std::string state;      // portState, e.g. SLAVE
+	std::string timestamping;
+	std::string iface;
+} pmc_port;
+
+/*
+ * ptp4l, through its management interface on a UNIX socket, using pmc. ptp4l
+ * only steers the PHC of the NIC, so unless the vsyncs are on the PHC the
+ * system clock is also read against it to cover phc2sys.
+ */
+class pmc_source : public clock_source {
+private:
+	std::string uds;        // Socket of ptp4l, empty for the default
+	bool system;            // Check the system clock against the PHC
+public:
+	pmc_source(const char *path, bool sys) : uds(path ? path : ""), system(sys) {}
+	int query(clock_status *st);
+	const char *name() { return "ptp4l"; }
+};
+
+// chronyd, through its command socket, using chronyc
+class chrony_source : public clock_source {
+public:
+	int query(clock_status *st);
+	const char *name() { return "chrony"; }
+};
+
+// A file holding "locked|unlocked offset_us", written by a local stand-in
+class file_source : public clock_source {
+private:
+	std::string path;
+public:
+	file_source(const char *p) : path(p) {}
+	int query(clock_status *st);
+	const char *name() { return "file"; }
+};
+
+/*
+ * Decides from the health of the clock whether the vsyncs of two systems can
+ * be compared. The vsync timestamps are only as good as the clocks, so a
+ * correction made while the clock is unlocked or far off chases the clock
+ * error instead of a drift of the displays. Safe to share between threads.
+ */
+class clock_gate {
+private:
+	clock_source *source;
+	double max_offset_us;
+	double margin_us;       // Offset tolerated between two systems, 0 = derived
+	clock_status last;
+	uint64_t last_ns;       // When last was read, 0 = never
+	std::mutex lock;
+public:
+	clock_gate() : source(NULL), max_offset_us(CLOCK_DEFAULT_MAX_OFFSET_US), margin_us(0),
+		last_ns(0) {
+		last.state = CLOCK_UNKNOWN;
+		last.offset_us = 0;
+	}
+	~clock_gate() { delete source; }
+	int init(const char *spec, double max_offset, double margin, bool system_clock);
+	bool enabled() { return source != NULL; }
+	int check(double *error_us);
+	double margin();
+};
+
+#endif
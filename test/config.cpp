@@ -0,0 +1,357 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/inotify.h>
+#include <vector>
+#include <debug.h>
+#include "config.h"
+
+/**
+* @brief
+* Destructor of the configuration, stops watching the file.
+*/
+config_file::~config_file()
+{
+	if (notify_fd >= 0) {
+		close(notify_fd);
+	}
+}
+
+/**
+* @brief
+* Removes the blanks around a string.
+* @param *str - The string, changed in place
+* @return The start of the trimmed string
+*/
+static char *trim(char *str)
+{
+	char *end;
+
+	while (*str == ' ' || *str == '\t') {
+		str++;
+	}
+	end = str + strlen(str);
+	while (end > str && strchr(" \t\r\n", end[-1])) {
+		*--end = 0;
+	}
+	return str;
+}
+
+/**
+* @brief
+* Reads the configuration file. The settings read before are only replaced
+* if the whole file can be read.
+* @param *filename - The file to read
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int config_file::load(const char *filename)
+{
+	std::map<std::string, std::map<std::string, std::string>> read;
+	std::string section = "global";
+	char buffer[256];
+	int line = 0, ret = 0;
+
+	FILE *fp = fopen(filename, "r");
+	if (!fp) {
+		ERR("Failed to open configuration file %s: %s\n", filename, strerror(errno));
+		return 1;
+	}
+
+	while (fgets(buffer, sizeof(buffer), fp)) {
+		char *str = trim(buffer), *eq;
+		line++;
+		if (!*str || *str == '#' || *str == ';') {
+			continue;
+		}
+		if (*str == '[') {
+			char *close = strchr(str, ']');
+			if (!close) {
+				ERR("%s:%d: missing ]\n", filename, line);
+				ret = 1;
+				break;
+			}
+			*close = 0;
+			section = trim(str + 1);
+			// [pipe1] and [pipe 1] are the same section
+			int pipe;
+			if (sscanf(section.c_str(), "pipe %d", &pipe) == 1 ||
+				sscanf(section.c_str(), "pipe%d", &pipe) == 1) {
+				section = "pipe " + std::to_string(pipe);
+			}
+		} else if ((eq = strchr(str, '='))) {
+			*eq = 0;
+			// A comment may follow the value after a blank
+			char *value = eq + 1, *c = value;
+			while ((c = strpbrk(c, "#;"))) {
+				if (c > value && (c[-1] == ' ' || c[-1] == '\t')) {
+					*c = 0;
+					break;
+				}
+				c++;
+			}
+			read[section][trim(str)] = trim(value);
+		} else {
+			ERR("%s:%d: expected key = value\n", filename, line);
+			ret = 1;
+			break;
+		}
+	}
+	fclose(fp);
+
+	if (!ret) {
+		path = filename;
+		sections.swap(read);
+	}
+	return ret;
+}
+
+/**
+* @brief
+* Finds the value of a setting for a pipe.
+* @param *key - The setting
+* @param pipe - The pipe, its section and the one of its display override [global]
+* @return The value or NULL if it isn't set
+*/
+const char *config_file::lookup(const char *key, int pipe)
+{
+	const char *sections_to_try[] = { NULL, NULL, "global" };
+	std::string pipe_section = "pipe " + std::to_string(pipe);
+	std::string display_section;
+	sections_to_try[0] = pipe_section.c_str();
+	auto d = displays.find(pipe);
+	if (d != displays.end()) {
+		display_section = "display " + d->second;
+		sections_to_try[1] = display_section.c_str();
+	}
+
+	for (int i = 0; i < 3; i++) {
+		if (!sections_to_try[i]) {
+			continue;
+		}
+		auto s = sections.find(sections_to_try[i]);
+		if (s != sections.end()) {
+			auto v = s->second.find(key);
+			if (v != s->second.end()) {
+				return v->second.c_str();
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+* @brief
+* Records the current values of the settings.
+* @param *items - The settings
+* @param count - Number of settings
+* @return void
+*/
+void config_values::save(const config_item *items, int count)
+{
+	char buffer[64];
+
+	values.clear();
+	for (int i = 0; i < count; i++) {
+		switch (items[i].type) {
+			case CONFIG_INT:
+				snprintf(buffer, sizeof(buffer), "%d", *(int *) items[i].value);
+				values[items[i].key] = buffer;
+				break;
+			case CONFIG_DOUBLE:
+				// Enough digits to read back the same double
+				snprintf(buffer, sizeof(buffer), "%.17g", *(double *) items[i].value);
+				values[items[i].key] = buffer;
+				break;
+			default:
+				values[items[i].key] = *(std::string *) items[i].value;
+				break;
+		}
+	}
+}
+
+/**
+* @brief
+* Gives the recorded value of a setting.
+* @param *key - The setting
+* @return The value or NULL if it wasn't recorded
+*/
+const char *config_values::get(const char *key) const
+{
+	auto v = values.find(key);
+	return v != values.end() ? v->second.c_str() : NULL;
+}
+
+/**
+* @brief
+* Sets the items from the configuration. Either all of them are set or,
+* if one is invalid, none is. Settings missing from the file take their
+* value in base, so the items match the file on top of base whatever was
+* applied before. Without base, or for settings only read at start, they
+* are left as they are.
+* @param *items - The settings
+* @param count - Number of settings
+* @param pipe - The pipe whose section applies
+* @param reload - Whether the program is running already, in which case
+* settings read only at start are reported instead of changed
+* @param *base - The values under the file, NULL for none
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int config_file::apply(config_item *items, int count, int pipe, bool reload,
+	const config_values *base)
+{
+	std::vector<int> ints(count);
+	std::vector<double> doubles(count);
+	std::vector<const char *> values(count);
+
+	// Check everything first so a bad value doesn't leave half of it applied
+	for (int i = 0; i < count; i++) {
+		const char *value = lookup(items[i].key, pipe);
+		char *end;
+		if (!value && base && !items[i].startup) {
+			value = base->get(items[i].key);
+		}
+		values[i] = value;
+		if (!value || items[i].type == CONFIG_STRING) {
+			continue;
+		}
+		doubles[i] = strtod(value, &end);
+		if (end == value || *end || doubles[i] < items[i].min || doubles[i] > items[i].max) {
+			ERR("Invalid %s in %s: %s (%g - %g)\n", items[i].key, path.c_str(), value,
+				items[i].min, items[i].max);
+			return 1;
+		}
+		ints[i] = (int) doubles[i];
+		if (items[i].type == CONFIG_INT && ints[i] != doubles[i]) {
+			ERR("Invalid %s in %s: %s is not an integer\n", items[i].key, path.c_str(), value);
+			return 1;
+		}
+	}
+
+	for (int i = 0; i < count; i++) {
+		const char *value = values[i];
+		bool same;
+		if (!value) {
+			continue;
+		}
+		switch (items[i].type) {
+			case CONFIG_INT:
+				same = *(int *) items[i].value == ints[i];
+				break;
+			case CONFIG_DOUBLE:
+				same = *(double *) items[i].value == doubles[i];
+				break;
+			default:
+				same = *(std::string *) items[i].value == value;
+				break;
+		}
+		if (same) {
+			continue;
+		}
+		if (reload && items[i].startup) {
+			WARNING("%s changed to %s, restart to apply it\n", items[i].key, value);
+			continue;
+		}
+		switch (items[i].type) {
+			case CONFIG_INT:
+				*(int *) items[i].value = ints[i];
+				break;
+			case CONFIG_DOUBLE:
+				*(double *) items[i].value = doubles[i];
+				break;
+			default:
+				*(std::string *) items[i].value = value;
+				break;
+		}
+		if (reload) {
+			INFO("%s set to %s\n", items[i].key, value);
+		}
+	}
+	return 0;
+}
+
+/**
+* @brief
+* Starts watching the configuration file for changes. The directory is
+* watched since editors often replace the file instead of writing it.
+* @param None
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int config_file::watch()
+{
+	std::vector<char> dir(path.begin(), path.end());
+	dir.push_back(0);
+
+	notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (notify_fd < 0 ||
+		inotify_add_watch(notify_fd, dirname(dir.data()), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		ERR("Failed to watch %s: %s\n", path.c_str(), strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+/**
+* @brief
+* Tells whether the configuration file was written since the last call.
+* @param None
+* @return true if it changed
+*/
+bool config_file::changed()
+{
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	std::vector<char> file(path.begin(), path.end());
+	bool ret = false;
+	ssize_t len;
+
+	if (notify_fd < 0) {
+		return false;
+	}
+	file.push_back(0);
+	const char *name = basename(file.data());
+
+	while ((len = read(notify_fd, buffer, sizeof(buffer))) > 0) {
+		for (char *p = buffer; p < buffer + len; ) {
+			struct inotify_event *ev = (struct inotify_event *) p;
+			if (ev->len && !strcmp(ev->name, name)) {
+				ret = true;
+			}
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	return ret;
+}
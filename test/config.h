@@ -0,0 +1,97 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#ifndef _CONFIG_H
+#define _CONFIG_H
+
+#include <map>
+#include <string>
+
+typedef enum {
+	CONFIG_INT,
+	CONFIG_DOUBLE,
+	CONFIG_STRING,
+} config_type;
+
+// A setting that can be read from the configuration file
+typedef struct _config_item {
+	const char *key;
+	config_type type;
+	void *value;            // int, double or std::string depending on the type
+	double min, max;        // Valid range of a number
+	bool startup;           // Only read at start, a change needs a restart
+} config_item;
+
+/*
+ * The values of the settings at one point, e.g. those given on the command
+ * line, which the configuration file is applied on top of again when it is
+ * read again, so a setting removed from the file goes back to its value.
+ */
+class config_values {
+private:
+	std::map<std::string, std::string> values;
+public:
+	void save(const config_item *items, int count);
+	const char *get(const char *key) const;
+};
+
+/*
+ * Reads an INI style configuration file:
+ *
+ *     # comment
+ *     [global]
+ *     delta = 100
+ *     [pipe 1]
+ *     delta = 200
+ *     [display 0000:00:02.0,0x7d55,0,DDI A,148500,1920x1080,2200x1125]
+ *     shift = 0.02
+ *
+ * A setting in the [pipe N] section of a pipe overrides the one in the
+ * [display key] section of the display on the pipe, which overrides the one
+ * in [global]. The key is the one of calibration_store::make_key, as written
+ * in the profiles of synctest --calibrate.
+ * The file can be watched with inotify so it is read again when saved.
+ */
+class config_file {
+private:
+	std::string path;
+	std::map<std::string, std::map<std::string, std::string>> sections;
+	std::map<int, std::string> displays;  // Display on each pipe
+	int notify_fd;
+	const char *lookup(const char *key, int pipe);
+public:
+	config_file() : notify_fd(-1) {}
+	~config_file();
+	int load(const char *filename);
+	void set_display(int pipe, const std::string &key) { displays[pipe] = key; }
+	int apply(config_item *items, int count, int pipe, bool reload,
+		const config_values *base = NULL);
+	int watch();
+	bool changed();
+	const char *get_path() { return path.c_str(); }
+};
+
+#endif
@@ -52,6 +52,7 @@ connection::connection(const char* ip) : portid(5001) , con_type(TCP)
 	sockfd = 0;
 	hostptr = {};
 	server_addr = {};
+	stopping = false;
 	
 	if (ip) {
 		strncpy(ip_address, ip, sizeof(ip_address) - 1);
@@ -165,6 +166,22 @@ void connection::close_server()
 	close(sockfd);
 }
 
+/**
+* @brief
+* Stops a server used by another thread. accept_client and recv_msg return
+* with a failure there, within the 100 ms of a receive poll, so the thread
+* can be joined. The socket must still be closed once it is done.
+* @param None
+* @return void
+*/
+void connection::stop_server()
+{
+	TRACING();
+	stopping = true;
+	// Wakes up a thread blocked in accept
+	shutdown(sockfd, SHUT_RDWR);
+}
+
 /**
 * @brief
 * pr_inet
@@ -304,7 +321,7 @@ int connection::recvfrom_msg(void *m, int size, int sockid, struct sockaddr *des
 
 	if (fcntl(sockfd_to_use, F_SETFL, flags | O_NONBLOCK) < 0) return 1;
 
-	while (!client_done) {
+	while (!client_done && !stopping) {
 		bytes_received = recvfrom(sockfd_to_use, (char *) m, size, 0, dest, (socklen_t *) dest_size);
 
 		if (bytes_received > 0) {
@@ -327,7 +344,7 @@ int connection::recvfrom_msg(void *m, int size, int sockid, struct sockaddr *des
 			}
 		}
 	}
-	return 0;
+	return stopping ? 1 : 0;
 }
 
 /**
@@ -27,6 +27,7 @@
 
 #include <netdb.h>
 #include <string.h>
+#include <atomic>
 #include <linux/input.h>
 #include <memory.h>
 #include <vsyncalter.h>
@@ -54,11 +55,13 @@ protected:
 	struct hostent * hostptr;
 	sockaddr_in server_addr;
 	char ip_address[32];  // Store IP address
+	std::atomic<bool> stopping;  // Set by stop_server from another thread
 	void set_server(sockaddr_in *addr, int s_addr, int portid);
 	void pr_inet(char **listptr, int length, char * buffer);
 public:
 	connection(const char* ip = "");
 	virtual ~connection() {}
+	void set_port(int port) { portid = port; }
 	virtual int init_client(const char *server_name);
 	virtual int init_server();
 	int open_socket(int type);
@@ -74,6 +77,8 @@ public:
 	virtual int accept_client(int *new_sockfd);
 	void close_client();
 	void close_server();
+	void stop_server();
+	bool stopped() { return stopping; }
 };
 
 
@@ -0,0 +1,234 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#include <time.h>
+#include <chrono>
+#include <debug.h>
+#include "history.h"
+
+/**
+* @brief
+* Starts recording the vblanks of a pipe.
+* @param *device_str - The device to capture on
+* @param p - The pipe
+* @param size - Number of vblanks kept
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int vblank_history::start(const char *device_str, int p, int size)
+{
+	if (size <= 0) {
+		return 1;
+	}
+	device = device_str;
+	pipe = p;
+	ring.resize(size);
+	total = 0;
+	stopping = false;
+	if (pthread_create(&tid, NULL, run, this)) {
+		ERR("Failed to start the vblank history\n");
+		return 1;
+	}
+	running = true;
+	return 0;
+}
+
+/**
+* @brief
+* Stops recording. The stream ends with the next vblank.
+* @param None
+* @return void
+*/
+void vblank_history::stop()
+{
+	if (!running) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	pthread_join(tid, NULL);
+	running = false;
+}
+
+/**
+* @brief
+* Thread streaming the vblanks of the pipe into the ring.
+* @param *arg - The vblank_history
+* @return NULL
+*/
+void *vblank_history::run(void *arg)
+{
+	vblank_history *h = (vblank_history *) arg;
+
+	if (stream_vsync(h->device.c_str(), &h->pipe, 1, 0, store, h)) {
+		ERR("vblank history of pipe %d stopped\n", h->pipe);
+	}
+	return NULL;
+}
+
+/**
+* @brief
+* Stream handler adding a batch of vblanks to the ring.
+* @param pipe - The pipe of the batch
+* @param *samples - The vblanks
+* @param count - Number of vblanks
+* @param *user_data - The vblank_history
+* @return Non-zero to stop the stream
+*/
+int vblank_history::store(int pipe, const vsync_sample *samples, int count, void *user_data)
+{
+	vblank_history *h = (vblank_history *) user_data;
+	{
+		std::lock_guard<std::mutex> guard(h->lock);
+		for (int i = 0; i < count; i++) {
+			h->ring[h->total++ % h->ring.size()] = samples[i];
+		}
+		if (h->stopping) {
+			return 1;
+		}
+	}
+	h->added.notify_all();
+	return 0;
+}
+
+/**
+* @brief
+* Copies a window of the ring and checks it like a fresh capture.
+* @param &window - The vblanks of the window
+* @param *va - Receives the timestamps in us
+* @param *quality - Receives the VSYNC_FLAG_* of the window
+* @return void
+*/
+static void copy_window(std::vector<vsync_sample> &window, uint64_t *va, uint32_t *quality)
+{
+	*quality = check_vsync_samples(window.data(), window.size());
+	for (size_t i = 0; i < window.size(); i++) {
+		va[i] = window[i].timestamp_ns / 1000;
+	}
+}
+
+/**
+* @brief
+* Finds the vblank nearest to a time. The lock must be held.
+* @param time_ns - The time
+* @return Index of the vblank, -1 if the ring is empty
+*/
+int64_t vblank_history::find_nearest(uint64_t time_ns)
+{
+	uint64_t oldest = total > ring.size() ? total - ring.size() : 0;
+	uint64_t lo = oldest, hi = total;
+
+	if (total == 0) {
+		return -1;
+	}
+	// Timestamps grow with the index, find the first one at or after time_ns
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (at(mid).timestamp_ns < time_ns) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == total) {
+		return total - 1;
+	}
+	if (lo > oldest && time_ns - at(lo - 1).timestamp_ns < at(lo).timestamp_ns - time_ns) {
+		return lo - 1;
+	}
+	return lo;
+}
+
+/**
+* @brief
+* Gives the last vblanks of the pipe. The history must be recent, if the
+* stream stopped the caller should capture instead.
+* @param count - Number of vblanks
+* @param *va - Receives the timestamps in us
+* @param *quality - Receives the VSYNC_FLAG_* of the vblanks
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE, not enough recent history
+*/
+int vblank_history::last(int count, uint64_t *va, uint32_t *quality)
+{
+	std::vector<vsync_sample> window;
+	uint64_t now_ns = get_vsync_time_ns();
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (count <= 0 || (uint64_t) count > total || (size_t) count > ring.size() ||
+		now_ns > at(total - 1).timestamp_ns + HISTORY_MAX_AGE_MS * 1000000ULL) {
+		return 1;
+	}
+	for (uint64_t i = total - count; i < total; i++) {
+		window.push_back(at(i));
+	}
+	copy_window(window, va, quality);
+	return 0;
+}
+
+/**
+* @brief
+* Gives the vblanks of the pipe ending at the one nearest to a time. If the
+* time is past the last vblank, the next one is waited for.
+* @param time_us - The time in us, on the clock of the vblank timestamps
+* @param count - Number of vblanks
+* @param *va - Receives the timestamps in us
+* @param *quality - Receives the VSYNC_FLAG_* of the vblanks
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE, the time is not in the history
+*/
+int vblank_history::nearest(uint64_t time_us, int count, uint64_t *va, uint32_t *quality)
+{
+	uint64_t time_ns = time_us * 1000;
+	std::vector<vsync_sample> window;
+
+	std::unique_lock<std::mutex> guard(lock);
+	if (count <= 0 || (size_t) count > ring.size()) {
+		return 1;
+	}
+
+	// The nearest vblank may still be to come, which is certain once one
+	// after the time was recorded
+	added.wait_for(guard, std::chrono::milliseconds(HISTORY_WAIT_MS), [&] {
+		return total && at(total - 1).timestamp_ns >= time_ns;
+	});
+
+	int64_t n = find_nearest(time_ns);
+	uint64_t oldest = total > ring.size() ? total - ring.size() : 0;
+	if (n < 0 || (uint64_t) n + 1 < oldest + count) {
+		return 1;
+	}
+	for (uint64_t i = n + 1 - count; i <= (uint64_t) n; i++) {
+		window.push_back(at(i));
+	}
+	copy_window(window, va, quality);
+	return 0;
+}
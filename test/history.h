@@ -0,0 +1,72 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+#ifndef _HISTORY_H
+#define _HISTORY_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+#include <vsyncalter.h>
+
+#define HISTORY_DEFAULT_SIZE   4096  // vblanks kept, over a minute at 60 Hz
+#define HISTORY_WAIT_MS        100   // Longest wait for a vblank that is due
+#define HISTORY_MAX_AGE_MS     100   // Older history means the capture stopped
+
+/*
+ * Keeps the last vblanks of a pipe in a ring, filled by a thread streaming
+ * them from the library, so the primary can answer a request right away
+ * instead of capturing new vblanks for it. A window can be the last N
+ * vblanks or the N vblanks ending at the one nearest to a given time, which
+ * lets a secondary compare its own capture with the same time range.
+ */
+class vblank_history {
+private:
+	std::vector<vsync_sample> ring;
+	uint64_t total;         // vblanks added since the start
+	std::string device;
+	int pipe;
+	bool stopping, running;
+	pthread_t tid;
+	std::mutex lock;
+	std::condition_variable added;
+	static void *run(void *arg);
+	static int store(int pipe, const vsync_sample *samples, int count, void *user_data);
+	const vsync_sample &at(uint64_t index) { return ring[index % ring.size()]; }
+	int64_t find_nearest(uint64_t time_ns);
+public:
+	vblank_history() : total(0), pipe(0), stopping(false), running(false) {}
+	~vblank_history() { stop(); }
+	int start(const char *device_str, int pipe, int size);
+	void stop();
+	int last(int count, uint64_t *va, uint32_t *quality);
+	int nearest(uint64_t time_us, int count, uint64_t *va, uint32_t *quality);
+};
+
+#endif
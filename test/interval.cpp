@@ -0,0 +1,238 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "vsyncalter.h"
+#include "interval.h"
+
+/**
+* @brief
+* This function finds the average of all the vertical syncs that
+* have been provided by the primary system to the secondary.
+* @param *va - The array holding all the vertical syncs of the primary system
+* @param sz - The size of this array
+* @return The average of the vertical syncs
+*/
+long find_avg(uint64_t *va, int sz)
+{
+	long avg = 0;
+	for(int i = 0; i < sz - 1; i++) {
+		avg += va[i+1] - va[i];
+	}
+	return avg / ((sz == 1) ? sz : (sz - 1));
+}
+
+/**
+* @brief
+* This function turns the time between a vsync of the secondary and one of
+* the primary into the time to the nearest vsync of the primary.
+* @param delta - Time of the secondary's vsync minus the primary's in us
+* @param period - Vsync period of the secondary in us
+* @return The delta to the nearest vsync of the primary in us
+*/
+long nearest_delta(long delta, long period)
+{
+	/*
+	 * If the primary is ahead or behind the secondary by more than a vsync,
+	 * we can just adjust the secondary's vsync to what we think the primary's
+	 * next vsync would be happening at. We do this by calculating the average
+	 * of its last N vsyncs that it has provided to us and assuming that its
+	 * next vsync would be happening at this cadence. Then we modulo the delta
+	 * with this average to give us a time difference between it's nearest
+	 * vsync to the secondary's. As long as we adjust the secondary's vsync
+	 * to this value, it would basically mean that the primary and secondary
+	 * system's vsyncs are firing at the same time.
+	 */
+	if(delta > period || delta < period) {
+		delta %= period;
+	}
+
+	/*
+	 * If the time difference between primary and secondary is larger than the
+	 * mid point of secondary's vsync time period, then it makes sense to sync
+	 * with the next vsync of the primary. For example, say primary's vsyncs
+	 * are happening at a regular cadence of 0, 16.66, 33.33 ms while
+	 * secondary's vsyncs are happening at a regular candence of 10, 26.66,
+	 * 43.33 ms, then the time difference between them is exactly 10 ms. If
+	 * we were to make the secondary faster for each iteration so that it
+	 * walks back those 10 ms and gets in sync with the primary, it would have
+	 * taken us about 600 iterations of vsyncs = 10 seconds. However, if were
+	 * to make the secondary slower for each iteration so that it walks forward
+	 * then since it is only 16.66 - 10 = 6.66 ms away from the next vsync of
+	 * the primary, it would take only 400 iterations of vsyncs = 6.66 seconds
+	 * to get in sync. Therefore, the general rule is that we should make
+	 * secondary's vsyncs walk back only if it the delta is less than half of
+	 * secondary's vsync time period, otherwise, we should walk forward.
+	 */
+	if(delta > period/2) {
+		delta -= period;
+	}
+
+	return delta;
+}
+
+typedef struct _line_fit {
+	double origin;   // First timestamp, the fit is relative to it for precision
+	double mean_k;   // Mean vsync index
+	double mean_t;   // Mean time since origin, the fitted time at mean_k
+	double period;   // Slope in us per vsync
+	double sxx;      // Sum of the squared index deviations
+	double var;      // Variance of the residuals, 0 if unknown
+	int n;
+} line_fit;
+
+/**
+* @brief
+* This function fits a line through a window of vsyncs, time against vsync
+* index. The index of each vsync is counted in median periods from the
+* first, so a missed vsync leaves a gap instead of bending the line.
+* @param *va - The vsyncs in us
+* @param sz - Number of vsyncs, at least 2
+* @param *fit - Receives the line
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+static int fit_line(const uint64_t *va, int sz, line_fit *fit)
+{
+	std::vector<double> k(sz), diffs;
+	double sxt = 0, ssr = 0;
+
+	if(sz < 2) {
+		return 1;
+	}
+	for(int i = 1; i < sz; i++) {
+		diffs.push_back((double) va[i] - va[i-1]);
+	}
+	std::nth_element(diffs.begin(), diffs.begin() + diffs.size() / 2, diffs.end());
+	double approx = diffs[diffs.size() / 2];
+	if(approx <= 0) {
+		return 1;
+	}
+
+	fit->origin = va[0];
+	fit->n = sz;
+	fit->mean_k = fit->mean_t = 0;
+	for(int i = 0; i < sz; i++) {
+		k[i] = std::round((va[i] - fit->origin) / approx);
+		fit->mean_k += k[i];
+		fit->mean_t += va[i] - fit->origin;
+	}
+	fit->mean_k /= sz;
+	fit->mean_t /= sz;
+
+	fit->sxx = 0;
+	for(int i = 0; i < sz; i++) {
+		fit->sxx += (k[i] - fit->mean_k) * (k[i] - fit->mean_k);
+		sxt += (k[i] - fit->mean_k) * (va[i] - fit->origin - fit->mean_t);
+	}
+	if(fit->sxx <= 0) {
+		return 1;
+	}
+	fit->period = sxt / fit->sxx;
+
+	for(int i = 0; i < sz; i++) {
+		double r = va[i] - fit->origin - fit->mean_t - fit->period * (k[i] - fit->mean_k);
+		ssr += r * r;
+	}
+	fit->var = sz > 2 ? ssr / (sz - 2) : 0;
+	return fit->period > 0 ? 0 : 1;
+}
+
+/**
+* @brief
+* This function estimates the phase of the secondary's vsyncs against the
+* primary's from whole windows rather than a single pair of vsyncs. Each
+* window is fitted with a line and the offset is taken at the middle of the
+* secondary's window, to the primary's vsync the line puts nearest to it.
+* The jitter of any one vsync is averaged out, and the scatter of the
+* vsyncs around the lines bounds the result.
+* @param *primary - The primary's vsyncs in us
+* @param primary_sz - Number of primary vsyncs
+* @param *secondary - The secondary's vsyncs in us
+* @param secondary_sz - Number of secondary vsyncs
+* @param *est - Receives the estimate
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE, the windows can't be fitted
+*/
+int estimate_phase(const uint64_t *primary, int primary_sz, const uint64_t *secondary,
+	int secondary_sz, phase_estimate *est)
+{
+	line_fit p, s;
+
+	if(fit_line(primary, primary_sz, &p) || fit_line(secondary, secondary_sz, &s)) {
+		return 1;
+	}
+
+	// The secondary's line is best known at its mean, take its vsync nearest
+	// to the mean and the primary's vsync nearest to that
+	double ks = std::round(s.mean_k);
+	double ref = s.origin + s.mean_t + s.period * (ks - s.mean_k);
+	double k = std::round((ref - p.origin - p.mean_t) / p.period + p.mean_k);
+	double primary_t = p.origin + p.mean_t + p.period * (k - p.mean_k);
+
+	est->offset_us = ref - primary_t;
+	est->period_us = p.period;
+
+	// Variance of each line where it is evaluated. The primary's grows the
+	// further the reference is from its window.
+	double var_p = p.var * (1.0 / p.n + (k - p.mean_k) * (k - p.mean_k) / p.sxx);
+	double var_s = s.var * (1.0 / s.n + (ks - s.mean_k) * (ks - s.mean_k) / s.sxx);
+	est->error_us = PHASE_ERROR_SIGMAS * std::sqrt(var_p + var_s);
+	return 0;
+}
+
+/**
+* @brief
+* This function checks that the primary's vsyncs belong to the exchange that
+* fetched them. Its last vsync can't be older than the request less the span
+* of the window and one period, nor newer than the reply. Anywhere else, the
+* clocks of the two systems don't agree.
+* @param *primary - The vsyncs of the primary in us on the shared timescale
+* @param sz - The number of vsyncs
+* @param request_us - Time the request was made on the shared timescale
+* @param recv_us - Time the reply was received on the shared timescale
+* @param margin_us - Offset tolerated between the clocks of the two systems
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE, the clocks are not synchronized
+*/
+int check_exchange_window(const uint64_t *primary, int sz, uint64_t request_us,
+	uint64_t recv_us, double margin_us)
+{
+	uint64_t last = primary[sz - 1];
+	uint64_t period = sz > 1 ? (last - primary[0]) / (sz - 1) :
+		(uint64_t) (VSYNC_ONE_VSYNC_PERIOD_IN_MS * 1000);
+	uint64_t span = last - primary[0] + period;
+	uint64_t margin = (uint64_t) margin_us;
+
+	if(last + span + margin < request_us || last > recv_us + margin) {
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef _INTERVAL_H
+#define _INTERVAL_H
+
+#include <stdint.h>
+
+#define PHASE_ERROR_SIGMAS     2      // Width of the error bound in standard deviations
+// Added to the quality of a window whose phase is too uncertain to correct
+#define PHASE_FLAG_UNCERTAIN   0x200
+
+typedef struct _phase_estimate {
+	double offset_us;   // Secondary's vsync minus the nearest primary's, in us
+	double error_us;    // Bound of offset_us, 0 if the windows are too short to tell
+	double period_us;   // Fitted vsync period of the primary in us
+} phase_estimate;
+
+long find_avg(uint64_t *va, int sz);
+long nearest_delta(long delta, long period);
+int estimate_phase(const uint64_t *primary, int primary_sz, const uint64_t *secondary,
+	int secondary_sz, phase_estimate *est);
+int check_exchange_window(const uint64_t *primary, int sz, uint64_t request_us,
+	uint64_t recv_us, double margin_us);
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#include "journal.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Construct a new journal::journal
+ */
+journal::journal() : fd(-1), format(JOURNAL_CSV), max_size(0), file_size(0), used(0),
+	header_done(false)
+{
+	start = {};
+	last_flush = {};
+}
+
+/**
+* @brief
+* This function opens the journal. Records are kept in a buffer which is
+* written out when it fills up, every JOURNAL_FLUSH_SEC seconds through
+* tick() and when the journal is closed. Once the file reaches its maximum
+* size it is renamed to <filename>.1, older ones are shifted up to
+* <filename>.JOURNAL_MAX_FILES, and a new file is started with the same
+* header comments.
+* @param *filename - The file to write
+* @param fmt - CSV text or compact binary records
+* @param max_mb - Size in MB at which the journal is rotated, 0 = never
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int journal::open(const char *filename, journal_format fmt, size_t max_mb)
+{
+	close();
+	path = filename;
+	format = fmt;
+	max_size = max_mb * 1024 * 1024;
+	used = 0;
+	header.clear();
+	header_done = false;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	last_flush = start;
+	return open_file();
+}
+
+/**
+* @brief
+* This function opens the current journal file and starts it with the
+* binary file header and the header comments if it is empty.
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int journal::open_file()
+{
+	struct stat st;
+
+	fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0) {
+		ERR("Failed to open journal %s: %s\n", path.c_str(), strerror(errno));
+		return 1;
+	}
+
+	file_size = fstat(fd, &st) ? 0 : st.st_size;
+	if (file_size == 0) {
+		if (format == JOURNAL_BINARY) {
+			journal_header h;
+			memcpy(h.magic, JOURNAL_MAGIC, sizeof(h.magic));
+			h.version = JOURNAL_VERSION;
+			h.entry_size = sizeof(journal_entry);
+			append(&h, sizeof(h));
+		}
+		for (size_t i = 0; i < header.size(); i++) {
+			append_comment(header[i].c_str(), header[i].size());
+		}
+	}
+	return 0;
+}
+
+/**
+* @brief
+* Returns the time since the journal was opened.
+* @return Time in seconds
+*/
+double journal::elapsed()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/**
+* @brief
+* This function adds data to the buffer, writing the buffer out first if
+* the data doesn't fit.
+* @param *data - The data
+* @param size - Size of the data in bytes
+* @return void
+*/
+void journal::append(const void *data, size_t size)
+{
+	if (used + size > sizeof(buffer)) {
+		flush();
+	}
+	if (size > sizeof(buffer)) {
+		size = sizeof(buffer);
+	}
+	memcpy(buffer + used, data, size);
+	used += size;
+}
+
+/**
+* @brief
+* This function adds an already timestamped comment to the buffer.
+* @param *text - The comment
+* @param len - Length of the comment
+* @return void
+*/
+void journal::append_comment(const char *text, size_t len)
+{
+	if (format == JOURNAL_BINARY) {
+		journal_comment c = { JOURNAL_COMMENT, 0, (uint16_t) len };
+		append(&c, sizeof(c));
+		append(text, len);
+	} else {
+		append("#", 1);
+		append(text, len);
+		append("\n", 1);
+	}
+}
+
+/**
+* @brief
+* This function adds a comment line to the journal. Comments made before
+* the first record form the header of the journal and are repeated at the
+* start of every rotated file.
+* @param *fmt - printf style format of the comment
+* @return void
+*/
+void journal::comment(const char *fmt, ...)
+{
+	char text[1024];
+	va_list args;
+
+	if (fd < 0) {
+		return;
+	}
+
+	int len = snprintf(text, sizeof(text), "[+%.3fs] ", elapsed());
+	va_start(args, fmt);
+	vsnprintf(text + len, sizeof(text) - len, fmt, args);
+	va_end(args);
+	len = strlen(text);
+
+	if (!header_done) {
+		header.push_back(std::string(text, len));
+	}
+	append_comment(text, len);
+}
+
+/**
+* @brief
+* This function adds a record to the journal. Its time is filled in here.
+* Skipped windows are kept as comments in the CSV format so that they don't
+* show up as corrections in the plots.
+* @param *entry - The record
+* @return void
+*/
+void journal::record(journal_entry *entry)
+{
+	if (fd < 0) {
+		return;
+	}
+
+	header_done = true;
+	entry->time = elapsed();
+
+	if (format == JOURNAL_BINARY) {
+		append(entry, sizeof(*entry));
+	} else {
+		char line[256];
+		int len;
+		if (entry->type == JOURNAL_SKIP) {
+			len = snprintf(line, sizeof(line), "#[+%.3fs] Skipped window, delta %ld us, flags 0x%x\n",
+				entry->time, (long) entry->delta, entry->flags);
+		} else if (entry->type == JOURNAL_TRIM) {
+			len = snprintf(line, sizeof(line), "#[+%.3fs] Trimmed PLL to %.3f, delta %ld us\n",
+				entry->time, entry->pll_clock, (long) entry->delta);
+		} else {
+			len = snprintf(line, sizeof(line), "[+%.3fs] ,%7.3f,%3ld,%.3f,%.3f,%u,0x%x\n",
+				entry->time, entry->duration, (long) entry->delta, entry->pll_clock,
+				entry->correction_ms, entry->steps, entry->flags);
+		}
+		append(line, len);
+	}
+
+	if (max_size && file_size + used >= max_size) {
+		rotate();
+	}
+}
+
+/**
+* @brief
+* This function writes the buffer out if it has been holding data for
+* JOURNAL_FLUSH_SEC seconds. It is meant to be called periodically.
+* @return void
+*/
+void journal::tick()
+{
+	struct timespec now;
+
+	if (fd < 0 || !used) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec - last_flush.tv_sec >= JOURNAL_FLUSH_SEC) {
+		flush();
+	}
+}
+
+/**
+* @brief
+* This function writes the buffer to the journal file.
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int journal::flush()
+{
+	size_t done = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &last_flush);
+	while (fd >= 0 && done < used) {
+		ssize_t ret = write(fd, buffer + done, used - done);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ERR("Failed to write journal %s: %s\n", path.c_str(), strerror(errno));
+			used = 0;
+			return 1;
+		}
+		done += ret;
+	}
+	file_size += done;
+	used = 0;
+	return 0;
+}
+
+/**
+* @brief
+* This function moves the full journal file aside and starts a new one.
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int journal::rotate()
+{
+	char from[PATH_MAX], to[PATH_MAX];
+
+	flush();
+	::close(fd);
+	fd = -1;
+
+	for (int i = JOURNAL_MAX_FILES - 1; i >= 1; i--) {
+		snprintf(from, sizeof(from), "%s.%d", path.c_str(), i);
+		snprintf(to, sizeof(to), "%s.%d", path.c_str(), i + 1);
+		rename(from, to);
+	}
+	snprintf(to, sizeof(to), "%s.1", path.c_str());
+	if (rename(path.c_str(), to)) {
+		ERR("Failed to rotate journal %s: %s\n", path.c_str(), strerror(errno));
+	}
+	INFO("Journal rotated to %s\n", to);
+	return open_file();
+}
+
+/**
+* @brief
+* This function writes out the buffer and closes the journal.
+* @return void
+*/
+void journal::close()
+{
+	if (fd >= 0) {
+		flush();
+		::close(fd);
+		fd = -1;
+	}
+}
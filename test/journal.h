@@ -0,0 +1,108 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#define JOURNAL_BUFFER_SIZE       (64 * 1024)  // Bytes buffered before writing
+#define JOURNAL_FLUSH_SEC         5            // Longest time data stays buffered
+#define JOURNAL_DEFAULT_MAX_MB    16           // Size at which a journal is rotated
+#define JOURNAL_MAX_FILES         4            // Rotated journals kept besides the current one
+#define JOURNAL_MAGIC             "SGJ"
+#define JOURNAL_VERSION           1
+
+enum journal_format {
+	JOURNAL_CSV,
+	JOURNAL_BINARY,
+};
+
+// Types of binary records
+enum {
+	JOURNAL_COMMENT,     // journal_comment followed by the text
+	JOURNAL_SYNC,        // journal_entry of a correction
+	JOURNAL_SKIP,        // journal_entry of a window that was not used
+	JOURNAL_TRIM,        // journal_entry of a permanent PLL trim
+};
+
+#pragma pack(push, 1)
+typedef struct _journal_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t entry_size;
+} journal_header;
+
+typedef struct _journal_comment {
+	uint8_t type;
+	uint8_t reserved;
+	uint16_t length;
+} journal_comment;
+
+typedef struct _journal_entry {
+	uint8_t type;
+	uint8_t reserved;
+	uint16_t steps;          // Steps the correction takes to revert
+	uint32_t flags;          // VSYNC_FLAG_* of the vsyncs used
+	int64_t delta;           // Drift delta in us
+	double time;             // Seconds since the journal was opened
+	double duration;         // Seconds since the previous correction
+	double pll_clock;        // PLL frequency before the correction
+	double correction_ms;    // Time spent applying the correction
+} journal_entry;
+#pragma pack(pop)
+
+class journal {
+protected:
+	int fd;
+	journal_format format;
+	std::string path;
+	size_t max_size, file_size;
+	char buffer[JOURNAL_BUFFER_SIZE];
+	size_t used;
+	struct timespec start, last_flush;
+	std::vector<std::string> header;
+	bool header_done;
+	int open_file();
+	int rotate();
+	void append(const void *data, size_t size);
+	void append_comment(const char *text, size_t len);
+	double elapsed();
+public:
+	journal();
+	~journal() { close(); }
+	int open(const char *filename, journal_format fmt, size_t max_mb);
+	void comment(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+	void record(journal_entry *entry);
+	void tick();
+	int flush();
+	void close();
+	bool is_open() { return fd >= 0; }
+};
+
+#endif
@@ -28,6 +28,20 @@
 #include <sys/time.h>
 #include <debug.h>
 
+// The timestamps travel in a fixed size array so that a message fits in a
+// single frame on both the TCP and the raw PTP connection
+#define MSG_MAX_TIMESTAMPS	VSYNC_MAX_TIMESTAMPS
+// Relays a message may pass through from the root primary, to catch loops
+#define MSG_MAX_HOPS		8
+// Added to the quality of a relay's vsyncs while it corrects its own PLL
+#define MSG_FLAG_CORRECTING	0x100
+
+// Which vsyncs a secondary asks the primary for
+enum request_t {
+	MSG_REQ_LAST,       // The latest ones
+	MSG_REQ_NEAREST,    // The ones ending nearest to time_us
+};
+
 enum header_t {
 	ACK,
 	NACK,
@@ -39,8 +53,14 @@ class msg {
 protected:
 	header_t header;
 	timeval tv;
-	uint64_t vsync_array[VSYNC_MAX_TIMESTAMPS];
+	uint64_t vsync_array[MSG_MAX_TIMESTAMPS];
 	int vblank_count;
+	uint32_t quality;
+	uint32_t capture_us;
+	uint32_t hops;       // Relays between the sender and the root primary
+	int32_t offset_us;   // Offset of the sender's vsyncs from the root primary's
+	uint32_t request;    // request_t of a secondary's ACK
+	uint64_t time_us;    // Time of a MSG_REQ_NEAREST request
 public:
 	void ack() {
 		header = ACK;
@@ -60,6 +80,20 @@ public:
 	void set_vblank_count(int vbl) {
 		vblank_count = vbl;
 	}
+	void set_quality(uint32_t q) {
+		quality = q;
+	}
+	void set_capture_time(uint32_t us) {
+		capture_us = us;
+	}
+	void set_relay(uint32_t h, int32_t offset) {
+		hops = h;
+		offset_us = offset;
+	}
+	void set_request(request_t req, uint64_t t_us) {
+		request = req;
+		time_us = t_us;
+	}
 
 	void compare_time() {
 		timeval tv_now, res;
@@ -70,9 +104,15 @@ public:
 
 	header_t get_type() { return header; }
 	uint64_t *get_va() { return vsync_array; }
-	int get_size() { return VSYNC_MAX_TIMESTAMPS; }
+	int get_size() { return MSG_MAX_TIMESTAMPS; }
 	int is_client_present() { return header != CLOSE_MSG; }
 	int get_vblank_count() { return vblank_count; }
+	uint32_t get_quality() { return quality; }
+	uint32_t get_capture_time() { return capture_us; }
+	uint32_t get_hops() { return hops; }
+	int32_t get_offset() { return offset_us; }
+	request_t get_request() { return (request_t) request; }
+	uint64_t get_request_time() { return time_us; }
 };
 
 #endif
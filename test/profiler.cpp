@@ -0,0 +1,77 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#include <algorithm>
+#include <vector>
+#include <debug.h>
+#include "profiler.h"
+
+static const char *phase_names[PHASE_COUNT] = {
+	"connect",
+	"request send",
+	"primary capture",
+	"response receive",
+	"local capture",
+	"delta",
+	"ramp-up",
+	"hold",
+	"ramp-down",
+	"reset",
+	"iteration",
+};
+
+/**
+* @brief
+* Prints the count, mean and percentiles of the spans kept for every phase
+* that has run.
+* @param None
+* @return void
+*/
+void profiler::print()
+{
+	INFO("Iteration profile (ms, last %d spans per phase)\n", PROFILER_RING_SIZE);
+	INFO("%-18s %8s %9s %9s %9s %9s %9s\n", "phase", "count", "mean", "p50", "p90", "p99", "max");
+
+	for (int p = 0; p < PHASE_COUNT; p++) {
+		int n = (int) std::min<uint64_t>(count[p], PROFILER_RING_SIZE);
+		if (!n) {
+			continue;
+		}
+
+		std::vector<uint64_t> sorted(spans[p], spans[p] + n);
+		std::sort(sorted.begin(), sorted.end());
+		double sum = 0;
+		for (uint64_t s : sorted) {
+			sum += s;
+		}
+
+		auto pct = [&](double q) {
+			return sorted[std::min(n - 1, (int) (q * n))] / 1e6;
+		};
+		INFO("%-18s %8lu %9.3f %9.3f %9.3f %9.3f %9.3f\n", phase_names[p],
+			(unsigned long) count[p], sum / n / 1e6, pct(0.5), pct(0.9), pct(0.99),
+			sorted[n - 1] / 1e6);
+	}
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <stdint.h>
+#include <clocks.h>
+
+#define PROFILER_RING_SIZE  1024  // Spans kept per phase
+
+// Phases of a secondary iteration
+enum profile_phase {
+	PHASE_CONNECT,          // Connecting to the primary
+	PHASE_SEND,             // Sending the vsync request
+	PHASE_PRIMARY_CAPTURE,  // Primary capturing its vsyncs, as it reports
+	PHASE_RECEIVE,          // Rest of the wait for the reply
+	PHASE_LOCAL_CAPTURE,    // Capturing the local vsyncs
+	PHASE_DELTA,            // Computing the delta
+	PHASE_RAMP_UP,          // Stepping the PLL to the shifted frequency
+	PHASE_HOLD,             // Running at the shifted frequency
+	PHASE_RAMP_DOWN,        // Stepping the PLL back
+	PHASE_RESET,            // Restoring the original registers
+	PHASE_ITERATION,        // Whole iteration
+	PHASE_COUNT,
+};
+
+/*
+ * Keeps the most recent spans of every phase in fixed-size rings, so that
+ * a long run does not grow memory, and summarizes them as percentiles.
+ */
+class profiler {
+private:
+	uint64_t spans[PHASE_COUNT][PROFILER_RING_SIZE];
+	uint64_t count[PHASE_COUNT];
+public:
+	profiler() : spans(), count() {}
+
+	/**
+	* @brief
+	* Records a span of a phase, replacing the oldest one once the ring is full.
+	* @param phase - The phase
+	* @param ns - Duration of the span in nanoseconds
+	* @return void
+	*/
+	void add(profile_phase phase, uint64_t ns) {
+		spans[phase][count[phase]++ % PROFILER_RING_SIZE] = ns;
+	}
+
+	/**
+	* @brief
+	* Records the span of a phase that started at the given time.
+	* @param phase - The phase that ended
+	* @param start - Time at which the phase started, see monotonic_raw_ns
+	* @return The current time, which is the start of the next phase
+	*/
+	uint64_t end(profile_phase phase, uint64_t start) {
+		uint64_t t = monotonic_raw_ns();
+		add(phase, t - start);
+		return t;
+	}
+
+	void print();
+};
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <debug.h>
+#include <clocks.h>
+#include "scheduler.h"
+
+/**
+* @brief
+* Sets the bounds of the wait and the drift at which the secondary corrects.
+* @param min - Shortest wait in milliseconds
+* @param max - Longest wait in milliseconds
+* @param threshold - Drift in microseconds that triggers a correction
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int loop_scheduler::configure(int min, int max, int threshold)
+{
+	if (min <= 0 || max < min) {
+		ERR("Invalid poll period bounds: %d - %d ms\n", min, max);
+		return 1;
+	}
+	min_ms = min;
+	max_ms = max;
+	threshold_us = threshold;
+	interval_ms = min;
+	return 0;
+}
+
+/**
+* @brief
+* Updates the drift rate with the delta of a new window and picks the next
+* wait. Without a threshold the secondary never corrects, so the longest
+* wait is used.
+* @param delta_us - Delta between the secondary and the primary
+* @return void
+*/
+void loop_scheduler::observe(long delta_us)
+{
+	uint64_t now = monotonic_ns();
+
+	if (have_last && now > last_ns) {
+		double r = (delta_us - last_delta_us) * 1e9 / (now - last_ns);
+		if (!samples) {
+			rate = r;
+			rate_var = 0;
+		} else {
+			double d = r - rate;
+			rate += SCHED_RATE_ALPHA * d;
+			rate_var = (1 - SCHED_RATE_ALPHA) * (rate_var + SCHED_RATE_ALPHA * d * d);
+		}
+		samples++;
+	}
+	have_last = true;
+	last_delta_us = delta_us;
+	last_ns = now;
+
+	int target;
+	if (!threshold_us) {
+		target = max_ms;
+	} else if (labs(delta_us) >= threshold_us || samples < 2) {
+		target = min_ms;
+	} else {
+		double worst_rate = fabs(rate) + SCHED_RATE_SIGMAS * sqrt(rate_var);
+		double margin_us = threshold_us - labs(delta_us);
+		double ms = worst_rate > 0 ? SCHED_HEADROOM * margin_us / worst_rate * 1000 : max_ms;
+		target = (int) std::min<double>(ms, std::min(interval_ms * 2, max_ms));
+	}
+
+	interval_ms = std::max(target, min_ms);
+	DBG("Drift rate %.3f us/s (+/- %.3f), next poll in %d ms\n", rate, sqrt(rate_var), interval_ms);
+}
+
+/**
+* @brief
+* Restarts the estimate after a correction moved the phase and possibly
+* the frequency of the secondary.
+* @param None
+* @return void
+*/
+void loop_scheduler::corrected()
+{
+	have_last = false;
+	samples = 0;
+	interval_ms = min_ms;
+}
+
+/**
+* @brief
+* Restarts the drift rate estimate after the frequency of the secondary was
+* trimmed. The phase did not move, so the wait is kept.
+* @param None
+* @return void
+*/
+void loop_scheduler::trimmed()
+{
+	samples = 0;
+}
+
+/**
+* @brief
+* Tells whether the drift rate has been measured often enough and steadily
+* enough to act on it.
+* @param None
+* @return true if the drift rate can be trusted
+*/
+bool loop_scheduler::confident()
+{
+	return samples >= SCHED_CONFIDENT_RATES &&
+		sqrt(rate_var) <= std::max(SCHED_CONFIDENT_SIGMA, fabs(rate) / 4);
+}
+
+/**
+* @brief
+* Polls again soon when a window could not be used.
+* @param None
+* @return void
+*/
+void loop_scheduler::retry()
+{
+	interval_ms = min_ms;
+}
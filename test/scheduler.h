@@ -0,0 +1,72 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+
+#include <stdint.h>
+
+#define SCHED_DEFAULT_MIN_MS   250    // Shortest wait between two polls
+#define SCHED_DEFAULT_MAX_MS   10000  // Longest wait between two polls
+#define SCHED_HEADROOM         0.5    // Share of the time to the threshold that is waited
+#define SCHED_RATE_ALPHA       0.3    // Weight of a new drift rate in its average
+#define SCHED_RATE_SIGMAS      2.0    // Deviations added to the drift rate for safety
+#define SCHED_CONFIDENT_RATES  3      // Drift rates needed before the estimate is trusted
+#define SCHED_CONFIDENT_SIGMA  0.5    // Largest deviation in us/s of a trusted drift rate
+
+/*
+ * Chooses how long the secondary waits before polling the primary again.
+ * The drift rate is estimated from the deltas of consecutive windows and
+ * the wait is a share of the time the drift needs to reach the sync
+ * threshold. The wait grows at most twofold per poll as confidence builds
+ * and drops to the minimum after a correction or an unusable window.
+ */
+class loop_scheduler {
+private:
+	int min_ms;
+	int max_ms;
+	int threshold_us;
+	int interval_ms;
+	bool have_last;
+	double last_delta_us;
+	uint64_t last_ns;
+	double rate;        // Average drift in us per second
+	double rate_var;    // Variance of the drift rate
+	int samples;        // Drift rates measured since the last correction
+public:
+	loop_scheduler() : min_ms(SCHED_DEFAULT_MIN_MS), max_ms(SCHED_DEFAULT_MAX_MS),
+		threshold_us(0), interval_ms(SCHED_DEFAULT_MIN_MS), have_last(false),
+		last_delta_us(0), last_ns(0), rate(0), rate_var(0), samples(0) {}
+	int configure(int min, int max, int threshold);
+	void observe(long delta_us);
+	void corrected();
+	void retry();
+	void trimmed();
+	bool confident();
+	int next_ms() { return interval_ms; }
+	double drift_rate() { return rate; }
+};
+
+#endif
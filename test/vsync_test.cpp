@@ -28,13 +28,24 @@
 #include <unistd.h>
 #include <vsyncalter.h>
 #include <debug.h>
+#include <clocks.h>
 #include <stdlib.h>
 #include <time.h>
 #include <math.h>
 #include <regex>
+#include <vector>
 #include <getopt.h>
+#include <atomic>
 #include "connection.h"
 #include "message.h"
+#include "journal.h"
+#include "interval.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "calibration.h"
+#include "config.h"
+#include "history.h"
+#include "clock_health.h"
 #include "version.h"
 
 using namespace std;
@@ -43,8 +54,55 @@ connection *server, *client;
 int client_done = 0;
 int thread_continue = 1;
 struct timespec g_last;
+profiler g_profiler;
+loop_scheduler g_scheduler;
+bool g_predict = false;
+calibration_store g_calibration;
+std::string g_calibration_key;  // Display the learned frequency belongs to, empty if not stored
+volatile sig_atomic_t g_profile_dump = 0;
+volatile sig_atomic_t g_reload = 0;
+config_file g_config;
+// The settings under the configuration file, from the options and the profile
+config_values g_base;
+// Served to the secondaries of a relay, all 0 on the root primary
+std::atomic<int> g_relay_hops(0);         // Relays between this node and the root primary
+std::atomic<int> g_relay_offset(0);       // Last offset of this node from the root primary in us
+std::atomic<bool> g_relay_correcting(false);
+vblank_history g_history;
+clock_gate g_clock;
+int g_history_size = HISTORY_DEFAULT_SIZE;  // 0 = capture on each request
+bool g_aligned = false;
+
+typedef struct _relay_args {
+	const char *serve_if;
+	connection *server;     // Owned by the main thread, which stops it
+	int pipe;
+} relay_args;
 
 #define MAX_DEVICE_NAME_LENGTH 64
+#define POLL_VBLANKS           2    // Vblanks compared in each poll after the first
+#define TRIM_GAIN              0.5  // Share of the predicted error corrected by a trim
+#define TRIM_HORIZON_SEC       30   // Time over which a trim steers the delta to zero
+#define TRIM_MIN_PPM           0.2  // Smaller trims are not worth a register write
+#define TRIM_MAX_STEP_PPM      10.0 // Largest single trim
+#define TRIM_MAX_TOTAL_PPM     200.0 // Largest total trim from the starting frequency
+
+// Codes of the options that only have a long name
+enum {
+	OPT_MIN_PERIOD = 256,
+	OPT_MAX_PERIOD,
+	OPT_POLL_VBLANKS,
+	OPT_PREDICT,
+	OPT_CALIBRATION,
+	OPT_SERVE,
+	OPT_HISTORY,
+	OPT_ALIGNED,
+	OPT_CLOCK_SOURCE,
+	OPT_CLOCK_MAX_OFFSET,
+	OPT_CLOCK_MARGIN,
+	OPT_TIMESCALE,
+	OPT_PROFILE,
+};
 char g_devicestr[MAX_DEVICE_NAME_LENGTH];
 
 /**
@@ -79,6 +137,28 @@ void client_close_signal(int sig)
 	client_done = 1;
 }
 
+/**
+* @brief
+* This function asks the secondary loop to print the iteration profile
+* @param sig - The signal that was received
+* @return void
+*/
+void profile_signal(int sig)
+{
+	g_profile_dump = 1;
+}
+
+/**
+* @brief
+* This function asks the secondary loop to read the configuration file again
+* @param sig - The signal that was received
+* @return void
+*/
+void reload_signal(int sig)
+{
+	g_reload = 1;
+}
+
 /**
 * @brief
 * This function prints out the last N vsyncs that the system has
@@ -114,71 +194,276 @@ void print_vsyncs(char *msg, uint64_t *va, int sz)
 }
 
 #define LOG_PREFIX "sync_pipe_"
-#define LOG_SUFFIX ".csv"
-char log_filename[128];  // Holds the log file name with date and time
-struct timeval log_start_time;
-// Call this once at program start
-void init_log_file_name(int pipe) {
+#define LOG_SUFFIX_CSV ".csv"
+#define LOG_SUFFIX_BIN ".sgj"
+journal g_journal;  // Record of the corrections made by the secondary
+
+/**
+* @brief
+* This function opens the journal of the secondary. Its name holds the pipe
+* and the date and time, e.g. sync_pipe_0_20250610_110827.csv
+* @param pipe - The pipe being synchronized
+* @param fmt - CSV text or compact binary records
+* @param max_mb - Size in MB at which the journal is rotated
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int open_journal(int pipe, journal_format fmt, int max_mb)
+{
 	time_t now = time(NULL);
 	struct tm *tm_info = localtime(&now);
 	char datetime[32];
+	char filename[128];
 
 	// Format: YYYY-MM-DD_HH-MM-SS
 	strftime(datetime, sizeof(datetime), "%Y%m%d_%H%M%S", tm_info);
 
-	// Generate filename: synchronization_pipe_<pipe>_<datetime>.log
-	snprintf(log_filename, sizeof(log_filename), "%s%d_%s%s",
-			LOG_PREFIX, pipe, datetime, LOG_SUFFIX);
-	gettimeofday(&log_start_time, NULL);  // Save start time
+	snprintf(filename, sizeof(filename), "%s%d_%s%s",
+			LOG_PREFIX, pipe, datetime,
+			fmt == JOURNAL_BINARY ? LOG_SUFFIX_BIN : LOG_SUFFIX_CSV);
+	return g_journal.open(filename, fmt, max_mb);
+}
+
+/**
+* @brief
+* This function reads the configuration file again and applies it between
+* two polls, so a correction in progress always completes with the
+* settings it started with. The file is applied on top of the settings from
+* the options and the profile, so a setting removed from it goes back.
+* @param *items - The settings that can be configured
+* @param count - Number of settings
+* @param pipe - The pipe of the secondary
+* @param &min_period - Shortest wait between polls, to configure the scheduler
+* @param &max_period - Longest wait between polls, to configure the scheduler
+* @param &delta - Drift threshold, to configure the scheduler
+* @return void
+*/
+void reload_config(config_item *items, int count, int pipe, int &min_period,
+	int &max_period, int &delta)
+{
+	std::string path = g_config.get_path();
+
+	INFO("Reading %s again\n", path.c_str());
+	if (g_config.load(path.c_str()) || g_config.apply(items, count, pipe, true, &g_base)) {
+		ERR("Keeping the current configuration\n");
+		return;
+	}
+	g_scheduler.configure(min_period, max_period, delta);
+	g_journal.comment("Configuration reloaded from %s", path.c_str());
+}
+
+/**
+* @brief
+* This function applies the sync parameters that synctest --calibrate found
+* for the display of the pipe, and the [display key] section of the
+* configuration file. The configuration file still overrides the profile.
+* The settings from the options and the profile are kept as the base the
+* file is applied on when it is read again.
+* @param *filename - The profile, empty for none
+* @param pipe - The pipe of the secondary
+* @param *phy - Name of the PHY of the pipe
+* @param *items - The settings that can be configured
+* @param count - Number of settings
+* @param &options - The settings from the options
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int apply_profile(const char *filename, int pipe, const char *phy, config_item *items,
+	int count, const config_values &options)
+{
+	vsync_pipe_mode mode;
+	config_file profile;
+
+	g_base = options;
+	if (get_pipe_mode(g_devicestr, pipe, &mode)) {
+		if (*filename) {
+			WARNING("Mode of pipe %d unknown, the profile is not applied\n", pipe);
+		}
+		return 0;
+	}
+	std::string key = calibration_store::make_key(&mode, pipe, phy);
+	g_config.set_display(pipe, key);
+
+	if (*filename) {
+		// Under the file, which was applied already
+		profile.set_display(pipe, key);
+		if (profile.load(filename) || profile.apply(items, count, pipe, false, &options)) {
+			return 1;
+		}
+		g_base.save(items, count);
+		INFO("Applied the profile of %s from %s\n", key.c_str(), filename);
+	}
+	if (*g_config.get_path() && g_config.apply(items, count, pipe, false, &g_base)) {
+		return 1;
+	}
+	return 0;
+}
+
+/**
+* @brief
+* This function loads the calibration store and applies the PLL frequency
+* learned for the display of the pipe in an earlier run. A value learned for
+* another device, PHY or mode is not applied.
+* @param *filename - The calibration file
+* @param pipe - The pipe of the secondary
+* @param *phy - Name of the PHY of the pipe
+* @param shift - PLL frequency change fraction per step
+* @param wait_between_steps - Wait in milliseconds between steps
+* @param apply - Whether to apply the stored frequency
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int open_calibration(const char *filename, int pipe, const char *phy, double shift,
+	int wait_between_steps, bool apply)
+{
+	vsync_pipe_mode mode;
+	double stored;
+
+	if (get_pipe_mode(g_devicestr, pipe, &mode)) {
+		WARNING("Mode of pipe %d unknown, learned frequency will not be stored\n", pipe);
+		return 0;
+	}
+	if (g_calibration.load(filename)) {
+		return 1;
+	}
+	g_calibration_key = calibration_store::make_key(&mode, pipe, phy);
+	DBG("Calibration key: %s\n", g_calibration_key.c_str());
+
+	if (!apply || !g_calibration.lookup(g_calibration_key, &stored)) {
+		return 0;
+	}
+
+	double current_freq = get_pll_clock(pipe);
+	if (current_freq <= 0 || fabs(stored / current_freq - 1) > CALIBRATION_MAX_OFFSET) {
+		WARNING("Ignoring stored PLL clock %lf, too far from %lf\n", stored, current_freq);
+		return 0;
+	}
+
+	INFO("Setting PLL clock value to %lf from %s\n", stored, filename);
+	if (set_pll_clock(stored, pipe, shift, wait_between_steps)) {
+		return 1;
+	}
+	g_journal.comment("Applied stored PLL clock %lf", stored);
+	return 0;
 }
 
-// log_to_file with printf-style formatting
-void log_to_file(bool comment, const char *fmt, ...) {
-	FILE *fp = fopen(log_filename, "a");
-	if (!fp) {
-		perror("Failed to open log file");
+/**
+* @brief
+* This function stores the current PLL frequency of the pipe as the one
+* learned for its display. It is called after each permanent change so a
+* crash loses at most the last one.
+* @param pipe - The pipe of the secondary
+* @return void
+*/
+void save_calibration(int pipe)
+{
+	if (g_calibration_key.empty()) {
 		return;
 	}
+	double current_freq = get_pll_clock(pipe);
+	if (current_freq > 0 && g_calibration.update(g_calibration_key, current_freq)) {
+		g_calibration.save();
+	}
+}
+
+/**
+* @brief
+* This function finds how many steps the library takes to revert a
+* correction, using the same rule as phys::program_phy.
+* @param delta_ms - The correction in milliseconds
+* @param shift - PLL frequency change fraction
+* @param shift2 - PLL frequency change fraction for large drift
+* @param step_threshold - Delta in microseconds from which shift2 is used
+* @return The number of steps
+*/
+int correction_steps(double delta_ms, double shift, double shift2, int step_threshold)
+{
+	double used = (shift2 && fabs(delta_ms) * 1000 >= step_threshold) ? shift2 : shift;
+	return used == 0 ? 0 : abs((int) (delta_ms * 100 / used));
+}
 
-	struct timeval now;
-	gettimeofday(&now, NULL);
+/**
+* @brief
+* This function trims the PLL of the secondary permanently so that the
+* predicted delta stays near zero instead of drifting up to the threshold.
+* A drift of 1 us per second is a frequency error of 1 ppm, so the trim
+* cancels the measured drift rate and also steers the current delta back
+* to zero over TRIM_HORIZON_SEC. Only part of the error is corrected at a
+* time and the trims are bounded, since the estimate is noisy.
+* @param pipe - The pipe whose PLL is trimmed
+* @param delta - The current delta between the secondary and the primary in us
+* @param shift - PLL frequency change fraction per step
+* @param wait_between_steps - Wait in milliseconds between steps
+* @return void
+*/
+void predictive_trim(int pipe, long delta, double shift, int wait_between_steps)
+{
+	static double total_ppm = 0;
 
-	long delta_sec = now.tv_sec - log_start_time.tv_sec;
-	long delta_usec = now.tv_usec - log_start_time.tv_usec;
-	if (delta_usec < 0) {
-		delta_sec--;
-		delta_usec += 1000000;
+	if (!g_scheduler.confident()) {
+		return;
 	}
 
-	double delta = delta_sec + (delta_usec / 1e6);
+	double ppm = TRIM_GAIN * (g_scheduler.drift_rate() + (double) delta / TRIM_HORIZON_SEC);
+	ppm = std::max(-TRIM_MAX_STEP_PPM, std::min(TRIM_MAX_STEP_PPM, ppm));
+	if (fabs(ppm) < TRIM_MIN_PPM || fabs(total_ppm + ppm) > TRIM_MAX_TOTAL_PPM) {
+		return;
+	}
 
-	// Format the message
-	char message[1024];
-	va_list args;
-	va_start(args, fmt);
-	vsnprintf(message, sizeof(message), fmt, args);
-	va_end(args);
+	double current_freq = get_pll_clock(pipe);
+	if (current_freq <= 0 ||
+		set_pll_clock(current_freq * (1 + ppm / 1e6), pipe, shift, wait_between_steps)) {
+		return;
+	}
 
-	// Log format: [+1.234s] Your message
-	fprintf(fp, "%s[+%.3fs] %s\n", comment ? "#": "", delta, message);
-	fclose(fp);
+	// The dividers may not resolve the trim exactly, so account for what was set
+	double new_freq = get_pll_clock(pipe);
+	double applied_ppm = (new_freq - current_freq) / current_freq * 1e6;
+	if (fabs(applied_ppm) < 1e-6) {
+		return;
+	}
+	total_ppm += applied_ppm;
+	g_scheduler.trimmed();
+	save_calibration(pipe);
+
+	INFO("Trimmed PLL by %.3f ppm to %lf (drift %.3f us/s, total %.3f ppm)\n",
+		applied_ppm, new_freq, g_scheduler.drift_rate(), total_ppm);
+	journal_entry entry = {};
+	entry.type = JOURNAL_TRIM;
+	entry.delta = delta;
+	entry.pll_clock = new_freq;
+	g_journal.record(&entry);
 }
 
 /**
 * @brief
-* This function finds the average of all the vertical syncs that
-* have been provided by the primary system to the secondary.
-* @param *va - The array holding all the vertical syncs of the primary system
+* This function gets a list of vsyncs in microseconds along with the flags
+* describing whether they can be trusted.
+* @param *va - The array in which vsync timestamps need to be given
 * @param sz - The size of this array
-* @return The average of the vertical syncs
+* @param pipe - The pipe whose vblanks are needed
+* @param *quality - Receives the VSYNC_FLAG_* found in the vsyncs
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
 */
-long find_avg(uint64_t *va, int sz)
+int get_checked_vsync(uint64_t *va, int sz, int pipe, uint32_t *quality)
 {
-	int avg = 0;
-	for(int i = 0; i < sz - 1; i++) {
-		avg += va[i+1] - va[i];
+	std::vector<vsync_sample> samples(sz);
+	vsync_sample *sample_array = samples.data();
+
+	if(get_vsync_samples(g_devicestr, &sample_array, sz, &pipe, 1)) {
+		return 1;
 	}
-	return avg / ((sz == 1) ? sz : (sz - 1));
+
+	*quality = check_vsync_samples(sample_array, sz);
+	for(int i = 0; i < sz; i++) {
+		va[i] = samples[i].timestamp_ns / 1000;
+	}
+	return 0;
 }
 
 /**
@@ -186,35 +471,65 @@ long find_avg(uint64_t *va, int sz)
 * This function is used by the server side to get last 10 vsyncs, send
 * them to the client and receive an ACK from it. Once reveived, it terminates
 * connection with the client.
+* @param *srv - The server the client connected to
 * @param new_sockfd - The socket on which we need to communicate with the client
 * @return
 * - 0 = SUCCESS
 * - 1 = FAILURE
 */
-int do_msg(int new_sockfd, int pipe)
+int do_msg(connection *srv, int new_sockfd, int pipe)
 {
 	int ret = 0;
 	msg m, r;
 	uint64_t *va = m.get_va();
+	uint32_t quality;
+	uint64_t capture_start;
 
 	do {
 		memset(&m, 0, sizeof(m));
 
-		if(server->recv_msg(&r, sizeof(r), new_sockfd)) {
+		if(srv->recv_msg(&r, sizeof(r), new_sockfd)) {
 			ret = 1;
 			break;
 		}
 
-		if(get_vsync(g_devicestr, va, r.get_vblank_count(), pipe)) {
+		// The count comes from the peer and must fit in the reply
+		if(r.get_vblank_count() <= 0 || r.get_vblank_count() > m.get_size()) {
+			ERR("Invalid vblank count requested: %d\n", r.get_vblank_count());
 			close(new_sockfd);
 			return 1;
 		}
 
+		// The history answers at once, a fresh capture is the fallback when
+		// it is off or does not cover the request
+		capture_start = monotonic_raw_ns();
+		if(!g_history_size ||
+			(r.get_request() == MSG_REQ_NEAREST ?
+			g_history.nearest(r.get_request_time(), r.get_vblank_count(), va, &quality) :
+			g_history.last(r.get_vblank_count(), va, &quality))) {
+			if(get_checked_vsync(va, r.get_vblank_count(), pipe, &quality)) {
+				close(new_sockfd);
+				return 1;
+			}
+		}
+		m.set_capture_time((monotonic_raw_ns() - capture_start) / 1000);
+
 		print_vsyncs((char *) "", va, r.get_vblank_count());
+		if(quality) {
+			WARNING("Vsyncs are not reliable (flags 0x%x)\n", quality);
+		}
+		// A relay's vsyncs are being moved while it corrects, so they can't be
+		// used as a reference until it is done
+		if(g_relay_correcting) {
+			quality |= MSG_FLAG_CORRECTING;
+		}
+		m.set_quality(quality);
+		m.set_relay(g_relay_hops, g_relay_offset);
+		metrics_add(VSYNC_COUNTER_REQUESTS, 1);
 		m.add_vsync();
 		m.add_time();
 
-		if(server->send_msg(&m, sizeof(m), new_sockfd)) {
+		if(srv->send_msg(&m, sizeof(m), new_sockfd)) {
 			ret = 1;
 			break;
 		}
@@ -244,50 +559,77 @@ bool isValidIPv4(const std::string &ip)
 	}
 }
 
+/**
+* @brief
+* This function creates the server of a primary or a relay.
+* @param *ptp_if - The PTP interface or the IP address to serve on
+* @return The server, not yet initialized
+*/
+connection *new_server(const char *ptp_if)
+{
+	if(!isValidIPv4(std::string(ptp_if))) {
+		return new ptp_connection(ptp_if);
+	}
+	return new connection(ptp_if);
+}
+
 /**
 * @brief
 * This function takes all the actions of the primary system which
 * are to initialize the server, wait for any clients, dispatch a function to
 * handle each client and then wait for another client to join until the user
-* Ctrl+C's out.
-* @param *ptp_if - This is the PTP interface provided by the user on command
-* line. It can also be NULL, in which case they would rather have us
-* communicate via TCP.
+* Ctrl+C's out or the server is stopped.
+* @param *srv - The server, see new_server. The caller deletes it.
 * @return
 * - 0 = SUCCESS
 * - 1 = FAILURE
 */
-int do_primary(const char *ptp_if, int pipe)
+int do_primary(connection *srv, int pipe)
 {
-	if(!isValidIPv4(std::string(ptp_if))) {
-		server = new ptp_connection(ptp_if);
-	} else {
-		server = new connection(ptp_if);
-	}
-
-	if(server->init_server()) {
+	if(srv->init_server()) {
 		ERR("Failed to init socket connection\n");
 		return 1;
 	}
 
-	signal(SIGINT, server_close_signal);
-	signal(SIGTERM, server_close_signal);
+	if(g_history_size && g_history.start(g_devicestr, pipe, g_history_size)) {
+		WARNING("Serving without vblank history\n");
+		g_history_size = 0;
+	}
 
 	while(1) {
 		int new_socket;
 		INFO("Waiting for clients\n");
-		if(server->accept_client(&new_socket)) {
-			return 1;
+		if(srv->accept_client(&new_socket)) {
+			return srv->stopped() ? 0 : 1;
 		}
 
-		if(do_msg(new_socket, pipe)) {
-			return 1;
+		if(do_msg(srv, new_socket, pipe)) {
+			return srv->stopped() ? 0 : 1;
 		}
 	}
 
 	return 0;
 }
 
+/**
+ * @brief
+ * This function is the thread of a relay serving its own vsyncs to the
+ * secondaries below it while the main thread keeps it in sync with its
+ * own primary.
+ *
+ * @param arg - The relay_args with the server and the pipe to serve
+ * @return void*
+ */
+void* relay_task(void* arg)
+{
+	relay_args *args = (relay_args *) arg;
+
+	if(do_primary(args->server, args->pipe)) {
+		ERR("Relay stopped serving on %s\n", args->serve_if);
+	}
+	return NULL;
+}
+
 /**
  * @brief
  * This function is the background thread task to call print_vblank_interval
@@ -375,93 +717,174 @@ int do_secondary(
 {
     msg m, r;
     int ret = 0;
-    uint64_t client_vsync[VSYNC_MAX_TIMESTAMPS], *primary_vsync;
+    uint64_t *primary_vsync;
+    std::vector<uint64_t> client_vsync;
     long delta, avg_primary, avg_secondary;
     pthread_t tid;
     int status;
-    struct timespec now;
+    uint32_t quality;
+    struct timespec now, request_start;
+    uint64_t request_us = get_vsync_time_ns() / 1000, reply_us;
     int64_t duration;
     static u_int32_t success_iter = 0, sync_count = 0, out_of_sync = 0;
-	const int ns_in_ms =  1000000;
+    static double base_freq = 0.0;  // PLL frequency of the first correction
+	uint64_t iteration_start = monotonic_raw_ns(), phase_start = iteration_start, recv_ns;
+	vsync_sync_timing sync_timing;
+	phase_estimate phase;
+	double clock_error;
 
 	client = eth_addr ? new ptp_connection(server_ip, eth_addr)
 						: new connection(server_ip);
 
-	if(client->init_client(server_ip)) {
+	if(timestamps > MSG_MAX_TIMESTAMPS) {
+		ERR("Too many timestamps (max %d)", MSG_MAX_TIMESTAMPS);
 		goto cleanup_fail;
 	}
+	client_vsync.resize(timestamps);
+
+	// Aligned, the local vsyncs come first and the primary gives its own from
+	// the same time out of its history, so both windows see the same
+	// disturbances instead of two captures a round trip apart
+	if(g_aligned) {
+		if(get_checked_vsync(client_vsync.data(), timestamps, pipe, &quality)) {
+			goto cleanup_fail;
+		}
+		phase_start = g_profiler.end(PHASE_LOCAL_CAPTURE, phase_start);
+	}
 
-	if(timestamps > VSYNC_MAX_TIMESTAMPS) {
-		ERR("Too many timestamps (max %d)", VSYNC_MAX_TIMESTAMPS);
+	if(client->init_client(server_ip)) {
 		goto cleanup_fail;
 	}
+	phase_start = g_profiler.end(PHASE_CONNECT, phase_start);
 
 	do {
 		r.ack();
 		r.set_vblank_count(timestamps);
-		ret = client->send_msg(&r, sizeof(r)) || client->recv_msg(&m, sizeof(m));
+		if(g_aligned) {
+			r.set_request(MSG_REQ_NEAREST, client_vsync[0]);
+		} else {
+			r.set_request(MSG_REQ_LAST, 0);
+			request_us = get_vsync_time_ns() / 1000;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &request_start);
+		phase_start = monotonic_raw_ns();
+		ret = client->send_msg(&r, sizeof(r));
+		phase_start = g_profiler.end(PHASE_SEND, phase_start);
+		ret = ret || client->recv_msg(&m, sizeof(m));
 	} while(ret);
+	reply_us = get_vsync_time_ns() / 1000;
+
+	// The primary reports how long it captured for, the rest of the wait is
+	// the network and scheduling
+	recv_ns = monotonic_raw_ns() - phase_start;
+	g_profiler.add(PHASE_PRIMARY_CAPTURE, m.get_capture_time() * 1000ULL);
+	g_profiler.add(PHASE_RECEIVE, recv_ns > m.get_capture_time() * 1000ULL ?
+		recv_ns - m.get_capture_time() * 1000ULL : 0);
+	phase_start += recv_ns;
+
+	// The round trip includes the time the primary takes to capture its vsyncs
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	metrics_record(VSYNC_METRIC_RTT_US, (now.tv_sec - request_start.tv_sec) * 1000000 +
+		(now.tv_nsec - request_start.tv_nsec) / 1000);
 
 	DBG("Received vsyncs from the primary system\n");
 
-	if(get_vsync(g_devicestr, client_vsync, timestamps, pipe)) {
-		goto cleanup_fail;
+	if(!g_aligned) {
+		if(get_checked_vsync(client_vsync.data(), timestamps, pipe, &quality)) {
+			goto cleanup_fail;
+		}
+		phase_start = g_profiler.end(PHASE_LOCAL_CAPTURE, phase_start);
 	}
 
 	primary_vsync = m.get_va();
 
-	// Check if the clocks on both systems are in sync.  Give margin of 35 ms
-	if (llabs(client_vsync[0] - primary_vsync[timestamps-1]) > 35 * ns_in_ms) {
-		ERR("Primary and secondary clocks are not synchronized.");
+	if (m.get_hops() >= MSG_MAX_HOPS) {
+		ERR("Primary is %u relays away from the root (max %d)\n", m.get_hops(), MSG_MAX_HOPS);
+		goto cleanup_fail;
+	}
+
+	// Check if the clocks on both systems are in sync. Aligned, the request
+	// stands from the start of the local capture it asks to match.
+	if (check_exchange_window(primary_vsync, timestamps, request_us, reply_us,
+			g_clock.margin())) {
+		ERR("Primary and secondary clocks are not synchronized.\n");
 		goto cleanup;
 	}
 
 	print_vsyncs((char *) "PRIMARY'S", primary_vsync, timestamps);
-	print_vsyncs((char *) "SECONDARY'S", client_vsync, timestamps);
+	print_vsyncs((char *) "SECONDARY'S", client_vsync.data(), timestamps);
+
+	// A missed frame or an outlier on either side would turn into a bogus
+	// delta and a PLL shift the displays never needed, so wait for a clean window
+	if(m.get_quality() || quality) {
+		WARNING("Skipping correction, vsyncs not reliable (primary 0x%x, secondary 0x%x)\n",
+			m.get_quality(), quality);
+		journal_entry skipped = {};
+		skipped.type = JOURNAL_SKIP;
+		skipped.flags = m.get_quality() | quality;
+		skipped.delta = client_vsync[0] - primary_vsync[timestamps-1];
+		g_journal.record(&skipped);
+		metrics_add(VSYNC_COUNTER_SKIPPED, 1);
+		g_scheduler.retry();
+		goto cleanup;
+	}
 
 	delta = client_vsync[0] - primary_vsync[timestamps-1];
 	avg_primary = find_avg(primary_vsync, timestamps);
-	avg_secondary = find_avg(client_vsync, timestamps);
+	avg_secondary = find_avg(client_vsync.data(), timestamps);
 
 	DBG("Time average of the vsyncs on the primary system is %ld us\n", avg_primary);
 	DBG("Time average of the vsyncs on the secondary system is %ld us\n", avg_secondary);
 	DBG("Time difference between secondary and primary is %ld us\n", delta);
-	/*
-	 * If the primary is ahead or behind the secondary by more than a vsync,
-	 * we can just adjust the secondary's vsync to what we think the primary's
-	 * next vsync would be happening at. We do this by calculating the average
-	 * of its last N vsyncs that it has provided to us and assuming that its
-	 * next vsync would be happening at this cadence. Then we modulo the delta
-	 * with this average to give us a time difference between it's nearest
-	 * vsync to the secondary's. As long as we adjust the secondary's vsync
-	 * to this value, it would basically mean that the primary and secondary
-	 * system's vsyncs are firing at the same time.
-	 */
-	if(delta > avg_secondary || delta < avg_secondary) {
-		delta %= avg_secondary;
-	}
-
-	/*
-	 * If the time difference between primary and secondary is larger than the
-	 * mid point of secondary's vsync time period, then it makes sense to sync
-	 * with the next vsync of the primary. For example, say primary's vsyncs
-	 * are happening at a regular cadence of 0, 16.66, 33.33 ms while
-	 * secondary's vsyncs are happening at a regular candence of 10, 26.66,
-	 * 43.33 ms, then the time difference between them is exactly 10 ms. If
-	 * we were to make the secondary faster for each iteration so that it
-	 * walks back those 10 ms and gets in sync with the primary, it would have
-	 * taken us about 600 iterations of vsyncs = 10 seconds. However, if were
-	 * to make the secondary slower for each iteration so that it walks forward
-	 * then since it is only 16.66 - 10 = 6.66 ms away from the next vsync of
-	 * the primary, it would take only 400 iterations of vsyncs = 6.66 seconds
-	 * to get in sync. Therefore, the general rule is that we should make
-	 * secondary's vsyncs walk back only if it the delta is less than half of
-	 * secondary's vsync time period, otherwise, we should walk forward.
-	 */
-	if(delta > avg_secondary/2) {
-		delta -= avg_secondary;
+
+	// The vsyncs are stamped by the system clocks, while the clock daemon
+	// is not locked a delta would be the clock error rather than a drift
+	if(g_clock.check(&clock_error)) {
+		journal_entry skipped = {};
+		skipped.type = JOURNAL_SKIP;
+		skipped.flags = CLOCK_FLAG_UNLOCKED;
+		skipped.delta = delta;
+		g_journal.record(&skipped);
+		metrics_add(VSYNC_COUNTER_SKIPPED, 1);
+		g_scheduler.retry();
+		goto cleanup;
+	}
+
+	// The lines through both windows give the phase with the jitter of
+	// single vsyncs averaged out. When they can't be fitted, the first
+	// secondary vsync against the last primary one is the fallback.
+	if(!estimate_phase(primary_vsync, timestamps, client_vsync.data(), timestamps, &phase)) {
+		DBG("Phase of the secondary is %.1f us +/- %.1f us\n", phase.offset_us, phase.error_us);
+		// Too wide a bound can't tell whether the displays are in sync. The
+		// clock error is as much part of it as the jitter.
+		if(sync_threshold_us && phase.error_us + clock_error > sync_threshold_us / 2.0) {
+			WARNING("Skipping correction, phase uncertain (%.1f us +/- %.1f us, clock %.1f us)\n",
+				phase.offset_us, phase.error_us, clock_error);
+			journal_entry skipped = {};
+			skipped.type = JOURNAL_SKIP;
+			skipped.flags = PHASE_FLAG_UNCERTAIN;
+			skipped.delta = lround(phase.offset_us);
+			g_journal.record(&skipped);
+			metrics_add(VSYNC_COUNTER_SKIPPED, 1);
+			g_scheduler.retry();
+			goto cleanup;
+		}
+		delta = lround(phase.offset_us);
+	} else {
+		delta = nearest_delta(delta, avg_secondary);
 	}
 
+	// A relay reports how far its vsyncs are from the root primary's, adding
+	// it gives this node's offset from the root so errors don't add up along
+	// a chain of relays
+	if (m.get_hops()) {
+		DBG("Primary is relay %u, %d us from the root\n", m.get_hops(), m.get_offset());
+		delta += m.get_offset();
+	}
+	g_relay_offset = delta;
+	g_relay_hops = m.get_hops() + 1;
+	g_relay_correcting = false;
+
 	clock_gettime(CLOCK_MONOTONIC, &now);
 
 	// Calculate the duration in milliseconds
@@ -469,11 +892,15 @@ int do_secondary(
 
 	DBG("Time average of the vsyncs: Primary = %.3f ms, Secondary = %.3f ms, Delta = %ld us\n", avg_primary/1000.0, avg_secondary/1000.0, delta);
 	INFO("Delta: %4ld us [%.3f sec since last sync]\n", delta, duration/1000.0);
+	metrics_record(VSYNC_METRIC_DELTA_US, delta);
+	g_profiler.end(PHASE_DELTA, phase_start);
+	g_scheduler.observe(delta);
 
 
 	if(sync_threshold_us && abs(delta) > sync_threshold_us) {
 
 		out_of_sync++;
+		metrics_add(VSYNC_COUNTER_OUT_OF_SYNC, 1);
 		// Carry out synchronization only after two iterations of out_of_sync
 		// Or if it's the beginning and we have not synchronized yet
 		if (out_of_sync < 2 && sync_count > 1) {
@@ -491,7 +918,11 @@ int do_secondary(
 		double delta_ms = (delta * -1.0) / 1000.0;
 		double current_freq = get_pll_clock(pipe);
 
-		log_to_file(false, ",%7.3f,%3ld,%.3f", duration/1000.0, delta, current_freq);
+		journal_entry entry = {};
+		entry.type = JOURNAL_SYNC;
+		entry.delta = delta;
+		entry.duration = duration / 1000.0;
+		entry.pll_clock = current_freq;
 
 		INFO("Synchronizing after %.3f seconds.\n", duration/1000.0);
 
@@ -514,10 +945,31 @@ int do_secondary(
 			delta_ms *= (1.0 + overshoot_ratio); // Apply overshoot ratio
 		}
 
+		struct timespec sync_start;
+		clock_gettime(CLOCK_MONOTONIC, &sync_start);
+		g_relay_correcting = true;
 		synchronize_vsync(delta_ms, pipe, shift, shift2, step_threshold, wait_between_steps, true, true);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (!get_sync_timing(pipe, &sync_timing)) {
+			g_profiler.add(PHASE_RAMP_UP, sync_timing.ramp_up_ns);
+			g_profiler.add(PHASE_HOLD, sync_timing.hold_ns);
+			g_profiler.add(PHASE_RAMP_DOWN, sync_timing.ramp_down_ns);
+			g_profiler.add(PHASE_RESET, sync_timing.reset_ns);
+		}
 		thread_continue = 0; // Set flag to 0 to signal the thread to terminate
 		pthread_join(tid, NULL); // Wait for the thread to terminate
 
+		entry.correction_ms = (now.tv_sec - sync_start.tv_sec) * 1000.0 +
+			(now.tv_nsec - sync_start.tv_nsec) / 1000000.0;
+		entry.steps = correction_steps(delta_ms, shift, shift2, step_threshold);
+		g_journal.record(&entry);
+		metrics_record(VSYNC_METRIC_CORRECTION_US, (int64_t) (entry.correction_ms * 1000));
+		if (!isNotZero(base_freq)) {
+			base_freq = current_freq;
+		}
+		metrics_record(VSYNC_METRIC_PLL_OFFSET_PPB,
+			(int64_t) ((current_freq - base_freq) / base_freq * 1e9));
+
 		// Adaptive Learning:
 		// If learning rate is provided and atleast one sync was trigger before (allow for atleast one sync)
 		// and had atleast one successful check and the duration since the last synchronization is less
@@ -535,16 +987,27 @@ int do_secondary(
 			// The learning_rate is used as the shift value.  The 'false' parameter indicates
 			// not to reset values after writing and to return immediately.
 			synchronize_vsync((double) delta_ms, pipe, learning_rate, 0.0, step_threshold, wait_between_steps, false, true);
+			save_calibration(pipe);
 		}
+		// The correction walked the offset back, the next poll measures what is left
+		g_relay_offset = 0;
+		g_relay_correcting = false;
 
 		clock_gettime(CLOCK_MONOTONIC, &g_last);
+		g_scheduler.corrected();
 		success_iter = 0;  // Reset iteration count
 		sync_count++;
+		metrics_add(VSYNC_COUNTER_SYNC, 1);
+		metrics_set(VSYNC_COUNTER_SUCCESS_ITER, success_iter);
 
 	}
 	else {
 		out_of_sync = 0; // Reset out_of_sync count
 		success_iter++;
+		metrics_set(VSYNC_COUNTER_SUCCESS_ITER, success_iter);
+		if (g_predict) {
+			predictive_trim(pipe, delta, shift, wait_between_steps);
+		}
 	}
 
 cleanup:
@@ -553,6 +1016,7 @@ cleanup:
 		delete client;
 		client = NULL;
 	}
+	g_profiler.end(PHASE_ITERATION, iteration_start);
 	return ret;
 
 cleanup_fail:
@@ -572,7 +1036,7 @@ void print_help(const char *program_name)
 	// Using printf for printing help
 	printf("Usage: %s [-m mode] [-i interface] [-c mac_address] [-d delta] [-p pipe] [-s shift] [-v loglevel] ... [-h]\n"
 		"Options:\n"
-		"  -m mode            Mode of operation: pri, sec (default: pri)\n"
+		"  -m mode            Mode of operation: pri, sec, relay (default: pri)\n"
 		"  -i interface       Network interface to listen on (primary) or connect to (secondary) (default: 127.0.0.1)\n"
 		"  -c mac_address     MAC address of the network interface to connect to. Applicable to ethernet interface mode only.\n"
 		"  -d delta           Drift time in microseconds to allow before pll reprogramming - in microseconds (default: 100 us)\n"
@@ -589,8 +1053,41 @@ void print_help(const char *program_name)
 		"  -t step_threshold  Delta threshold in microseconds to trigger stepping mode (default: 1000 us)\n"
 		"  -w step_wait       Wait in milliseconds between steps (default: 50 ms) \n"
 		"  -n                 Use DP M & N Path. (default: no)\n"
+		"  -j format          Journal format of the secondary: csv or bin (default: csv)\n"
+		"  -r size            Size in MB at which the journal is rotated, 0 = never (default: 16)\n"
+		"  -M file            Write metrics in the Prometheus text format to this file every second\n"
+		"  -P                 Print the iteration profile of the secondary on exit (also on SIGUSR1)\n"
+		"  -C file            Read the settings from an INI file, overriding the options. The\n"
+		"                     secondary applies it again when it changes or on SIGHUP\n"
+		"  --min-period ms    Shortest wait between two polls of the secondary (default: %d ms)\n"
+		"  --max-period ms    Longest wait between two polls of the secondary, used once the\n"
+		"                     drift rate shows the threshold is far away (default: %d ms)\n"
+		"  --poll-vblanks n   Vblanks compared in each poll after the first one (default: %d)\n"
+		"  --predict          Trim the PLL permanently from the measured drift rate to keep\n"
+		"                     the delta near zero between corrections (default: no)\n"
+		"  --calibration file File storing the PLL frequency learned for each display and mode,\n"
+		"                     reapplied at start unless -f is given. none = disabled (default: %s)\n"
+		"  --serve interface  Network interface or IP address a relay serves its own vsyncs on\n"
+		"  --history n        Vblanks the primary keeps to answer requests without capturing,\n"
+		"                     0 = capture for each request (default: %d)\n"
+		"  --aligned          Compare the secondary's vsyncs with the primary's from the same\n"
+		"                     time, taken from the primary's history (default: no)\n"
+		"  --clock-source src Clock daemon whose lock gates the corrections: pmc[:socket] for\n"
+		"                     ptp4l and the system clock phc2sys keeps on its PHC (only the PHC\n"
+		"                     with --timescale phc:), chrony, file:path for a local stand-in or\n"
+		"                     none (default: none)\n"
+		"  --clock-max-offset us Clock offset beyond which corrections are suspended (default: %d us)\n"
+		"  --clock-margin us  Offset between the clocks of the two systems tolerated when checking\n"
+		"                     the primary's vsyncs are from the exchange (default: twice\n"
+		"                     --clock-max-offset with a clock source, else %d us)\n"
+		"  --timescale clock  Clock of the vsync timestamps, the same on all systems: realtime,\n"
+		"                     tai or phc:device, e.g. phc:/dev/ptp0 (default: realtime)\n"
+		"  --profile file     Sync parameters per display written by synctest --calibrate,\n"
+		"                     overridden by -C (default: none)\n"
 		"  -h                 Display this help message\n",
-		program_name);
+		program_name, SCHED_DEFAULT_MIN_MS, SCHED_DEFAULT_MAX_MS, POLL_VBLANKS,
+		CALIBRATION_DEFAULT_FILE, HISTORY_DEFAULT_SIZE, CLOCK_DEFAULT_MAX_OFFSET_US,
+		CLOCK_DEFAULT_MARGIN_US);
 
 }
 
@@ -611,7 +1108,7 @@ int main(int argc, char *argv[])
 	std::string interface_or_ip = "127.0.0.1";  // Default to localhost
 	std::string mac_address = "";
 	std::string device_str = find_first_dri_card();
-	int timestamps = VSYNC_MAX_TIMESTAMPS;
+	int timestamps = MSG_MAX_TIMESTAMPS;
 	int pipe = 0;  // Default pipe# 0
 	int delta = 100;
 	double frequency = 0.0;
@@ -620,12 +1117,60 @@ int main(int argc, char *argv[])
 	double overshoot_ratio = 0.0; // Default overshoot ratio
 	int time_period = 480, step_threshold = VSYNC_TIME_DELTA_FOR_STEP, wait_between_steps = VSYNC_DEFAULT_WAIT_IN_MS;
 	bool m_n = false;
+	std::string metrics_file = "";
+	bool print_profile = false;
+	int min_period = SCHED_DEFAULT_MIN_MS, max_period = SCHED_DEFAULT_MAX_MS;
+	int poll_vblanks = POLL_VBLANKS;
+	std::string calibration_file = CALIBRATION_DEFAULT_FILE;
+	std::string serve_if = "";
+	std::string clock_spec = "none";
+	std::string timescale = "realtime";
+	std::string profile_path = "";
+	double clock_max_offset = CLOCK_DEFAULT_MAX_OFFSET_US;
+	double clock_margin = 0;
+	relay_args relay;
+	pthread_t relay_tid;
+	bool relay_running = false;
+	journal_format journal_fmt = JOURNAL_CSV;
+	int journal_mb = JOURNAL_DEFAULT_MAX_MB;
+	std::string config_path = "";
+	config_item config_items[] = {
+		{"delta", CONFIG_INT, &delta, 0, 1000000, false},
+		{"shift", CONFIG_DOUBLE, &shift, 0, 1, false},
+		{"shift2", CONFIG_DOUBLE, &shift2, 0, 1, false},
+		{"step_threshold", CONFIG_INT, &step_threshold, 0, 1000000, false},
+		{"step_wait", CONFIG_INT, &wait_between_steps, 0, 10000, false},
+		{"learning_rate", CONFIG_DOUBLE, &learning_rate, 0, 1, false},
+		{"time_period", CONFIG_INT, &time_period, 0, 10000000, false},
+		{"overshoot", CONFIG_DOUBLE, &overshoot_ratio, 0, 1, false},
+		{"min_period", CONFIG_INT, &min_period, 1, 3600000, false},
+		{"max_period", CONFIG_INT, &max_period, 1, 3600000, false},
+		{"poll_vblanks", CONFIG_INT, &poll_vblanks, 2, MSG_MAX_TIMESTAMPS, false},
+		{"pipe", CONFIG_INT, &pipe, 0, VSYNC_ALL_PIPES, true},
+		{"device", CONFIG_STRING, &device_str, 0, 0, true},
+		{"frequency", CONFIG_DOUBLE, &frequency, 0, 1e7, true},
+	};
+	const int config_count = sizeof(config_items) / sizeof(config_items[0]);
+	config_values options;
 	static struct option long_options[] = {
 		{"mn", no_argument, NULL, 'n'},
+		{"min-period", required_argument, NULL, OPT_MIN_PERIOD},
+		{"max-period", required_argument, NULL, OPT_MAX_PERIOD},
+		{"poll-vblanks", required_argument, NULL, OPT_POLL_VBLANKS},
+		{"predict", no_argument, NULL, OPT_PREDICT},
+		{"calibration", required_argument, NULL, OPT_CALIBRATION},
+		{"serve", required_argument, NULL, OPT_SERVE},
+		{"history", required_argument, NULL, OPT_HISTORY},
+		{"aligned", no_argument, NULL, OPT_ALIGNED},
+		{"clock-source", required_argument, NULL, OPT_CLOCK_SOURCE},
+		{"clock-max-offset", required_argument, NULL, OPT_CLOCK_MAX_OFFSET},
+		{"clock-margin", required_argument, NULL, OPT_CLOCK_MARGIN},
+		{"timescale", required_argument, NULL, OPT_TIMESCALE},
+		{"profile", required_argument, NULL, OPT_PROFILE},
 		{0, 0, 0, 0}
 	};
 	int opt, option_index = 0; // getopt_long stores the option index here
-	while ((opt = getopt_long(argc, argv, "m:i:c:p:d:s:x:f:o:e:k:l:n:t:w:v:h", long_options, &option_index)) != -1) {
+	while ((opt = getopt_long(argc, argv, "m:i:c:p:d:s:x:f:o:e:k:l:n:t:w:v:j:r:M:C:Ph", long_options, &option_index)) != -1) {
 		switch (opt) {
 			case 'm':
 				modeStr = optarg;
@@ -669,6 +1214,80 @@ int main(int argc, char *argv[])
 			case 'w':
 				wait_between_steps = std::stoi(optarg);
 				break;
+			case 'j':
+				if (!strcasecmp(optarg, "csv")) {
+					journal_fmt = JOURNAL_CSV;
+				} else if (!strcasecmp(optarg, "bin")) {
+					journal_fmt = JOURNAL_BINARY;
+				} else {
+					ERR("Invalid journal format: %s\n", optarg);
+					print_help(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'M':
+				metrics_file = optarg;
+				break;
+			case 'P':
+				print_profile = true;
+				break;
+			case 'C':
+				config_path = optarg;
+				break;
+			case OPT_MIN_PERIOD:
+				min_period = std::stoi(optarg);
+				break;
+			case OPT_MAX_PERIOD:
+				max_period = std::stoi(optarg);
+				break;
+			case OPT_POLL_VBLANKS:
+				poll_vblanks = std::stoi(optarg);
+				if (poll_vblanks < 2 || poll_vblanks > MSG_MAX_TIMESTAMPS) {
+					ERR("Invalid vblanks per poll: %d (2 - %d)\n", poll_vblanks, MSG_MAX_TIMESTAMPS);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'r':
+				journal_mb = std::stoi(optarg);
+				if (journal_mb < 0) {
+					ERR("Invalid journal size: %d\n", journal_mb);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_PREDICT:
+				g_predict = true;
+				break;
+			case OPT_CALIBRATION:
+				calibration_file = optarg;
+				break;
+			case OPT_SERVE:
+				serve_if = optarg;
+				break;
+			case OPT_HISTORY:
+				g_history_size = std::stoi(optarg);
+				if (g_history_size < 0) {
+					ERR("Invalid history size: %d\n", g_history_size);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_ALIGNED:
+				g_aligned = true;
+				break;
+			case OPT_CLOCK_SOURCE:
+				clock_spec = optarg;
+				break;
+			case OPT_CLOCK_MAX_OFFSET:
+				clock_max_offset = std::stod(optarg);
+				break;
+			case OPT_CLOCK_MARGIN:
+				clock_margin = std::stod(optarg);
+				break;
+			case OPT_TIMESCALE:
+				timescale = optarg;
+				break;
+			case OPT_PROFILE:
+				profile_path = optarg;
+				break;
 			case 'v':
 				log_level = optarg;
 				set_log_level_str(optarg);
@@ -689,6 +1308,18 @@ int main(int argc, char *argv[])
 		set_log_mode("[ PRIMARY ]");
 	} else if (modeStr == "sec") {
 		set_log_mode("[SECONDARY]");
+	} else if (modeStr == "relay") {
+		set_log_mode("[  RELAY  ]");
+		if (serve_if.empty()) {
+			ERR("Relay mode needs the interface to serve on (--serve)\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	options.save(config_items, config_count);
+	if (!config_path.empty() && (g_config.load(config_path.c_str()) ||
+		g_config.apply(config_items, config_count, pipe, false))) {
+		exit(EXIT_FAILURE);
 	}
 
 	// Print configurations
@@ -715,36 +1346,41 @@ int main(int argc, char *argv[])
 	// Copy until src string size or max size - 1.
 	strncpy(g_devicestr, device_str.c_str(), MAX_DEVICE_NAME_LENGTH - 1);
 
+	if (set_vsync_timescale_str(timescale.c_str())) {
+		return 1;
+	}
+
 	u_int64_t va[VSYNC_MAX_TIMESTAMPS];
-	// Get only one timestamp to check if kernel patch was applied.
-	if (get_vsync(g_devicestr, va, 1, pipe) == -1) {
+	// Get only one timestamp to check the vblanks are on the timescale
+	if (get_vsync(g_devicestr, va, 1, pipe)) {
 		ERR("Failed to get vsync\n");
 		return 1;
 	}
 
-	//Check if Kernel real time clock patch is applied.
-	struct timespec ts;
-	if (clock_gettime(CLOCK_REALTIME, &ts) == 0) {
-		int64_t current_time_in_microseconds = ((unsigned long long)ts.tv_sec * 1000000ULL) + ((unsigned long long)ts.tv_nsec / 1000);
-		int64_t difference = current_time_in_microseconds - va[0];
-		// Check if kernel patch applied. Get system real time and compare it with vsync time. The
-		// difference shouldn't be more than few milliseconds. Giving 100 ms margin.
-		const int diff_in_micro=100000; // time in microseconds
-		if (labs(difference) >  diff_in_micro) {
-			ERR("Kernel patch not applied. Exiting\n");
-			return 1;
-		}
-	} else {
-		// Handle error in clock_gettime
-		ERR("Failed to get the current time");
+	// The library converts the kernel's timestamps, the last vblank can't be
+	// more than a few frames old. Giving 100 ms margin.
+	int64_t difference = (int64_t) (get_vsync_time_ns() / 1000) - (int64_t) va[0];
+	const int diff_in_micro=100000; // time in microseconds
+	if (labs(difference) >  diff_in_micro) {
+		ERR("Vsync timestamps are %ld us off the %s timescale. Exiting\n",
+			(long) difference, timescale.c_str());
+		return 1;
+	}
+
+	if(!metrics_file.empty() && metrics_start(metrics_file.c_str())) {
 		return 1;
 	}
 
 	if(!modeStr.compare("pri")) {
-		ret = do_primary(interface_or_ip.length() > 0 ? interface_or_ip.c_str() : NULL, pipe);
-	} else if(!modeStr.compare("sec")) {
+		server = new_server(interface_or_ip.c_str());
+		signal(SIGINT, server_close_signal);
+		signal(SIGTERM, server_close_signal);
+		ret = do_primary(server, pipe);
+	} else if(!modeStr.compare("sec") || !modeStr.compare("relay")) {
 		signal(SIGINT, client_close_signal);
 		signal(SIGTERM, client_close_signal);
+		signal(SIGUSR1, profile_signal);
+		signal(SIGHUP, reload_signal);
 		clock_gettime(CLOCK_MONOTONIC, &g_last);
 		// lib initialization only for secondary mode.
 		if(vsync_lib_init(g_devicestr, m_n)) {
@@ -758,9 +1394,16 @@ int main(int argc, char *argv[])
 			return 1;
 		}
 
-		init_log_file_name(pipe);
-		log_to_file(true, "Secondary mode starting");
-		log_to_file(true,
+		if (apply_profile(profile_path.c_str(), pipe, name, config_items, config_count,
+				options)) {
+			return 1;
+		}
+
+		if (open_journal(pipe, journal_fmt, journal_mb)) {
+			return 1;
+		}
+		g_journal.comment("Secondary mode starting");
+		g_journal.comment(
 						"Configuration:\n"
 						"#\tPHY Type: %s\n"
 						"#\tPipe ID: %d\n"
@@ -780,11 +1423,44 @@ int main(int argc, char *argv[])
 						time_period
 					);
 
-		log_to_file(true, "\n#[Time],duration from last sync (sec),drift delta (us),PLL Frequency");
+		g_journal.comment("\n#[Time],duration from last sync (sec),drift delta (us),PLL Frequency,"
+			"correction time (ms),steps,flags");
+		if (g_scheduler.configure(min_period, max_period, delta)) {
+			return 1;
+		}
+		if (g_clock.init(clock_spec.c_str(), clock_max_offset, clock_margin,
+				timescale.compare(0, 4, "phc:") != 0)) {
+			return 1;
+		}
+		// SIGHUP still reloads the file if it can't be watched
+		if (!config_path.empty()) {
+			g_config.watch();
+		}
+		// A relay is a secondary of its primary that also serves its own
+		// vsyncs as the primary of the nodes below it. They are marked
+		// unusable until its first measurement against the root.
+		if (!modeStr.compare("relay")) {
+			g_relay_hops = 1;
+			g_relay_correcting = true;
+			relay.serve_if = serve_if.c_str();
+			relay.server = new_server(relay.serve_if);
+			relay.pipe = pipe;
+			if (pthread_create(&relay_tid, NULL, relay_task, &relay)) {
+				ERR("Failed to start the relay's server\n");
+				delete relay.server;
+				return 1;
+			}
+			relay_running = true;
+		}
 		if (isNotZero(frequency)) {
 			INFO("Setting PLL clock value to %lf\n", frequency);
 			set_pll_clock(frequency, pipe, shift, wait_between_steps);
 		}
+		if (calibration_file != "none" &&
+			open_calibration(calibration_file.c_str(), pipe, name, shift,
+				wait_between_steps, !isNotZero(frequency))) {
+			return 1;
+		}
 		// Keep doing synchronization until the user Ctrl+C's out
 		do {
 				ret = do_secondary(interface_or_ip.c_str(),
@@ -792,10 +1468,34 @@ int main(int argc, char *argv[])
 					pipe, delta, timestamps, shift, time_period, learning_rate,
 					shift2, overshoot_ratio, step_threshold, wait_between_steps);
 
-				timestamps = 2;
-				sleep(1);
+				timestamps = poll_vblanks;
+				g_journal.tick();
+				if (g_profile_dump) {
+					g_profile_dump = 0;
+					g_profiler.print();
+				}
+				if (g_reload || g_config.changed()) {
+					g_reload = 0;
+					reload_config(config_items, config_count, pipe, min_period,
+						max_period, delta);
+				}
+				usleep(g_scheduler.next_ms() * 1000);
 		} while(!client_done && !ret);
 
+		if (print_profile) {
+			g_profiler.print();
+		}
+		save_calibration(pipe);
+		g_journal.close();
+
+		// Stopped rather than canceled, the server may hold the history's
+		// or the library's locks
+		if (relay_running) {
+			relay.server->stop_server();
+			pthread_join(relay_tid, NULL);
+			relay.server->close_server();
+			delete relay.server;
+		}
 		vsync_lib_uninit();
 	}
 
@@ -808,5 +1508,6 @@ int main(int argc, char *argv[])
 		delete server;
 		server = NULL;
 	}
+	metrics_stop();
 	return ret;
 }
@@ -6,6 +6,7 @@
 #include <math.h>
 #include <getopt.h>
 #include <stdbool.h>
+#include <time.h>
 #include "unity.h"
 //#include "version.h"
 
@@ -17,11 +18,20 @@ void tearDown(void) {
 
 }
 
+// Device the tests run on, set with --device. e.g. sim:pipes=2 runs them on
+// the simulated display.
+static const char *device_arg = NULL;
+
+static const char *test_device(void)
+{
+	return device_arg ? device_arg : find_first_dri_card();
+}
+
 void test_get_phy_name() {
 
 	char name[32];
 	int i = 0;
-	const char* device_str = find_first_dri_card();
+	const char* device_str = test_device();
 	for (i = 0 ; i < 4; i++) {
 		TEST_ASSERT_EQUAL_INT(0,vsync_lib_init(device_str, false));
 		// Check if valid PHY
@@ -63,7 +73,7 @@ void test_synchronize_vsync(void)
 {
 	int result, pipe;
 	char name[32];
-	const char* device_str = find_first_dri_card();
+	const char* device_str = test_device();
 	for (pipe = 0 ; pipe < VSYNC_ALL_PIPES; pipe++) {
 
 		TEST_ASSERT_EQUAL_INT(0,vsync_lib_init(device_str, false));
@@ -77,34 +87,40 @@ void test_synchronize_vsync(void)
 		// Case 1: Library not initialized
 		TEST_ASSERT_EQUAL_INT(0,vsync_lib_uninit());
 		// Case: PHY list is null
-		result = synchronize_vsync(1.0, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(1.0, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_NOT_EQUAL(0, result);
 
 
 		TEST_ASSERT_EQUAL_INT(0,vsync_lib_init(device_str, false));
 
 		set_log_level(LOG_LEVEL_INFO);
-		result = synchronize_vsync(0.5, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(0.5, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 		// Case: With stepping
-		result = synchronize_vsync(1.5, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(1.5, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
+		// Case: Phases of the last correction
+		vsync_sync_timing timing;
+		TEST_ASSERT_EQUAL_INT(0, get_sync_timing(pipe, &timing));
+		TEST_ASSERT_TRUE(timing.hold_ns > 0);
+		TEST_ASSERT_NOT_EQUAL(0, get_sync_timing(VSYNC_ALL_PIPES, &timing));
+
 		// Case: Too huge delta. e.g -50
-		result = synchronize_vsync(-50.5, pipe, 0.01, 0.0, true, true);
+		result = synchronize_vsync(-50.5, pipe, 0.01, 0.0, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_NOT_EQUAL(0, result);
 
 		// Case: Large shift
-		result = synchronize_vsync(1.0, pipe, 4.0, 0.1, false, false);
+		result = synchronize_vsync(1.0, pipe, 4.0, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, false, false);
 		TEST_ASSERT_NOT_EQUAL(0, result);
 
 		// Case: Large shift1
-		result = synchronize_vsync(1.0, pipe, 0.01, 4.0, false, false);
+		result = synchronize_vsync(1.0, pipe, 0.01, 4.0, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, false, false);
 		TEST_ASSERT_NOT_EQUAL(0, result);
 
 		// Case: All pipes
-		result = synchronize_vsync(1.0, VSYNC_ALL_PIPES, 0.01, 0.02, true, true);
+		result = synchronize_vsync(1.0, VSYNC_ALL_PIPES, 0.01, 0.02, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 	}
 }
@@ -114,7 +130,7 @@ void test_get_vsync(void)
 	int result, pipe;
 	char name[32];
 	uint64_t vsync_array[VSYNC_MAX_TIMESTAMPS];
-	const char* device_str = find_first_dri_card();
+	const char* device_str = test_device();
 	for (pipe = 0 ; pipe < VSYNC_ALL_PIPES; pipe++) {
 		TEST_ASSERT_EQUAL_INT(0,vsync_lib_init(device_str, false));
 
@@ -157,12 +173,226 @@ void test_get_vsync(void)
 		result = get_vsync(device_str, vsync_array, VSYNC_MAX_TIMESTAMPS, pipe);
 		TEST_ASSERT_EQUAL_INT(0, result);
 		TEST_ASSERT_NOT_EQUAL(0, vsync_array[VSYNC_MAX_TIMESTAMPS]);
-		TEST_ASSERT_EQUAL_INT(0,vsync_lib_uninit(device_str, false));
+		TEST_ASSERT_EQUAL_INT(0,vsync_lib_uninit());
+	}
+}
+
+void test_get_vsync_multi(void)
+{
+	int result, pipe, num_pipes = 0;
+	char name[32];
+	int pipes[VSYNC_ALL_PIPES];
+	uint64_t vsync_storage[VSYNC_ALL_PIPES][VSYNC_MAX_TIMESTAMPS];
+	uint64_t *vsync_arrays[VSYNC_ALL_PIPES];
+	const char* device_str = test_device();
+
+	TEST_ASSERT_EQUAL_INT(0,vsync_lib_init(device_str, false));
+	for (pipe = 0 ; pipe < VSYNC_ALL_PIPES; pipe++) {
+		// Collect all valid pipes
+		if (get_phy_name(pipe, name, sizeof(name)) == false) {
+			continue;
+		}
+		vsync_arrays[num_pipes] = vsync_storage[num_pipes];
+		pipes[num_pipes++] = pipe;
+	}
+	TEST_ASSERT_EQUAL_INT(0,vsync_lib_uninit());
+
+	if (num_pipes == 0) {
+		return;
+	}
+
+	// Case 1: Null arrays
+	result = get_vsync_multi(device_str, NULL, 5, pipes, num_pipes);
+	TEST_ASSERT_NOT_EQUAL(0, result);
+
+	// Case 2: Invalid pipe count
+	result = get_vsync_multi(device_str, vsync_arrays, 5, pipes, 0);
+	TEST_ASSERT_NOT_EQUAL(0, result);
+
+	// Case 3: Same pipe requested twice
+	if (num_pipes == 1) {
+		int dup_pipes[2] = { pipes[0], pipes[0] };
+		result = get_vsync_multi(device_str, vsync_arrays, 5, dup_pipes, 2);
+		TEST_ASSERT_NOT_EQUAL(0, result);
+	}
+
+	// Case 4: All valid pipes at once
+	memset(vsync_storage, 0, sizeof(vsync_storage));
+	result = get_vsync_multi(device_str, vsync_arrays, 5, pipes, num_pipes);
+	TEST_ASSERT_EQUAL_INT(0, result);
+	for (pipe = 0; pipe < num_pipes; pipe++) {
+		TEST_ASSERT_NOT_EQUAL(0, vsync_storage[pipe][4]);
+		TEST_ASSERT_EQUAL(0, vsync_storage[pipe][5]);
+	}
+}
+
+void test_get_vsync_samples(void)
+{
+	int result, pipe, i;
+	char name[32];
+	vsync_sample samples[VSYNC_MAX_TIMESTAMPS];
+	vsync_sample *sample_arrays[1] = { samples };
+	const char* device_str = test_device();
+	for (pipe = 0 ; pipe < VSYNC_ALL_PIPES; pipe++) {
+		TEST_ASSERT_EQUAL_INT(0,vsync_lib_init(device_str, false));
+
+		// Check if valid PHY
+		if (get_phy_name(pipe, name, sizeof(name)) == false) {
+			TEST_ASSERT_EQUAL_INT(0,vsync_lib_uninit());
+			continue;
+		}
+		TEST_ASSERT_EQUAL_INT(0,vsync_lib_uninit());
+
+		// Case 1: Null sample arrays
+		result = get_vsync_samples(device_str, NULL, 5, &pipe, 1);
+		TEST_ASSERT_NOT_EQUAL(0, result);
+
+		// Case 2: Consecutive vblanks have consecutive sequence numbers
+		memset(samples, 0, sizeof(samples));
+		result = get_vsync_samples(device_str, sample_arrays, 10, &pipe, 1);
+		TEST_ASSERT_EQUAL_INT(0, result);
+		for (i = 1; i < 10; i++) {
+			TEST_ASSERT_TRUE(samples[i].timestamp_ns > samples[i-1].timestamp_ns);
+			TEST_ASSERT_EQUAL_UINT64(samples[i-1].sequence + 1, samples[i].sequence);
+		}
 	}
 }
 
+void test_check_vsync_samples(void)
+{
+	vsync_sample samples[10];
+	int i;
+
+	for (i = 0; i < 10; i++) {
+		samples[i].timestamp_ns = 1000000000ULL + i * 16666667ULL + (i % 2) * 2000;
+		samples[i].sequence = 100 + i;
+		samples[i].flags = 0;
+	}
+
+	// Case 1: Regular vsyncs with a little jitter
+	TEST_ASSERT_EQUAL_UINT32(0, check_vsync_samples(samples, 10));
+
+	// Case 2: Invalid input
+	TEST_ASSERT_EQUAL_UINT32(0, check_vsync_samples(NULL, 10));
+
+	// Case 3: Vsync arriving 2 ms late
+	samples[5].timestamp_ns += 2000000;
+	TEST_ASSERT_TRUE(check_vsync_samples(samples, 10) & VSYNC_FLAG_OUTLIER);
+	TEST_ASSERT_TRUE(samples[5].flags & VSYNC_FLAG_OUTLIER);
+	TEST_ASSERT_FALSE(samples[2].flags & VSYNC_FLAG_OUTLIER);
+
+	// Case 4: A skipped frame is a gap, not an outlier
+	samples[5].timestamp_ns -= 2000000;
+	for (i = 0; i < 10; i++) {
+		samples[i].flags = 0;
+	}
+	for (i = 7; i < 10; i++) {
+		samples[i].timestamp_ns += 16666667ULL;
+		samples[i].sequence++;
+	}
+	TEST_ASSERT_EQUAL_UINT32(VSYNC_FLAG_MISSED, check_vsync_samples(samples, 10));
+	TEST_ASSERT_TRUE(samples[7].flags & VSYNC_FLAG_MISSED);
+}
+
+typedef struct _stream_state {
+	int count;
+	int batches;
+	uint64_t last_sequence;
+	int stop_after;
+} stream_state;
+
+static int count_stream(int pipe, const vsync_sample *samples, int count, void *user_data)
+{
+	stream_state *state = (stream_state *) user_data;
+	int i;
+	(void) pipe;
+
+	TEST_ASSERT_TRUE(count > 0 && count <= VSYNC_STREAM_BATCH);
+	for (i = 0; i < count; i++) {
+		if (state->count) {
+			TEST_ASSERT_EQUAL_UINT64(state->last_sequence + 1, samples[i].sequence);
+		}
+		state->last_sequence = samples[i].sequence;
+		state->count++;
+	}
+	state->batches++;
+	return state->stop_after && state->batches >= state->stop_after;
+}
+
+void test_stream_vsync(void)
+{
+	int result, pipe;
+	char name[32];
+	stream_state state;
+	const char* device_str = test_device();
+	for (pipe = 0 ; pipe < VSYNC_ALL_PIPES; pipe++) {
+		TEST_ASSERT_EQUAL_INT(0,vsync_lib_init(device_str, false));
+
+		// Check if valid PHY
+		if (get_phy_name(pipe, name, sizeof(name)) == false) {
+			TEST_ASSERT_EQUAL_INT(0,vsync_lib_uninit());
+			continue;
+		}
+		TEST_ASSERT_EQUAL_INT(0,vsync_lib_uninit());
+
+		// Case 1: Null handler
+		result = stream_vsync(device_str, &pipe, 1, 5, NULL, NULL);
+		TEST_ASSERT_NOT_EQUAL(0, result);
+
+		// Case 2: More vsyncs than VSYNC_MAX_TIMESTAMPS, including a partial batch
+		memset(&state, 0, sizeof(state));
+		result = stream_vsync(device_str, &pipe, 1, VSYNC_MAX_TIMESTAMPS + 10, count_stream, &state);
+		TEST_ASSERT_EQUAL_INT(0, result);
+		TEST_ASSERT_EQUAL_INT(VSYNC_MAX_TIMESTAMPS + 10, state.count);
+
+		// Case 3: Unbounded stream stopped by the handler. Batches are handed
+		// over as the vblanks arrive, so they may be short.
+		memset(&state, 0, sizeof(state));
+		state.stop_after = 2;
+		result = stream_vsync(device_str, &pipe, 1, 0, count_stream, &state);
+		TEST_ASSERT_EQUAL_INT(0, result);
+		TEST_ASSERT_EQUAL_INT(2, state.batches);
+		TEST_ASSERT_TRUE(state.count >= 2 && state.count <= 2 * VSYNC_STREAM_BATCH);
+	}
+}
+
+void test_vsync_timescale(void)
+{
+	struct timespec ts;
+	uint64_t now_ns, vsync_now_ns;
+	int64_t va_diff;
+	uint64_t va[1];
+	char name[32];
+	const char* device_str = test_device();
+
+	// Case 1: The library's time follows the clock of the timescale
+	TEST_ASSERT_EQUAL_INT(0, set_vsync_timescale(VSYNC_TIMESCALE_TAI, NULL));
+	vsync_now_ns = get_vsync_time_ns();
+	clock_gettime(CLOCK_TAI, &ts);
+	now_ns = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+	TEST_ASSERT_TRUE(now_ns >= vsync_now_ns && now_ns - vsync_now_ns < 1000000);
+
+	// Case 2: vblanks come on the timescale, a few frames old at most
+	TEST_ASSERT_EQUAL_INT(0, set_vsync_timescale_str("realtime"));
+	TEST_ASSERT_EQUAL_INT(0,vsync_lib_init(device_str, false));
+	if (get_phy_name(0, name, sizeof(name))) {
+		TEST_ASSERT_EQUAL_INT(0, get_vsync(device_str, va, 1, 0));
+		clock_gettime(CLOCK_REALTIME, &ts);
+		va_diff = (int64_t) (ts.tv_sec * 1000000LL + ts.tv_nsec / 1000) - (int64_t) va[0];
+		TEST_ASSERT_TRUE(va_diff >= 0 && va_diff < 100000);
+	}
+	TEST_ASSERT_EQUAL_INT(0,vsync_lib_uninit());
+
+	// Case 3: Invalid timescales
+	TEST_ASSERT_NOT_EQUAL(0, set_vsync_timescale(VSYNC_TIMESCALE_PHC, NULL));
+	TEST_ASSERT_NOT_EQUAL(0, set_vsync_timescale(VSYNC_TIMESCALE_PHC, "/dev/invalid"));
+	TEST_ASSERT_NOT_EQUAL(0, set_vsync_timescale((vsync_timescale) 10, NULL));
+	TEST_ASSERT_NOT_EQUAL(0, set_vsync_timescale_str("gps"));
+	TEST_ASSERT_NOT_EQUAL(0, set_vsync_timescale_str(NULL));
+}
+
 void test_frequency_set(void) {
-	const char* device_str = find_first_dri_card();
+	const char* device_str = test_device();
 	double pll_clock = 0.0;
 	double modified_pll_clock = 0.0;
 	int ret = 0, pipe;
@@ -190,7 +420,7 @@ void test_get_vblank_interval(void)
 {
 	int pipe;
 	char name[32];
-	const char* device_str = find_first_dri_card();
+	const char* device_str = test_device();
 	TEST_ASSERT_EQUAL_INT(0,vsync_lib_init(device_str, false));
 	set_log_level(LOG_LEVEL_ERROR);
 	// get_vblank_interval doesn't need vsync_lib_init.
@@ -216,9 +446,9 @@ void test_get_vblank_interval(void)
 		interval = get_vblank_interval(device_str, pipe, 1);
 		TEST_ASSERT_TRUE_MESSAGE(interval == 0.0, "Expected interval > 0.0 for valid input");
 
-		// Case:  Invalid stamp count (higher)
+		// Case: More stamps than fit in one message
 		interval = get_vblank_interval(device_str, pipe, VSYNC_MAX_TIMESTAMPS+1);
-		TEST_ASSERT_TRUE_MESSAGE(interval == 0.0, "Expected interval > 0.0 for valid input");
+		TEST_ASSERT_TRUE_MESSAGE(interval > 0.0, "Expected interval > 0.0 for valid input");
 
 		// Case: Invalid device
 		interval = get_vblank_interval("/dev/dri/invalid", pipe, VSYNC_MAX_TIMESTAMPS);
@@ -239,18 +469,41 @@ void test_get_vblank_interval(void)
 
 void test_drm_info(void)
 {
-	const char* device_str = find_first_dri_card();
+	const char* device_str = test_device();
  	TEST_ASSERT_EQUAL_INT(0,print_drm_info(device_str));
 	TEST_ASSERT_EQUAL_INT(1,print_drm_info("/dev/dri/invalid"));
 	TEST_ASSERT_EQUAL_INT(1,print_drm_info(""));
 	TEST_ASSERT_EQUAL_INT(1,print_drm_info(NULL));
 }
 
+void test_get_pipe_mode(void)
+{
+	int pipe;
+	char name[32];
+	vsync_pipe_mode mode;
+	const char* device_str = test_device();
+	TEST_ASSERT_NOT_EQUAL(0, get_pipe_mode(device_str, 0, &mode));
+	TEST_ASSERT_EQUAL_INT(0,vsync_lib_init(device_str, false));
+	for (pipe = 0 ; pipe < VSYNC_ALL_PIPES; pipe++) {
+		if (get_phy_name(pipe, name, sizeof(name)) == false) {
+			continue;
+		}
+		TEST_ASSERT_EQUAL_INT(0, get_pipe_mode(device_str, pipe, &mode));
+		TEST_ASSERT_NOT_EQUAL(0, mode.clock_khz);
+		TEST_ASSERT_TRUE(mode.htotal >= mode.hdisplay);
+		TEST_ASSERT_TRUE(mode.vtotal >= mode.vdisplay);
+		TEST_ASSERT_NOT_EQUAL(0, get_pipe_mode(device_str, pipe, NULL));
+		TEST_ASSERT_NOT_EQUAL(0, get_pipe_mode("/dev/dri/invalid", pipe, &mode));
+	}
+	TEST_ASSERT_NOT_EQUAL(0, get_pipe_mode(device_str, VSYNC_ALL_PIPES, &mode));
+	TEST_ASSERT_EQUAL_INT(0,vsync_lib_uninit());
+}
+
 void test_m_n(void)
 {
 	int result, pipe;
 	char name[32];
-	const char* device_str = find_first_dri_card();
+	const char* device_str = test_device();
 	TEST_ASSERT_EQUAL_INT(0,vsync_lib_init(device_str, true));
 		set_log_level(LOG_LEVEL_INFO);
 	for (pipe = 0 ; pipe < VSYNC_ALL_PIPES; pipe++) {
@@ -268,31 +521,31 @@ void test_m_n(void)
 		printf("Found %s\n", name);
 
 		set_log_level(LOG_LEVEL_INFO);
-		result = synchronize_vsync(0.1, pipe, 0.001, 0.1, true, true);
+		result = synchronize_vsync(0.1, pipe, 0.001, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 
-		result = synchronize_vsync(0.1, pipe, 0.001, 0.01, true, true);
+		result = synchronize_vsync(0.1, pipe, 0.001, 0.01, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 		// Case: no commit, no reset
-		result = synchronize_vsync(0.1, pipe, 0.001, 0.1, false, false);
+		result = synchronize_vsync(0.1, pipe, 0.001, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, false, false);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 		// Case: Too huge delta. e.g -50
-		result = synchronize_vsync(-50.5, pipe, 0.01, 0.0, true, true);
+		result = synchronize_vsync(-50.5, pipe, 0.01, 0.0, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_NOT_EQUAL(0, result);
 
 		// Case: Large shift
-		result = synchronize_vsync(1.0, pipe, 4.0, 0.1, false, false);
+		result = synchronize_vsync(1.0, pipe, 4.0, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, false, false);
 		TEST_ASSERT_NOT_EQUAL(0, result);
 
 		// Case: Large shift1
-		result = synchronize_vsync(1.0, pipe, 0.01, 4.0, false, false);
+		result = synchronize_vsync(1.0, pipe, 0.01, 4.0, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, false, false);
 		TEST_ASSERT_NOT_EQUAL(0, result);
 
 		// Case: All pipes
-		result = synchronize_vsync(1.0, VSYNC_ALL_PIPES, 0.01, 0.02, true, true);
+		result = synchronize_vsync(1.0, VSYNC_ALL_PIPES, 0.01, 0.02, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 	}
 
@@ -305,7 +558,7 @@ void test_logging(void)
 {
 	int pipe, result;
 	char name[32];
-	const char* device_str = find_first_dri_card();
+	const char* device_str = test_device();
 	TEST_ASSERT_EQUAL_INT(0,vsync_lib_init(device_str, false));
 	// get_vblank_interval doesn't need vsync_lib_init.
 	// vsync_lib_init is for get_phy_name to get enabled PHYs
@@ -316,72 +569,72 @@ void test_logging(void)
 		}
 		set_log_mode("[UNITTEST]");
 		set_log_level(LOG_LEVEL_NONE);
-		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 		// Case : Level ERROR
 		set_log_level(LOG_LEVEL_ERROR);
-		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 		// Case : Level WARNING
 		set_log_level(LOG_LEVEL_WARNING);
-		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 		// Case : Level INFO
 		set_log_level(LOG_LEVEL_INFO);
-		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 		// Case : Level DEBUG
 		set_log_level(LOG_LEVEL_DEBUG);
-		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 		// Case : Level TRACE
 		set_log_level(LOG_LEVEL_TRACE);
-		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 		// Case : Level NONE
 		set_log_level(LOG_LEVEL_NONE);
-		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 		// Case : Invalid Level
 		set_log_level(16);
-		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 		// Case: str Level NULL
 		set_log_level_str(NULL);
-		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 		// Case: str Level error
 		set_log_level_str("error");
-		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 		// Case: str Level warning
 		set_log_level_str("warning");
-		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 		// Case: str Level info
 		set_log_level_str("info");
-		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 		// Case: str Level debug
 		set_log_level_str("debug");
-		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 
 		// Case: str Level trace
 		set_log_level_str("trace");
-		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, true, true);
+		result = synchronize_vsync(0.05, pipe, 0.01, 0.1, VSYNC_TIME_DELTA_FOR_STEP, VSYNC_DEFAULT_WAIT_IN_MS, true, true);
 		TEST_ASSERT_EQUAL_INT(0, result);
 	}
 
@@ -389,23 +642,59 @@ void test_logging(void)
 
 }
 
+void test_sim_pll_response(void)
+{
+	double pll, nominal;
+	const char* device_str = "sim:ppm=50,jitter=0.2";
+
+	TEST_ASSERT_EQUAL_INT(0,vsync_lib_init(device_str, false));
+	pll = get_pll_clock(0);
+	TEST_ASSERT_TRUE(pll > 0.0);
+
+	// The clock of the display runs 50 ppm fast
+	nominal = get_vblank_interval(device_str, 0, 60);
+	TEST_ASSERT_DOUBLE_WITHIN(0.0005, 16.666667 / 1.00005, nominal);
+
+	// A faster PLL gives a shorter frame period
+	TEST_ASSERT_EQUAL_INT(0, set_pll_clock(pll * 1.001, 0, 0.01, 0));
+	TEST_ASSERT_DOUBLE_WITHIN(0.0005, nominal / 1.001, get_vblank_interval(device_str, 0, 60));
+
+	TEST_ASSERT_EQUAL_INT(0, set_pll_clock(pll, 0, 0.01, 0));
+	TEST_ASSERT_DOUBLE_WITHIN(0.0005, nominal, get_vblank_interval(device_str, 0, 60));
+
+	// Pipe 1 is not simulated unless asked for
+	TEST_ASSERT_TRUE(get_vblank_interval(device_str, 1, 10) == 0.0);
+	TEST_ASSERT_EQUAL_INT(0,vsync_lib_uninit());
+}
+
 
 int main(int argc, char **argv) {
 	UNITY_BEGIN();
 
-	// Check for optional flag
+	// Check for optional flags
 	int run_mn_test = 0;
-	if (argc > 1 && strcmp(argv[1], "--run-mn-test") == 0) {
-		run_mn_test = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--run-mn-test") == 0) {
+			run_mn_test = 1;
+		} else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc) {
+			device_arg = argv[++i];
+		}
 	}
 
 	RUN_TEST(test_frequency_set);
 	RUN_TEST(test_get_phy_name);
 	RUN_TEST(test_synchronize_vsync);
 	RUN_TEST(test_get_vsync);
+	RUN_TEST(test_get_vsync_multi);
+	RUN_TEST(test_get_vsync_samples);
+	RUN_TEST(test_stream_vsync);
+	RUN_TEST(test_check_vsync_samples);
+	RUN_TEST(test_vsync_timescale);
 	RUN_TEST(test_get_vblank_interval);
 	RUN_TEST(test_drm_info);
+	RUN_TEST(test_get_pipe_mode);
 	RUN_TEST(test_logging);
+	RUN_TEST(test_sim_pll_response);
 
 	if (run_mn_test) {
 		RUN_TEST(test_m_n);
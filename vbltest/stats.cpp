@@ -0,0 +1,333 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <debug.h>
+#include "stats.h"
+
+/**
+* @brief
+* Constructor of the statistics of a pipe.
+* @param p - The pipe
+* @param bin - Width of a histogram bin in us
+*/
+vbl_stats::vbl_stats(int p, double bin) : pipe(p), bin_us(bin), warmup_count(0),
+	nominal_us(0), count(0), missed(0), mean(0), m2(0), min(0), max(0), below(0),
+	above(0), t0_ns(0), seq0(0), last_ns(0), last_seq(0), frames(0)
+{
+	memset(hist, 0, sizeof(hist));
+	memset(diff_sum, 0, sizeof(diff_sum));
+	memset(adev_sum, 0, sizeof(adev_sum));
+	memset(mdev_sum, 0, sizeof(mdev_sum));
+	memset(adev_count, 0, sizeof(adev_count));
+	memset(mdev_count, 0, sizeof(mdev_count));
+}
+
+/**
+* @brief
+* Adds a batch of vsyncs. The first ones are held back until the nominal
+* period is known, which the histogram and the phase are measured against.
+* @param *samples - The vsyncs, oldest first
+* @param n - Number of entries in samples
+* @return void
+*/
+void vbl_stats::add(const vsync_sample *samples, int n)
+{
+	for (int i = 0; i < n; i++) {
+		if (ready()) {
+			add_sample(samples[i]);
+			continue;
+		}
+
+		if (warmup_count && samples[i].sequence <= warmup[warmup_count - 1].sequence) {
+			continue;
+		}
+		warmup[warmup_count++] = samples[i];
+		if (warmup_count <= STATS_WARMUP) {
+			continue;
+		}
+
+		// The median period per frame isn't thrown off by a late vblank
+		double periods[STATS_WARMUP];
+		for (int j = 0; j < STATS_WARMUP; j++) {
+			periods[j] = (warmup[j + 1].timestamp_ns - warmup[j].timestamp_ns) / 1000.0 /
+				(warmup[j + 1].sequence - warmup[j].sequence);
+		}
+		std::nth_element(periods, periods + STATS_WARMUP / 2, periods + STATS_WARMUP);
+		nominal_us = periods[STATS_WARMUP / 2];
+		DBG("Pipe %d nominal period %.3f us\n", pipe, nominal_us);
+
+		for (int j = 0; j < warmup_count; j++) {
+			add_sample(warmup[j]);
+		}
+	}
+}
+
+/**
+* @brief
+* Adds a vsync once the nominal period is known.
+* @param &s - The vsync
+* @return void
+*/
+void vbl_stats::add_sample(const vsync_sample &s)
+{
+	if (!last_ns) {
+		t0_ns = last_ns = s.timestamp_ns;
+		seq0 = last_seq = s.sequence;
+		add_phase(0);
+		return;
+	}
+	if (s.sequence <= last_seq) {
+		return;
+	}
+
+	uint64_t gap = s.sequence - last_seq;
+	double x = (s.timestamp_ns - t0_ns) / 1000.0 - (s.sequence - seq0) * nominal_us;
+	double last_x = (last_ns - t0_ns) / 1000.0 - (last_seq - seq0) * nominal_us;
+
+	// A missed vblank leaves a hole in the phase which is filled in by
+	// interpolation, the interval counts as one per frame
+	missed += gap - 1;
+	for (uint64_t f = 1; f < gap; f++) {
+		add_phase(last_x + (x - last_x) * f / gap);
+	}
+	add_phase(x);
+	add_interval((s.timestamp_ns - last_ns) / 1000.0 / gap);
+
+	last_ns = s.timestamp_ns;
+	last_seq = s.sequence;
+}
+
+/**
+* @brief
+* Adds an interval to the running mean, variance, extremes and histogram.
+* @param interval_us - The interval between two vblanks in us
+* @return void
+*/
+void vbl_stats::add_interval(double interval_us)
+{
+	count++;
+	double d = interval_us - mean;
+	mean += d / count;
+	m2 += d * (interval_us - mean);
+	if (count == 1 || interval_us < min) {
+		min = interval_us;
+	}
+	if (count == 1 || interval_us > max) {
+		max = interval_us;
+	}
+
+	double bin = floor((interval_us - nominal_us) / bin_us) + STATS_HIST_BINS / 2;
+	if (bin < 0) {
+		below++;
+	} else if (bin >= STATS_HIST_BINS) {
+		above++;
+	} else {
+		hist[(int) bin]++;
+	}
+}
+
+/**
+* @brief
+* Adds the phase of the next frame and updates the Allan variances of every
+* averaging time tau = m periods from the second differences
+* x[n] - 2 x[n-m] + x[n-2m]. The modified variance averages m consecutive
+* second differences, whose sum is kept over a window of the last m.
+* @param x - Phase of the frame against the nominal period in us
+* @return void
+*/
+void vbl_stats::add_phase(double x)
+{
+	const uint64_t size = 2 * STATS_MAX_TAU + 1;
+	phase[frames % size] = x;
+
+	for (int t = 0; t < STATS_TAUS; t++) {
+		uint64_t m = 1 << t;
+		if (frames < 2 * m) {
+			break;
+		}
+		double d = x - 2 * phase[(frames - m) % size] + phase[(frames - 2 * m) % size];
+		uint64_t k = adev_count[t]++;
+		adev_sum[t] += d * d;
+
+		double *window = diff[t];
+		if (k >= m) {
+			diff_sum[t] -= window[k % m];
+		}
+		window[k % m] = d;
+		diff_sum[t] += d;
+		if (k % m == m - 1) {
+			// Sum the window again once per pass so rounding doesn't build up
+			diff_sum[t] = 0;
+			for (uint64_t i = 0; i < m; i++) {
+				diff_sum[t] += window[i];
+			}
+		}
+		if (k + 1 >= m) {
+			mdev_sum[t] += diff_sum[t] * diff_sum[t];
+			mdev_count[t]++;
+		}
+	}
+	frames++;
+}
+
+/**
+* @brief
+* Overlapping Allan deviation.
+* @param t - Index of the averaging time, tau = 2^t periods
+* @return The deviation as a fraction of the frequency, -1 if too few
+* vblanks were captured for this tau
+*/
+double vbl_stats::adev(int t)
+{
+	if (!adev_count[t]) {
+		return -1;
+	}
+	double tau = (1 << t) * nominal_us;
+	return sqrt(adev_sum[t] / (2 * tau * tau * adev_count[t]));
+}
+
+/**
+* @brief
+* Modified Allan deviation, which tells white from flicker phase noise.
+* @param t - Index of the averaging time, tau = 2^t periods
+* @return The deviation as a fraction of the frequency, -1 if too few
+* vblanks were captured for this tau
+*/
+double vbl_stats::mdev(int t)
+{
+	if (!mdev_count[t]) {
+		return -1;
+	}
+	double m = 1 << t;
+	double tau = m * nominal_us;
+	return sqrt(mdev_sum[t] / (2 * m * m * tau * tau * mdev_count[t]));
+}
+
+/**
+* @brief
+* Finds a percentile of the intervals from the histogram, interpolated
+* within its bin. Intervals outside of the histogram are only known by the
+* minimum and maximum.
+* @param p - The percentile, 0 - 1
+* @return The interval in us
+*/
+double vbl_stats::percentile(double p)
+{
+	double target = p * count, seen = below;
+	if (target <= seen) {
+		return min;
+	}
+	double lo = nominal_us - STATS_HIST_BINS / 2 * bin_us;
+	for (int i = 0; i < STATS_HIST_BINS; i++) {
+		if (hist[i] && seen + hist[i] >= target) {
+			double v = lo + (i + (target - seen) / hist[i]) * bin_us;
+			return std::max(min, std::min(max, v));
+		}
+		seen += hist[i];
+	}
+	return max;
+}
+
+/**
+* @brief
+* Writes the CSV header of the summaries. JSON needs none.
+* @param *fp - The output
+* @param format - Format of the summaries
+* @return void
+*/
+void vbl_stats::header(FILE *fp, stats_format format)
+{
+	if (format != STATS_CSV) {
+		return;
+	}
+	fprintf(fp, "elapsed_s,pipe,count,missed,nominal_us,mean_us,stddev_us,min_us,max_us,"
+		"p50_us,p90_us,p99_us,p999_us");
+	for (int t = 0; t < STATS_TAUS; t++) {
+		fprintf(fp, ",adev_%d", 1 << t);
+	}
+	for (int t = 0; t < STATS_TAUS; t++) {
+		fprintf(fp, ",mdev_%d", 1 << t);
+	}
+	fprintf(fp, "\n");
+}
+
+/**
+* @brief
+* Writes a summary of everything captured so far, a CSV row or a JSON object
+* on a line. The Allan deviations are given per averaging time in periods;
+* those not reached yet are empty or left out.
+* @param *fp - The output
+* @param format - Format of the summary
+* @param elapsed_s - Time since the capture started in seconds
+* @return void
+*/
+void vbl_stats::report(FILE *fp, stats_format format, double elapsed_s)
+{
+	double stddev = count > 1 ? sqrt(m2 / (count - 1)) : 0;
+	const double pct[] = { 0.5, 0.9, 0.99, 0.999 };
+
+	if (format == STATS_CSV) {
+		fprintf(fp, "%.3f,%d,%lu,%lu,%.3f,%.3f,%.3f,%.3f,%.3f", elapsed_s, pipe,
+			(unsigned long) count, (unsigned long) missed, nominal_us, mean, stddev, min, max);
+		for (double p : pct) {
+			fprintf(fp, ",%.3f", percentile(p));
+		}
+		for (int t = 0; t < STATS_TAUS; t++) {
+			if (adev(t) < 0) {
+				fprintf(fp, ",");
+			} else {
+				fprintf(fp, ",%.3e", adev(t));
+			}
+		}
+		for (int t = 0; t < STATS_TAUS; t++) {
+			if (mdev(t) < 0) {
+				fprintf(fp, ",");
+			} else {
+				fprintf(fp, ",%.3e", mdev(t));
+			}
+		}
+		fprintf(fp, "\n");
+		return;
+	}
+
+	fprintf(fp, "{\"elapsed_s\":%.3f,\"pipe\":%d,\"count\":%lu,\"missed\":%lu,"
+		"\"nominal_us\":%.3f,\"mean_us\":%.3f,\"stddev_us\":%.3f,\"min_us\":%.3f,"
+		"\"max_us\":%.3f,\"p50_us\":%.3f,\"p90_us\":%.3f,\"p99_us\":%.3f,\"p999_us\":%.3f,"
+		"\"allan\":[", elapsed_s, pipe, (unsigned long) count, (unsigned long) missed,
+		nominal_us, mean, stddev, min, max, percentile(pct[0]), percentile(pct[1]),
+		percentile(pct[2]), percentile(pct[3]));
+	for (int t = 0; t < STATS_TAUS && adev(t) >= 0; t++) {
+		fprintf(fp, "%s{\"tau\":%d,\"tau_s\":%.6f,\"adev\":%.3e", t ? "," : "", 1 << t,
+			(1 << t) * nominal_us / 1000000.0, adev(t));
+		if (mdev(t) >= 0) {
+			fprintf(fp, ",\"mdev\":%.3e", mdev(t));
+		}
+		fprintf(fp, "}");
+	}
+	fprintf(fp, "]}\n");
+}
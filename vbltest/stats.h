@@ -0,0 +1,97 @@
+/*
+ * Copyright © 2024 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vsyncalter.h>
+
+#define STATS_WARMUP         64      // Intervals whose median becomes the nominal period
+#define STATS_HIST_BINS      1024    // Bins of the interval histogram around the nominal period
+#define STATS_DEFAULT_BIN_US 0.25    // Default width of a histogram bin in us
+#define STATS_TAUS           11      // Averaging times of the Allan deviations, 1 to 1024 periods
+#define STATS_MAX_TAU        (1 << (STATS_TAUS - 1))
+
+typedef enum {
+	STATS_CSV,
+	STATS_JSON,
+} stats_format;
+
+/*
+ * Streaming statistics of the vblank intervals of a pipe, kept in memory of
+ * a fixed size however long the capture runs:
+ * - mean and variance with Welford's algorithm, minimum and maximum
+ * - a histogram around the nominal period for percentiles
+ * - overlapping and modified Allan deviation for averaging times of 1, 2,
+ *   4 ... STATS_MAX_TAU periods, from the phase of the vblanks against the
+ *   nominal period. Missed vblanks are filled in by interpolation.
+ */
+class vbl_stats {
+private:
+	int pipe;
+	double bin_us;
+
+	// Warm-up until the nominal period is known
+	vsync_sample warmup[STATS_WARMUP + 1];
+	int warmup_count;
+	double nominal_us;
+
+	// Intervals
+	uint64_t count;
+	uint64_t missed;
+	double mean, m2, min, max;
+	uint64_t hist[STATS_HIST_BINS];
+	uint64_t below, above;
+
+	// Phase in us against the nominal period, one entry per frame
+	uint64_t t0_ns, seq0;
+	uint64_t last_ns, last_seq;
+	uint64_t frames;
+	double phase[2 * STATS_MAX_TAU + 1];
+	double diff[STATS_TAUS][STATS_MAX_TAU];    // Last second differences of each tau
+	double diff_sum[STATS_TAUS];               // Their sum over tau frames
+	double adev_sum[STATS_TAUS], mdev_sum[STATS_TAUS];
+	uint64_t adev_count[STATS_TAUS], mdev_count[STATS_TAUS];
+
+	void add_sample(const vsync_sample &s);
+	void add_interval(double interval_us);
+	void add_phase(double x);
+	double percentile(double p);
+public:
+	vbl_stats(int p, double bin);
+	void add(const vsync_sample *samples, int n);
+	bool ready() { return nominal_us > 0; }
+	double adev(int t);
+	double mdev(int t);
+	static void header(FILE *fp, stats_format format);
+	void report(FILE *fp, stats_format format, double elapsed_s);
+};
+
+#endif
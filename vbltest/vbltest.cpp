@@ -23,12 +23,17 @@
  */
 
 #include <string.h>
+#include <errno.h>
 #include <signal.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <vsyncalter.h>
 #include <debug.h>
 #include <math.h>
+#include <sstream>
+#include <vector>
 #include "version.h"
+#include "stats.h"
 
 using namespace std;
 
@@ -99,6 +104,167 @@ void print_vsyncs(char* msg, uint64_t* va, int sz)
 	INFO("First timestamp in the second: +%u us\n", min_offset);
 }
 
+/**
+* @brief
+* This function parses a comma separated list of pipes, e.g. "0,1,2"
+* @param *str - The string to parse
+* @param &pipes - The vector which receives the pipe numbers
+* @return
+* - true = SUCCESS
+* - false = FAILURE
+*/
+bool parse_pipes(const char* str, std::vector<int>& pipes)
+{
+	std::stringstream ss(str);
+	std::string item;
+
+	pipes.clear();
+	while (std::getline(ss, item, ',')) {
+		try {
+			pipes.push_back(std::stoi(item));
+		} catch (...) {
+			return false;
+		}
+	}
+	return !pipes.empty() && (int) pipes.size() <= VSYNC_ALL_PIPES;
+}
+
+/**
+* @brief
+* This function prints the average offset of every pipe's vsyncs from the
+* first pipe's vsyncs. Since all pipes are captured in the same event loop,
+* the offsets show how the displays of this system are aligned to each other.
+* @param &pipes - The pipes that were captured
+* @param **va - One array of vsyncs per pipe
+* @param sz - The size of each array
+* @return void
+*/
+void print_pipe_offsets(const std::vector<int>& pipes, uint64_t** va, int sz)
+{
+	for (size_t p = 1; p < pipes.size(); p++) {
+		double offset = 0;
+		for (int i = 0; i < sz; i++) {
+			offset += (double) ((int64_t) (va[p][i] - va[0][i]));
+		}
+		INFO("Pipe %d offset from pipe %d: %.3lf us\n", pipes[p], pipes[0], offset / sz);
+	}
+}
+
+// State of a streaming analysis shared with the stream handler
+typedef struct _stats_run {
+	std::vector<int> pipes;
+	std::vector<vbl_stats *> stats;
+	FILE *out;
+	stats_format format;
+	uint64_t start_ns;
+	uint64_t next_report_ns;
+	uint64_t report_ns;     // Time between summaries
+	uint64_t end_ns;        // 0 = run until stopped
+} stats_run;
+
+/**
+* @brief
+* This function stops the streaming analysis on Ctrl+C. The stream returns
+* and the final summary is written.
+* @param sig - The signal that was received
+* @return void
+*/
+void stats_signal(int sig)
+{
+	shutdown_lib();
+}
+
+/**
+* @brief
+* This function writes a summary of every pipe whose nominal period is known.
+* @param *run - The streaming analysis
+* @param now_ns - The current time in ns
+* @return void
+*/
+void report_stats(stats_run *run, uint64_t now_ns)
+{
+	double elapsed = (now_ns - run->start_ns) / 1000000000.0;
+	for (size_t p = 0; p < run->stats.size(); p++) {
+		if (run->stats[p]->ready()) {
+			run->stats[p]->report(run->out, run->format, elapsed);
+		}
+	}
+	fflush(run->out);
+}
+
+/**
+* @brief
+* Stream handler of the analysis. It adds each batch to the statistics of
+* its pipe and writes the summaries when they are due.
+* @param pipe - The pipe the batch belongs to
+* @param *samples - The batch
+* @param count - Number of entries in samples
+* @param *user_data - Pointer to the stats_run
+* @return 1 once the duration is over, 0 to keep streaming
+*/
+int stats_handler(int pipe, const vsync_sample *samples, int count, void *user_data)
+{
+	stats_run *run = (stats_run *) user_data;
+	for (size_t p = 0; p < run->pipes.size(); p++) {
+		if (run->pipes[p] == pipe) {
+			run->stats[p]->add(samples, count);
+		}
+	}
+
+	uint64_t now_ns = get_vsync_time_ns();
+	if (now_ns >= run->next_report_ns) {
+		report_stats(run, now_ns);
+		run->next_report_ns += run->report_ns;
+		if (run->next_report_ns <= now_ns) {
+			run->next_report_ns = now_ns + run->report_ns;
+		}
+	}
+	return run->end_ns && now_ns >= run->end_ns;
+}
+
+/**
+* @brief
+* This function analyzes the vblank intervals of the pipes while streaming
+* them, in memory of a fixed size however long it runs, and writes periodic
+* summaries followed by a final one.
+* @param &device_str - The device to capture on
+* @param &pipes - The pipes to analyze
+* @param *run - Output, format and timing of the summaries
+* @param bin_us - Width of a histogram bin in us
+* @return
+* - 0 = SUCCESS
+* - 1 = FAILURE
+*/
+int run_stats(const std::string &device_str, const std::vector<int> &pipes, stats_run *run,
+	double bin_us)
+{
+	run->pipes = pipes;
+	for (size_t p = 0; p < pipes.size(); p++) {
+		run->stats.push_back(new vbl_stats(pipes[p], bin_us));
+	}
+
+	signal(SIGINT, stats_signal);
+	signal(SIGTERM, stats_signal);
+
+	log_flush();
+	vbl_stats::header(run->out, run->format);
+	run->start_ns = get_vsync_time_ns();
+	run->next_report_ns = run->start_ns + run->report_ns;
+	if (run->end_ns) {
+		run->end_ns += run->start_ns;
+	}
+
+	int ret = stream_vsync(device_str.c_str(), pipes.data(), (int) pipes.size(), 0,
+		stats_handler, run);
+	report_stats(run, get_vsync_time_ns());
+
+	for (size_t p = 0; p < run->stats.size(); p++) {
+		delete run->stats[p];
+	}
+	run->stats.clear();
+	return ret;
+}
+
 /**
  * @brief
  * Print help message
@@ -109,13 +275,20 @@ void print_vsyncs(char* msg, uint64_t* va, int sz)
 void print_help(const char* program_name)
 {
 	// Using printf for printing help
-	printf("Usage: %s [-p pipe] [-c vsync_count] [-v loglevel] [-h]\n"
+	printf("Usage: %s [-p pipe] [-c vsync_count] [-v loglevel] [--stats] [-h]\n"
 		"Options:\n"
-		"  -p pipe        Pipe to get stamps for.  0,1,2 ... (default: 0)\n"
+		"  -p pipe        Pipe to get stamps for.  0,1,2 ... or a list e.g 0,1 (default: 0)\n"
 		"  -c vsync_count Number of vsyncs to get timestamp for (default: 100)\n"
 		"  -e device      Device string (default: /dev/dri/card0)\n"
 		"  -l loop        Loop mode: 0 = no loop, 1 = loop (default: 0)\n"
 		"  -v loglevel    Log level: error, warning, info, debug or trace (default: info)\n"
+		"  --stats        Analyze the intervals while streaming until Ctrl+C instead of\n"
+		"                 printing the vsyncs: mean, deviation, percentiles and Allan deviation\n"
+		"  --report s     Seconds between summaries of --stats (default: 10)\n"
+		"  --duration s   Stop --stats after this many seconds, 0 = never (default: 0)\n"
+		"  --format fmt   Format of the summaries: csv or json (default: csv)\n"
+		"  --output file  Write the summaries to this file (default: standard output)\n"
+		"  --bin us       Width of a histogram bin for the percentiles (default: 0.25 us)\n"
 		"  -h             Display this help message\n",
 		program_name);
 }
@@ -132,7 +305,7 @@ void print_help(const char* program_name)
 int main(int argc, char* argv[])
 {
 	int ret = 0;
-	uint64_t* client_vsync;
+	std::vector<uint64_t*> client_vsync;
 	double avg;
 
 	printf("Vbltest Version: %s\n", get_version( ).c_str( ));
@@ -140,12 +313,36 @@ int main(int argc, char* argv[])
 	std::string device_str = find_first_dri_card();
 	std::string log_level = "info";
 	int loop_mode = 0;
-	int pipe = 0;  // Default pipe# 0
-	int opt;
-	while ((opt = getopt(argc, argv, "p:c:e:l:v:h")) != -1) {
+	std::vector<int> pipes(1, 0);  // Default pipe# 0
+	bool stats_mode = false;
+	double report_s = 10, duration_s = 0, bin_us = STATS_DEFAULT_BIN_US;
+	std::string format = "csv", output_path = "";
+	enum {
+		OPT_STATS = 1000,
+		OPT_REPORT,
+		OPT_DURATION,
+		OPT_FORMAT,
+		OPT_OUTPUT,
+		OPT_BIN,
+	};
+	struct option long_options[] = {
+		{"stats", no_argument, NULL, OPT_STATS},
+		{"report", required_argument, NULL, OPT_REPORT},
+		{"duration", required_argument, NULL, OPT_DURATION},
+		{"format", required_argument, NULL, OPT_FORMAT},
+		{"output", required_argument, NULL, OPT_OUTPUT},
+		{"bin", required_argument, NULL, OPT_BIN},
+		{"help", no_argument, NULL, 'h'},
+		{0, 0, 0, 0}
+	};
+	int opt, option_index = 0;
+	while ((opt = getopt_long(argc, argv, "p:c:e:l:v:h", long_options, &option_index)) != -1) {
 		switch (opt) {
 			case 'p':
-				pipe = std::stoi(optarg);
+				if (!parse_pipes(optarg, pipes)) {
+					ERR("Invalid pipe list: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
 				break;
 			case 'c':
 				vsync_count = std::stoi(optarg);
@@ -160,6 +357,36 @@ int main(int argc, char* argv[])
 			case 'e':
 				device_str = optarg;
 				break;
+			case OPT_STATS:
+				stats_mode = true;
+				break;
+			case OPT_REPORT:
+				report_s = std::stod(optarg);
+				if (report_s <= 0) {
+					ERR("Invalid report period: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_DURATION:
+				duration_s = std::stod(optarg);
+				break;
+			case OPT_FORMAT:
+				format = optarg;
+				if (format != "csv" && format != "json") {
+					ERR("Invalid format: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_OUTPUT:
+				output_path = optarg;
+				break;
+			case OPT_BIN:
+				bin_us = std::stod(optarg);
+				if (bin_us <= 0) {
+					ERR("Invalid bin width: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 'h':
 				print_help(argv[0]);
 				exit(EXIT_SUCCESS);
@@ -171,35 +398,63 @@ int main(int argc, char* argv[])
 
 	// Print configurations
 	INFO("Configuration:\n");
-	INFO("\tPipe ID: %d\n", pipe);
+	for (size_t p = 0; p < pipes.size(); p++) {
+		INFO("\tPipe ID: %d\n", pipes[p]);
+	}
 	INFO("\tDevice: %s\n", device_str.c_str());
 	INFO("\tSync Count: %d\n", vsync_count);
 	INFO("\tLog Level: %s\n", log_level.c_str());
 
 	print_drm_info(device_str.c_str());
 
-	client_vsync = new uint64_t[vsync_count];
-	if (!client_vsync) {
-		ERR("Memory allocation failed for client_vsync.\n");
-		return 1; // Exit if memory allocation fails
+	if (stats_mode) {
+		stats_run run;
+		run.out = stdout;
+		run.format = format == "json" ? STATS_JSON : STATS_CSV;
+		run.report_ns = (uint64_t) (report_s * 1000000000.0);
+		run.end_ns = (uint64_t) (duration_s * 1000000000.0);
+		if (!output_path.empty()) {
+			run.out = fopen(output_path.c_str(), "w");
+			if (!run.out) {
+				ERR("Failed to open %s: %s\n", output_path.c_str(), strerror(errno));
+				return 1;
+			}
+		}
+		ret = run_stats(device_str, pipes, &run, bin_us);
+		if (run.out != stdout) {
+			fclose(run.out);
+		}
+		return ret;
+	}
+
+	for (size_t p = 0; p < pipes.size(); p++) {
+		client_vsync.push_back(new uint64_t[vsync_count]);
 	}
 
 	do {
-		if (get_vsync(device_str.c_str(), client_vsync, vsync_count, pipe)) {
-			delete[] client_vsync;
-			return 1;
+		if (get_vsync_multi(device_str.c_str(), client_vsync.data(), vsync_count,
+				pipes.data(), (int) pipes.size())) {
+			ret = 1;
+			break;
 		}
 
-		avg = find_avg(&client_vsync[0], vsync_count);
-
-		// Clear the console
+		// Clear the console once everything logged so far is out
+		log_flush();
 		printf("\033[2J\033[H");  // clear screen and move cursor to top
 		fflush(stdout);
 
-		print_vsyncs((char*)"", client_vsync, vsync_count);
-		INFO("Time average of the vsyncs on the primary system is %.3lf microseconds\n", avg);
+		for (size_t p = 0; p < pipes.size(); p++) {
+			char prefix[32];
+			snprintf(prefix, sizeof(prefix), "Pipe %d ", pipes[p]);
+			avg = find_avg(client_vsync[p], vsync_count);
+			print_vsyncs(prefix, client_vsync[p], vsync_count);
+			INFO("Time average of the vsyncs on pipe %d is %.3lf microseconds\n", pipes[p], avg);
+		}
+		print_pipe_offsets(pipes, client_vsync.data(), vsync_count);
 	} while(loop_mode); // Keep printing while Ctrl+C is not pressed
 
-	delete[] client_vsync;
+	for (size_t p = 0; p < client_vsync.size(); p++) {
+		delete[] client_vsync[p];
+	}
 	return ret;
 }